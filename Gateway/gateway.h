@@ -9,6 +9,13 @@
 #define GATEWAY_API
 #endif //__linux__
 
+#ifdef _WIN32
+#define GATEWAY_EXPORT GATEWAY_API
+#endif //_WIN32
+#ifdef __linux__
+#define GATEWAY_EXPORT GATEWAY_API __attribute__ ((visibility("default")))
+#endif //__linux__
+
 typedef void (GATEWAY_API *pSetDeviceToOpen)(long value);
 typedef long (GATEWAY_API *pGetDeviceToOpen)();
 
@@ -17,8 +24,8 @@ typedef long (GATEWAY_API *pGetDeviceToOpen)();
 extern "C" {
 #endif
 
-void GATEWAY_API SetDeviceToOpen(long value);
-long GATEWAY_API GetDeviceToOpen();
+void GATEWAY_EXPORT SetDeviceToOpen(long value);
+long GATEWAY_EXPORT GetDeviceToOpen();
 
 #ifdef __cplusplus
 }
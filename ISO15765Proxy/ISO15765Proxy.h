@@ -17,6 +17,381 @@
 #define ISO15765_PROXY_API J2534_API __attribute__ ((visibility("default")))
 #endif //__linux__
 
+/*
+ * Extension ioctls, handled by ISO15765 channels
+ */
+#define ISO15765_IOCTL_BASE           0x10100
+#define ISO15765_IOCTL_FLASH_DOWNLOAD (ISO15765_IOCTL_BASE + 0x00) // pInput: ISO15765_FLASH_DOWNLOAD*, pOutput: ISO15765_FLASH_RESULT*
+#define ISO15765_IOCTL_OBD_POLL_START (ISO15765_IOCTL_BASE + 0x01) // pInput: ISO15765_OBD_POLL*, pOutput: unsigned long* poll ID
+#define ISO15765_IOCTL_OBD_POLL_STOP  (ISO15765_IOCTL_BASE + 0x02) // pInput: unsigned long* poll ID, NULL for all
+#define ISO15765_IOCTL_OBD_POLL_READ  (ISO15765_IOCTL_BASE + 0x03) // pInput: unsigned long* timeout in ms, pOutput: ISO15765_OBD_SAMPLE_LIST*
+#define ISO15765_IOCTL_RDBI_CACHE_CONFIG (ISO15765_IOCTL_BASE + 0x04) // pInput: ISO15765_RDBI_CACHE_CONFIG*
+#define ISO15765_IOCTL_RDBI_CACHE_TTL    (ISO15765_IOCTL_BASE + 0x05) // pInput: ISO15765_RDBI_CACHE_TTL*
+#define ISO15765_IOCTL_RDBI_CACHE_CLEAR  (ISO15765_IOCTL_BASE + 0x06) // No parameters
+#define ISO15765_IOCTL_RDBI_CACHE_STATS  (ISO15765_IOCTL_BASE + 0x07) // pOutput: ISO15765_RDBI_CACHE_STATS*
+#define ISO15765_IOCTL_KEEPALIVE_START   (ISO15765_IOCTL_BASE + 0x08) // pInput: ISO15765_KEEPALIVE*
+#define ISO15765_IOCTL_KEEPALIVE_STOP    (ISO15765_IOCTL_BASE + 0x09) // pInput: unsigned long* target ID, NULL for all
+#define ISO15765_IOCTL_KEEPALIVE_STATS   (ISO15765_IOCTL_BASE + 0x0A) // pOutput: ISO15765_KEEPALIVE_STATS*
+#define ISO15765_IOCTL_DTC_READ          (ISO15765_IOCTL_BASE + 0x0B) // pInput: ISO15765_DTC_READ*, pOutput: ISO15765_DTC_LIST*
+#define ISO15765_IOCTL_SCAN              (ISO15765_IOCTL_BASE + 0x0C) // pInput: ISO15765_SCAN*, pOutput: ISO15765_SCAN_LIST*
+#define ISO15765_IOCTL_RESPONSE_PENDING_STATS (ISO15765_IOCTL_BASE + 0x0D) // pOutput: unsigned long* 0x78 absorbed
+#define ISO15765_IOCTL_TRANSACTION       (ISO15765_IOCTL_BASE + 0x0E) // pInput: ISO15765_TRANSACTION*, pOutput: PASSTHRU_MSG* response
+#define ISO15765_IOCTL_MEMORY_DUMP       (ISO15765_IOCTL_BASE + 0x0F) // pInput: ISO15765_MEMORY_DUMP*, pOutput: ISO15765_MEMORY_DUMP_RESULT*
+#define ISO15765_IOCTL_FLASH_DELTA       (ISO15765_IOCTL_BASE + 0x10) // pInput: ISO15765_FLASH_DELTA*, pOutput: ISO15765_FLASH_DELTA_RESULT*
+#define ISO15765_IOCTL_FLASH_FILE        (ISO15765_IOCTL_BASE + 0x11) // pInput: ISO15765_FLASH_FILE*, pOutput: ISO15765_FLASH_FILE_RESULT*
+#define ISO15765_IOCTL_SNAPSHOT          (ISO15765_IOCTL_BASE + 0x12) // pOutput: ISO15765_SNAPSHOT*
+#define ISO15765_IOCTL_RESTORE           (ISO15765_IOCTL_BASE + 0x13) // pInput: ISO15765_SNAPSHOT*, pOutput: ISO15765_SNAPSHOT* restored, NULL or pInput allowed
+#define ISO15765_IOCTL_BUFFER_POOL_STATS (ISO15765_IOCTL_BASE + 0x14) // pOutput: ISO15765_BUFFER_POOL_STATS*
+
+/*
+ * Configuration parameters of the ISO15765 channels (GET_CONFIG/SET_CONFIG), in the range of the tool manufacturers.
+ * With ISO15765_CONFIG_RESPONSE_PENDING, the response pending (0x7F xx 0x78) negative responses to the requests sent
+ * are not returned by PassThruReadMsgs, which waits up to P2* for the final response instead.
+ */
+#define ISO15765_CONFIG_BASE             0x8100
+#define ISO15765_CONFIG_RESPONSE_PENDING (ISO15765_CONFIG_BASE + 0x00) // 0 (default) or 1
+#define ISO15765_CONFIG_P2_STAR          (ISO15765_CONFIG_BASE + 0x01) // In ms, 5000 by default
+
+/*
+ * Request and its response in one call. The response is the first message of the same service from the pattern of
+ * the filter of the request, response pending (0x78) negative responses are absorbed. The messages of the other
+ * transfers received meanwhile are returned by the next reads; past 64 of them the transaction fails with
+ * ERR_BUFFER_OVERFLOW, and the response is left to the reads too.
+ */
+typedef struct {
+    PASSTHRU_MSG *RequestPtr;            // ISO15765 message, a FLOW_CONTROL_FILTER must be started for its ID
+    unsigned long Timeout;               // In ms, for the request and the response
+    unsigned long P2StarTimeout;         // In ms after a response pending, 0 for ISO15765_CONFIG_P2_STAR
+} ISO15765_TRANSACTION;
+
+/*
+ * ReadMemoryByAddress (0x23) of a memory region into a file mapped in memory. The largest block accepted by the ECU
+ * is probed by halving the block size on length and range errors. Requests are sent ahead of the responses when
+ * Pipeline allows it and the requests fit in a single frame; the engine falls back to one request at a time if the
+ * ECU does not keep up. A failed block is retried from its address.
+ */
+typedef struct {
+    unsigned long TargetID;              // CAN ID of the requests, a FLOW_CONTROL_FILTER must be started for it
+    unsigned long TxFlags;
+    unsigned long AddressAndLengthFormat;// addressAndLengthFormatIdentifier, 0x44 for 4 bytes address and size
+    unsigned long MemoryAddress;
+    unsigned long MemorySize;
+    const char *FileName;                // Created, or resized to MemorySize bytes
+    unsigned long Offset;                // Bytes already in the file, BytesRead of a previous dump to resume it
+    unsigned long MaxBlockLength;        // First block size tried, 0 for the largest ISO15765 response (4094 bytes)
+    unsigned long Pipeline;              // Requests in flight, 0 or 1 for one at a time, up to 4
+    unsigned long Retries;               // Attempts per block after a failure, 0 for 3
+    unsigned long P2Timeout;             // In ms, 0 for 50 ms
+    unsigned long P2StarTimeout;         // In ms, 0 for 5000 ms
+} ISO15765_MEMORY_DUMP;
+
+typedef struct {
+    unsigned long BytesRead;             // Bytes in the file from its start
+    unsigned long Requests;
+    unsigned long BlockLength;           // Block size accepted by the ECU
+    unsigned long Pipeline;              // Requests in flight at the end
+    unsigned long Retries;
+    unsigned long ResponsePending;
+    unsigned long FailedAddress;         // Address of the block which failed
+    unsigned long ResponseCode;          // Its negative response code, 0 on timeout
+} ISO15765_MEMORY_DUMP_RESULT;
+
+/*
+ * RequestDownload (0x34), TransferData (0x36) and RequestTransferExit (0x37) of a memory region, run by the proxy.
+ * TargetID is the CAN ID of the requests: a FLOW_CONTROL_FILTER with this flow control ID must be started.
+ */
+typedef struct {
+    unsigned long TargetID;              // CAN ID of the requests
+    unsigned long TxFlags;               // TxFlags of the requests (ISO15765_FRAME_PAD...)
+    unsigned long DataFormat;            // dataFormatIdentifier (compression/encryption), 0x00 for raw data
+    unsigned long AddressAndLengthFormat;// addressAndLengthFormatIdentifier, 0x44 for 4 bytes address and size
+    unsigned long MemoryAddress;
+    unsigned long MemorySize;            // Number of bytes of Data
+    const unsigned char *Data;
+    unsigned long MaxBlockLength;        // Upper bound of the ECU's maxNumberOfBlockLength, 0 for none
+    unsigned long P2Timeout;             // Response timeout in ms, 0 for 50 ms
+    unsigned long P2StarTimeout;         // Timeout after a response pending in ms, and transmission timeout, 0 for 5000 ms
+    unsigned long ChecksumType;          // ISO15765_CHECKSUM_*, of Data
+    unsigned long Compression;           // ISO15765_COMPRESSION_*, with the method of the ECU in DataFormat
+} ISO15765_FLASH_DOWNLOAD;
+
+/*
+ * Checksums computed while the blocks are sent, for the check memory routine that follows the download
+ */
+#define ISO15765_CHECKSUM_NONE  0
+#define ISO15765_CHECKSUM_CRC32 1        // IEEE 802.3 (zlib)
+#define ISO15765_CHECKSUM_CRC16 2        // CCITT, polynomial 0x1021 and initial value 0xFFFF
+#define ISO15765_CHECKSUM_ADD32 3        // Sum of the bytes modulo 2^32, the lower bytes for narrower sums
+
+/*
+ * Compression of Data by the proxy, on worker threads while the blocks are sent. MemorySize stays the size of Data.
+ */
+#define ISO15765_COMPRESSION_NONE 0      // Data is sent as is, compressed or not
+#define ISO15765_COMPRESSION_LZSS 1      // LZSS of the Okumura decoder: 4096 bytes window, 18 bytes matches
+
+typedef struct {
+    unsigned long BytesTransferred;      // Data bytes of the TransferData requests, compressed or not
+    unsigned long BlockCount;            // Number of TransferData requests
+    unsigned long BlockLength;           // maxNumberOfBlockLength in use
+    unsigned long ResponsePending;       // Number of 0x78 negative responses absorbed
+    unsigned long FailedService;         // Service which failed, 0 on success
+    unsigned long ResponseCode;          // Its negative response code, 0 on timeout
+    unsigned long Checksum;              // Of Data, set as soon as the last block is transferred
+} ISO15765_FLASH_RESULT;
+
+/*
+ * Download of the segments of an image which differ from the image last flashed, as recorded in a manifest file per
+ * target and memory address. Each run of changed segments is erased (optional) and downloaded on its own; everything
+ * is downloaded when the part number, the segment size or the image size changed. The manifest can only tell what
+ * was flashed through it: an ECU flashed by other means must be flashed once without a manifest entry.
+ */
+typedef struct {
+    ISO15765_FLASH_DOWNLOAD Download;    // Whole image, ChecksumType applies to the whole image
+    const char *ManifestFile;            // Created if missing
+    const char *PartNumber;              // Software part number of the image, without spaces
+    unsigned long SegmentSize;           // Unit compared and erased, the erase sector size, 0 for 4096 bytes
+    unsigned long Erase;                 // 1 to erase the changed segments first (RoutineControl 0xFF00)
+    unsigned long Threads;               // Hashing threads, 0 for one per core
+} ISO15765_FLASH_DELTA;
+
+typedef struct {
+    ISO15765_FLASH_RESULT Flash;         // Sums over the downloads, FailedService 0x31 on an erase failure
+    unsigned long Segments;
+    unsigned long SegmentsChanged;
+    unsigned long Downloads;             // RequestDownload sequences, one per run of changed segments
+    unsigned long BytesSkipped;
+} ISO15765_FLASH_DELTA_RESULT;
+
+/*
+ * Download of regions of an image file, mapped in memory: the TransferData blocks are built from the mapping, and the
+ * pages sent are released, so that the memory used does not grow with the image. The regions are downloaded in order,
+ * each with its own RequestDownload.
+ */
+typedef struct {
+    unsigned long MemoryAddress;
+    unsigned long FileOffset;
+    unsigned long Size;                  // 0 for the rest of the file
+    unsigned long Checksum;              // Out: of the region, with Download.ChecksumType
+} ISO15765_FLASH_REGION;
+
+typedef struct {
+    ISO15765_FLASH_DOWNLOAD Download;    // Parameters of the downloads, MemoryAddress, MemorySize and Data are not used
+    const char *FileName;                // Binary image
+    unsigned long NumOfRegions;
+    ISO15765_FLASH_REGION *RegionPtr;
+} ISO15765_FLASH_FILE;
+
+typedef struct {
+    ISO15765_FLASH_RESULT Flash;         // Sums over the regions, the failure of the failed region
+    unsigned long Regions;               // Regions downloaded
+} ISO15765_FLASH_FILE_RESULT;
+
+/*
+ * Periodic read of an OBD-II mode 01 PID. The PIDs due at the same time on the same target are packed by 6 in one
+ * request, and the targets are polled concurrently. Polling only runs during ISO15765_IOCTL_OBD_POLL_READ.
+ */
+typedef struct {
+    unsigned long TargetID;              // CAN ID of the requests, a FLOW_CONTROL_FILTER must be started for it
+    unsigned long TxFlags;
+    unsigned long Pid;
+    unsigned long Period;                // In ms, 0 for as often as possible
+    unsigned long DataLength;            // Number of data bytes, 0 to use the SAE J1979 length of the PID
+} ISO15765_OBD_POLL;
+
+typedef struct {
+    unsigned long TargetID;
+    unsigned long Pid;
+    unsigned long Timestamp;             // Reception time in microseconds
+    unsigned long DataSize;
+    unsigned char Data[8];               // Data bytes A, B, C...
+} ISO15765_OBD_SAMPLE;
+
+typedef struct {
+    unsigned long NumOfSamples;          // In: size of the array, out: number of samples
+    ISO15765_OBD_SAMPLE *SamplePtr;
+    unsigned long Requests;              // Out: requests sent during the call
+    unsigned long Timeouts;              // Out: requests not answered within P2, or answered negatively
+} ISO15765_OBD_SAMPLE_LIST;
+
+/*
+ * Cache of the positive responses to ReadDataByIdentifier (0x22) requests of a single DID, per target. A request
+ * written while a fresh response is cached is not sent, the cached response is returned by the next read.
+ * WriteDataByIdentifier (0x2E) invalidates its DID, ECUReset (0x11) and DiagnosticSessionControl (0x10) the target.
+ */
+#define ISO15765_RDBI_TTL_INFINITE 0xFFFFFFFF
+
+typedef struct {
+    unsigned long Enable;                // Disabling clears the cache
+    unsigned long DefaultTTL;            // In ms, for the DIDs without TTL, 0 to only cache these DIDs
+} ISO15765_RDBI_CACHE_CONFIG;
+
+typedef struct {
+    unsigned long Did;
+    unsigned long TTL;                   // In ms, 0 to never cache the DID
+} ISO15765_RDBI_CACHE_TTL;
+
+typedef struct {
+    unsigned long Hits;
+    unsigned long Misses;
+    unsigned long Invalidations;         // Number of entries dropped by writes, resets and session changes
+    unsigned long Entries;
+} ISO15765_RDBI_CACHE_STATS;
+
+/*
+ * TesterPresent (0x3E 0x80) sent to a target when no other request was sent to it for S3 minus the margin. The
+ * keepalives are periodic messages of the CAN channel, sent by the adapter even between the calls of the application;
+ * a request written to the target starts their interval over when the next one is due within half an interval, and
+ * holds them back while a segmented request is sent. Each target takes one of the periodic messages of the adapter.
+ * The negative responses to the keepalives are not returned, unless the application has its own TesterPresent
+ * outstanding to the target.
+ */
+typedef struct {
+    unsigned long TargetID;              // CAN ID of the requests, a FLOW_CONTROL_FILTER must be started for it
+    unsigned long TxFlags;
+    unsigned long S3;                    // Session timeout of the ECU in ms, 0 for 5000 ms
+    unsigned long Margin;                // In ms, 0 for 1000 ms
+} ISO15765_KEEPALIVE;
+
+typedef struct {
+    unsigned long Sent;                  // TesterPresent requests sent, counted from the intervals elapsed
+    unsigned long Postponed;             // Times the requests of the application started the interval over
+    unsigned long Targets;
+} ISO15765_KEEPALIVE_STATS;
+
+/*
+ * ReadDTCInformation reportDTCByStatusMask (0x19 0x02) of several targets at once. The requests are sent without
+ * waiting for the responses, within MaxPending requests in flight and RequestInterval between two requests, and
+ * the responses are reassembled concurrently. The DTCs of all the targets are returned in one list.
+ */
+typedef struct {
+    unsigned long RequestID;             // A FLOW_CONTROL_FILTER must be started with this flow control ID
+    unsigned long ResponseID;            // In: pattern of the filter, 0 for any, out: pattern of the filter
+    unsigned long Result;                // Out: STATUS_NOERROR, ERR_TIMEOUT, ERR_FAILED on a negative response...
+    unsigned long ResponseCode;          // Out: negative response code
+    unsigned long ResponsePending;       // Out: number of 0x78 negative responses absorbed
+    unsigned long AvailabilityMask;      // Out: DTCStatusAvailabilityMask
+    unsigned long NumOfDtcs;             // Out: DTCs reported, including those which did not fit in the list
+} ISO15765_DTC_TARGET;
+
+typedef struct {
+    unsigned long NumOfTargets;
+    ISO15765_DTC_TARGET *TargetPtr;
+    unsigned long TxFlags;
+    unsigned long StatusMask;
+    unsigned long P2Timeout;             // In ms, 0 for 50 ms
+    unsigned long P2StarTimeout;         // In ms, 0 for 5000 ms
+    unsigned long MaxPending;            // Requests in flight, 0 for no limit
+    unsigned long RequestInterval;       // Minimum time between two requests in ms
+} ISO15765_DTC_READ;
+
+typedef struct {
+    unsigned long TargetID;              // RequestID of the target
+    unsigned long Dtc;                   // 3 bytes DTC
+    unsigned long Status;                // statusOfDTC
+} ISO15765_DTC;
+
+typedef struct {
+    unsigned long NumOfDtcs;             // In: size of the array, out: number of DTCs
+    ISO15765_DTC *DtcPtr;
+} ISO15765_DTC_LIST;
+
+/*
+ * Discovery of the ECUs answering a range of request IDs. A probe is sent to every ID, with one PASS filter
+ * covering all the response IDs; the responses are reassembled as they come, flow controls included. The scan ends
+ * once nothing was received for QuietWindow after the last probe. The frames of the other transfers received
+ * during the scan are dropped.
+ */
+#define ISO15765_SCAN_OFFSET       0     // Response ID = request ID + ResponseOffset
+#define ISO15765_SCAN_NORMAL_FIXED 1     // 29 bits normal fixed addressing: target and source addresses swapped
+
+typedef struct {
+    unsigned long FirstID;
+    unsigned long LastID;
+    unsigned long Step;                  // Between two request IDs, 0 for 1
+    unsigned long TxFlags;               // CAN_29BIT_ID, ISO15765_FRAME_PAD
+    unsigned long Addressing;            // ISO15765_SCAN_OFFSET or ISO15765_SCAN_NORMAL_FIXED
+    unsigned long ResponseOffset;        // 0 for 8
+    unsigned long Interval;              // Between two probes in ms, 0 to send them back to back
+    unsigned long QuietWindow;           // In ms, 0 for 100 ms
+    unsigned long ProbeSize;             // 0 for TesterPresent (0x3E 0x00)
+    unsigned char Probe[7];
+} ISO15765_SCAN;
+
+typedef struct {
+    unsigned long RequestID;
+    unsigned long ResponseID;
+    unsigned long Timestamp;             // First frame of the response, in microseconds
+    unsigned long DataSize;              // Size of the response, 0 if it was not completed
+    unsigned char Data[32];              // Start of the response
+} ISO15765_SCAN_RESPONDER;
+
+typedef struct {
+    unsigned long NumOfResponders;       // In: size of the array, out: number of responders, by request ID
+    ISO15765_SCAN_RESPONDER *ResponderPtr;
+    unsigned long Probes;                // Out: probes sent
+} ISO15765_SCAN_LIST;
+
+/*
+ * State of a channel: configuration, filters and periodic messages. A snapshot is restored on a new channel, after a
+ * reconnection, with one SET_CONFIG and a start per filter and periodic message, in the order of the snapshot. The
+ * restored snapshot gives the new filter and message IDs. The OBD polls and keepalives of the channel are kept. BS and
+ * STmin are not part of it: every segmented message waits for the flow control of the ECU after its first frame.
+ * When the device refuses a filter or a periodic message, the ones already started are stopped with the OBD polls
+ * and the keepalives: the channel is left empty, not half restored.
+ */
+#define ISO15765_SNAPSHOT_MAX_CONFIGS   16
+#define ISO15765_SNAPSHOT_MAX_FILTERS   16
+#define ISO15765_SNAPSHOT_MAX_PERIODICS 16
+
+// Filter and periodic messages are limited to 12 bytes
+typedef struct {
+    unsigned long ProtocolID;
+    unsigned long RxStatus;
+    unsigned long TxFlags;
+    unsigned long DataSize;
+    unsigned char Data[12];
+} ISO15765_SNAPSHOT_MSG;
+
+typedef struct {
+    unsigned long FilterID;
+    unsigned long FilterType;
+    ISO15765_SNAPSHOT_MSG Mask;
+    ISO15765_SNAPSHOT_MSG Pattern;
+    ISO15765_SNAPSHOT_MSG FlowControl;   // Of the FLOW_CONTROL_FILTERs
+} ISO15765_SNAPSHOT_FILTER;
+
+typedef struct {
+    unsigned long MsgID;
+    unsigned long TimeInterval;
+    ISO15765_SNAPSHOT_MSG Msg;
+} ISO15765_SNAPSHOT_PERIODIC;
+
+typedef struct {
+    unsigned long NumOfConfigs;
+    SCONFIG Configs[ISO15765_SNAPSHOT_MAX_CONFIGS];
+    unsigned long NumOfFilters;
+    ISO15765_SNAPSHOT_FILTER Filters[ISO15765_SNAPSHOT_MAX_FILTERS];
+    unsigned long NumOfPeriodics;
+    ISO15765_SNAPSHOT_PERIODIC Periodics[ISO15765_SNAPSHOT_MAX_PERIODICS];
+} ISO15765_SNAPSHOT;
+
+/*
+ * Reassembly buffers of a channel, by size class. Only multi-frame receptions take a buffer, and give it back to the
+ * channel once done. The high-water mark is the most buffers of the class in use at once.
+ */
+#define ISO15765_BUFFER_POOL_CLASSES 4
+
+typedef struct {
+    unsigned long Size;                  // Capacity of the buffers of the class
+    unsigned long InUse;
+    unsigned long HighWater;
+    unsigned long Allocated;             // In use or free
+} ISO15765_BUFFER_CLASS_STATS;
+
+typedef struct {
+    ISO15765_BUFFER_CLASS_STATS Classes[ISO15765_BUFFER_POOL_CLASSES];
+} ISO15765_BUFFER_POOL_STATS;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
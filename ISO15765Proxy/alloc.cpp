@@ -0,0 +1,485 @@
+#include <new>
+#include <vector>
+#include <chrono>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "iso15765.h"
+#include "clock.h"
+#include "utils.h"
+
+#define J2534_DATA_OFFSET 4
+#define CAN_DATA_SIZE 8
+
+#define TESTER_PID 0x7E0
+#define ECU_PID 0x7E8
+
+#define MESSAGE_SIZE 1024
+#define MAX_FRAMES ((MESSAGE_SIZE / 7) + 2)
+
+#define LOOKUP_FILTERS 64
+#define TEARDOWN_FILTERS 256
+#define OTHER_PID_BASE 0x100
+
+/*
+ * Global allocator hook: every operator new/delete of the process is counted while mCounting is set
+ */
+struct AllocationCounters {
+    bool counting;
+    unsigned long long allocations;
+    unsigned long long deallocations;
+    unsigned long long bytes;
+};
+
+static AllocationCounters gCounters = {false, 0, 0, 0};
+
+static void *countedAlloc(size_t size) {
+    if(gCounters.counting) {
+        gCounters.allocations++;
+        gCounters.bytes += size;
+    }
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if(ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+static void countedFree(void *ptr) {
+    if(ptr != NULL && gCounters.counting) {
+        gCounters.deallocations++;
+    }
+    free(ptr);
+}
+
+void *operator new(size_t size) {
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size) {
+    return countedAlloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+    UNUSED(size);
+    countedFree(ptr);
+}
+
+void operator delete[](void *ptr, size_t size) noexcept {
+    UNUSED(size);
+    countedFree(ptr);
+}
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+DEFINE_SHARED(ChannelLoop)
+DEFINE_SHARED(DeviceLoop)
+
+/*
+ * Allocation-free CAN channel: answers every first frame with a CTS flow control and replays a prepared list of
+ * frames to the reader, so that only the allocations of the ISO15765 layer are counted.
+ */
+class ChannelLoop: public Channel {
+public:
+    ChannelLoop(): mFrameCount(0), mFrameIndex(0), mPendingFlowControl(false) {
+        memset(&mFlowControl, 0, sizeof(mFlowControl));
+        mFlowControl.ProtocolID = CAN;
+        mFlowControl.DataSize = J2534_DATA_OFFSET + CAN_DATA_SIZE;
+        pid2Data(ECU_PID, mFlowControl.Data);
+        mFlowControl.Data[J2534_DATA_OFFSET] = 0x30;
+    }
+
+    virtual ~ChannelLoop() {
+    }
+
+    virtual void readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override {
+        UNUSED(Timeout);
+        unsigned long count = 0;
+        for(; count < *pNumMsgs; ++count) {
+            if(mPendingFlowControl) {
+                pMsg[count] = mFlowControl;
+                mPendingFlowControl = false;
+            } else if(mFrameIndex < mFrameCount) {
+                pMsg[count] = mFrames[mFrameIndex++];
+            } else {
+                break;
+            }
+        }
+        *pNumMsgs = count;
+    }
+
+    virtual void writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override {
+        UNUSED(Timeout);
+        for(unsigned long i = 0; i < *pNumMsgs; ++i) {
+            if((pMsg[i].Data[J2534_DATA_OFFSET] >> 4) == 1) {
+                mPendingFlowControl = true;
+            }
+        }
+    }
+
+    virtual PeriodicMessagePtr startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) override {
+        UNUSED(pMsg);
+        UNUSED(TimeInterval);
+        return nullptr;
+    }
+
+    virtual void stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) override {
+        UNUSED(periodicMessage);
+    }
+
+    virtual MessageFilterPtr startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
+                                         PASSTHRU_MSG *pFlowControlMsg) override {
+        UNUSED(FilterType);
+        UNUSED(pMaskMsg);
+        UNUSED(pPatternMsg);
+        UNUSED(pFlowControlMsg);
+        return nullptr;
+    }
+
+    virtual void stopMsgFilter(const MessageFilterPtr &messageFilter) override {
+        UNUSED(messageFilter);
+    }
+
+    virtual void ioctl(unsigned long IoctlID, void *pInput, void *pOutput) override {
+        UNUSED(IoctlID);
+        UNUSED(pInput);
+        UNUSED(pOutput);
+    }
+
+    virtual DeviceWeakPtr getDevice() const override {
+        return DeviceWeakPtr();
+    }
+
+    // Prepare the frames of an ECU response of MESSAGE_SIZE bytes
+    void prepareResponse() {
+        mFrameCount = 0;
+        mFrameIndex = 0;
+        PASSTHRU_MSG &ff = mFrames[mFrameCount++];
+        memset(&ff, 0, sizeof(ff));
+        ff.ProtocolID = CAN;
+        ff.DataSize = J2534_DATA_OFFSET + CAN_DATA_SIZE;
+        pid2Data(ECU_PID, ff.Data);
+        ff.Data[J2534_DATA_OFFSET] = 0x10 | ((MESSAGE_SIZE >> 8) & 0x0F);
+        ff.Data[J2534_DATA_OFFSET + 1] = MESSAGE_SIZE & 0xFF;
+        size_t offset = 6;
+        unsigned int sequence = 1;
+        while(offset < MESSAGE_SIZE) {
+            PASSTHRU_MSG &cf = mFrames[mFrameCount++];
+            cf = ff;
+            cf.Data[J2534_DATA_OFFSET] = 0x20 | (sequence++ & 0x0F);
+            offset += 7;
+        }
+    }
+
+private:
+    PASSTHRU_MSG mFrames[MAX_FRAMES];
+    unsigned long mFrameCount;
+    unsigned long mFrameIndex;
+    PASSTHRU_MSG mFlowControl;
+    bool mPendingFlowControl;
+};
+
+class DeviceLoop: public Device {
+public:
+    virtual ~DeviceLoop() {
+    }
+
+    virtual ChannelPtr connect(unsigned long ProtocolID, unsigned long Flags, unsigned long BaudRate) override {
+        UNUSED(ProtocolID);
+        UNUSED(Flags);
+        UNUSED(BaudRate);
+        return mChannel;
+    }
+
+    virtual void disconnect(const ChannelPtr &channelPtr) override {
+        UNUSED(channelPtr);
+    }
+
+    virtual void setProgrammingVoltage(unsigned long PinNumber, unsigned long Voltage) override {
+        UNUSED(PinNumber);
+        UNUSED(Voltage);
+    }
+
+    virtual void readVersion(char *pFirmwareVersion, char *pDllVersion, char *pApiVersion) override {
+        UNUSED(pFirmwareVersion);
+        UNUSED(pDllVersion);
+        UNUSED(pApiVersion);
+    }
+
+    virtual void ioctl(unsigned long IoctlID, void *pInput, void *pOutput) override {
+        UNUSED(IoctlID);
+        UNUSED(pInput);
+        UNUSED(pOutput);
+    }
+
+    virtual LibraryWeakPtr getLibrary() const override {
+        return LibraryWeakPtr();
+    }
+
+    ChannelLoopPtr mChannel;
+};
+
+struct OperationResult {
+    const char *name;
+    unsigned long iterations;
+    unsigned long failures;
+    bool hotPath;
+    AllocationCounters counters;
+    double seconds;
+};
+
+static std::chrono::steady_clock::time_point gStart;
+
+static void beginCounting() {
+    gCounters.allocations = 0;
+    gCounters.deallocations = 0;
+    gCounters.bytes = 0;
+    gCounters.counting = true;
+    gStart = std::chrono::steady_clock::now();
+}
+
+static void endCounting(OperationResult &result) {
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - gStart).count();
+    gCounters.counting = false;
+    result.counters = gCounters;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--iterations N] [--warmup N] [--output FILE]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long iterations = 1000;
+    unsigned long warmup = 10;
+    const char *output = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return -1;
+        }
+        if(strcmp(argv[i], "--iterations") == 0) {
+            iterations = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--warmup") == 0) {
+            warmup = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--output") == 0) {
+            output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if(iterations < 1) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    VirtualClockPtr clock = std::make_shared<VirtualClock>();
+    DeviceLoopPtr loop = std::make_shared<DeviceLoop>();
+    loop->mChannel = std::make_shared<ChannelLoop>();
+    DeviceISO15765Ptr device = std::make_shared<DeviceISO15765>(nullptr, loop);
+
+    PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+    memset(&maskMsg, 0, sizeof(maskMsg));
+    memset(&patternMsg, 0, sizeof(patternMsg));
+    memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+    maskMsg.ProtocolID = patternMsg.ProtocolID = flowControlMsg.ProtocolID = ISO15765;
+    maskMsg.DataSize = patternMsg.DataSize = flowControlMsg.DataSize = J2534_DATA_OFFSET;
+    pid2Data(0xFFFFFFFF, maskMsg.Data);
+    pid2Data(ECU_PID, patternMsg.Data);
+    pid2Data(TESTER_PID, flowControlMsg.Data);
+
+    PASSTHRU_MSG request;
+    memset(&request, 0, sizeof(request));
+    request.ProtocolID = ISO15765;
+    request.DataSize = J2534_DATA_OFFSET + MESSAGE_SIZE;
+    pid2Data(TESTER_PID, request.Data);
+
+    std::vector<OperationResult> results(7);
+    results[0].name = "connect";
+    results[1].name = "start_filter";
+    results[2].name = "write_1k";
+    results[3].name = "read_1k";
+    results[4].name = "filter_churn";
+    results[5].name = "read_1k_64_filters";
+    results[6].name = "teardown_256_filters";
+    for(OperationResult &result: results) {
+        result.iterations = 1;
+        result.failures = 0;
+        result.hotPath = false;
+    }
+    results[2].hotPath = results[3].hotPath = results[5].hotPath = true;
+
+    // Setup costs, measured once
+    beginCounting();
+    ChannelPtr channel = device->connect(ISO15765, 0, 500000);
+    endCounting(results[0]);
+
+    beginCounting();
+    channel->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+    endCounting(results[1]);
+
+    // The connected channel uses the default clock: run the hot path on a channel bound to the virtual one
+    ChannelISO15765Ptr hot = std::make_shared<ChannelISO15765>(ISO15765, device, loop->mChannel, clock);
+    hot->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+
+    // Same, with the filter of the ECU behind the ones of other addresses: every frame scans them
+    PASSTHRU_MSG otherPatternMsg = patternMsg, otherFlowControlMsg = flowControlMsg;
+    ChannelISO15765Ptr many = std::make_shared<ChannelISO15765>(ISO15765, device, loop->mChannel, clock);
+    for(unsigned long i = 0; i < LOOKUP_FILTERS - 1; ++i) {
+        pid2Data(OTHER_PID_BASE + 2 * i + 1, otherPatternMsg.Data);
+        pid2Data(OTHER_PID_BASE + 2 * i, otherFlowControlMsg.Data);
+        many->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &otherPatternMsg, &otherFlowControlMsg);
+    }
+    many->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+    std::vector<MessageFilterPtr> teardown(TEARDOWN_FILTERS);
+
+    // Steady-state costs
+    for(unsigned long w = 0; w <= warmup; ++w) {
+        bool measure = (w == warmup);
+        unsigned long count = measure ? iterations : 1;
+
+        if(measure) {
+            beginCounting();
+        }
+        for(unsigned long i = 0; i < count; ++i) {
+            unsigned long num = 1;
+            hot->writeMsgs(&request, &num, 1000);
+            if(num != 1 && measure) {
+                results[2].failures++;
+            }
+        }
+        if(measure) {
+            endCounting(results[2]);
+            results[2].iterations = count;
+        }
+
+        PASSTHRU_MSG response;
+        if(measure) {
+            beginCounting();
+        }
+        for(unsigned long i = 0; i < count; ++i) {
+            loop->mChannel->prepareResponse();
+            unsigned long num = 1;
+            hot->readMsgs(&response, &num, 1000);
+            if((num != 1 || response.DataSize != J2534_DATA_OFFSET + MESSAGE_SIZE) && measure) {
+                results[3].failures++;
+            }
+        }
+        if(measure) {
+            endCounting(results[3]);
+            results[3].iterations = count;
+        }
+
+        // Scanners start and stop a filter for every probed address
+        if(measure) {
+            beginCounting();
+        }
+        for(unsigned long i = 0; i < count; ++i) {
+            MessageFilterPtr filter = hot->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+            if(filter == nullptr && measure) {
+                results[4].failures++;
+            } else {
+                hot->stopMsgFilter(filter);
+            }
+        }
+        if(measure) {
+            endCounting(results[4]);
+            results[4].iterations = count;
+        }
+
+        if(measure) {
+            beginCounting();
+        }
+        for(unsigned long i = 0; i < count; ++i) {
+            loop->mChannel->prepareResponse();
+            unsigned long num = 1;
+            many->readMsgs(&response, &num, 1000);
+            if((num != 1 || response.DataSize != J2534_DATA_OFFSET + MESSAGE_SIZE) && measure) {
+                results[5].failures++;
+            }
+        }
+        if(measure) {
+            endCounting(results[5]);
+            results[5].iterations = count;
+        }
+
+        // A channel closed with many filters: they are stopped in the order they were started
+        unsigned long teardowns = measure ? (count / 16 + 1) : 1;
+        if(measure) {
+            beginCounting();
+        }
+        for(unsigned long i = 0; i < teardowns; ++i) {
+            for(unsigned long j = 0; j < TEARDOWN_FILTERS; ++j) {
+                pid2Data(OTHER_PID_BASE + 2 * j + 1, otherPatternMsg.Data);
+                pid2Data(OTHER_PID_BASE + 2 * j, otherFlowControlMsg.Data);
+                teardown[j] = hot->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &otherPatternMsg, &otherFlowControlMsg);
+            }
+            for(unsigned long j = 0; j < TEARDOWN_FILTERS; ++j) {
+                hot->stopMsgFilter(teardown[j]);
+                teardown[j] = nullptr;
+            }
+        }
+        if(measure) {
+            endCounting(results[6]);
+            results[6].iterations = teardowns;
+        }
+    }
+
+    FILE *file = stdout;
+    if(output != NULL) {
+        file = fopen(output, "w");
+        if(file == NULL) {
+            fprintf(stderr, "Can't open %s\n", output);
+            return -1;
+        }
+    }
+    fprintf(file, "{\n  \"benchmark\": \"iso15765_alloc\",\n");
+    fprintf(file, "  \"footprint\": {\"ChannelISO15765\": %lu, \"TransferISO15765\": %lu, \"MessageFilterISO15765\": %lu, \"PASSTHRU_MSG\": %lu},\n",
+            (unsigned long)sizeof(ChannelISO15765), (unsigned long)sizeof(TransferISO15765),
+            (unsigned long)sizeof(MessageFilterISO15765), (unsigned long)sizeof(PASSTHRU_MSG));
+    fprintf(file, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        OperationResult &result = results[i];
+        fprintf(file, "    {\"operation\": \"%s\", \"iterations\": %lu, \"failures\": %lu, \"allocations\": %llu, \"deallocations\": %llu, "
+                "\"bytes\": %llu, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f, \"ns_per_op\": %.1f}%s\n",
+                result.name, result.iterations, result.failures, result.counters.allocations, result.counters.deallocations,
+                result.counters.bytes, (double)result.counters.allocations / result.iterations,
+                (double)result.counters.bytes / result.iterations, result.seconds * 1e9 / result.iterations,
+                (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    if(file != stdout) {
+        fclose(file);
+    }
+
+    // Gate: the message hot path must not allocate
+    int ret = 0;
+    for(size_t i = 2; i < results.size(); ++i) {
+        if(results[i].failures != 0) {
+            fprintf(stderr, "%s: %lu failure(s)\n", results[i].name, results[i].failures);
+            ret = -2;
+        }
+        if(results[i].hotPath && results[i].counters.allocations != 0) {
+            fprintf(stderr, "%s: %llu allocation(s) on the hot path\n", results[i].name, results[i].counters.allocations);
+            ret = -2;
+        }
+    }
+    return ret;
+}
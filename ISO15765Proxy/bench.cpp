@@ -0,0 +1,394 @@
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "internal.h"
+#include "iso15765.h"
+#include "bus.h"
+#include "stats.h"
+#include "utils.h"
+
+#define J2534_DATA_OFFSET 4
+#define ISO15765_MAX_PAYLOAD 4095
+
+#define PID_BASE_11BIT 0x600
+#define PID_BASE_29BIT 0x18DA0000
+
+#define TRANSFER_TIMEOUT 5000
+
+typedef std::chrono::steady_clock bench_clock;
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+struct BenchCase {
+    size_t payload;
+    unsigned long bs;
+    unsigned long stmin;
+    unsigned int addressing;
+    unsigned int concurrency;
+};
+
+struct BenchResult {
+    BenchCase bench;
+    unsigned long messages;
+    unsigned long errors;
+    double wall;
+    double cpu;
+    std::vector<double> latencies;
+};
+
+struct BenchOptions {
+    std::vector<unsigned long> sizes;
+    std::vector<unsigned long> bs;
+    std::vector<unsigned long> stmin;
+    std::vector<unsigned long> addressing;
+    std::vector<unsigned long> concurrency;
+    unsigned long iterations;
+    unsigned long maxTime;
+    const char *output;
+};
+
+/*
+ * One sender/receiver pair of ISO15765 channels on the shared bus.
+ * The receiver only starts a read when the sender hands it a ticket, so each message is timed on its own.
+ */
+class BenchPair {
+public:
+    BenchPair(const BusPtr &bus, const BenchCase &bench, unsigned int index);
+    ~BenchPair();
+
+    void run(unsigned long iterations, bench_clock::time_point end);
+
+    unsigned long mMessages;
+    unsigned long mErrors;
+    std::vector<double> mLatencies;
+
+private:
+    void receive();
+
+    BusPtr mBus;
+    ChannelTestPtr mSenderChannel;
+    ChannelTestPtr mReceiverChannel;
+    ChannelPtr mSender;
+    ChannelPtr mReceiver;
+
+    PASSTHRU_MSG mTxMsg;
+    PASSTHRU_MSG mRxMsg;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mTicket;
+    bool mDone;
+    bool mStop;
+    bool mOk;
+    bench_clock::time_point mReceived;
+};
+
+BenchPair::BenchPair(const BusPtr &bus, const BenchCase &bench, unsigned int index): mMessages(0), mErrors(0), mBus(bus),
+        mTicket(false), mDone(false), mStop(false), mOk(false) {
+    mSenderChannel = std::make_shared<ChannelTest>();
+    mReceiverChannel = std::make_shared<ChannelTest>();
+    mBus->addChannel(mSenderChannel);
+    mBus->addChannel(mReceiverChannel);
+
+    mSender = std::make_shared<ChannelISO15765>(ISO15765, nullptr, mSenderChannel);
+    mReceiver = std::make_shared<ChannelISO15765>(ISO15765, nullptr, mReceiverChannel);
+
+    SCONFIG CfgItem[2];
+    SCONFIG_LIST Input;
+    CfgItem[0].Parameter = ISO15765_BS;
+    CfgItem[0].Value = bench.bs;
+    CfgItem[1].Parameter = ISO15765_STMIN;
+    CfgItem[1].Value = bench.stmin;
+    Input.NumOfParams = 2;
+    Input.ConfigPtr = CfgItem;
+    mSender->ioctl(SET_CONFIG, &Input, NULL);
+    mReceiver->ioctl(SET_CONFIG, &Input, NULL);
+
+    uint32_t base = (bench.addressing == 29) ? PID_BASE_29BIT : PID_BASE_11BIT;
+    uint32_t txPid = base + 2 * index;
+    uint32_t rxPid = base + 2 * index + 1;
+
+    PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+    memset(&maskMsg, 0, sizeof(maskMsg));
+    memset(&patternMsg, 0, sizeof(patternMsg));
+    memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+    maskMsg.DataSize = patternMsg.DataSize = flowControlMsg.DataSize = J2534_DATA_OFFSET;
+
+    pid2Data(0xFFFFFFFF, maskMsg.Data);
+    pid2Data(rxPid, patternMsg.Data);
+    pid2Data(txPid, flowControlMsg.Data);
+    mSender->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+
+    pid2Data(txPid, patternMsg.Data);
+    pid2Data(rxPid, flowControlMsg.Data);
+    mReceiver->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+
+    memset(&mTxMsg, 0, sizeof(mTxMsg));
+    mTxMsg.ProtocolID = ISO15765;
+    mTxMsg.TxFlags = (bench.addressing == 29) ? CAN_29BIT_ID : 0;
+    mTxMsg.DataSize = J2534_DATA_OFFSET + bench.payload;
+    pid2Data(txPid, mTxMsg.Data);
+    for(size_t i = 0; i < bench.payload; ++i) {
+        mTxMsg.Data[J2534_DATA_OFFSET + i] = (uint8_t)((i + index) % 256);
+    }
+}
+
+BenchPair::~BenchPair() {
+    mBus->removeChannel(mSenderChannel);
+    mBus->removeChannel(mReceiverChannel);
+}
+
+void BenchPair::receive() {
+    std::unique_lock<std::mutex> lck(mMutex);
+    while(true) {
+        mCondition.wait(lck, [this]() { return mTicket || mStop; });
+        if(mStop) {
+            return;
+        }
+        mTicket = false;
+        lck.unlock();
+
+        unsigned long count = 1;
+        mReceiver->readMsgs(&mRxMsg, &count, TRANSFER_TIMEOUT);
+        bench_clock::time_point received = bench_clock::now();
+        bool ok = count == 1 && mRxMsg.DataSize == mTxMsg.DataSize &&
+                memcmp(mRxMsg.Data, mTxMsg.Data, mTxMsg.DataSize) == 0;
+
+        lck.lock();
+        mReceived = received;
+        mOk = ok;
+        mDone = true;
+        mCondition.notify_all();
+    }
+}
+
+void BenchPair::run(unsigned long iterations, bench_clock::time_point end) {
+    std::thread receiver(&BenchPair::receive, this);
+
+    for(unsigned long i = 0; i < iterations; ++i) {
+        if(i > 0 && bench_clock::now() >= end) {
+            break;
+        }
+        {
+            std::unique_lock<std::mutex> lck(mMutex);
+            mDone = false;
+            mTicket = true;
+            mCondition.notify_all();
+        }
+
+        bench_clock::time_point start = bench_clock::now();
+        unsigned long count = 1;
+        mSender->writeMsgs(&mTxMsg, &count, TRANSFER_TIMEOUT);
+
+        std::unique_lock<std::mutex> lck(mMutex);
+        mCondition.wait(lck, [this]() { return mDone; });
+        if(count != 1 || !mOk) {
+            mErrors++;
+            continue;
+        }
+        mMessages++;
+        mLatencies.push_back(std::chrono::duration<double, std::micro>(mReceived - start).count());
+    }
+
+    {
+        std::unique_lock<std::mutex> lck(mMutex);
+        mStop = true;
+        mCondition.notify_all();
+    }
+    receiver.join();
+}
+
+static BenchResult runCase(const BenchCase &bench, const BenchOptions &options) {
+    BenchResult result;
+    result.bench = bench;
+    result.messages = 0;
+    result.errors = 0;
+
+    BusPtr bus = std::make_shared<Bus>();
+    std::vector<std::unique_ptr<BenchPair>> pairs;
+    for(unsigned int i = 0; i < bench.concurrency; ++i) {
+        pairs.push_back(std::unique_ptr<BenchPair>(new BenchPair(bus, bench, i)));
+    }
+
+    clock_t cpuStart = clock();
+    bench_clock::time_point start = bench_clock::now();
+    bench_clock::time_point end = start + std::chrono::milliseconds(options.maxTime);
+
+    std::vector<std::thread> threads;
+    for(std::unique_ptr<BenchPair> &pair: pairs) {
+        BenchPair *p = pair.get();
+        threads.push_back(std::thread([p, &options, end]() {
+            p->run(options.iterations, end);
+        }));
+    }
+    for(std::thread &thread: threads) {
+        thread.join();
+    }
+
+    result.wall = std::chrono::duration<double>(bench_clock::now() - start).count();
+    result.cpu = (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    for(std::unique_ptr<BenchPair> &pair: pairs) {
+        result.messages += pair->mMessages;
+        result.errors += pair->mErrors;
+        result.latencies.insert(result.latencies.end(), pair->mLatencies.begin(), pair->mLatencies.end());
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+static void writeJson(FILE *file, const std::vector<BenchResult> &results) {
+    fprintf(file, "{\n  \"benchmark\": \"iso15765\",\n  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        double messages = r.messages > 0 ? (double)r.messages : 1;
+        fprintf(file, "    {\"payload\": %lu, \"bs\": %lu, \"stmin\": %lu, \"addressing\": \"%ubit\", \"concurrency\": %u, "
+                "\"messages\": %lu, \"errors\": %lu, \"msgs_per_s\": %.2f, \"payload_MBps\": %.4f, "
+                "\"cpu_us_per_msg\": %.2f, \"latency_us\": {\"p50\": %.2f, \"p99\": %.2f}}%s\n",
+                (unsigned long)r.bench.payload, r.bench.bs, r.bench.stmin, r.bench.addressing, r.bench.concurrency,
+                r.messages, r.errors, r.messages / r.wall, (r.messages * r.bench.payload) / r.wall / 1e6,
+                r.cpu * 1e6 / messages, percentile(r.latencies, 0.50), percentile(r.latencies, 0.99),
+                (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+static bool parseList(const char *str, std::vector<unsigned long> &list) {
+    list.clear();
+    const char *p = str;
+    while(*p != '\0') {
+        char *end;
+        unsigned long value = strtoul(p, &end, 0);
+        if(end == p) {
+            return false;
+        }
+        list.push_back(value);
+        p = end;
+        if(*p == ',') {
+            p++;
+        }
+    }
+    return !list.empty();
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  --sizes LIST         Payload sizes in bytes (1-%d)\n", ISO15765_MAX_PAYLOAD);
+    fprintf(stderr, "  --bs LIST            Block sizes\n");
+    fprintf(stderr, "  --stmin LIST         Separation times (ms)\n");
+    fprintf(stderr, "  --addressing LIST    CAN identifier sizes (11, 29)\n");
+    fprintf(stderr, "  --concurrency LIST   Number of concurrent transfers\n");
+    fprintf(stderr, "  --iterations N       Maximum messages per transfer and case\n");
+    fprintf(stderr, "  --max-time MS        Time budget per case\n");
+    fprintf(stderr, "  --output FILE        Write the JSON report to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    parseList("1,7,8,62,256,1023,4095", options.sizes);
+    parseList("0,8", options.bs);
+    parseList("0,1", options.stmin);
+    parseList("11,29", options.addressing);
+    parseList("1,4", options.concurrency);
+    options.iterations = 50;
+    options.maxTime = 250;
+    options.output = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return -1;
+        }
+        bool ok = true;
+        const char *arg = argv[i];
+        const char *value = argv[++i];
+        if(strcmp(arg, "--sizes") == 0) {
+            ok = parseList(value, options.sizes);
+        } else if(strcmp(arg, "--bs") == 0) {
+            ok = parseList(value, options.bs);
+        } else if(strcmp(arg, "--stmin") == 0) {
+            ok = parseList(value, options.stmin);
+        } else if(strcmp(arg, "--addressing") == 0) {
+            ok = parseList(value, options.addressing);
+        } else if(strcmp(arg, "--concurrency") == 0) {
+            ok = parseList(value, options.concurrency);
+        } else if(strcmp(arg, "--iterations") == 0) {
+            options.iterations = strtoul(value, NULL, 0);
+        } else if(strcmp(arg, "--max-time") == 0) {
+            options.maxTime = strtoul(value, NULL, 0);
+        } else if(strcmp(arg, "--output") == 0) {
+            options.output = value;
+        } else {
+            ok = false;
+        }
+        if(!ok) {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    for(unsigned long size: options.sizes) {
+        if(size < 1 || size > ISO15765_MAX_PAYLOAD) {
+            fprintf(stderr, "Unsupported payload size %lu (1-%d)\n", size, ISO15765_MAX_PAYLOAD);
+            return -1;
+        }
+    }
+    for(unsigned long addressing: options.addressing) {
+        if(addressing != 11 && addressing != 29) {
+            fprintf(stderr, "Unsupported addressing %lu (11 or 29)\n", addressing);
+            return -1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for(unsigned long concurrency: options.concurrency) {
+        for(unsigned long addressing: options.addressing) {
+            for(unsigned long stmin: options.stmin) {
+                for(unsigned long bs: options.bs) {
+                    for(unsigned long size: options.sizes) {
+                        BenchCase bench = {size, bs, stmin, (unsigned int)addressing, (unsigned int)concurrency};
+                        BenchResult result = runCase(bench, options);
+                        fprintf(stderr, "size=%4lu bs=%2lu stmin=%lu addr=%lu conc=%lu: %lu msgs, %lu errors, %.1f msgs/s, p50 %.0f us\n",
+                                size, bs, stmin, addressing, concurrency, result.messages, result.errors,
+                                result.messages / result.wall, percentile(result.latencies, 0.50));
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+    }
+
+    FILE *file = stdout;
+    if(options.output != NULL) {
+        file = fopen(options.output, "w");
+        if(file == NULL) {
+            fprintf(stderr, "Can't open %s\n", options.output);
+            return -1;
+        }
+    }
+    writeJson(file, results);
+    if(file != stdout) {
+        fclose(file);
+    }
+
+    unsigned long errors = 0;
+    for(BenchResult &result: results) {
+        errors += result.errors;
+    }
+    return errors == 0 ? 0 : -2;
+}
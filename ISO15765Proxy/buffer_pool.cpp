@@ -0,0 +1,58 @@
+#include "buffer_pool.h"
+
+#include "simple.h"
+
+// The largest class holds an ISO15765 message of 4095 bytes
+static const size_t classSizes[ISO15765_BUFFER_POOL_CLASSES] = {64, 256, 1024, 4096};
+
+BufferPool::BufferPool() {
+    for(size_t i = 0; i < ISO15765_BUFFER_POOL_CLASSES; ++i) {
+        mClasses[i].size = classSizes[i];
+        mClasses[i].inUse = 0;
+        mClasses[i].highWater = 0;
+        mClasses[i].allocated = 0;
+    }
+}
+
+BufferPool::~BufferPool() {
+}
+
+BufferPool::SizeClass &BufferPool::getClass(size_t size) {
+    for(SizeClass &sizeClass: mClasses) {
+        if(size <= sizeClass.size) {
+            return sizeClass;
+        }
+    }
+    throw J2534Exception(ERR_FAILED);
+}
+
+std::unique_ptr<uint8_t[]> BufferPool::acquire(size_t size) {
+    SizeClass &sizeClass = getClass(size);
+    std::unique_ptr<uint8_t[]> buffer;
+    if(sizeClass.free.empty()) {
+        buffer.reset(new uint8_t[sizeClass.size]);
+        sizeClass.allocated++;
+    } else {
+        buffer = std::move(sizeClass.free.back());
+        sizeClass.free.pop_back();
+    }
+    if(++sizeClass.inUse > sizeClass.highWater) {
+        sizeClass.highWater = sizeClass.inUse;
+    }
+    return buffer;
+}
+
+void BufferPool::release(std::unique_ptr<uint8_t[]> buffer, size_t size) {
+    SizeClass &sizeClass = getClass(size);
+    sizeClass.free.push_back(std::move(buffer));
+    sizeClass.inUse--;
+}
+
+void BufferPool::getStats(ISO15765_BUFFER_POOL_STATS &stats) const {
+    for(size_t i = 0; i < ISO15765_BUFFER_POOL_CLASSES; ++i) {
+        stats.Classes[i].Size = mClasses[i].size;
+        stats.Classes[i].InUse = mClasses[i].inUse;
+        stats.Classes[i].HighWater = mClasses[i].highWater;
+        stats.Classes[i].Allocated = mClasses[i].allocated;
+    }
+}
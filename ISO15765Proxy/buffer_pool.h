@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef _BUFFER_POOL_H
+#define _BUFFER_POOL_H
+
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ISO15765Proxy.h"
+#include "utils.h"
+
+DEFINE_SHARED(BufferPool)
+
+/*
+ * Reassembly buffers of the transfers of a channel, in size classes. A transfer takes a buffer on a first frame and
+ * gives it back once the message is complete or dropped; free buffers are kept for the next messages.
+ */
+class BufferPool {
+public:
+    BufferPool();
+    ~BufferPool();
+
+    // At least size bytes, size can't be above the largest class
+    std::unique_ptr<uint8_t[]> acquire(size_t size);
+
+    // size is the one given to acquire()
+    void release(std::unique_ptr<uint8_t[]> buffer, size_t size);
+
+    void getStats(ISO15765_BUFFER_POOL_STATS &stats) const;
+
+private:
+    struct SizeClass {
+        size_t size;
+        std::vector<std::unique_ptr<uint8_t[]>> free;
+        unsigned long inUse;
+        unsigned long highWater;
+        unsigned long allocated;
+    };
+
+    SizeClass &getClass(size_t size);
+
+    SizeClass mClasses[ISO15765_BUFFER_POOL_CLASSES];
+};
+
+#endif //_BUFFER_POOL_H
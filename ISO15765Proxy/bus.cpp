@@ -0,0 +1,264 @@
+#include "bus.h"
+
+#include <chrono>
+#include <algorithm>
+
+#include <stdio.h>
+
+#include "utils.h"
+
+#ifdef DEBUG
+#define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
+#else //DEBUG
+#define LOG_DEBUG(...)
+#endif //DEBUG
+
+static uint32_t data2pid(const uint8_t *data) {
+    uint32_t pid = 0;
+
+    pid |= ((0x1F & data[0]) << 24);
+    pid |= ((0xFF & data[1]) << 16);
+    pid |= ((0xFF & data[2]) << 8);
+    pid |= ((0xFF & data[3]) << 0);
+
+    return pid;
+}
+
+static void printFrame(const CanFrame &frame) {
+#ifdef DEBUG
+    printf("%08x ", frame.id);
+    for(unsigned int i = 0; i < frame.size; ++i) {
+        printf("%02x ", frame.data[i]);
+    }
+    printf("\n");
+#else //DEBUG
+    UNUSED(frame);
+#endif //DEBUG
+}
+
+/*
+ * MessageFilterTest
+ */
+
+MessageFilterTest::MessageFilterTest(const ChannelTestPtr& channel, uint32_t maskPid, uint32_t patternPid): mChannel(channel), mMaskPid(maskPid), mPatternPid(patternPid) {
+
+}
+
+ChannelWeakPtr MessageFilterTest::getChannel() const {
+    return mChannel;
+}
+
+bool MessageFilterTest::match(const CanFrame &frame) const {
+    return (frame.id & mMaskPid) == (mPatternPid & mMaskPid);
+}
+
+/*
+ * Bus
+ */
+
+Bus::Bus(): mContinue(true), mThread(_run, this) {
+}
+
+Bus::~Bus() {
+    {
+        std::unique_lock<std::mutex> lck(mMutex);
+        mContinue = false;
+        mInterrupted.notify_all();
+    }
+    mThread.join();
+}
+
+void Bus::_run(Bus *bus) {
+    bus->run();
+}
+
+void Bus::addChannel(const ChannelTestPtr &channel) {
+    std::unique_lock<std::mutex> lck (mMutex);
+    channel->mBus = shared_from_this();
+    mChannels.push_back(channel);
+}
+
+void Bus::removeChannel(const ChannelTestPtr &channel) {
+    std::unique_lock<std::mutex> lck (mMutex);
+    channel->mBus.reset();
+    mChannels.remove(channel);
+}
+
+void Bus::run() {
+    std::unique_lock<std::mutex> lck (mMutex);
+    while(true) {
+        mInterrupted.wait(lck, [this]() {
+            return !mContinue || !mIncommingMessageChannels.empty();
+        });
+        if(!mContinue) {
+            break;
+        }
+
+        while(!mIncommingMessageChannels.empty()) {
+            ChannelTestPtr channel = mIncommingMessageChannels.front();
+            mIncommingMessageChannels.pop_front();
+
+            std::unique_lock<std::mutex> lckC (channel->mMutex);
+
+            while(!channel->mOutBuffers.empty()) {
+                // Dispatch the incoming message to the other channel on the bus
+                CanFrame &frame = channel->mOutBuffers.front();
+                printFrame(frame);
+                for(ChannelTestPtr &c: mChannels) {
+                    if(c != channel) {
+                        std::unique_lock<std::mutex> lckC2 (c->mMutex);
+                        if(c->accept(frame)) {
+                            c->mInBuffers.push_back(frame);
+                            c->mInterrupted.notify_all();
+                            LOG_DEBUG("%p -> %p", (void*)channel.get(), (void*)c.get());
+                        }
+                    }
+                }
+                channel->mOutBuffers.pop_front();
+            }
+
+            channel->mInterrupted.notify_all();
+        }
+    }
+}
+
+/*
+ * ChannelTest
+ */
+
+ChannelTest::ChannelTest() {
+}
+
+ChannelTest::~ChannelTest() {
+
+}
+
+bool ChannelTest::accept(const CanFrame &frame) const {
+    return std::any_of(mMessageFilters.begin(), mMessageFilters.end(), [&](const MessageFilterTestPtr &messageFilter) {
+        return messageFilter->match(frame);
+    });
+}
+
+void ChannelTest::readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
+    BusPtr bus = mBus.lock();
+    if(!bus) {
+        LOG_DEBUG("No connected to bus");
+        *pNumMsgs = 0;
+        return;
+    }
+
+    // Set Deadline
+    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+    unsigned long count = 0;
+    std::unique_lock<std::mutex> lck (mMutex);
+
+    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
+        while(mInBuffers.empty()) {
+            if(mInterrupted.wait_until(lck, deadline) == std::cv_status::timeout) {
+                goto end;
+            }
+        }
+        frameToMsg(mInBuffers.front(), *(pMsg++));
+        mInBuffers.pop_front();
+
+        count++;
+    }
+end:
+    *pNumMsgs = count;
+    LOG_DEBUG("Read %ld message(s)", *pNumMsgs);
+}
+
+void ChannelTest::writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
+    BusPtr bus = mBus.lock();
+    if(!bus) {
+        LOG_DEBUG("No connected to bus");
+        *pNumMsgs = 0;
+        return;
+    }
+
+    // Set Deadline
+    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+
+    unsigned long count = 0;
+
+    LOG_DEBUG("Send %ld message(s)", *pNumMsgs);
+    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
+        CanFrame frame;
+        if(!msgToFrame(*(pMsg++), frame)) {
+            LOG_DEBUG("Invalid frame size");
+            goto end;
+        }
+        {
+            std::unique_lock<std::mutex> lck (mMutex);
+            mOutBuffers.push_back(frame);
+        }
+        {
+            // The bus lock is never taken while holding the channel one
+            std::unique_lock<std::mutex> lck (bus->mMutex);
+            bus->mIncommingMessageChannels.push_back(std::static_pointer_cast<ChannelTest>(shared_from_this()));
+            bus->mInterrupted.notify_all();
+        }
+
+        std::unique_lock<std::mutex> lck (mMutex);
+        while(!mOutBuffers.empty()) {
+            if(mInterrupted.wait_until(lck, deadline) == std::cv_status::timeout) {
+                goto end;
+            }
+        }
+
+        count++;
+    }
+
+end:
+    *pNumMsgs = count;
+    return;
+}
+
+PeriodicMessagePtr ChannelTest::startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) {
+    UNUSED(pMsg);
+    UNUSED(TimeInterval);
+    return nullptr;
+}
+
+void ChannelTest::stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) {
+    UNUSED(periodicMessage);
+}
+
+MessageFilterPtr ChannelTest::startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
+                                                             PASSTHRU_MSG *pFlowControlMsg) {
+    UNUSED(pFlowControlMsg);
+    uint32_t maskPid = 0;
+    uint32_t patternPid = 0;
+    if(pMaskMsg != NULL && pPatternMsg != NULL) {
+        maskPid = data2pid(pMaskMsg->Data);
+        patternPid = data2pid(pPatternMsg->Data);
+    }
+    MessageFilterTestPtr messageFilter = std::make_shared<MessageFilterTest>(std::static_pointer_cast<ChannelTest>(shared_from_this()), maskPid, patternPid);
+    if(FilterType == PASS_FILTER) {
+        std::unique_lock<std::mutex> lck (mMutex);
+        mMessageFilters.push_back(messageFilter);
+    }
+    return messageFilter;
+}
+
+void ChannelTest::stopMsgFilter(const MessageFilterPtr &messageFilter) {
+    std::unique_lock<std::mutex> lck (mMutex);
+    mMessageFilters.remove(std::static_pointer_cast<MessageFilterTest>(messageFilter));
+}
+
+void ChannelTest::ioctl(unsigned long IoctlID, void *pInput, void *pOutput) {
+    UNUSED(pInput);
+    UNUSED(pOutput);
+    std::unique_lock<std::mutex> lck (mMutex);
+    if(IoctlID == CLEAR_RX_BUFFER) {
+        mInBuffers.clear();
+    } else if(IoctlID == CLEAR_TX_BUFFER) {
+        mOutBuffers.clear();
+    } else if(IoctlID == CLEAR_MSG_FILTERS) {
+        mMessageFilters.clear();
+    }
+}
+
+DeviceWeakPtr ChannelTest::getDevice() const {
+    return DeviceWeakPtr();
+}
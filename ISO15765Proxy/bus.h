@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef _BUS_H
+#define _BUS_H
+
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "internal.h"
+#include "can_frame.h"
+
+DEFINE_SHARED(ChannelTest)
+DEFINE_SHARED(MessageFilterTest)
+DEFINE_SHARED(Bus)
+
+/*
+ * Simulated CAN bus used by the test and benchmark executables.
+ * Frames written on a channel, which must be CAN frames, are dispatched by the bus thread to every other channel whose PASS filters match.
+ */
+class Bus: public std::enable_shared_from_this<Bus> {
+    friend class ChannelTest;
+public:
+    Bus();
+    ~Bus();
+    void addChannel(const ChannelTestPtr &channel);
+    void removeChannel(const ChannelTestPtr &channel);
+
+    static void _run(Bus *bus);
+protected:
+    void run();
+private:
+    std::list<ChannelTestPtr> mChannels;
+
+    bool mContinue;
+    std::mutex mMutex;
+    std::list<ChannelTestPtr> mIncommingMessageChannels;
+    std::condition_variable mInterrupted;
+    std::thread mThread;
+};
+
+class ChannelTest: public Channel {
+    friend class Bus;
+public:
+    ChannelTest();
+
+    virtual ~ChannelTest();
+
+    virtual void readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override;
+
+    virtual void writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override;
+
+    virtual PeriodicMessagePtr startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) override;
+
+    virtual void stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) override;
+
+    virtual MessageFilterPtr startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
+                                         PASSTHRU_MSG *pFlowControlMsg) override;
+
+    virtual void stopMsgFilter(const MessageFilterPtr &messageFilter) override;
+
+    virtual void ioctl(unsigned long IoctlID, void *pInput, void *pOutput) override;
+
+    virtual DeviceWeakPtr getDevice() const override;
+
+private:
+    bool accept(const CanFrame &frame) const;
+
+    BusWeakPtr mBus;
+
+    std::list<CanFrame> mInBuffers;
+    std::list<CanFrame> mOutBuffers;
+    std::list<MessageFilterTestPtr> mMessageFilters;
+
+    std::mutex mMutex;
+    std::condition_variable mInterrupted;
+};
+
+class MessageFilterTest : public MessageFilter {
+    friend class ChannelTest;
+public:
+    MessageFilterTest(const ChannelTestPtr& channel, uint32_t maskPid, uint32_t patternPid);
+
+    virtual ChannelWeakPtr getChannel() const override;
+
+    bool match(const CanFrame &frame) const;
+protected:
+    ChannelTestWeakPtr mChannel;
+    uint32_t mMaskPid;
+    uint32_t mPatternPid;
+};
+
+#endif //_BUS_H
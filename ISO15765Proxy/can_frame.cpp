@@ -0,0 +1,39 @@
+#include "can_frame.h"
+
+#include <string.h>
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = (0x1F & (pid >> 24));
+    data[1] = (0xFF & (pid >> 16));
+    data[2] = (0xFF & (pid >> 8));
+    data[3] = (0xFF & (pid >> 0));
+}
+
+bool msgToFrame(const PASSTHRU_MSG &msg, CanFrame &frame) {
+    if(msg.DataSize < CAN_FRAME_ID_SIZE || msg.DataSize > CAN_FRAME_ID_SIZE + CAN_FRAME_MAX_DATA) {
+        return false;
+    }
+    frame.protocolId = msg.ProtocolID;
+    frame.rxStatus = msg.RxStatus;
+    frame.txFlags = msg.TxFlags;
+    frame.timestamp = msg.Timestamp;
+    frame.id = data2pid(msg.Data);
+    frame.size = msg.DataSize - CAN_FRAME_ID_SIZE;
+    memcpy(frame.data, &msg.Data[CAN_FRAME_ID_SIZE], frame.size);
+    return true;
+}
+
+void frameToMsg(const CanFrame &frame, PASSTHRU_MSG &msg) {
+    msg.ProtocolID = frame.protocolId;
+    msg.RxStatus = frame.rxStatus;
+    msg.TxFlags = frame.txFlags;
+    msg.Timestamp = frame.timestamp;
+    msg.DataSize = CAN_FRAME_ID_SIZE + frame.size;
+    msg.ExtraDataIndex = msg.DataSize;
+    pid2Data(frame.id, msg.Data);
+    memcpy(&msg.Data[CAN_FRAME_ID_SIZE], frame.data, frame.size);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef _CAN_FRAME_H
+#define _CAN_FRAME_H
+
+#include <stdint.h>
+
+#include "j2534_v0404.h"
+
+#define CAN_FRAME_ID_SIZE 4
+// Classic CAN, J2534 04.04 has no CAN FD protocol
+#define CAN_FRAME_MAX_DATA 8
+
+/*
+ * CAN frame as it travels between the ISO15765 layer and the CAN channels. A PASSTHRU_MSG is more than 4 KB for at most
+ * 12 bytes of ID and payload: frames are only converted at the Channel calls, and only their used bytes are copied.
+ */
+struct CanFrame {
+    unsigned long protocolId;
+    unsigned long rxStatus;
+    unsigned long txFlags;
+    unsigned long timestamp;
+    uint32_t id;
+    uint8_t size;
+    uint8_t data[CAN_FRAME_MAX_DATA];
+};
+
+// Return false if the message doesn't fit a CAN frame
+bool msgToFrame(const PASSTHRU_MSG &msg, CanFrame &frame);
+
+// Only the header and the ID and payload of the message are written
+void frameToMsg(const CanFrame &frame, PASSTHRU_MSG &msg);
+
+#endif //_CAN_FRAME_H
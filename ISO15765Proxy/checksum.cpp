@@ -0,0 +1,131 @@
+#include "checksum.h"
+
+#include "ISO15765Proxy.h"
+
+// IEEE 802.3, reflected
+#define CRC32_POLYNOMIAL 0xEDB88320
+#define CRC32_INIT 0xFFFFFFFF
+
+// CCITT, not reflected
+#define CRC16_POLYNOMIAL 0x1021
+#define CRC16_INIT 0xFFFF
+
+struct Crc32Tables {
+    uint32_t table[8][256];
+
+    Crc32Tables() {
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+            }
+            table[0][i] = crc;
+        }
+        // table[k][i]: CRC of byte i followed by k zero bytes
+        for(uint32_t i = 0; i < 256; ++i) {
+            for(int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+struct Crc16Table {
+    uint16_t table[256];
+
+    Crc16Table() {
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint16_t crc = i << 8;
+            for(int bit = 0; bit < 8; ++bit) {
+                crc = (crc << 1) ^ ((crc & 0x8000) ? CRC16_POLYNOMIAL : 0);
+            }
+            table[i] = crc;
+        }
+    }
+};
+
+static const Crc32Tables &crc32Tables() {
+    static const Crc32Tables tables;
+    return tables;
+}
+
+static const Crc16Table &crc16Table() {
+    static const Crc16Table table;
+    return table;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size) {
+    const uint32_t (*t)[256] = crc32Tables().table;
+    // Bytes are combined explicitly, so that the result does not depend on the endianness nor the alignment
+    while(size >= 8) {
+        uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while(size-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+static uint32_t crc16(uint32_t crc, const uint8_t *data, size_t size) {
+    const uint16_t *t = crc16Table().table;
+    while(size-- > 0) {
+        crc = ((crc << 8) ^ t[((crc >> 8) ^ *data++) & 0xFF]) & 0xFFFF;
+    }
+    return crc;
+}
+
+static uint32_t add32(uint32_t sum, const uint8_t *data, size_t size) {
+    // Independent sums, for the compiler to keep them in parallel
+    uint32_t sums[4] = {sum, 0, 0, 0};
+    while(size >= 4) {
+        sums[0] += data[0];
+        sums[1] += data[1];
+        sums[2] += data[2];
+        sums[3] += data[3];
+        data += 4;
+        size -= 4;
+    }
+    while(size-- > 0) {
+        sums[0] += *data++;
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+Checksum::Checksum(unsigned long type): mType(type), mState(0) {
+    if(mType == ISO15765_CHECKSUM_CRC32) {
+        mState = CRC32_INIT;
+    } else if(mType == ISO15765_CHECKSUM_CRC16) {
+        mState = CRC16_INIT;
+    }
+}
+
+Checksum::~Checksum() {
+}
+
+void Checksum::update(const uint8_t *data, size_t size) {
+    switch(mType) {
+        case ISO15765_CHECKSUM_CRC32:
+            mState = crc32(mState, data, size);
+            break;
+        case ISO15765_CHECKSUM_CRC16:
+            mState = crc16(mState, data, size);
+            break;
+        case ISO15765_CHECKSUM_ADD32:
+            mState = add32(mState, data, size);
+            break;
+        default:
+            break;
+    }
+}
+
+uint32_t Checksum::value() const {
+    return (mType == ISO15765_CHECKSUM_CRC32) ? (mState ^ CRC32_INIT) : mState;
+}
+
+bool Checksum::isValid(unsigned long type) {
+    return type <= ISO15765_CHECKSUM_ADD32;
+}
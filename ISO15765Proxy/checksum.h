@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Checksums of the flash images, updated block by block while they are sent (ISO15765_CHECKSUM_*).
+ * CRC32 is computed 8 bytes at a time with slicing tables, the additive sum 4 bytes at a time.
+ */
+class Checksum {
+public:
+    Checksum(unsigned long type);
+    ~Checksum();
+
+    void update(const uint8_t *data, size_t size);
+
+    uint32_t value() const;
+
+    static bool isValid(unsigned long type);
+
+private:
+    unsigned long mType;
+    uint32_t mState;
+};
+
+#endif //_CHECKSUM_H
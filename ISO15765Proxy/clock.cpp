@@ -0,0 +1,55 @@
+#include "clock.h"
+
+#include <thread>
+
+Clock::~Clock() {
+}
+
+ClockPtr Clock::getDefault() {
+    static ClockPtr clock = std::make_shared<SteadyClock>();
+    return clock;
+}
+
+/*
+ * SteadyClock
+ */
+
+SteadyClock::SteadyClock() {
+}
+
+SteadyClock::~SteadyClock() {
+}
+
+Clock::time_point SteadyClock::now() {
+    return std::chrono::steady_clock::now();
+}
+
+void SteadyClock::sleepFor(const duration &d) {
+    std::this_thread::sleep_for(d);
+}
+
+/*
+ * VirtualClock
+ */
+
+VirtualClock::VirtualClock(): mNow() {
+}
+
+VirtualClock::~VirtualClock() {
+}
+
+Clock::time_point VirtualClock::now() {
+    return mNow;
+}
+
+void VirtualClock::sleepFor(const duration &d) {
+    if(d > duration::zero()) {
+        mNow += d;
+    }
+}
+
+void VirtualClock::advanceTo(const time_point &t) {
+    if(t > mNow) {
+        mNow = t;
+    }
+}
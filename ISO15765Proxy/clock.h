@@ -0,0 +1,60 @@
+#pragma once
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include <chrono>
+
+#include "utils.h"
+
+DEFINE_SHARED(Clock)
+DEFINE_SHARED(SteadyClock)
+DEFINE_SHARED(VirtualClock)
+
+/*
+ * Source of time and sleeps for the ISO15765 layer
+ */
+class Clock {
+public:
+    typedef std::chrono::steady_clock::duration duration;
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    virtual ~Clock();
+
+    virtual time_point now() = 0;
+
+    virtual void sleepFor(const duration &d) = 0;
+
+    static ClockPtr getDefault();
+};
+
+class SteadyClock: public Clock {
+public:
+    SteadyClock();
+    virtual ~SteadyClock();
+
+    virtual time_point now() override;
+
+    virtual void sleepFor(const duration &d) override;
+};
+
+/*
+ * Discrete-event clock: time only moves when the code under test sleeps or waits, and it jumps straight to the
+ * deadline. Intended for single-threaded tests.
+ */
+class VirtualClock: public Clock {
+public:
+    VirtualClock();
+    virtual ~VirtualClock();
+
+    virtual time_point now() override;
+
+    virtual void sleepFor(const duration &d) override;
+
+    void advanceTo(const time_point &t);
+
+private:
+    time_point mNow;
+};
+
+#endif //_CLOCK_H
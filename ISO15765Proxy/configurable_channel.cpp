@@ -1,5 +1,8 @@
 #include "configurable_channel.h"
 
+#include <functional>
+
+#include "ISO15765Proxy.h"
 #include "utils.h"
 
 template<typename T>
@@ -21,11 +24,11 @@ public:
 
 protected:
     template<typename T>
-    static std::function<unsigned long &()> getParam(T &obj, ConfigParams<T> *params, unsigned long id) {
+    static unsigned long *getParam(T &obj, ConfigParams<T> *params, unsigned long id) {
         ConfigParams<T> *p = params;
         while (p != NULL && p->id != 0) {
             if (p->id == id) {
-                return std::bind(p->fct, obj);
+                return &p->fct(obj);
             }
             p++;
         }
@@ -33,11 +36,11 @@ protected:
     }
 
     template<typename T>
-    static std::function<unsigned long const &()> getParam(const T &obj, ConfigParams<T> *params, unsigned long id) {
+    static const unsigned long *getParam(const T &obj, ConfigParams<T> *params, unsigned long id) {
         ConfigParams<T> *p = params;
         while (p != NULL && p->id != 0) {
             if (p->id == id) {
-                return std::bind(p->fct, obj);
+                return &p->fct(const_cast<T &>(obj));
             }
             p++;
         }
@@ -84,11 +87,14 @@ private:
     unsigned long mBlockSize;
     unsigned long mSeparationTime;
     unsigned long mISO15765AddrType;
+    unsigned long mResponsePending;
+    unsigned long mP2Star;
 
     static ConfigParams<ISO15765Config> parameters[];
 };
 
 DefaultConfig::DefaultConfig() {
+    mDatarate = 0;
     mLoopback = 0;
 }
 
@@ -103,18 +109,18 @@ ConfigParams<DefaultConfig> DefaultConfig::parameters[] = {
 };
 
 bool DefaultConfig::getValue(unsigned long config, unsigned long *value) const {
-    std::function<const unsigned long &()> fct = getParam(*this, parameters, config);
-    if (fct) {
-        *value = fct();
+    const unsigned long *param = getParam(*this, parameters, config);
+    if (param != NULL) {
+        *value = *param;
         return true;
     }
     return false;
 }
 
 bool DefaultConfig::setValue(unsigned long config, unsigned long value) {
-    std::function<unsigned long &()> fct = getParam(*this, parameters, config);
-    if (fct) {
-        fct() = value;
+    unsigned long *param = getParam(*this, parameters, config);
+    if (param != NULL) {
+        *param = value;
         return true;
     }
     return false;
@@ -142,9 +148,9 @@ bool CANConfig::getValue(unsigned long config, unsigned long *value) const {
     if (DefaultConfig::getValue(config, value)) {
         return true;
     }
-    std::function<const unsigned long &()> fct = getParam(*this, parameters, config);
-    if (fct) {
-        *value = fct();
+    const unsigned long *param = getParam(*this, parameters, config);
+    if (param != NULL) {
+        *value = *param;
         return true;
     }
     return false;
@@ -154,9 +160,9 @@ bool CANConfig::setValue(unsigned long config, unsigned long value) {
     if (DefaultConfig::setValue(config, value)) {
         return true;
     }
-    std::function<unsigned long &()> fct = getParam(*this, parameters, config);
-    if (fct) {
-        fct() = value;
+    unsigned long *param = getParam(*this, parameters, config);
+    if (param != NULL) {
+        *param = value;
         return true;
     }
     return false;
@@ -166,6 +172,8 @@ ISO15765Config::ISO15765Config() {
     mBlockSize = 0;
     mSeparationTime = 0;
     mISO15765AddrType = 0;
+    mResponsePending = 0;
+    mP2Star = 5000;
 }
 
 ISO15765Config::~ISO15765Config() {
@@ -176,6 +184,8 @@ ConfigParams<ISO15765Config> ISO15765Config::parameters[] = {
         {ISO15765_BS,        [](ISO15765Config &c) -> unsigned long & { return c.mBlockSize; }},
         {ISO15765_STMIN,     [](ISO15765Config &c) -> unsigned long & { return c.mSeparationTime; }},
         {ISO15765_ADDR_TYPE, [](ISO15765Config &c) -> unsigned long & { return c.mISO15765AddrType; }},
+        {ISO15765_CONFIG_RESPONSE_PENDING, [](ISO15765Config &c) -> unsigned long & { return c.mResponsePending; }},
+        {ISO15765_CONFIG_P2_STAR, [](ISO15765Config &c) -> unsigned long & { return c.mP2Star; }},
         {0, NULL}
 };
 
@@ -183,9 +193,9 @@ bool ISO15765Config::getValue(unsigned long config, unsigned long *value) const
     if (CANConfig::getValue(config, value)) {
         return true;
     }
-    std::function<const unsigned long &()> fct = getParam(*this, parameters, config);
-    if (fct) {
-        *value = fct();
+    const unsigned long *param = getParam(*this, parameters, config);
+    if (param != NULL) {
+        *value = *param;
         return true;
     }
     return false;
@@ -195,9 +205,9 @@ bool ISO15765Config::setValue(unsigned long config, unsigned long value) {
     if (CANConfig::setValue(config, value)) {
         return true;
     }
-    std::function<unsigned long &()> fct = getParam(*this, parameters, config);
-    if (fct) {
-        fct() = value;
+    unsigned long *param = getParam(*this, parameters, config);
+    if (param != NULL) {
+        *param = value;
         return true;
     }
     return false;
@@ -0,0 +1,179 @@
+#include "delta.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <string.h>
+
+#include "flash.h"
+#include "simple.h"
+
+#define MAX_FORMAT_LENGTH 4
+
+// SID, routineControlType and routineIdentifier
+#define ROUTINE_CONTROL_HEADER_SIZE 4
+
+DeltaFlash::DeltaFlash(UdsClient &client): mClient(client) {
+}
+
+DeltaFlash::~DeltaFlash() {
+}
+
+Sha256Digest DeltaFlash::hash(const uint8_t *data, size_t size) {
+    return sha256(data, size);
+}
+
+void DeltaFlash::run(const ISO15765_FLASH_DELTA &delta, ISO15765_FLASH_DELTA_RESULT &result) {
+    memset(&result, 0, sizeof(result));
+    const ISO15765_FLASH_DOWNLOAD &download = delta.Download;
+    if(download.Data == NULL || download.MemorySize == 0 || !Checksum::isValid(download.ChecksumType)) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    size_t partNumberLength = strlen(delta.PartNumber);
+    if(partNumberLength == 0 || partNumberLength > 255 || strpbrk(delta.PartNumber, " \t\r\n") != NULL) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    FlashManifest::Entry entry;
+    entry.target = download.TargetID;
+    entry.address = download.MemoryAddress;
+    entry.segmentSize = (delta.SegmentSize != 0) ? delta.SegmentSize : DELTA_DEFAULT_SEGMENT_SIZE;
+    entry.partNumber = delta.PartNumber;
+    Checksum checksum(download.ChecksumType);
+    hashImage(delta, entry.segmentSize, entry.hashes, checksum);
+
+    FlashManifest manifest(delta.ManifestFile);
+    manifest.load();
+    const FlashManifest::Entry *last = manifest.find(entry.target, entry.address);
+    bool comparable = last != NULL && last->partNumber == entry.partNumber && last->segmentSize == entry.segmentSize &&
+            last->hashes.size() == entry.hashes.size();
+
+    result.Segments = entry.hashes.size();
+    std::vector<bool> changed(entry.hashes.size());
+    for(size_t i = 0; i < entry.hashes.size(); ++i) {
+        changed[i] = !comparable || last->hashes[i] != entry.hashes[i];
+        result.SegmentsChanged += changed[i] ? 1 : 0;
+        if(!changed[i]) {
+            result.BytesSkipped += std::min<unsigned long>(entry.segmentSize, download.MemorySize - i * entry.segmentSize);
+        }
+    }
+
+    if(result.SegmentsChanged > 0) {
+        // Until the whole image is in the ECU, the ECU holds neither image
+        manifest.remove(entry.target, entry.address);
+        manifest.save();
+    }
+    try {
+        for(size_t first = 0; first < changed.size();) {
+            if(!changed[first]) {
+                first++;
+                continue;
+            }
+            size_t end = first;
+            while(end < changed.size() && changed[end]) {
+                end++;
+            }
+            unsigned long offset = first * entry.segmentSize;
+            unsigned long size = std::min<unsigned long>(end * entry.segmentSize, download.MemorySize) - offset;
+            if(delta.Erase) {
+                erase(download, offset, size, result);
+            }
+            this->download(delta, offset, size, result);
+            first = end;
+        }
+    } catch(J2534Exception &) {
+        result.Flash.ResponsePending = mClient.getResponsePending();
+        throw;
+    }
+    result.Flash.ResponsePending = mClient.getResponsePending();
+    result.Flash.Checksum = checksum.value();
+
+    if(result.SegmentsChanged > 0) {
+        manifest.set(entry);
+        manifest.save();
+    }
+}
+
+void DeltaFlash::hashImage(const ISO15765_FLASH_DELTA &delta, size_t segmentSize, std::vector<Sha256Digest> &hashes,
+                           Checksum &checksum) {
+    const uint8_t *data = delta.Download.Data;
+    size_t size = delta.Download.MemorySize;
+    size_t count = (size + segmentSize - 1) / segmentSize;
+    hashes.resize(count);
+
+    size_t threads = (delta.Threads != 0) ? delta.Threads : std::thread::hardware_concurrency();
+    threads = std::max<size_t>(1, std::min(threads, count));
+    auto hashSegments = [&](size_t first, size_t end) {
+        for(size_t i = first; i < end; ++i) {
+            size_t offset = i * segmentSize;
+            hashes[i] = hash(data + offset, std::min(segmentSize, size - offset));
+        }
+    };
+
+    // Contiguous ranges of segments per thread, the checksum of the whole image on this one meanwhile
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t) {
+        workers.emplace_back(hashSegments, count * t / threads, count * (t + 1) / threads);
+    }
+    checksum.update(data, size);
+    for(std::thread &worker: workers) {
+        worker.join();
+    }
+}
+
+void DeltaFlash::erase(const ISO15765_FLASH_DOWNLOAD &download, unsigned long offset, unsigned long size,
+                       ISO15765_FLASH_DELTA_RESULT &result) {
+    size_t addressLength = download.AddressAndLengthFormat & 0x0F;
+    size_t sizeLength = (download.AddressAndLengthFormat >> 4) & 0x0F;
+    if(addressLength == 0 || addressLength > MAX_FORMAT_LENGTH || sizeLength == 0 || sizeLength > MAX_FORMAT_LENGTH) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    uint8_t request[ROUTINE_CONTROL_HEADER_SIZE + 1 + 2 * MAX_FORMAT_LENGTH];
+    size_t length = 0;
+    unsigned long address = download.MemoryAddress + offset;
+    request[length++] = UDS_ROUTINE_CONTROL;
+    request[length++] = UDS_START_ROUTINE;
+    request[length++] = (UDS_ROUTINE_ERASE_MEMORY >> 8) & 0xFF;
+    request[length++] = UDS_ROUTINE_ERASE_MEMORY & 0xFF;
+    request[length++] = download.AddressAndLengthFormat & 0xFF;
+    for(size_t i = addressLength; i > 0; --i) {
+        request[length++] = (address >> (8 * (i - 1))) & 0xFF;
+    }
+    for(size_t i = sizeLength; i > 0; --i) {
+        request[length++] = (size >> (8 * (i - 1))) & 0xFF;
+    }
+
+    result.Flash.FailedService = UDS_ROUTINE_CONTROL;
+    uint8_t responseCode = mClient.request(request, length, mResponse);
+    if(responseCode != 0) {
+        result.Flash.ResponseCode = responseCode;
+        throw J2534Exception(ERR_FAILED);
+    }
+    result.Flash.FailedService = 0;
+}
+
+void DeltaFlash::download(const ISO15765_FLASH_DELTA &delta, unsigned long offset, unsigned long size,
+                          ISO15765_FLASH_DELTA_RESULT &result) {
+    ISO15765_FLASH_DOWNLOAD download = delta.Download;
+    download.MemoryAddress += offset;
+    download.MemorySize = size;
+    download.Data += offset;
+    download.ChecksumType = ISO15765_CHECKSUM_NONE;
+
+    ISO15765_FLASH_RESULT flash;
+    FlashDownload engine(mClient);
+    result.Downloads++;
+    try {
+        engine.run(download, flash);
+    } catch(J2534Exception &) {
+        result.Flash.BytesTransferred += flash.BytesTransferred;
+        result.Flash.BlockCount += flash.BlockCount;
+        result.Flash.FailedService = flash.FailedService;
+        result.Flash.ResponseCode = flash.ResponseCode;
+        throw;
+    }
+    result.Flash.BytesTransferred += flash.BytesTransferred;
+    result.Flash.BlockCount += flash.BlockCount;
+    result.Flash.BlockLength = flash.BlockLength;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef _DELTA_H
+#define _DELTA_H
+
+#include <vector>
+
+#include "ISO15765Proxy.h"
+#include "checksum.h"
+#include "manifest.h"
+#include "uds.h"
+
+#define UDS_ROUTINE_CONTROL 0x31
+#define UDS_START_ROUTINE 0x01
+#define UDS_ROUTINE_ERASE_MEMORY 0xFF00
+
+#define DELTA_DEFAULT_SEGMENT_SIZE 4096
+
+/*
+ * Delta download: the segments of the image are hashed on several threads, compared with the manifest, and the runs
+ * of changed segments are downloaded with FlashDownload. The manifest entry is dropped before the first download
+ * and written back once the whole image is in the ECU.
+ */
+class DeltaFlash {
+public:
+    DeltaFlash(UdsClient &client);
+    ~DeltaFlash();
+
+    // Throw J2534Exception on failure, the result is filled in any case
+    void run(const ISO15765_FLASH_DELTA &delta, ISO15765_FLASH_DELTA_RESULT &result);
+
+    // Hash of a segment: it alone decides whether the segment is flashed, any change must show
+    static Sha256Digest hash(const uint8_t *data, size_t size);
+
+private:
+    void hashImage(const ISO15765_FLASH_DELTA &delta, size_t segmentSize, std::vector<Sha256Digest> &hashes,
+                   Checksum &checksum);
+    void erase(const ISO15765_FLASH_DOWNLOAD &download, unsigned long offset, unsigned long size,
+               ISO15765_FLASH_DELTA_RESULT &result);
+    void download(const ISO15765_FLASH_DELTA &delta, unsigned long offset, unsigned long size,
+                  ISO15765_FLASH_DELTA_RESULT &result);
+
+    UdsClient &mClient;
+    PASSTHRU_MSG mResponse;
+};
+
+#endif //_DELTA_H
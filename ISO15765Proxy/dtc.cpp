@@ -0,0 +1,142 @@
+#include "dtc.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <string.h>
+
+#include "simple.h"
+
+#define DTC_RECORD_SIZE 4
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+// Whole milliseconds to wait, rounded up so that a read never returns before the wake up time
+static unsigned long waitTime(const Clock::time_point &now, const Clock::time_point &wake) {
+    if(wake <= now) {
+        return 1;
+    }
+    return (std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count() + 999) / 1000;
+}
+
+DtcReader::DtcReader(Channel &channel, Clock &clock): mChannel(channel), mClock(clock), mPending(0), mCapacity(0) {
+}
+
+DtcReader::~DtcReader() {
+}
+
+void DtcReader::run(const std::vector<UdsClientPtr> &clients, const ISO15765_DTC_READ &read, ISO15765_DTC_LIST &list) {
+    mTargets.clear();
+    for(size_t i = 0; i < clients.size(); ++i) {
+        Target target;
+        target.client = clients[i];
+        target.result = &read.TargetPtr[i];
+        target.state = WAITING;
+        target.result->Result = STATUS_NOERROR;
+        target.result->ResponseCode = 0;
+        target.result->ResponsePending = 0;
+        target.result->AvailabilityMask = 0;
+        target.result->NumOfDtcs = 0;
+        mTargets.push_back(target);
+    }
+    mPending = 0;
+    mCapacity = list.NumOfDtcs;
+    list.NumOfDtcs = 0;
+
+    size_t maxPending = (read.MaxPending != 0) ? read.MaxPending : mTargets.size();
+    Clock::duration interval = std::chrono::milliseconds(read.RequestInterval);
+    Clock::time_point nextSend = mClock.now();
+    auto waiting = mTargets.begin();
+    while(true) {
+        Clock::time_point now = mClock.now();
+        while(waiting != mTargets.end() && mPending < maxPending && now >= nextSend) {
+            send(*waiting++, read.StatusMask);
+            nextSend = now + interval;
+            now = mClock.now();
+        }
+
+        Clock::time_point wake = Clock::time_point::max();
+        for(Target &target: mTargets) {
+            if(target.state != OUTSTANDING) {
+                continue;
+            }
+            if(now >= target.expiry) {
+                done(target, ERR_TIMEOUT);
+            } else {
+                wake = std::min(wake, target.expiry);
+            }
+        }
+        if(waiting != mTargets.end() && mPending < maxPending) {
+            wake = std::min(wake, nextSend);
+        }
+        if(wake == Clock::time_point::max()) {
+            break;
+        }
+
+        if(UdsClient::read(mChannel, mMessage, waitTime(now, wake))) {
+            dispatch(mMessage, list);
+        }
+    }
+}
+
+void DtcReader::send(Target &target, uint8_t statusMask) {
+    uint8_t request[] = {UDS_READ_DTC_INFORMATION, UDS_REPORT_DTC_BY_STATUS_MASK, statusMask};
+    try {
+        target.client->send(target.client->prepare(mMessage, request, sizeof(request)));
+    } catch(J2534Exception &exception) {
+        target.state = DONE;
+        target.result->Result = exception.code();
+        return;
+    }
+    target.state = OUTSTANDING;
+    target.expiry = mClock.now() + std::chrono::milliseconds(target.client->getP2());
+    mPending++;
+}
+
+void DtcReader::done(Target &target, unsigned long result) {
+    target.state = DONE;
+    target.result->Result = result;
+    mPending--;
+}
+
+void DtcReader::dispatch(const PASSTHRU_MSG &msg, ISO15765_DTC_LIST &list) {
+    uint32_t pid = data2pid(msg.Data);
+    auto target = std::find_if(mTargets.begin(), mTargets.end(), [&](const Target &target) {
+        return target.state == OUTSTANDING && target.client->getResponsePid() == pid;
+    });
+    if(target == mTargets.end()) {
+        return;
+    }
+
+    const uint8_t *data = UdsClient::payload(msg);
+    size_t size = UdsClient::payloadSize(msg);
+    if(size >= 3 && data[0] == UDS_POSITIVE_RESPONSE(UDS_READ_DTC_INFORMATION) && data[1] == UDS_REPORT_DTC_BY_STATUS_MASK) {
+        parse(*target, data, size, list);
+        done(*target, STATUS_NOERROR);
+    } else if(size >= 3 && data[0] == UDS_NEGATIVE_RESPONSE && data[1] == UDS_READ_DTC_INFORMATION) {
+        if(data[2] == UDS_NRC_RESPONSE_PENDING) {
+            target->result->ResponsePending++;
+            target->expiry = mClock.now() + std::chrono::milliseconds(target->client->getP2Star());
+        } else {
+            target->result->ResponseCode = data[2];
+            done(*target, ERR_FAILED);
+        }
+    }
+}
+
+void DtcReader::parse(Target &target, const uint8_t *data, size_t size, ISO15765_DTC_LIST &list) {
+    // [0x59][0x02][DTCStatusAvailabilityMask] then [DTC high][middle][low][status] for each DTC
+    target.result->AvailabilityMask = data[2];
+    for(size_t offset = 3; offset + DTC_RECORD_SIZE <= size; offset += DTC_RECORD_SIZE) {
+        target.result->NumOfDtcs++;
+        if(list.NumOfDtcs >= mCapacity) {
+            continue;
+        }
+        ISO15765_DTC &dtc = list.DtcPtr[list.NumOfDtcs++];
+        dtc.TargetID = target.client->getRequestPid();
+        dtc.Dtc = (data[offset] << 16) | (data[offset + 1] << 8) | data[offset + 2];
+        dtc.Status = data[offset + 3];
+    }
+}
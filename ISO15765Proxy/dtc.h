@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef _DTC_H
+#define _DTC_H
+
+#include <vector>
+
+#include "ISO15765Proxy.h"
+#include "uds.h"
+
+#define UDS_READ_DTC_INFORMATION 0x19
+#define UDS_REPORT_DTC_BY_STATUS_MASK 0x02
+
+/*
+ * reportDTCByStatusMask of several targets, with their requests in flight at the same time. run() returns once
+ * every target answered, failed or timed out.
+ */
+class DtcReader {
+public:
+    DtcReader(Channel &channel, Clock &clock);
+    ~DtcReader();
+
+    // The clients and the targets are in the same order
+    void run(const std::vector<UdsClientPtr> &clients, const ISO15765_DTC_READ &read, ISO15765_DTC_LIST &list);
+
+private:
+    enum State {
+        WAITING = 0,
+        OUTSTANDING,
+        DONE
+    };
+
+    struct Target {
+        UdsClientPtr client;
+        ISO15765_DTC_TARGET *result;
+        State state;
+        Clock::time_point expiry;
+    };
+
+    void send(Target &target, uint8_t statusMask);
+    void dispatch(const PASSTHRU_MSG &msg, ISO15765_DTC_LIST &list);
+    void parse(Target &target, const uint8_t *data, size_t size, ISO15765_DTC_LIST &list);
+    void done(Target &target, unsigned long result);
+
+    Channel &mChannel;
+    Clock &mClock;
+    std::vector<Target> mTargets;
+    size_t mPending;
+    size_t mCapacity;
+    PASSTHRU_MSG mMessage;
+};
+
+#endif //_DTC_H
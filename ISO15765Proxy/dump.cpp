@@ -0,0 +1,159 @@
+#include "dump.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+#include "simple.h"
+
+#define CAN_SINGLE_FRAME_SIZE 7
+
+// SID and addressAndLengthFormatIdentifier
+#define READ_MEMORY_HEADER_SIZE 2
+
+#define MAX_FORMAT_LENGTH 4
+
+#define UDS_NRC_INCORRECT_MESSAGE_LENGTH 0x13
+#define UDS_NRC_RESPONSE_TOO_LONG 0x14
+#define UDS_NRC_BUSY_REPEAT_REQUEST 0x21
+#define UDS_NRC_REQUEST_OUT_OF_RANGE 0x31
+
+static bool fits(unsigned long value, size_t length) {
+    return length >= sizeof(value) || (value >> (8 * length)) == 0;
+}
+
+// Errors an ECU returns for a block longer than it accepts
+static bool isLengthError(uint8_t responseCode) {
+    return responseCode == UDS_NRC_INCORRECT_MESSAGE_LENGTH || responseCode == UDS_NRC_RESPONSE_TOO_LONG ||
+            responseCode == UDS_NRC_REQUEST_OUT_OF_RANGE;
+}
+
+MemoryDump::MemoryDump(UdsClient &client): mClient(client), mAddressLength(0), mSizeLength(0) {
+}
+
+MemoryDump::~MemoryDump() {
+}
+
+void MemoryDump::run(const ISO15765_MEMORY_DUMP &dump, ISO15765_MEMORY_DUMP_RESULT &result) {
+    memset(&result, 0, sizeof(result));
+    mAddressLength = dump.AddressAndLengthFormat & 0x0F;
+    mSizeLength = (dump.AddressAndLengthFormat >> 4) & 0x0F;
+    if(mAddressLength == 0 || mAddressLength > MAX_FORMAT_LENGTH || mSizeLength == 0 || mSizeLength > MAX_FORMAT_LENGTH) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    if(dump.MemorySize == 0 || dump.Offset > dump.MemorySize || dump.Pipeline > DUMP_MAX_PIPELINE ||
+            !fits(dump.MemoryAddress + (dump.MemorySize - 1), mAddressLength)) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    mFile.create(dump.FileName, dump.MemorySize);
+    try {
+        read(dump, result);
+        mFile.close();
+    } catch(J2534Exception &) {
+        result.ResponsePending = mClient.getResponsePending();
+        mFile.close();
+        throw;
+    }
+    result.ResponsePending = mClient.getResponsePending();
+}
+
+void MemoryDump::read(const ISO15765_MEMORY_DUMP &dump, ISO15765_MEMORY_DUMP_RESULT &result) {
+    size_t block = (dump.MaxBlockLength != 0) ? std::min<size_t>(dump.MaxBlockLength, DUMP_MAX_BLOCK_LENGTH) : DUMP_MAX_BLOCK_LENGTH;
+    if(!fits(block, mSizeLength)) {
+        block = (1UL << (8 * mSizeLength)) - 1;
+    }
+    // Only single frame requests are sent ahead: the flow control of a first frame would be mixed with the responses
+    size_t pipeline = std::max<size_t>(dump.Pipeline, 1);
+    if(READ_MEMORY_HEADER_SIZE + mAddressLength + mSizeLength > CAN_SINGLE_FRAME_SIZE) {
+        pipeline = 1;
+    }
+    unsigned long maxRetries = (dump.Retries != 0) ? dump.Retries : DUMP_DEFAULT_RETRIES;
+    unsigned long retries = 0;
+    bool confirmed = false;
+    unsigned long offset = dump.Offset;
+    size_t lengths[DUMP_MAX_PIPELINE];
+
+    while(offset < dump.MemorySize) {
+        size_t count = 0;
+        for(unsigned long next = offset; count < pipeline && next < dump.MemorySize; ++count) {
+            lengths[count] = std::min<size_t>(block, dump.MemorySize - next);
+            mClient.send(prepare(mRequests[count], dump.MemoryAddress + next, lengths[count]));
+            next += lengths[count];
+            result.Requests++;
+        }
+
+        // Responses in the order of the requests
+        uint8_t responseCode = 0;
+        bool timeout = false;
+        size_t received = 0;
+        for(; received < count; ++received) {
+            try {
+                responseCode = mClient.receive(UDS_READ_MEMORY_BY_ADDRESS, mResponse);
+            } catch(J2534Exception &exception) {
+                if(exception.code() != ERR_TIMEOUT) {
+                    throw;
+                }
+                timeout = true;
+                break;
+            }
+            if(responseCode != 0 || UdsClient::payloadSize(mResponse) != 1 + lengths[received]) {
+                break;
+            }
+            memcpy(mFile.data() + offset, UdsClient::payload(mResponse) + 1, lengths[received]);
+            offset += lengths[received];
+            result.BytesRead = offset;
+            confirmed = true;
+            retries = 0;
+        }
+        if(received == count) {
+            continue;
+        }
+        // The responses to the requests sent ahead of the failed one are dropped
+        for(size_t i = received + 1; i < count && !timeout; ++i) {
+            try {
+                mClient.receive(UDS_READ_MEMORY_BY_ADDRESS, mResponse);
+            } catch(J2534Exception &exception) {
+                if(exception.code() != ERR_TIMEOUT) {
+                    throw;
+                }
+                break;
+            }
+        }
+
+        if(isLengthError(responseCode) && !confirmed && block > 1) {
+            block = (block + 1) / 2;
+            continue;
+        }
+        if((timeout || responseCode == UDS_NRC_BUSY_REPEAT_REQUEST) && pipeline > 1) {
+            pipeline = 1;
+            continue;
+        }
+        // A range error with a block size already accepted is not retried
+        if(++retries > maxRetries || (isLengthError(responseCode) && confirmed)) {
+            result.BlockLength = block;
+            result.Pipeline = pipeline;
+            result.FailedAddress = dump.MemoryAddress + offset;
+            result.ResponseCode = responseCode;
+            throw J2534Exception(timeout ? ERR_TIMEOUT : ERR_FAILED);
+        }
+        result.Retries++;
+    }
+    result.BytesRead = offset;
+    result.BlockLength = block;
+    result.Pipeline = pipeline;
+}
+
+PASSTHRU_MSG &MemoryDump::prepare(PASSTHRU_MSG &msg, unsigned long address, size_t length) {
+    uint8_t request[READ_MEMORY_HEADER_SIZE + 2 * MAX_FORMAT_LENGTH];
+    size_t size = 0;
+    request[size++] = UDS_READ_MEMORY_BY_ADDRESS;
+    request[size++] = (mSizeLength << 4) | mAddressLength;
+    for(size_t i = mAddressLength; i > 0; --i) {
+        request[size++] = (address >> (8 * (i - 1))) & 0xFF;
+    }
+    for(size_t i = mSizeLength; i > 0; --i) {
+        request[size++] = (length >> (8 * (i - 1))) & 0xFF;
+    }
+    return mClient.prepare(msg, request, size);
+}
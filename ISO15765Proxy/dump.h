@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef _DUMP_H
+#define _DUMP_H
+
+#include "ISO15765Proxy.h"
+#include "mapped_file.h"
+#include "uds.h"
+
+#define UDS_READ_MEMORY_BY_ADDRESS 0x23
+
+#define DUMP_MAX_BLOCK_LENGTH (0xFFF - 1)
+#define DUMP_MAX_PIPELINE 4
+#define DUMP_DEFAULT_RETRIES 3
+
+/*
+ * Dump of a memory region with ReadMemoryByAddress, written in place in a mapped file. The responses do not echo the
+ * address, requests sent ahead are matched to the responses in order.
+ */
+class MemoryDump {
+public:
+    MemoryDump(UdsClient &client);
+    ~MemoryDump();
+
+    // Throw J2534Exception on failure, the result is filled in any case
+    void run(const ISO15765_MEMORY_DUMP &dump, ISO15765_MEMORY_DUMP_RESULT &result);
+
+private:
+    PASSTHRU_MSG &prepare(PASSTHRU_MSG &msg, unsigned long address, size_t length);
+    void read(const ISO15765_MEMORY_DUMP &dump, ISO15765_MEMORY_DUMP_RESULT &result);
+
+    UdsClient &mClient;
+    size_t mAddressLength;
+    size_t mSizeLength;
+    MappedFile mFile;
+    PASSTHRU_MSG mRequests[DUMP_MAX_PIPELINE];
+    PASSTHRU_MSG mResponse;
+};
+
+#endif //_DUMP_H
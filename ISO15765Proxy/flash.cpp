@@ -0,0 +1,186 @@
+#include "flash.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <string.h>
+
+#include "simple.h"
+#include "utils.h"
+
+#define J2534_DATA_OFFSET 4
+#define ISO15765_MAX_SIZE 0xFFF
+
+// SID and blockSequenceCounter of TransferData
+#define TRANSFER_DATA_HEADER_SIZE 2
+
+#define MAX_FORMAT_LENGTH 4
+
+static bool fits(unsigned long value, size_t length) {
+    return length >= sizeof(value) || (value >> (8 * length)) == 0;
+}
+
+FlashDownload::FlashDownload(UdsClient &client): mClient(client), mService(0), mResponseCode(0), mData(NULL), mRemaining(0),
+        mChecked(0), mMapping(NULL), mReleased(NULL) {
+}
+
+FlashDownload::~FlashDownload() {
+}
+
+void FlashDownload::setMapping(const MappedFile *mapping) {
+    mMapping = mapping;
+}
+
+void FlashDownload::run(const ISO15765_FLASH_DOWNLOAD &download, ISO15765_FLASH_RESULT &result) {
+    memset(&result, 0, sizeof(result));
+    if(download.Data == NULL || download.MemorySize == 0 || !Checksum::isValid(download.ChecksumType)) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    // The ECU only decompresses with a compressionMethod
+    if(download.Compression > ISO15765_COMPRESSION_LZSS ||
+            (download.Compression != ISO15765_COMPRESSION_NONE && (download.DataFormat & 0xF0) == 0)) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    try {
+        size_t blockLength = requestDownload(download);
+        result.BlockLength = blockLength;
+        transferData(download, blockLength, result);
+        requestTransferExit();
+        result.ResponsePending = mClient.getResponsePending();
+    } catch(J2534Exception &) {
+        result.ResponsePending = mClient.getResponsePending();
+        result.FailedService = mService;
+        result.ResponseCode = mResponseCode;
+        throw;
+    }
+}
+
+size_t FlashDownload::requestDownload(const ISO15765_FLASH_DOWNLOAD &download) {
+    size_t addressLength = download.AddressAndLengthFormat & 0x0F;
+    size_t sizeLength = (download.AddressAndLengthFormat >> 4) & 0x0F;
+    if(addressLength == 0 || addressLength > MAX_FORMAT_LENGTH || sizeLength == 0 || sizeLength > MAX_FORMAT_LENGTH) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    if(!fits(download.MemoryAddress, addressLength) || !fits(download.MemorySize, sizeLength)) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    uint8_t request[3 + 2 * MAX_FORMAT_LENGTH];
+    size_t size = 0;
+    request[size++] = UDS_REQUEST_DOWNLOAD;
+    request[size++] = download.DataFormat & 0xFF;
+    request[size++] = download.AddressAndLengthFormat & 0xFF;
+    for(size_t i = addressLength; i > 0; --i) {
+        request[size++] = (download.MemoryAddress >> (8 * (i - 1))) & 0xFF;
+    }
+    for(size_t i = sizeLength; i > 0; --i) {
+        request[size++] = (download.MemorySize >> (8 * (i - 1))) & 0xFF;
+    }
+
+    mService = UDS_REQUEST_DOWNLOAD;
+    check(mClient.request(request, size, mResponse));
+
+    // lengthFormatIdentifier then maxNumberOfBlockLength, which counts the SID and the blockSequenceCounter
+    const uint8_t *data = UdsClient::payload(mResponse);
+    size_t responseSize = UdsClient::payloadSize(mResponse);
+    size_t lengthLength = (responseSize >= 2) ? (data[1] >> 4) : 0;
+    if(lengthLength == 0 || lengthLength > MAX_FORMAT_LENGTH || responseSize < 2 + lengthLength) {
+        throw J2534Exception(ERR_FAILED);
+    }
+    size_t blockLength = 0;
+    for(size_t i = 0; i < lengthLength; ++i) {
+        blockLength = (blockLength << 8) | data[2 + i];
+    }
+
+    blockLength = std::min<size_t>(blockLength, ISO15765_MAX_SIZE);
+    if(download.MaxBlockLength != 0) {
+        blockLength = std::min<size_t>(blockLength, download.MaxBlockLength);
+    }
+    if(blockLength <= TRANSFER_DATA_HEADER_SIZE) {
+        throw J2534Exception(ERR_FAILED);
+    }
+    return blockLength;
+}
+
+void FlashDownload::transferData(const ISO15765_FLASH_DOWNLOAD &download, size_t blockLength, ISO15765_FLASH_RESULT &result) {
+    const size_t chunk = blockLength - TRANSFER_DATA_HEADER_SIZE;
+    mData = download.Data;
+    mRemaining = download.MemorySize;
+    mChecked = 0;
+    mReleased = download.Data;
+    if(download.Compression == ISO15765_COMPRESSION_LZSS) {
+        // This thread sends, the others compress
+        size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency()) - 1;
+        mCompressor = std::make_unique<LzssCompressor>(download.Data, download.MemorySize, std::max<size_t>(1, threads));
+    }
+
+    mService = UDS_TRANSFER_DATA;
+    PASSTHRU_MSG *current = &mBlocks[0];
+    PASSTHRU_MSG *next = &mBlocks[1];
+    uint8_t sequence = 1;
+    Checksum checksum(download.ChecksumType);
+    size_t currentSize = prepareBlock(*current, sequence, chunk, checksum);
+    while(currentSize > 0) {
+        mClient.send(*current);
+
+        // Build the next block while this one is processed by the ECU
+        uint8_t nextSequence = sequence + 1;
+        size_t nextSize = prepareBlock(*next, nextSequence, chunk, checksum);
+
+        check(mClient.receive(UDS_TRANSFER_DATA, mResponse));
+        if(UdsClient::payloadSize(mResponse) < 2 || UdsClient::payload(mResponse)[1] != sequence) {
+            throw J2534Exception(ERR_FAILED);
+        }
+        result.BytesTransferred += currentSize;
+        result.BlockCount++;
+
+        std::swap(current, next);
+        sequence = nextSequence;
+        currentSize = nextSize;
+    }
+    result.Checksum = checksum.value();
+}
+
+void FlashDownload::requestTransferExit() {
+    const uint8_t request[] = {UDS_REQUEST_TRANSFER_EXIT};
+    mService = UDS_REQUEST_TRANSFER_EXIT;
+    check(mClient.request(request, sizeof(request), mResponse));
+}
+
+size_t FlashDownload::prepareBlock(PASSTHRU_MSG &msg, uint8_t sequence, size_t chunk, Checksum &checksum) {
+    uint8_t *data = &msg.Data[J2534_DATA_OFFSET + TRANSFER_DATA_HEADER_SIZE];
+    size_t size;
+    if(mCompressor) {
+        size = mCompressor->read(data, chunk);
+        // The checksum is of the image, not of the compressed stream
+        size_t consumed = mCompressor->consumed();
+        checksum.update(mData + mChecked, consumed - mChecked);
+        mChecked = consumed;
+    } else {
+        size = std::min(chunk, mRemaining);
+        memcpy(data, mData, size);
+        checksum.update(mData, size);
+        mData += size;
+        mRemaining -= size;
+    }
+    if(mMapping != NULL) {
+        // The image before done is in the blocks already
+        const uint8_t *done = mCompressor ? mData + mChecked : mData;
+        mMapping->release(mReleased, done);
+        mReleased = done;
+    }
+    if(size == 0) {
+        return 0;
+    }
+    mClient.prepare(msg, NULL, TRANSFER_DATA_HEADER_SIZE + size);
+    msg.Data[J2534_DATA_OFFSET] = UDS_TRANSFER_DATA;
+    msg.Data[J2534_DATA_OFFSET + 1] = sequence;
+    return size;
+}
+
+void FlashDownload::check(uint8_t responseCode) {
+    if(responseCode != 0) {
+        mResponseCode = responseCode;
+        throw J2534Exception(ERR_FAILED);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#ifndef _FLASH_H
+#define _FLASH_H
+
+#include <memory>
+
+#include "ISO15765Proxy.h"
+#include "checksum.h"
+#include "lzss.h"
+#include "mapped_file.h"
+#include "uds.h"
+
+#define UDS_REQUEST_DOWNLOAD 0x34
+#define UDS_TRANSFER_DATA 0x36
+#define UDS_REQUEST_TRANSFER_EXIT 0x37
+
+/*
+ * Download of a memory region: RequestDownload, one TransferData per maxNumberOfBlockLength, RequestTransferExit.
+ * UDS allows a single outstanding request, so the pipelining happens on the tester side: the next TransferData is
+ * built while the ECU processes the current one, and no call goes back to the application between blocks. The checksum
+ * of the image is updated as each block is built, rather than in a second pass over the image. Compressed downloads
+ * take their blocks from an LzssCompressor, which compresses the image ahead on worker threads.
+ */
+class FlashDownload {
+public:
+    FlashDownload(UdsClient &client);
+    ~FlashDownload();
+
+    // Throw J2534Exception on failure, the result is filled in any case
+    void run(const ISO15765_FLASH_DOWNLOAD &download, ISO15765_FLASH_RESULT &result);
+
+    // Data is in this mapping: the pages sent are dropped from the working set
+    void setMapping(const MappedFile *mapping);
+
+private:
+    size_t requestDownload(const ISO15765_FLASH_DOWNLOAD &download);
+    void transferData(const ISO15765_FLASH_DOWNLOAD &download, size_t blockLength, ISO15765_FLASH_RESULT &result);
+    void requestTransferExit();
+    size_t prepareBlock(PASSTHRU_MSG &msg, uint8_t sequence, size_t chunk, Checksum &checksum);
+    void check(uint8_t responseCode);
+
+    UdsClient &mClient;
+    uint8_t mService;
+    uint8_t mResponseCode;
+    const uint8_t *mData;
+    size_t mRemaining;
+    std::unique_ptr<LzssCompressor> mCompressor;
+    size_t mChecked;
+    const MappedFile *mMapping;
+    const uint8_t *mReleased;
+    PASSTHRU_MSG mBlocks[2];
+    PASSTHRU_MSG mResponse;
+};
+
+#endif //_FLASH_H
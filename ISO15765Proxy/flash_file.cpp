@@ -0,0 +1,59 @@
+#include "flash_file.h"
+
+#include <string.h>
+
+#include "flash.h"
+#include "simple.h"
+
+FlashFile::FlashFile(UdsClient &client): mClient(client) {
+}
+
+FlashFile::~FlashFile() {
+}
+
+void FlashFile::run(const ISO15765_FLASH_FILE &flashFile, ISO15765_FLASH_FILE_RESULT &result) {
+    memset(&result, 0, sizeof(result));
+    if(flashFile.NumOfRegions == 0) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    mFile.open(flashFile.FileName);
+
+    // All the regions are checked before the first download
+    for(unsigned long i = 0; i < flashFile.NumOfRegions; ++i) {
+        const ISO15765_FLASH_REGION &region = flashFile.RegionPtr[i];
+        if(region.FileOffset >= mFile.size() || region.Size > mFile.size() - region.FileOffset) {
+            throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+        }
+    }
+
+    for(unsigned long i = 0; i < flashFile.NumOfRegions; ++i) {
+        ISO15765_FLASH_REGION &region = flashFile.RegionPtr[i];
+        ISO15765_FLASH_DOWNLOAD download = flashFile.Download;
+        download.MemoryAddress = region.MemoryAddress;
+        download.MemorySize = (region.Size != 0) ? region.Size : mFile.size() - region.FileOffset;
+        download.Data = mFile.data() + region.FileOffset;
+
+        ISO15765_FLASH_RESULT flash;
+        FlashDownload engine(mClient);
+        engine.setMapping(&mFile);
+        try {
+            engine.run(download, flash);
+        } catch(J2534Exception &) {
+            result.Flash.BytesTransferred += flash.BytesTransferred;
+            result.Flash.BlockCount += flash.BlockCount;
+            result.Flash.BlockLength = flash.BlockLength;
+            result.Flash.ResponsePending = flash.ResponsePending;
+            result.Flash.FailedService = flash.FailedService;
+            result.Flash.ResponseCode = flash.ResponseCode;
+            mFile.close();
+            throw;
+        }
+        region.Checksum = flash.Checksum;
+        result.Flash.BytesTransferred += flash.BytesTransferred;
+        result.Flash.BlockCount += flash.BlockCount;
+        result.Flash.BlockLength = flash.BlockLength;
+        result.Flash.ResponsePending = flash.ResponsePending;
+        result.Regions++;
+    }
+    mFile.close();
+}
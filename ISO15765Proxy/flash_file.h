@@ -0,0 +1,26 @@
+#pragma once
+
+#ifndef _FLASH_FILE_H
+#define _FLASH_FILE_H
+
+#include "ISO15765Proxy.h"
+#include "mapped_file.h"
+#include "uds.h"
+
+/*
+ * Download of the regions of a mapped image file, one FlashDownload per region
+ */
+class FlashFile {
+public:
+    FlashFile(UdsClient &client);
+    ~FlashFile();
+
+    // Throw J2534Exception on failure, the result is filled in any case
+    void run(const ISO15765_FLASH_FILE &flashFile, ISO15765_FLASH_FILE_RESULT &result);
+
+private:
+    UdsClient &mClient;
+    MappedFile mFile;
+};
+
+#endif //_FLASH_FILE_H
@@ -0,0 +1,318 @@
+#include <vector>
+#include <chrono>
+#include <random>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "iso15765.h"
+#include "virtual_channel.h"
+#include "utils.h"
+
+/*
+ * Fuzz target for the ISO15765 layer: the input is decoded as a script of operations run against a ChannelISO15765
+ * on top of a ChannelVirtual. Built with -DUSE_LIBFUZZER it is a libFuzzer target, otherwise it has its own driver
+ * which replays files (AFL style, one input per file) or generates random inputs, and reports executions per second.
+ *
+ * Input: [BS][STmin] then operations, each starting with an opcode byte
+ *   0 frame:  [pid][size][delay][data...]      schedule a CAN frame of size (0-16) bytes
+ *   1 read:   [count][timeout]                  readMsgs of 1-3 messages
+ *   2 write:  [size hi][size lo][pid][flags][timeout] writeMsgs of one message
+ *   3 config: [BS][STmin]                       SET_CONFIG
+ *   4 filter: [type][pid]                       start a filter, or stop the last one
+ *   5 clear:                                    CLEAR_MSG_FILTERS
+ */
+
+#define J2534_DATA_OFFSET 4
+#define MAX_FRAME_SIZE 16
+#define MAX_WRITE_SIZE 4200
+#define MAX_READ_COUNT 3
+
+#define FUZZ_CHECK(x) if(!(x)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); abort(); }
+
+static const uint32_t fuzzPids[] = {0x7E8, 0x7E9, 0x7E0, 0x123};
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+class FuzzInput {
+public:
+    FuzzInput(const uint8_t *data, size_t size): mData(data), mSize(size), mOffset(0) {
+    }
+
+    bool empty() const {
+        return mOffset >= mSize;
+    }
+
+    uint8_t next() {
+        return (mOffset < mSize) ? mData[mOffset++] : 0;
+    }
+
+private:
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mOffset;
+};
+
+static void setConfig(const ChannelPtr &channel, unsigned long bs, unsigned long stmin) {
+    SCONFIG CfgItem[2];
+    SCONFIG_LIST Input;
+    CfgItem[0].Parameter = ISO15765_BS;
+    CfgItem[0].Value = bs;
+    CfgItem[1].Parameter = ISO15765_STMIN;
+    CfgItem[1].Value = stmin;
+    Input.NumOfParams = 2;
+    Input.ConfigPtr = CfgItem;
+    channel->ioctl(SET_CONFIG, &Input, NULL);
+}
+
+static MessageFilterPtr startFilter(const ChannelPtr &channel, unsigned long type, uint32_t pid) {
+    PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+    memset(&maskMsg, 0, sizeof(maskMsg));
+    memset(&patternMsg, 0, sizeof(patternMsg));
+    memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+    maskMsg.DataSize = patternMsg.DataSize = flowControlMsg.DataSize = J2534_DATA_OFFSET;
+    pid2Data(0xFFFFFFFF, maskMsg.Data);
+    pid2Data(pid, patternMsg.Data);
+    pid2Data(pid ^ 0x8, flowControlMsg.Data);
+    return channel->startMsgFilter(type, &maskMsg, &patternMsg, &flowControlMsg);
+}
+
+static void checkMessages(const std::vector<PASSTHRU_MSG> &msgs, unsigned long requested, unsigned long count) {
+    FUZZ_CHECK(count <= requested);
+    for(unsigned long i = 0; i < count; ++i) {
+        FUZZ_CHECK(msgs[i].ProtocolID == ISO15765);
+        FUZZ_CHECK(msgs[i].DataSize > J2534_DATA_OFFSET);
+        FUZZ_CHECK(msgs[i].DataSize <= J2534_DATA_OFFSET + 0xFFF);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    FuzzInput input(data, size);
+
+    VirtualClockPtr clock = std::make_shared<VirtualClock>();
+    ChannelVirtualPtr raw = std::make_shared<ChannelVirtual>(clock);
+    ChannelPtr channel = std::make_shared<ChannelISO15765>(ISO15765, nullptr, raw, clock);
+    uint8_t bs = input.next();
+    uint8_t stmin = input.next();
+    setConfig(channel, bs, stmin);
+    std::vector<MessageFilterPtr> filters;
+    filters.push_back(startFilter(channel, FLOW_CONTROL_FILTER, fuzzPids[0]));
+
+    while(!input.empty()) {
+        uint8_t op = input.next() % 6;
+        if(op == 0) {
+            PASSTHRU_MSG frame;
+            memset(&frame, 0, sizeof(frame));
+            frame.ProtocolID = CAN;
+            uint8_t pid = input.next();
+            frame.DataSize = input.next() % (MAX_FRAME_SIZE + 1);
+            uint8_t delay = input.next();
+            pid2Data(fuzzPids[pid % 4], frame.Data);
+            for(unsigned long i = J2534_DATA_OFFSET; i < frame.DataSize; ++i) {
+                frame.Data[i] = input.next();
+            }
+            raw->schedule(frame, std::chrono::microseconds(100 * delay));
+        } else if(op == 1) {
+            // Exactly sized output buffer, so that an overflow is caught by the sanitizers
+            unsigned long requested = 1 + input.next() % MAX_READ_COUNT;
+            unsigned long timeout = input.next();
+            std::vector<PASSTHRU_MSG> msgs(requested);
+            unsigned long count = requested;
+            channel->readMsgs(msgs.data(), &count, timeout);
+            checkMessages(msgs, requested, count);
+        } else if(op == 2) {
+            // The order of the bytes is fixed for the inputs to be replayed the same way
+            uint8_t high = input.next();
+            uint8_t low = input.next();
+            size_t length = ((high << 8) | low) % (MAX_WRITE_SIZE + 1);
+            uint8_t pid = input.next();
+            uint8_t flags = input.next();
+            unsigned long timeout = input.next();
+            std::unique_ptr<PASSTHRU_MSG> msg(new PASSTHRU_MSG());
+            msg->ProtocolID = ISO15765;
+            msg->TxFlags = (flags & 1) ? ISO15765_FRAME_PAD : 0;
+            msg->DataSize = std::min<size_t>(J2534_DATA_OFFSET + length, sizeof(msg->Data));
+            pid2Data(fuzzPids[pid % 4] ^ 0x8, msg->Data);
+            for(unsigned long i = J2534_DATA_OFFSET; i < msg->DataSize; ++i) {
+                msg->Data[i] = (uint8_t)i;
+            }
+            unsigned long count = 1;
+            channel->writeMsgs(msg.get(), &count, timeout);
+            FUZZ_CHECK(count <= 1);
+        } else if(op == 3) {
+            uint8_t bs = input.next();
+            uint8_t stmin = input.next();
+            setConfig(channel, bs, stmin);
+        } else if(op == 4) {
+            uint8_t type = input.next();
+            uint8_t pid = input.next();
+            if((type & 3) == 0 && !filters.empty()) {
+                channel->stopMsgFilter(filters.back());
+                filters.pop_back();
+            } else {
+                filters.push_back(startFilter(channel, (type & 1) ? FLOW_CONTROL_FILTER : PASS_FILTER, fuzzPids[pid % 4]));
+            }
+        } else {
+            channel->ioctl(CLEAR_MSG_FILTERS, NULL, NULL);
+            filters.clear();
+        }
+    }
+    return 0;
+}
+
+#ifndef USE_LIBFUZZER
+
+typedef std::chrono::steady_clock fuzz_clock;
+
+struct FuzzStats {
+    FuzzStats(): runs(0), bytes(0), start(fuzz_clock::now()) {
+    }
+
+    double elapsed() const {
+        return std::chrono::duration<double>(fuzz_clock::now() - start).count();
+    }
+
+    void print(const char *event) const {
+        double seconds = elapsed();
+        fprintf(stderr, "#%lu\t%s exec/s: %.0f bytes: %llu time: %.1fs\n", runs, event,
+                seconds > 0 ? runs / seconds : 0, bytes, seconds);
+    }
+
+    unsigned long runs;
+    unsigned long long bytes;
+    fuzz_clock::time_point start;
+};
+
+static void runOne(FuzzStats &stats, const uint8_t *data, size_t size) {
+    LLVMFuzzerTestOneInput(data, size);
+    stats.runs++;
+    stats.bytes += size;
+    // Progress on every power of two, as libFuzzer does
+    if((stats.runs & (stats.runs - 1)) == 0) {
+        stats.print("pulse");
+    }
+}
+
+static bool runFile(FuzzStats &stats, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return false;
+    }
+    std::vector<uint8_t> buffer;
+    uint8_t chunk[4096];
+    size_t len;
+    while((len = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        buffer.insert(buffer.end(), chunk, chunk + len);
+    }
+    fclose(file);
+    runOne(stats, buffer.data(), buffer.size());
+    return true;
+}
+
+static bool runPath(FuzzStats &stats, const char *path) {
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        fprintf(stderr, "Can't access %s\n", path);
+        return false;
+    }
+    if(!S_ISDIR(st.st_mode)) {
+        return runFile(stats, path);
+    }
+    DIR *dir = opendir(path);
+    if(dir == NULL) {
+        return false;
+    }
+    bool ret = true;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL) {
+        if(entry->d_name[0] == '.') {
+            continue;
+        }
+        std::string child = std::string(path) + "/" + entry->d_name;
+        ret &= runPath(stats, child.c_str());
+    }
+    closedir(dir);
+    return ret;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--runs N] [--max-len N] [--max-time S] [--seed N] [--verbose] [FILE|DIR...]\n", name);
+    fprintf(stderr, "  Replays the given inputs, or runs random inputs when none is given\n");
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long runs = 100000;
+    unsigned long maxLen = 256;
+    unsigned long maxTime = 0;
+    unsigned long seed = 1;
+    bool verbose = false;
+    std::vector<const char *> paths;
+
+    for(int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if(strcmp(arg, "--verbose") == 0) {
+            verbose = true;
+        } else if(strncmp(arg, "--", 2) == 0) {
+            if(i + 1 >= argc) {
+                usage(argv[0]);
+                return -1;
+            }
+            unsigned long value = strtoul(argv[++i], NULL, 0);
+            if(strcmp(arg, "--runs") == 0) {
+                runs = value;
+            } else if(strcmp(arg, "--max-len") == 0) {
+                maxLen = value;
+            } else if(strcmp(arg, "--max-time") == 0) {
+                maxTime = value;
+            } else if(strcmp(arg, "--seed") == 0) {
+                seed = value;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    // The ISO15765 layer traces to stdout
+    if(!verbose && freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Can't silence stdout\n");
+    }
+
+    FuzzStats stats;
+    if(!paths.empty()) {
+        for(const char *path: paths) {
+            if(!runPath(stats, path)) {
+                return -1;
+            }
+        }
+    } else {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> buffer(maxLen);
+        for(unsigned long i = 0; i < runs; ++i) {
+            size_t len = random() % (maxLen + 1);
+            for(size_t j = 0; j < len; ++j) {
+                buffer[j] = (uint8_t)random();
+            }
+            runOne(stats, buffer.data(), len);
+            if(maxTime != 0 && stats.elapsed() >= maxTime) {
+                break;
+            }
+        }
+    }
+    stats.print("DONE");
+    return 0;
+}
+
+#endif //USE_LIBFUZZER
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 
 #include "internal.h"
+#include "pool.h"
 #include <stdio.h>
 
 /*
@@ -23,4 +24,12 @@ PeriodicMessage::~PeriodicMessage() {
 }
 
 Configuration::~Configuration() {
-}
\ No newline at end of file
+}
+
+void *Configuration::operator new(size_t size) {
+    return poolAllocate(size);
+}
+
+void Configuration::operator delete(void *ptr, size_t size) {
+    poolDeallocate(ptr, size);
+}
@@ -3,7 +3,10 @@
 #ifndef _INTERNAL_H_H
 #define _INTERNAL_H_H
 
+#include <stddef.h>
+
 #include "j2534_v0404.h"
+#include "registry.h"
 #include "utils.h"
 
 DEFINE_SHARED(PeriodicMessage)
@@ -16,6 +19,11 @@ class Configuration {
 public:
     virtual ~Configuration();
 
+    // Created with every channel, from the pool
+    static void *operator new(size_t size);
+
+    static void operator delete(void *ptr, size_t size);
+
     virtual bool getValue(unsigned long config, unsigned long *value) const = 0;
 
     virtual bool setValue(unsigned long config, unsigned long value) = 0;
@@ -32,7 +40,7 @@ public:
     virtual void getLastError(char *pErrorDescription) = 0;
 };
 
-class Device : public std::enable_shared_from_this<Device> {
+class Device : public std::enable_shared_from_this<Device>, public RegistryEntry {
 public:
     virtual ~Device() = 0;
 
@@ -49,7 +57,7 @@ public:
     virtual LibraryWeakPtr getLibrary() const = 0;
 };
 
-class Channel : public std::enable_shared_from_this<Channel> {
+class Channel : public std::enable_shared_from_this<Channel>, public RegistryEntry {
 public:
     virtual ~Channel() = 0;
 
@@ -70,14 +78,14 @@ public:
     virtual DeviceWeakPtr getDevice() const = 0;
 };
 
-class MessageFilter : public std::enable_shared_from_this<MessageFilter> {
+class MessageFilter : public std::enable_shared_from_this<MessageFilter>, public RegistryEntry {
 public:
     virtual ~MessageFilter() = 0;
     
     virtual ChannelWeakPtr getChannel() const = 0;
 };
 
-class PeriodicMessage : public std::enable_shared_from_this<PeriodicMessage> {
+class PeriodicMessage : public std::enable_shared_from_this<PeriodicMessage>, public RegistryEntry {
 public:
     virtual ~PeriodicMessage() = 0;
     
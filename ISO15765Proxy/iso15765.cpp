@@ -1,10 +1,19 @@
 #include "iso15765.h"
 #include <chrono>
-#include <thread>
 #include <algorithm>
 
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
+#include "delta.h"
+#include "dtc.h"
+#include "dump.h"
+#include "flash.h"
+#include "flash_file.h"
+#include "pool.h"
+#include "scan.h"
+#include "simple.h"
 #include "utils.h"
 
 #define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
@@ -21,7 +30,7 @@ LibraryISO15765::~LibraryISO15765() {
 DevicePtr LibraryISO15765::open(void *pName) {
     DevicePtr ret = mLibrary->open(pName);
     ret = std::make_shared<DeviceISO15765>(std::static_pointer_cast<LibraryISO15765>(shared_from_this()), ret);
-    mDevices.push_back(ret);
+    mDevices.add(ret);
     return ret;
 }
 
@@ -48,8 +57,8 @@ ChannelPtr DeviceISO15765::connect(unsigned long ProtocolID, unsigned long Flags
     if (IS_ISO15765(ProtocolID)) {
         rpid--; // USE CAN instead
     }
-    ChannelISO15765Ptr ret = std::make_shared<ChannelISO15765>(ProtocolID, std::static_pointer_cast<DeviceISO15765>(shared_from_this()), mDevice->connect(rpid, Flags, BaudRate));
-    mChannels.push_back(ret);
+    ChannelISO15765Ptr ret = makePooled<ChannelISO15765>(ProtocolID, std::static_pointer_cast<DeviceISO15765>(shared_from_this()), mDevice->connect(rpid, Flags, BaudRate));
+    mChannels.add(ret);
     return ret;
 }
 
@@ -91,14 +100,44 @@ static uint32_t data2pid(const uint8_t *data) {
     return pid;
 }
 
-static void pid2Data(uint32_t pid, uint8_t *data) {
-    data[0] = (0x1F & (pid >> 24));
-    data[1] = (0xFF & (pid >> 16));
-    data[2] = (0xFF & (pid >> 8));
-    data[3] = (0xFF & (pid >> 0));
+// Filter and periodic messages are single frames, their definition fits a snapshot
+static void toSnapshotMsg(const PASSTHRU_MSG *msg, ISO15765_SNAPSHOT_MSG &snapshotMsg) {
+    memset(&snapshotMsg, 0, sizeof(snapshotMsg));
+    if(msg == NULL) {
+        return;
+    }
+    if(msg->DataSize > sizeof(snapshotMsg.Data)) {
+        throw J2534Exception(ERR_INVALID_MSG);
+    }
+    snapshotMsg.ProtocolID = msg->ProtocolID;
+    snapshotMsg.RxStatus = msg->RxStatus;
+    snapshotMsg.TxFlags = msg->TxFlags;
+    snapshotMsg.DataSize = msg->DataSize;
+    memcpy(snapshotMsg.Data, msg->Data, msg->DataSize);
+}
+
+static void checkSnapshotMsg(const ISO15765_SNAPSHOT_MSG &snapshotMsg) {
+    if(snapshotMsg.DataSize > sizeof(snapshotMsg.Data)) {
+        throw J2534Exception(ERR_INVALID_MSG);
+    }
 }
 
-TransferISO15765::TransferISO15765(Configuration &configuration, Channel &channel, const PASSTHRU_MSG &pMaskMsg, const PASSTHRU_MSG &pPatternMsg, const PASSTHRU_MSG &pFlowControlMsg): mChannelConfiguration(configuration), mChannel(channel), mState(START_STATE) {
+static void fromSnapshotMsg(const ISO15765_SNAPSHOT_MSG &snapshotMsg, PASSTHRU_MSG &msg) {
+    checkSnapshotMsg(snapshotMsg);
+    memset(&msg, 0, offsetof(PASSTHRU_MSG, Data));
+    msg.ProtocolID = snapshotMsg.ProtocolID;
+    msg.RxStatus = snapshotMsg.RxStatus;
+    msg.TxFlags = snapshotMsg.TxFlags;
+    msg.DataSize = snapshotMsg.DataSize;
+    msg.ExtraDataIndex = snapshotMsg.DataSize;
+    memcpy(msg.Data, snapshotMsg.Data, snapshotMsg.DataSize);
+}
+
+static long remainingTime(Clock &clock, const Clock::time_point &deadline) {
+    return (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock.now())).count();
+}
+
+TransferISO15765::TransferISO15765(Configuration &configuration, Channel &channel, Clock &clock, const BufferPoolPtr &pool, const PASSTHRU_MSG &pMaskMsg, const PASSTHRU_MSG &pPatternMsg, const PASSTHRU_MSG &pFlowControlMsg): mChannel(channel), mClock(clock), mReceiver(configuration, pool, data2pid(pFlowControlMsg.Data)) {
     mMaskPid = data2pid(pMaskMsg.Data);
     mPatternPid = data2pid(pPatternMsg.Data);
     mFlowControlPid = data2pid(pFlowControlMsg.Data);
@@ -106,225 +145,98 @@ TransferISO15765::TransferISO15765(Configuration &configuration, Channel &channe
 }
 
 TransferISO15765::~TransferISO15765() {
-    
+    clear();
 }
 
 void TransferISO15765::clear() {
-    mState = START_STATE;
-    mOffset = 0;
-    mSequence = 0;
-    mBs = 0;
-    mStmin = 0;
+    mSender.clear();
+    mReceiver.clear();
 }
 
-#define IS_SF(d) (((d & 0xF0) >> 4) == 0)
-#define IS_FF(d) (((d & 0xF0) >> 4) == 1)
-#define IS_CF(d) (((d & 0xF0) >> 4) == 2)
-#define IS_FC(d) (((d & 0xF0) >> 4) == 3)
-#define GET_MS(d) (d & 0x0F)
-
 #define J2534_DATA_OFFSET 4
-#define CAN_DATA_SIZE 8
-#define J2534_PCI_SIZE 1
-#define J2534_LENGTH_SIZE 1
-#define J2534_BS_SIZE 1
-#define J2534_STMIN_SIZE 1
-
-TransferISO15765::PCIFrameName TransferISO15765::getFrameName(uint8_t pci) {
-    if(IS_SF(pci)) {
-        return SingleFrame;
-    } else if(IS_FF(pci)) {
-        return FirstFrame;
-    } else if(IS_CF(pci)) {
-        return ConsecutiveFrame;
-    } else if(IS_FC(pci)) {
-        return FlowControl;
-    } else {
-        return UnknownFrame;
-    }
-}
+#define ISO15765_MAX_SIZE 0xFFF
+#define ISO15765_MAX_DEFERRED_MSGS 64
 
-uint8_t TransferISO15765::getPci(PCIFrameName frameName) {
-    if(frameName == SingleFrame) {
-        return (0x0 << 4);
-    } else if(frameName == FirstFrame) {
-        return (0x1 << 4);
-    } else if(frameName == ConsecutiveFrame) {
-        return (0x2 << 4);
-    } else if(frameName == FlowControl) {
-        return (0x3 << 4);
-    } else {
-        return (0xf << 4);
-    }
+// Only the used bytes of the PASSTHRU_MSG on the stack are touched
+bool TransferISO15765::writeFrame(const CanFrame &frame, unsigned long Timeout) {
+    PASSTHRU_MSG msg;
+    frameToMsg(frame, msg);
+    unsigned long count = 1;
+    mChannel.writeMsgs(&msg, &count, Timeout);
+    return count == 1;
 }
 
-size_t TransferISO15765::getRemainingSize(const PASSTHRU_MSG &msg, off_t offset) {
-    size_t ret = msg.DataSize - offset;
-    if(ret > 7) {
-        ret = 7;
+bool TransferISO15765::readFrame(CanFrame &frame, unsigned long Timeout) {
+    PASSTHRU_MSG msg;
+    unsigned long count = 1;
+    mChannel.readMsgs(&msg, &count, Timeout);
+    if(count != 1) {
+        return false;
     }
-    return ret;
-}
-
-void TransferISO15765::prepareSentMessageHeaders(PASSTHRU_MSG &out_msg, const PASSTHRU_MSG &in_msg) {
-    out_msg.ProtocolID = CAN;
-    out_msg.RxStatus = 0;
-    out_msg.TxFlags = in_msg.TxFlags & ~(ISO15765_FRAME_PAD|ISO15765_ADDR_TYPE);
-    out_msg.Timestamp = 0;
-    out_msg.DataSize = 0;
-    out_msg.ExtraDataIndex = 0;
-    
-    // Copy the PID
-    memcpy(&(out_msg.Data[0]), &(in_msg.Data[0]), J2534_DATA_OFFSET);
-}
-
-void TransferISO15765::prepareReceivedMessageHeaders(PASSTHRU_MSG &out_msg, const PASSTHRU_MSG &in_msg) {
-    out_msg.ProtocolID = ISO15765;
-    out_msg.RxStatus = 0;
-    out_msg.TxFlags = 0;
-    out_msg.Timestamp = 0;
-    out_msg.DataSize = 0;
-    out_msg.ExtraDataIndex = 0;
-    
-    // Copy the PID
-    memcpy(&(out_msg.Data[0]), &(in_msg.Data[0]), J2534_DATA_OFFSET);
-}
-
-void TransferISO15765::paddingMessage(PASSTHRU_MSG &smsg) {
-    for(int i = smsg.DataSize; i < CAN_DATA_SIZE + J2534_DATA_OFFSET; ++i) {
-        smsg.Data[i] = '\0';
+    if(!msgToFrame(msg, frame)) {
+        LOG_DEBUG("Invalid frame size");
+        return false;
     }
-    smsg.DataSize = CAN_DATA_SIZE + J2534_DATA_OFFSET;
+    return true;
 }
 
 bool TransferISO15765::writeMsg(const PASSTHRU_MSG &msg, unsigned long Timeout) {
-    PASSTHRU_MSG &tmp_msg = mMessage;
+    CanFrame frame;
+    bool first = true;
     
     // Set Deadline
-    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+    Clock::time_point deadline = mClock.now() + std::chrono::milliseconds(Timeout);
     
     try {
         // Sanity checks
-        if(msg.DataSize < J2534_DATA_OFFSET) {
+        if(msg.DataSize <= J2534_DATA_OFFSET || msg.DataSize > J2534_DATA_OFFSET + ISO15765_MAX_SIZE) {
             LOG_DEBUG("Invalid size");
             goto fail;
         }
         
-        if(mState != START_STATE) {
+        if(mReceiver.isReceiving() || !mSender.start(data2pid(msg.Data), msg.TxFlags, &msg.Data[J2534_DATA_OFFSET], msg.DataSize - J2534_DATA_OFFSET)) {
             LOG_DEBUG("Wrong state");
             goto fail;
         }
     
-        while(msg.DataSize > (size_t)mOffset) {
-            Timeout = (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now())).count();
-            if(Timeout <= 0) {
-                goto fail;
+        while(true) {
+            SenderISO15765::Status status = mSender.getStatus(mClock.now());
+            if(status == SenderISO15765::DONE) {
+                break;
             }
-            
-            if(mState == START_STATE) {
-                mOffset = J2534_DATA_OFFSET;
-                prepareSentMessageHeaders(tmp_msg, msg);
-                
-                // Compute
-                PCIFrameName frameName = SingleFrame;
-                size_t size = getRemainingSize(msg, mOffset);
-                
-                if(size < (msg.DataSize - mOffset)) {
-                    frameName = FirstFrame;
-                }
-                
-                // Fill the buffer
-                if(frameName == FirstFrame) {
-                    size_t fullsize = msg.DataSize - mOffset;
-                    tmp_msg.Data[J2534_DATA_OFFSET] = (getPci(frameName) & 0xF0)| ((fullsize >> 8) & 0x0F);
-                    tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE] = (fullsize & 0xFF);
-                    size = CAN_DATA_SIZE - J2534_PCI_SIZE - J2534_LENGTH_SIZE;
-                    mSequence++;
-                    tmp_msg.DataSize = J2534_DATA_OFFSET + J2534_PCI_SIZE + J2534_LENGTH_SIZE + size;
-                    memcpy(&(tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE + J2534_LENGTH_SIZE]), &(msg.Data[mOffset]), size);
-                } else {
-                    tmp_msg.Data[J2534_DATA_OFFSET] = (getPci(frameName) & 0xF0)| (size & 0x0F);
-                    tmp_msg.DataSize = J2534_DATA_OFFSET + J2534_PCI_SIZE + size;
-                    memcpy(&(tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE]), &(msg.Data[mOffset]), size);
-                }
-                
-                mOffset += size;
-                
-                // Padding
-                if(msg.TxFlags & ISO15765_FRAME_PAD) {
-                    paddingMessage(tmp_msg);
-                }
-                
-                unsigned long count = 1;
-                mChannel.writeMsgs(&tmp_msg, &count, Timeout);
-                if(count != 1) {
-                    LOG_DEBUG("Can't write message %d", frameName);
+            if(status == SenderISO15765::WAIT_SEPARATION) {
+                mClock.sleepFor(mSender.getWakeUp() - mClock.now());
+                continue;
+            }
+
+            // A null timeout still sends the first frame, only the following steps need time
+            if(!first) {
+                long remaining = remainingTime(mClock, deadline);
+                if(remaining <= 0) {
                     goto fail;
                 }
-                mState = FLOW_CONTROL_STATE;
-            } else if (mState == FLOW_CONTROL_STATE) {
-                unsigned long count = 1;
-                mChannel.readMsgs(&tmp_msg, &count, Timeout);
-                if(count != 1) {
-                    LOG_DEBUG("Can't read flow control message");
+                Timeout = remaining;
+            }
+            first = false;
+            
+            if(status == SenderISO15765::SEND) {
+                mSender.next(frame, mClock.now());
+                if(!writeFrame(frame, Timeout)) {
+                    LOG_DEBUG("Can't write message");
                     goto fail;
                 }
-                if(tmp_msg.DataSize < J2534_DATA_OFFSET) {
-                    LOG_DEBUG("Invalid flow control message size");
+            } else if(status == SenderISO15765::WAIT_FLOW_CONTROL) {
+                if(!readFrame(frame, Timeout)) {
+                    LOG_DEBUG("Can't read flow control message");
                     goto fail;
                 }
-                if((data2pid(tmp_msg.Data) & mMaskPid) != mPatternPid) {
+                if((frame.id & mMaskPid) != mPatternPid) {
                     LOG_DEBUG("Incorrect PID");
                     goto fail;
                 }
-                PCIFrameName frameName = getFrameName(tmp_msg.Data[J2534_DATA_OFFSET]);
-                if(frameName != FlowControl) {
-                    LOG_DEBUG("Invalid frame type %d (Need %d)", frameName, FlowControl);
-                    goto fail;
-                }
-                
-                // Get block information
-                mBs = tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE];
-                mStmin = tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE + J2534_BS_SIZE];
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(mStmin));
-                
-                mState = BLOCK_STATE;
-            } else if (mState == BLOCK_STATE) {
-                prepareSentMessageHeaders(tmp_msg, msg);
-                
-                // Compute
-                PCIFrameName frameName = ConsecutiveFrame;
-                size_t size = getRemainingSize(msg, mOffset);
-                
-                // Fill the buffer
-                tmp_msg.Data[J2534_DATA_OFFSET] = (getPci(frameName) & 0xF0)| ((mSequence++) & 0x0F);
-                tmp_msg.DataSize = J2534_DATA_OFFSET + J2534_PCI_SIZE + size;
-                memcpy(&(tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE]), &(msg.Data[mOffset]), size);
-                
-                mOffset += size;
-                
-                // Padding
-                if(msg.TxFlags & ISO15765_FRAME_PAD) {
-                    paddingMessage(tmp_msg);
-                }
-                
-                // Write the message
-                unsigned long count = 1;
-                mChannel.writeMsgs(&tmp_msg, &count, Timeout);
-                if(count != 1) {
-                    LOG_DEBUG("Can't write message");
+                if(!mSender.onFlowControl(frame, mClock.now())) {
                     goto fail;
                 }
-                
-                // End of the block ?
-                if(--mBs == 0) {
-                    mState = FLOW_CONTROL_STATE;
-                }
-                
-                if(mState == BLOCK_STATE) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(mStmin));
-                }
             } else {
                 LOG_DEBUG("Wrong state");
                 goto fail;
@@ -342,113 +254,27 @@ bool TransferISO15765::writeMsg(const PASSTHRU_MSG &msg, unsigned long Timeout)
     }
 }
 
-bool TransferISO15765::readMsg(const PASSTHRU_MSG &in_msg, PASSTHRU_MSG &out_msg, unsigned long Timeout) {
-    PASSTHRU_MSG &tmp_msg = mMessage;
-    if(in_msg.DataSize < J2534_DATA_OFFSET) {
-        LOG_DEBUG("Invalid flow control message size");
-        goto fail;
-    }
-    if((data2pid(in_msg.Data) & mMaskPid) != mPatternPid) {
+bool TransferISO15765::readMsg(const CanFrame &frame, PASSTHRU_MSG &out_msg, unsigned long Timeout) {
+    CanFrame flowControl;
+    unsigned int events;
+    if((frame.id & mMaskPid) != mPatternPid) {
         LOG_DEBUG("Incorrect PID");
         goto fail;
     }
-    {
-        PCIFrameName frameName = getFrameName(in_msg.Data[J2534_DATA_OFFSET]);
-        if(mState == START_STATE) {
-            prepareReceivedMessageHeaders(tmp_msg, in_msg);
-            mOffset = J2534_DATA_OFFSET;
-            
-            if(frameName == SingleFrame) {
-                size_t size = in_msg.Data[J2534_DATA_OFFSET] & 0x0F;
-                tmp_msg.DataSize = J2534_DATA_OFFSET + size;
-                memcpy(&(tmp_msg.Data[mOffset]), &(in_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE]), size);
-                
-                mOffset += size;
-            } else if(frameName == FirstFrame) {
-                size_t fullsize = ((in_msg.Data[J2534_DATA_OFFSET] & 0x0F) << 8) | (in_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE] & 0xFF);
-                tmp_msg.DataSize = J2534_DATA_OFFSET + fullsize;
-                size_t size = CAN_DATA_SIZE - J2534_PCI_SIZE - J2534_LENGTH_SIZE;
-                memcpy(&(tmp_msg.Data[mOffset]), &(in_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE + J2534_LENGTH_SIZE]), size);
-                
-                mSequence++;
-                mOffset += size;
-                
-                if(!sendFlowControlMessage(Timeout)) {
-                    LOG_DEBUG("Can't send flow control message");
-                    goto fail;
-                }
-
-                mState = BLOCK_STATE;
-            } else {
-                LOG_DEBUG("Invalid frame type %d", frameName);
-                goto fail;
-            }
-        } else if(mState == BLOCK_STATE) {
-            unsigned int seq = (in_msg.Data[J2534_DATA_OFFSET]) & 0xF;
-            if (seq != (mSequence % 0x10)) {
-                LOG_DEBUG("Wrong sequence number %d (Need %d)", seq, mSequence);
-                goto fail;
-            }
-            
-            size_t size = getRemainingSize(tmp_msg, mOffset);
-            memcpy(&(tmp_msg.Data[mOffset]), &(in_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE]), size);
-            
-            mSequence++;
-            mOffset += size;
-            
-            if(--mBs == 0) {
-                if(!sendFlowControlMessage(Timeout)) {
-                    LOG_DEBUG("Can't send flow control message");
-                    goto fail;
-                }
-            }
-        } else {
-            LOG_DEBUG("Wrong state");
+    events = mReceiver.onFrame(frame, flowControl, out_msg);
+    if(events & ReceiverISO15765::FLOW_CONTROL) {
+        if(!writeFrame(flowControl, Timeout)) {
+            LOG_DEBUG("Can't send flow control message");
             goto fail;
         }
-        
-        if((size_t)mOffset >= tmp_msg.DataSize) {
-            memcpy(&out_msg, &tmp_msg, sizeof(PASSTHRU_MSG));
-            clear();
-            return true;
-        }
     }
-    return false;
+    return (events & ReceiverISO15765::COMPLETE) != 0;
     
 fail:
     clear();
     return false;
 }
 
-bool TransferISO15765::sendFlowControlMessage(unsigned long Timeout) {
-    PASSTHRU_MSG tmp_msg;
-    
-    mBs = 0;
-    mChannelConfiguration.getValue(ISO15765_BS, &mBs);
-    mStmin = 0;
-    mChannelConfiguration.getValue(ISO15765_STMIN, &mStmin);
-    
-    tmp_msg.ProtocolID = CAN;
-    tmp_msg.RxStatus = 0;
-    tmp_msg.TxFlags = 0;
-    tmp_msg.Timestamp = 0;
-    tmp_msg.DataSize = J2534_DATA_OFFSET + J2534_PCI_SIZE + J2534_BS_SIZE + J2534_STMIN_SIZE;
-    tmp_msg.ExtraDataIndex = 0;
-    
-    pid2Data(mFlowControlPid, tmp_msg.Data);
-    tmp_msg.Data[J2534_DATA_OFFSET] = getPci(FlowControl);
-    tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE] = mBs;
-    tmp_msg.Data[J2534_DATA_OFFSET + J2534_PCI_SIZE + J2534_BS_SIZE] = mStmin;
-    paddingMessage(tmp_msg);
-    
-    unsigned long count = 1;
-    mChannel.writeMsgs(&tmp_msg, &count, Timeout);
-    if(count != 1) {
-        return false;
-    }
-    return true;
-}
-
 uint32_t TransferISO15765::getMaskPid() {
     return mMaskPid;
 }
@@ -467,31 +293,34 @@ uint32_t TransferISO15765::getFlowControlPid() {
  *
  */
 
-ChannelISO15765::ChannelISO15765(unsigned long protocolId, const DeviceISO15765Ptr &device, const ChannelPtr &channel): ConfigurableChannel(ISO15765), mProtocolId(protocolId), mDevice(device), mChannel(channel) {
-    
+ChannelISO15765::ChannelISO15765(unsigned long protocolId, const DeviceISO15765Ptr &device, const ChannelPtr &channel, const ClockPtr &clock): ConfigurableChannel(ISO15765), mProtocolId(protocolId), mDevice(device), mChannel(channel), mClock(clock), mResponsePendingCount(0) {
+    mBufferPool = std::make_shared<BufferPool>();
 }
 
 ChannelISO15765::~ChannelISO15765() {
 }
 
 TransferISO15765Ptr ChannelISO15765::getTransferByFlowControl(const PASSTHRU_MSG &msg) {
-    uint32_t pid = data2pid(msg.Data);
-    auto it = std::find_if(mMessageFilters.begin(), mMessageFilters.end(), [&](const MessageFilterPtr &messageFilter) {
-        return std::static_pointer_cast<MessageFilterISO15765>(messageFilter)->getTransfer()->getFlowControlPid() == pid;
-    });
-    if (it != mMessageFilters.end())  {
-        return (std::static_pointer_cast<MessageFilterISO15765>(*it))->getTransfer();
+    return getTransferByFlowControl(data2pid(msg.Data));
+}
+
+// The filters are scanned for every frame: no shared_ptr copy until one matches
+TransferISO15765Ptr ChannelISO15765::getTransferByFlowControl(uint32_t pid) {
+    for(const MessageFilterPtr &messageFilter: mMessageFilters) {
+        const TransferISO15765Ptr &transfer = static_cast<MessageFilterISO15765 &>(*messageFilter).getTransfer();
+        if(transfer && transfer->getFlowControlPid() == pid) {
+            return transfer;
+        }
     }
     return nullptr;
 }
 
-TransferISO15765Ptr ChannelISO15765::getTransferByPattern(const PASSTHRU_MSG &msg) {
-    uint32_t pid = data2pid(msg.Data);
-    auto it = std::find_if(mMessageFilters.begin(), mMessageFilters.end(), [&](const MessageFilterPtr &messageFilter) {
-        return std::static_pointer_cast<MessageFilterISO15765>(messageFilter)->getTransfer()->getPatternPid() == (pid & std::static_pointer_cast<MessageFilterISO15765>(messageFilter)->getTransfer()->getMaskPid());
-    });
-    if (it != mMessageFilters.end())  {
-        return (std::static_pointer_cast<MessageFilterISO15765>(*it))->getTransfer();
+TransferISO15765Ptr ChannelISO15765::getTransferByPattern(uint32_t pid) {
+    for(const MessageFilterPtr &messageFilter: mMessageFilters) {
+        const TransferISO15765Ptr &transfer = static_cast<MessageFilterISO15765 &>(*messageFilter).getTransfer();
+        if(transfer && transfer->getPatternPid() == (pid & transfer->getMaskPid())) {
+            return transfer;
+        }
     }
     return nullptr;
 }
@@ -500,10 +329,18 @@ MessageFilterPtr ChannelISO15765::startMsgFilter(unsigned long FilterType, PASST
                                      PASSTHRU_MSG *pFlowControlMsg) {
     TransferISO15765Ptr transfer;
     MessageFilterPtr messageFilter;
+    ISO15765_SNAPSHOT_FILTER definition;
     if(FilterType == FLOW_CONTROL_FILTER && IS_ISO15765(mProtocolId)) {
         if (pMaskMsg == NULL || pPatternMsg == NULL || pFlowControlMsg == NULL) {
             return mChannel->startMsgFilter(PASS_FILTER, NULL, NULL, NULL);
         }
+    }
+    memset(&definition, 0, sizeof(definition));
+    definition.FilterType = FilterType;
+    toSnapshotMsg(pMaskMsg, definition.Mask);
+    toSnapshotMsg(pPatternMsg, definition.Pattern);
+    toSnapshotMsg(pFlowControlMsg, definition.FlowControl);
+    if(FilterType == FLOW_CONTROL_FILTER && IS_ISO15765(mProtocolId)) {
         PASSTHRU_MSG maskMsg = *pMaskMsg, patternMsg = *pPatternMsg;
         maskMsg.ProtocolID = patternMsg.ProtocolID = CAN;
         maskMsg.RxStatus &= ~(ISO15765_PADDING_ERROR | ISO15765_ADDR_TYPE);
@@ -512,58 +349,44 @@ MessageFilterPtr ChannelISO15765::startMsgFilter(unsigned long FilterType, PASST
         patternMsg.TxFlags &= ~(ISO15765_FRAME_PAD);
         
         messageFilter = mChannel->startMsgFilter(PASS_FILTER, &maskMsg, &patternMsg, NULL);
-        transfer = std::make_shared<TransferISO15765>(getConfiguration(), *mChannel, *pMaskMsg, *pPatternMsg, *pFlowControlMsg);
+        transfer = makePooled<TransferISO15765>(getConfiguration(), *mChannel, *mClock, mBufferPool, *pMaskMsg, *pPatternMsg, *pFlowControlMsg);
     } else {
         messageFilter = mChannel->startMsgFilter(FilterType, pMaskMsg, pPatternMsg, pFlowControlMsg);
     }
-    MessageFilterISO15765Ptr msf = std::make_shared<MessageFilterISO15765>(std::static_pointer_cast<ChannelISO15765>(shared_from_this()), messageFilter, transfer);
-    mMessageFilters.push_back(msf);
+    MessageFilterISO15765Ptr msf = makePooled<MessageFilterISO15765>(std::static_pointer_cast<ChannelISO15765>(shared_from_this()), messageFilter, transfer);
+    msf->setDefinition(definition);
+    mMessageFilters.add(msf);
     return msf;
 }
 
 void ChannelISO15765::stopMsgFilter(const MessageFilterPtr &messageFilter) {
+    MessageFilterISO15765Ptr msf = std::dynamic_pointer_cast<MessageFilterISO15765>(messageFilter);
     mMessageFilters.remove(messageFilter);
-    mChannel->stopMsgFilter(std::dynamic_pointer_cast<MessageFilterISO15765>(messageFilter)->mMessageFilter);
+    mChannel->stopMsgFilter(msf->mMessageFilter);
+
+    // The keepalive of the target went through the filter
+    TransferISO15765Ptr &transfer = msf->getTransfer();
+    if(mKeepAlive && transfer && mKeepAlive->contains(transfer->getFlowControlPid()) &&
+            !getTransferByFlowControl(transfer->getFlowControlPid())) {
+        mKeepAlive->stop(transfer->getFlowControlPid());
+    }
 }
 
 void ChannelISO15765::readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
     if (IS_ISO15765(mProtocolId)) {
         unsigned long count = 0;
         try {            
-            PASSTHRU_MSG readMsg;
-            
-            std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+            Clock::time_point deadline = mClock->now() + std::chrono::milliseconds(Timeout);
+            bool blocking = (Timeout != 0);
             for(unsigned long i = 0; i < *pNumMsgs; ++i) {
-                while(true) {                
-                    {
-                        unsigned long c = 1;
-                        mChannel->readMsgs(&readMsg, &c, Timeout);
-                        if (c != 1) {
-                            LOG_DEBUG("Can't read msg");
-                            goto end;
-                        }
-                    }
-
-                    // Get transfer
-                    auto transfer = getTransferByPattern(readMsg);
-                    if (transfer) {
-                        if(transfer->readMsg(readMsg, *pMsg, Timeout)) {
-                            count++;
-                            pMsg++;
-                            break;
-                        }
-                    } else {
-                        LOG_DEBUG("No matching transfer");
-                    }
-                    
-                    Timeout = (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now())).count();
-                    if(Timeout <= 0) {
-                        LOG_DEBUG("Timeout");
-                        goto end;
-                    }
+                // Messages put aside by a transaction, and requests answered from the cache, are ready
+                if(popMsg(*pMsg) || receiveMsg(*pMsg, deadline, blocking)) {
+                    count++;
+                    pMsg++;
+                } else {
+                    break;
                 }
             };
-end:
             *pNumMsgs = count;
         } catch(std::exception &ex) {
             *pNumMsgs = count;
@@ -574,33 +397,97 @@ end:
     }
 }
 
+bool ChannelISO15765::popMsg(PASSTHRU_MSG &msg) {
+    if(!mDeferredMsgs.empty()) {
+        msg = mDeferredMsgs.front();
+        mDeferredMsgs.pop_front();
+        return true;
+    }
+    return mRdbiCache && mRdbiCache->pop(msg);
+}
+
+bool ChannelISO15765::receiveMsg(PASSTHRU_MSG &msg, Clock::time_point &deadline, bool blocking) {
+    CanFrame frame;
+    while(true) {
+        long remaining = remainingTime(*mClock, deadline);
+        unsigned long Timeout = (remaining > 0) ? remaining : 0;
+        if (!readFrame(frame, Timeout)) {
+            LOG_DEBUG("Can't read msg");
+            return false;
+        }
+
+        // Get transfer
+        auto transfer = getTransferByPattern(frame.id);
+        if (transfer) {
+            if(transfer->readMsg(frame, msg, Timeout)) {
+                if(mRdbiCache) {
+                    mRdbiCache->received(msg);
+                }
+                if(absorbResponsePending(msg, blocking ? &deadline : NULL)) {
+                    LOG_DEBUG("Response pending");
+                } else if(!mKeepAlive || !mKeepAlive->isResponse(msg)) {
+                    return true;
+                }
+            }
+        } else {
+            LOG_DEBUG("No matching transfer");
+        }
+        
+        if(remainingTime(*mClock, deadline) <= 0) {
+            LOG_DEBUG("Timeout");
+            return false;
+        }
+    }
+}
+
 void ChannelISO15765::writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
     if (IS_ISO15765(mProtocolId)) {
         unsigned long count = 0;
         try {            
-            std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+            Clock::time_point deadline = mClock->now() + std::chrono::milliseconds(Timeout);
+            bool blocking = (Timeout != 0);
             for(unsigned long i = 0; i < *pNumMsgs; ++i) {            
                 PASSTHRU_MSG &msg = *(pMsg++);
                 auto transfer = getTransferByFlowControl(msg);
                 if (transfer) {
-                    if(transfer->writeMsg(msg, Timeout)) {
+                    if(mRdbiCache && mRdbiCache->lookup(transfer->getFlowControlPid(), msg)) {
                         count++;
                     } else {
-                        LOG_DEBUG("Can't write msg");
+                        if(mKeepAlive) {
+                            mKeepAlive->request(transfer->getFlowControlPid(), msg);
+                        }
+                        if(transfer->writeMsg(msg, Timeout)) {
+                            trackRequest(*transfer, msg);
+                            if(mRdbiCache) {
+                                mRdbiCache->sent(transfer->getFlowControlPid(), transfer->getPatternPid(), msg);
+                            }
+                            count++;
+                        } else {
+                            LOG_DEBUG("Can't write msg");
+                        }
                     }
                 } else {
                     LOG_DEBUG("Ignore msg");
                 }
                 
-                Timeout = (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now())).count();
-                if(Timeout <= 0) {
-                    goto end;
+                if(blocking) {
+                    long remaining = remainingTime(*mClock, deadline);
+                    if(remaining <= 0) {
+                        goto end;
+                    }
+                    Timeout = remaining;
                 }
             };
 end:
             *pNumMsgs = count;
+            if(mKeepAlive) {
+                mKeepAlive->resume();
+            }
         } catch(std::exception &ex) {
             *pNumMsgs = count;
+            if(mKeepAlive) {
+                mKeepAlive->resume();
+            }
             throw;
         }
     } else {
@@ -609,10 +496,18 @@ end:
 }
 
 PeriodicMessagePtr ChannelISO15765::startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) {
-    return mChannel->startPeriodicMsg(pMsg, TimeInterval);
+    Periodic periodic;
+    periodic.timeInterval = TimeInterval;
+    toSnapshotMsg(pMsg, periodic.msg);
+    periodic.message = mChannel->startPeriodicMsg(pMsg, TimeInterval);
+    mPeriodics.push_back(periodic);
+    return periodic.message;
 }
 
 void ChannelISO15765::stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) {
+    mPeriodics.erase(std::remove_if(mPeriodics.begin(), mPeriodics.end(), [&](const Periodic &periodic) {
+        return periodic.message == periodicMessage;
+    }), mPeriodics.end());
     mChannel->stopPeriodicMsg(periodicMessage);
 }
 
@@ -620,10 +515,16 @@ DeviceWeakPtr ChannelISO15765::getDevice() const {
     return mDevice;
 }
 
+// Parameters handled by the ISO15765 layer, not forwarded to the CAN channel
+static bool isLocalParameter(unsigned long parameter) {
+    return parameter == ISO15765_BS || parameter == ISO15765_STMIN || parameter == ISO15765_ADDR_TYPE ||
+            parameter == ISO15765_CONFIG_RESPONSE_PENDING || parameter == ISO15765_CONFIG_P2_STAR;
+}
+
 bool ChannelISO15765::getConfig(SCONFIG *config) const {
     ConfigurableChannel::getConfig(config);
     unsigned long parameter = config->Parameter;
-    if(parameter != ISO15765_BS && parameter != ISO15765_STMIN && parameter != ISO15765_ADDR_TYPE) {
+    if(!isLocalParameter(parameter)) {
         SCONFIG_LIST Input;
         Input.NumOfParams = 1;
         Input.ConfigPtr = config;
@@ -635,7 +536,10 @@ bool ChannelISO15765::getConfig(SCONFIG *config) const {
 bool ChannelISO15765::setConfig(SCONFIG *config) {
     ConfigurableChannel::setConfig(config);
     unsigned long parameter = config->Parameter;
-    if(parameter != ISO15765_BS && parameter != ISO15765_STMIN && parameter != ISO15765_ADDR_TYPE) {
+    if(parameter == ISO15765_CONFIG_RESPONSE_PENDING && config->Value == 0) {
+        mPendingRequests.clear();
+    }
+    if(!isLocalParameter(parameter)) {
         SCONFIG_LIST Input;
         Input.NumOfParams = 1;
         Input.ConfigPtr = config;
@@ -649,19 +553,525 @@ bool ChannelISO15765::clearTxBuffers() {
 }
 
 bool ChannelISO15765::clearRxBuffers() {
+    mDeferredMsgs.clear();
     return false;
 }
 
 bool ChannelISO15765::clearPeriodicMessages() {
-    return false;
+    // The keepalives are periodic messages of the CAN channel too, only the ones of the application are stopped
+    for(const Periodic &periodic: mPeriodics) {
+        mChannel->stopPeriodicMsg(periodic.message);
+    }
+    mPeriodics.clear();
+    return true;
 }
 
 bool ChannelISO15765::clearMessageFilters() {
     mMessageFilters.clear();
+    // The polled and kept alive targets were reached through the filters
+    mObdPoller = nullptr;
+    if(mKeepAlive) {
+        mKeepAlive->clear();
+        mKeepAlive = nullptr;
+    }
     return false;
 }
     
+UdsClientPtr ChannelISO15765::createUdsClient(unsigned long targetPid, unsigned long txFlags, unsigned long p2, unsigned long p2Star) {
+    // The responses come from the pattern of the filter whose flow control ID is the target
+    TransferISO15765Ptr transfer = getTransferByFlowControl(targetPid);
+    if(!transfer) {
+        throw J2534Exception(ERR_NO_FLOW_CONTROL);
+    }
+    UdsClientPtr client = std::make_shared<UdsClient>(*this, *mClock, targetPid, transfer->getPatternPid());
+    client->setTxFlags(txFlags);
+    client->setTimeouts(p2, p2Star);
+    return client;
+}
+
+void ChannelISO15765::flashDownload(const ISO15765_FLASH_DOWNLOAD *download, ISO15765_FLASH_RESULT *result) {
+    if(download == NULL || result == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    UdsClientPtr client = createUdsClient(download->TargetID, download->TxFlags, download->P2Timeout, download->P2StarTimeout);
+    std::unique_ptr<FlashDownload> flash = std::make_unique<FlashDownload>(*client);
+    flash->run(*download, *result);
+}
+
+void ChannelISO15765::flashDelta(const ISO15765_FLASH_DELTA *delta, ISO15765_FLASH_DELTA_RESULT *result) {
+    if(delta == NULL || delta->ManifestFile == NULL || delta->PartNumber == NULL || result == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    const ISO15765_FLASH_DOWNLOAD &download = delta->Download;
+    UdsClientPtr client = createUdsClient(download.TargetID, download.TxFlags, download.P2Timeout, download.P2StarTimeout);
+    std::unique_ptr<DeltaFlash> flash = std::make_unique<DeltaFlash>(*client);
+    flash->run(*delta, *result);
+}
+
+void ChannelISO15765::flashFile(const ISO15765_FLASH_FILE *flashFile, ISO15765_FLASH_FILE_RESULT *result) {
+    if(flashFile == NULL || flashFile->FileName == NULL || flashFile->RegionPtr == NULL || result == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    const ISO15765_FLASH_DOWNLOAD &download = flashFile->Download;
+    UdsClientPtr client = createUdsClient(download.TargetID, download.TxFlags, download.P2Timeout, download.P2StarTimeout);
+    std::unique_ptr<FlashFile> flash = std::make_unique<FlashFile>(*client);
+    flash->run(*flashFile, *result);
+}
+    
+void ChannelISO15765::obdPollStart(const ISO15765_OBD_POLL *poll, unsigned long *pollId) {
+    if(poll == NULL || pollId == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    if(!mObdPoller) {
+        mObdPoller = std::make_shared<ObdPoller>(*this, *mClock);
+    }
+    *pollId = mObdPoller->start(createUdsClient(poll->TargetID, poll->TxFlags, 0, 0), *poll);
+}
+
+void ChannelISO15765::obdPollStop(const unsigned long *pollId) {
+    if(!mObdPoller) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    if(pollId == NULL) {
+        mObdPoller->stopAll();
+    } else {
+        mObdPoller->stop(*pollId);
+    }
+}
+
+void ChannelISO15765::obdPollRead(const unsigned long *timeout, ISO15765_OBD_SAMPLE_LIST *list) {
+    if(timeout == NULL || list == NULL || list->SamplePtr == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    if(!mObdPoller) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    mObdPoller->read(*list, *timeout);
+}
+    
+void ChannelISO15765::dtcRead(const ISO15765_DTC_READ *read, ISO15765_DTC_LIST *list) {
+    if(read == NULL || list == NULL || (read->NumOfTargets > 0 && read->TargetPtr == NULL) ||
+            (list->NumOfDtcs > 0 && list->DtcPtr == NULL)) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    if(read->StatusMask > 0xFF) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    // Nothing is sent unless every target can be reached
+    std::vector<UdsClientPtr> clients;
+    for(unsigned long i = 0; i < read->NumOfTargets; ++i) {
+        ISO15765_DTC_TARGET &target = read->TargetPtr[i];
+        UdsClientPtr client = createUdsClient(target.RequestID, read->TxFlags, read->P2Timeout, read->P2StarTimeout);
+        if(target.ResponseID != 0 && target.ResponseID != client->getResponsePid()) {
+            throw J2534Exception(ERR_NO_FLOW_CONTROL);
+        }
+        target.ResponseID = client->getResponsePid();
+        clients.push_back(client);
+    }
+    std::unique_ptr<DtcReader> reader = std::make_unique<DtcReader>(*this, *mClock);
+    reader->run(clients, *read, *list);
+}
+    
+void ChannelISO15765::scan(const ISO15765_SCAN *scan, ISO15765_SCAN_LIST *list) {
+    if(scan == NULL || list == NULL || (list->NumOfResponders > 0 && list->ResponderPtr == NULL)) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    std::unique_ptr<Scanner> scanner = std::make_unique<Scanner>(getConfiguration(), *mChannel, *mClock, mBufferPool);
+    scanner->run(*scan, *list);
+}
+    
+void ChannelISO15765::memoryDump(const ISO15765_MEMORY_DUMP *dump, ISO15765_MEMORY_DUMP_RESULT *result) {
+    if(dump == NULL || dump->FileName == NULL || result == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    UdsClientPtr client = createUdsClient(dump->TargetID, dump->TxFlags, dump->P2Timeout, dump->P2StarTimeout);
+    std::unique_ptr<MemoryDump> memoryDump = std::make_unique<MemoryDump>(*client);
+    memoryDump->run(*dump, *result);
+}
+
+// Parameters saved by the snapshots, the CAN ID size is given at connection
+static const unsigned long snapshotParameters[] = {
+    DATA_RATE, LOOPBACK, BIT_SAMPLE_POINT, SYNC_JUMP_WIDTH, ISO15765_BS, ISO15765_STMIN, ISO15765_ADDR_TYPE,
+    ISO15765_CONFIG_RESPONSE_PENDING, ISO15765_CONFIG_P2_STAR
+};
+
+void ChannelISO15765::snapshot(ISO15765_SNAPSHOT *snapshot) {
+    if(snapshot == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    if(mMessageFilters.size() > ISO15765_SNAPSHOT_MAX_FILTERS || mPeriodics.size() > ISO15765_SNAPSHOT_MAX_PERIODICS) {
+        throw J2534Exception(ERR_EXCEEDED_LIMIT);
+    }
+
+    snapshot->NumOfConfigs = 0;
+    for(unsigned long parameter: snapshotParameters) {
+        SCONFIG config = {parameter, 0};
+        try {
+            getConfig(&config);
+        } catch(J2534Exception &exception) {
+            // Not supported by the device
+            LOG_DEBUG("Can't get parameter %lu: %ld", parameter, exception.code());
+            continue;
+        }
+        snapshot->Configs[snapshot->NumOfConfigs++] = config;
+    }
+
+    snapshot->NumOfFilters = 0;
+    for(const MessageFilterPtr &messageFilter: mMessageFilters) {
+        MessageFilterISO15765Ptr msf = std::static_pointer_cast<MessageFilterISO15765>(messageFilter);
+        ISO15765_SNAPSHOT_FILTER &filter = snapshot->Filters[snapshot->NumOfFilters++];
+        filter = msf->getDefinition();
+        filter.FilterID = reinterpret_cast<unsigned long>(msf.get());
+    }
+
+    snapshot->NumOfPeriodics = 0;
+    for(const Periodic &periodic: mPeriodics) {
+        ISO15765_SNAPSHOT_PERIODIC &entry = snapshot->Periodics[snapshot->NumOfPeriodics++];
+        entry.MsgID = reinterpret_cast<unsigned long>(periodic.message.get());
+        entry.TimeInterval = periodic.timeInterval;
+        entry.Msg = periodic.msg;
+    }
+}
+
+void ChannelISO15765::restore(const ISO15765_SNAPSHOT *snapshot, ISO15765_SNAPSHOT *restored) {
+    if(snapshot == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    if(snapshot->NumOfConfigs > ISO15765_SNAPSHOT_MAX_CONFIGS || snapshot->NumOfFilters > ISO15765_SNAPSHOT_MAX_FILTERS ||
+            snapshot->NumOfPeriodics > ISO15765_SNAPSHOT_MAX_PERIODICS) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    // Check everything before the channel is touched
+    for(unsigned long i = 0; i < snapshot->NumOfFilters; ++i) {
+        checkSnapshotMsg(snapshot->Filters[i].Mask);
+        checkSnapshotMsg(snapshot->Filters[i].Pattern);
+        checkSnapshotMsg(snapshot->Filters[i].FlowControl);
+    }
+    for(unsigned long i = 0; i < snapshot->NumOfPeriodics; ++i) {
+        checkSnapshotMsg(snapshot->Periodics[i].Msg);
+    }
+
+    // The snapshot replaces the filters, with their transfers, and the periodic messages of the channel. The OBD polls
+    // and the keepalives go on through the new filters.
+    for(const Periodic &periodic: mPeriodics) {
+        mChannel->stopPeriodicMsg(periodic.message);
+    }
+    mPeriodics.clear();
+    for(const MessageFilterPtr &messageFilter: mMessageFilters) {
+        mChannel->stopMsgFilter(std::static_pointer_cast<MessageFilterISO15765>(messageFilter)->mMessageFilter);
+    }
+    mMessageFilters.clear();
+
+    // The CAN parameters go to the device in a single SET_CONFIG
+    SCONFIG forwarded[ISO15765_SNAPSHOT_MAX_CONFIGS];
+    unsigned long count = 0;
+    for(unsigned long i = 0; i < snapshot->NumOfConfigs; ++i) {
+        SCONFIG config = snapshot->Configs[i];
+        ConfigurableChannel::setConfig(&config);
+        if(config.Parameter == ISO15765_CONFIG_RESPONSE_PENDING && config.Value == 0) {
+            mPendingRequests.clear();
+        }
+        if(!isLocalParameter(config.Parameter)) {
+            forwarded[count++] = config;
+        }
+    }
+    if(count > 0) {
+        SCONFIG_LIST Input;
+        Input.NumOfParams = count;
+        Input.ConfigPtr = forwarded;
+        mChannel->ioctl(SET_CONFIG, &Input, NULL);
+    }
+
+    // Messages of 4 KB, kept off the stack
+    std::vector<PASSTHRU_MSG> msgs(3);
+    try {
+        for(unsigned long i = 0; i < snapshot->NumOfFilters; ++i) {
+            const ISO15765_SNAPSHOT_FILTER &filter = snapshot->Filters[i];
+            fromSnapshotMsg(filter.Mask, msgs[0]);
+            fromSnapshotMsg(filter.Pattern, msgs[1]);
+            fromSnapshotMsg(filter.FlowControl, msgs[2]);
+            startMsgFilter(filter.FilterType, &msgs[0], &msgs[1],
+                    (filter.FilterType == FLOW_CONTROL_FILTER) ? &msgs[2] : NULL);
+        }
+        for(unsigned long i = 0; i < snapshot->NumOfPeriodics; ++i) {
+            fromSnapshotMsg(snapshot->Periodics[i].Msg, msgs[0]);
+            startPeriodicMsg(&msgs[0], snapshot->Periodics[i].TimeInterval);
+        }
+    } catch(J2534Exception &exception) {
+        // Refused by the device: the channel is left empty rather than half restored
+        LOG_DEBUG("Can't restore the snapshot: %ld", exception.code());
+        clearPeriodicMessages();
+        for(const MessageFilterPtr &messageFilter: mMessageFilters) {
+            mChannel->stopMsgFilter(std::static_pointer_cast<MessageFilterISO15765>(messageFilter)->mMessageFilter);
+        }
+        clearMessageFilters();
+        throw;
+    }
+
+    if(restored != NULL) {
+        this->snapshot(restored);
+    }
+}
+    
+RdbiCache &ChannelISO15765::getRdbiCache() {
+    if(!mRdbiCache) {
+        mRdbiCache = std::make_shared<RdbiCache>(*mClock);
+    }
+    return *mRdbiCache;
+}
+    
+void ChannelISO15765::transaction(const ISO15765_TRANSACTION *transaction, PASSTHRU_MSG *response) {
+    if(transaction == NULL || transaction->RequestPtr == NULL || response == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    PASSTHRU_MSG &request = *transaction->RequestPtr;
+    if(request.DataSize <= J2534_DATA_OFFSET) {
+        throw J2534Exception(ERR_INVALID_MSG);
+    }
+    TransferISO15765Ptr transfer = getTransferByFlowControl(request);
+    if(!transfer) {
+        throw J2534Exception(ERR_NO_FLOW_CONTROL);
+    }
+    uint32_t responsePid = transfer->getPatternPid();
+    uint8_t sid = request.Data[J2534_DATA_OFFSET];
+    unsigned long p2Star = transaction->P2StarTimeout;
+    if(p2Star == 0) {
+        getConfiguration().getValue(ISO15765_CONFIG_P2_STAR, &p2Star);
+    }
+
+    // Through writeMsgs, for the cache and the keepalives. The response is read once the request is written: the PASS
+    // filter of the transfer is set in the CAN channel, which buffers the frames received meanwhile, and a segmented
+    // response waits for the flow control sent by the read.
+    Clock::time_point deadline = mClock->now() + std::chrono::milliseconds(transaction->Timeout);
+    unsigned long count = 1;
+    writeMsgs(&request, &count, transaction->Timeout);
+    if(count != 1) {
+        throw J2534Exception(ERR_FAILED);
+    }
+
+    while(true) {
+        bool cached = mRdbiCache && mRdbiCache->pop(*response);
+        if(!cached && !receiveMsg(*response, deadline, true)) {
+            throw J2534Exception(ERR_TIMEOUT);
+        }
+        if(data2pid(response->Data) == responsePid) {
+            const uint8_t *data = UdsClient::payload(*response);
+            size_t size = UdsClient::payloadSize(*response);
+            bool negative = (size >= 2 && data[0] == UDS_NEGATIVE_RESPONSE && data[1] == sid);
+            if(negative && size >= 3 && data[2] == UDS_NRC_RESPONSE_PENDING) {
+                mResponsePendingCount++;
+                deadline = std::max(deadline, mClock->now() + std::chrono::milliseconds(p2Star));
+                continue;
+            }
+            if(negative || (size >= 1 && data[0] == UDS_POSITIVE_RESPONSE(sid))) {
+                return;
+            }
+        }
+        // Nothing is dropped: when the queue is full, the messages left and the response are read by the application
+        mDeferredMsgs.push_back(*response);
+        if(mDeferredMsgs.size() >= ISO15765_MAX_DEFERRED_MSGS) {
+            throw J2534Exception(ERR_BUFFER_OVERFLOW);
+        }
+    }
+}
+
+void ChannelISO15765::trackRequest(TransferISO15765 &transfer, const PASSTHRU_MSG &msg) {
+    unsigned long enabled = 0;
+    getConfiguration().getValue(ISO15765_CONFIG_RESPONSE_PENDING, &enabled);
+    if(!enabled) {
+        return;
+    }
+    // One request at a time per target, the last one sent is awaited
+    auto it = std::find_if(mPendingRequests.begin(), mPendingRequests.end(), [&](const PendingRequest &request) {
+        return request.responsePid == transfer.getPatternPid();
+    });
+    if(it == mPendingRequests.end()) {
+        it = mPendingRequests.insert(mPendingRequests.end(), PendingRequest());
+    }
+    it->responsePid = transfer.getPatternPid();
+    it->sid = msg.Data[J2534_DATA_OFFSET];
+}
+
+bool ChannelISO15765::absorbResponsePending(const PASSTHRU_MSG &msg, Clock::time_point *deadline) {
+    if(mPendingRequests.empty()) {
+        return false;
+    }
+    uint32_t pid = data2pid(msg.Data);
+    auto it = std::find_if(mPendingRequests.begin(), mPendingRequests.end(), [&](const PendingRequest &request) {
+        return request.responsePid == pid;
+    });
+    if(it == mPendingRequests.end()) {
+        return false;
+    }
+
+    const uint8_t *data = UdsClient::payload(msg);
+    size_t size = UdsClient::payloadSize(msg);
+    bool negative = (size >= 2 && data[0] == UDS_NEGATIVE_RESPONSE && data[1] == it->sid);
+    if(negative && size >= 3 && data[2] == UDS_NRC_RESPONSE_PENDING) {
+        mResponsePendingCount++;
+        if(deadline != NULL) {
+            unsigned long p2Star = UDS_DEFAULT_P2_STAR;
+            getConfiguration().getValue(ISO15765_CONFIG_P2_STAR, &p2Star);
+            *deadline = std::max(*deadline, mClock->now() + std::chrono::milliseconds(p2Star));
+        }
+        return true;
+    }
+    if(negative || (size >= 1 && data[0] == UDS_POSITIVE_RESPONSE(it->sid))) {
+        mPendingRequests.erase(it);
+    }
+    return false;
+}
+
+void ChannelISO15765::keepAliveStart(const ISO15765_KEEPALIVE *keepAlive) {
+    if(keepAlive == NULL) {
+        throw J2534Exception(ERR_NULL_PARAMETER);
+    }
+    TransferISO15765Ptr transfer = getTransferByFlowControl(keepAlive->TargetID);
+    if(!transfer) {
+        throw J2534Exception(ERR_NO_FLOW_CONTROL);
+    }
+    if(!mKeepAlive) {
+        mKeepAlive = std::make_shared<KeepAlive>(*mChannel, *mClock);
+    }
+    mKeepAlive->start(transfer->getPatternPid(), *keepAlive);
+}
+
+void ChannelISO15765::keepAliveStop(const unsigned long *targetId) {
+    if(!mKeepAlive) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    if(targetId == NULL) {
+        mKeepAlive->clear();
+        mKeepAlive = nullptr;
+    } else {
+        mKeepAlive->stop(*targetId);
+    }
+}
+
+// Read a frame, messages that aren't CAN frames are skipped
+bool ChannelISO15765::readFrame(CanFrame &frame, unsigned long Timeout) {
+    PASSTHRU_MSG msg;
+    Clock::time_point deadline = mClock->now() + std::chrono::milliseconds(Timeout);
+    while(true) {
+        unsigned long c = 1;
+        mChannel->readMsgs(&msg, &c, Timeout);
+        if(c != 1) {
+            return false;
+        }
+        if(msgToFrame(msg, frame)) {
+            return true;
+        }
+        LOG_DEBUG("Invalid frame size");
+        long remaining = remainingTime(*mClock, deadline);
+        if(remaining <= 0) {
+            return false;
+        }
+        Timeout = remaining;
+    }
+}
+
 bool ChannelISO15765::handle_ioctl(unsigned long IoctlID, void *pInput, void *pOutput) {
+    switch (IoctlID) {
+        case ISO15765_IOCTL_FLASH_DOWNLOAD:
+            flashDownload(reinterpret_cast<const ISO15765_FLASH_DOWNLOAD *>(pInput), reinterpret_cast<ISO15765_FLASH_RESULT *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_OBD_POLL_START:
+            obdPollStart(reinterpret_cast<const ISO15765_OBD_POLL *>(pInput), reinterpret_cast<unsigned long *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_OBD_POLL_STOP:
+            obdPollStop(reinterpret_cast<const unsigned long *>(pInput));
+            return true;
+        case ISO15765_IOCTL_OBD_POLL_READ:
+            obdPollRead(reinterpret_cast<const unsigned long *>(pInput), reinterpret_cast<ISO15765_OBD_SAMPLE_LIST *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_RDBI_CACHE_CONFIG: {
+            const ISO15765_RDBI_CACHE_CONFIG *config = reinterpret_cast<const ISO15765_RDBI_CACHE_CONFIG *>(pInput);
+            if(config == NULL) {
+                throw J2534Exception(ERR_NULL_PARAMETER);
+            }
+            getRdbiCache().configure(config->Enable != 0, config->DefaultTTL);
+            return true;
+        }
+        case ISO15765_IOCTL_RDBI_CACHE_TTL: {
+            const ISO15765_RDBI_CACHE_TTL *ttl = reinterpret_cast<const ISO15765_RDBI_CACHE_TTL *>(pInput);
+            if(ttl == NULL) {
+                throw J2534Exception(ERR_NULL_PARAMETER);
+            }
+            if(ttl->Did > 0xFFFF) {
+                throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+            }
+            getRdbiCache().setTtl(ttl->Did, ttl->TTL);
+            return true;
+        }
+        case ISO15765_IOCTL_RDBI_CACHE_CLEAR:
+            getRdbiCache().clear();
+            return true;
+        case ISO15765_IOCTL_RDBI_CACHE_STATS: {
+            ISO15765_RDBI_CACHE_STATS *stats = reinterpret_cast<ISO15765_RDBI_CACHE_STATS *>(pOutput);
+            if(stats == NULL) {
+                throw J2534Exception(ERR_NULL_PARAMETER);
+            }
+            getRdbiCache().getStats(*stats);
+            return true;
+        }
+        case ISO15765_IOCTL_KEEPALIVE_START:
+            keepAliveStart(reinterpret_cast<const ISO15765_KEEPALIVE *>(pInput));
+            return true;
+        case ISO15765_IOCTL_KEEPALIVE_STOP:
+            keepAliveStop(reinterpret_cast<const unsigned long *>(pInput));
+            return true;
+        case ISO15765_IOCTL_KEEPALIVE_STATS: {
+            ISO15765_KEEPALIVE_STATS *stats = reinterpret_cast<ISO15765_KEEPALIVE_STATS *>(pOutput);
+            if(stats == NULL) {
+                throw J2534Exception(ERR_NULL_PARAMETER);
+            }
+            if(mKeepAlive) {
+                mKeepAlive->getStats(*stats);
+            } else {
+                memset(stats, 0, sizeof(*stats));
+            }
+            return true;
+        }
+        case ISO15765_IOCTL_DTC_READ:
+            dtcRead(reinterpret_cast<const ISO15765_DTC_READ *>(pInput), reinterpret_cast<ISO15765_DTC_LIST *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_SCAN:
+            scan(reinterpret_cast<const ISO15765_SCAN *>(pInput), reinterpret_cast<ISO15765_SCAN_LIST *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_TRANSACTION:
+            transaction(reinterpret_cast<const ISO15765_TRANSACTION *>(pInput), reinterpret_cast<PASSTHRU_MSG *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_FLASH_DELTA:
+            flashDelta(reinterpret_cast<const ISO15765_FLASH_DELTA *>(pInput), reinterpret_cast<ISO15765_FLASH_DELTA_RESULT *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_FLASH_FILE:
+            flashFile(reinterpret_cast<const ISO15765_FLASH_FILE *>(pInput), reinterpret_cast<ISO15765_FLASH_FILE_RESULT *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_MEMORY_DUMP:
+            memoryDump(reinterpret_cast<const ISO15765_MEMORY_DUMP *>(pInput), reinterpret_cast<ISO15765_MEMORY_DUMP_RESULT *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_SNAPSHOT:
+            snapshot(reinterpret_cast<ISO15765_SNAPSHOT *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_RESTORE:
+            restore(reinterpret_cast<const ISO15765_SNAPSHOT *>(pInput), reinterpret_cast<ISO15765_SNAPSHOT *>(pOutput));
+            return true;
+        case ISO15765_IOCTL_BUFFER_POOL_STATS: {
+            ISO15765_BUFFER_POOL_STATS *stats = reinterpret_cast<ISO15765_BUFFER_POOL_STATS *>(pOutput);
+            if(stats == NULL) {
+                throw J2534Exception(ERR_NULL_PARAMETER);
+            }
+            mBufferPool->getStats(*stats);
+            return true;
+        }
+        case ISO15765_IOCTL_RESPONSE_PENDING_STATS:
+            if(pOutput == NULL) {
+                throw J2534Exception(ERR_NULL_PARAMETER);
+            }
+            *reinterpret_cast<unsigned long *>(pOutput) = mResponsePendingCount;
+            return true;
+    }
     if(!ConfigurableChannel::handle_ioctl(IoctlID, pInput, pOutput)) {
         mChannel->ioctl(IoctlID, pInput, pOutput);
     }
@@ -690,4 +1100,12 @@ ChannelWeakPtr MessageFilterISO15765::getChannel() const {
     
 TransferISO15765Ptr& MessageFilterISO15765::getTransfer() {
     return mTransfer;
+}
+
+void MessageFilterISO15765::setDefinition(const ISO15765_SNAPSHOT_FILTER &definition) {
+    mDefinition = definition;
+}
+
+const ISO15765_SNAPSHOT_FILTER &MessageFilterISO15765::getDefinition() const {
+    return mDefinition;
 }
\ No newline at end of file
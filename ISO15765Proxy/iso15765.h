@@ -3,9 +3,21 @@
 #ifndef __ISO15765_H
 #define __ISO15765_H
 
+#include "ISO15765Proxy.h"
 #include "internal.h"
 #include "configurable_channel.h"
-#include <list>
+#include "can_frame.h"
+#include "iso15765_engine.h"
+#include "buffer_pool.h"
+#include "clock.h"
+#include "uds.h"
+#include "obd.h"
+#include "rdbi_cache.h"
+#include "keepalive.h"
+#include <deque>
+#include <vector>
+
+#include <sys/types.h>
 
 DEFINE_SHARED(TransferISO15765)
 DEFINE_SHARED(MessageFilterISO15765)
@@ -26,7 +38,7 @@ public:
     virtual void getLastError(char *pErrorDescription) override;
 
 protected:
-    std::list<DevicePtr> mDevices;
+    Registry<Device> mDevices;
     LibraryPtr mLibrary;
 };
 
@@ -51,7 +63,7 @@ public:
     
 protected:
     LibraryISO15765WeakPtr mLibrary;
-    std::list<ChannelPtr> mChannels;
+    Registry<Channel> mChannels;
     DevicePtr mDevice;
 };
 
@@ -59,7 +71,7 @@ class ChannelISO15765: public ConfigurableChannel {
     friend class TransferISO15765;
     friend class DeviceISO15765;
 public:
-    ChannelISO15765(unsigned long protocolId, const DeviceISO15765Ptr &device, const ChannelPtr &channel);
+    ChannelISO15765(unsigned long protocolId, const DeviceISO15765Ptr &device, const ChannelPtr &channel, const ClockPtr &clock = Clock::getDefault());
 
     virtual ~ChannelISO15765();
     
@@ -96,68 +108,113 @@ protected:
     virtual void ioctl(unsigned long IoctlID, void *pInput, void *pOutput) override;
     
     TransferISO15765Ptr getTransferByFlowControl(const PASSTHRU_MSG &msg);
+
+    TransferISO15765Ptr getTransferByFlowControl(uint32_t pid);
     
-    TransferISO15765Ptr getTransferByPattern(const PASSTHRU_MSG &msg);
+    TransferISO15765Ptr getTransferByPattern(uint32_t pid);
+
+    UdsClientPtr createUdsClient(unsigned long targetPid, unsigned long txFlags, unsigned long p2, unsigned long p2Star);
+
+    void flashDownload(const ISO15765_FLASH_DOWNLOAD *download, ISO15765_FLASH_RESULT *result);
+
+    void flashDelta(const ISO15765_FLASH_DELTA *delta, ISO15765_FLASH_DELTA_RESULT *result);
+
+    void flashFile(const ISO15765_FLASH_FILE *flashFile, ISO15765_FLASH_FILE_RESULT *result);
+
+    void obdPollStart(const ISO15765_OBD_POLL *poll, unsigned long *pollId);
+
+    void obdPollStop(const unsigned long *pollId);
+
+    void obdPollRead(const unsigned long *timeout, ISO15765_OBD_SAMPLE_LIST *list);
+
+    void dtcRead(const ISO15765_DTC_READ *read, ISO15765_DTC_LIST *list);
+
+    void scan(const ISO15765_SCAN *scan, ISO15765_SCAN_LIST *list);
+
+    void memoryDump(const ISO15765_MEMORY_DUMP *dump, ISO15765_MEMORY_DUMP_RESULT *result);
+
+    void snapshot(ISO15765_SNAPSHOT *snapshot);
+
+    void restore(const ISO15765_SNAPSHOT *snapshot, ISO15765_SNAPSHOT *restored);
+
+    RdbiCache &getRdbiCache();
+
+    void keepAliveStart(const ISO15765_KEEPALIVE *keepAlive);
+
+    void keepAliveStop(const unsigned long *targetId);
+
+    bool readFrame(CanFrame &frame, unsigned long Timeout);
+
+    bool popMsg(PASSTHRU_MSG &msg);
+
+    bool receiveMsg(PASSTHRU_MSG &msg, Clock::time_point &deadline, bool blocking);
+
+    void transaction(const ISO15765_TRANSACTION *transaction, PASSTHRU_MSG *response);
+
+    void trackRequest(TransferISO15765 &transfer, const PASSTHRU_MSG &msg);
+
+    bool absorbResponsePending(const PASSTHRU_MSG &msg, Clock::time_point *deadline);
     
 protected:
+    // Request waiting for its final response, when the response pending negative responses are absorbed
+    struct PendingRequest {
+        uint32_t responsePid;
+        uint8_t sid;
+    };
+
+    // Periodic messages are kept to be part of the snapshots
+    struct Periodic {
+        PeriodicMessagePtr message;
+        unsigned long timeInterval;
+        ISO15765_SNAPSHOT_MSG msg;
+    };
+
     unsigned long mProtocolId;
     DeviceISO15765WeakPtr mDevice;
-    std::list<MessageFilterPtr> mMessageFilters;
+    Registry<MessageFilter> mMessageFilters;
+    std::vector<Periodic> mPeriodics;
     ChannelPtr mChannel;
+    ClockPtr mClock;
+    BufferPoolPtr mBufferPool;
+    ObdPollerPtr mObdPoller;
+    RdbiCachePtr mRdbiCache;
+    KeepAlivePtr mKeepAlive;
+    std::vector<PendingRequest> mPendingRequests;
+    std::deque<PASSTHRU_MSG> mDeferredMsgs;
+    unsigned long mResponsePendingCount;
 };
  
+/*
+ * Blocking ISO15765 transfer of a filter: runs the sender and the receiver of the protocol engine with the calls of
+ * the CAN channel, sleeping for the separation times.
+ */
 class TransferISO15765 {
 public:
-    TransferISO15765(Configuration &configuration, Channel &channel, const PASSTHRU_MSG &pMaskMsg, const PASSTHRU_MSG &pPatternMsg, const PASSTHRU_MSG &pFlowControlMsg);
+    TransferISO15765(Configuration &configuration, Channel &channel, Clock &clock, const BufferPoolPtr &pool, const PASSTHRU_MSG &pMaskMsg, const PASSTHRU_MSG &pPatternMsg, const PASSTHRU_MSG &pFlowControlMsg);
     ~TransferISO15765();
     
     void clear();
     
     bool writeMsg(const PASSTHRU_MSG &msg, unsigned long Timeout);
-    bool readMsg(const PASSTHRU_MSG &in_msg, PASSTHRU_MSG &out_msg, unsigned long Timeout);
+    bool readMsg(const CanFrame &frame, PASSTHRU_MSG &out_msg, unsigned long Timeout);
     
     uint32_t getMaskPid();
     uint32_t getPatternPid();
     uint32_t getFlowControlPid();
 
 private:
-    enum TransferState {
-        START_STATE = 0,
-        FLOW_CONTROL_STATE,
-        BLOCK_STATE
-    };
+    bool writeFrame(const CanFrame &frame, unsigned long Timeout);
+    bool readFrame(CanFrame &frame, unsigned long Timeout);
 
-    enum PCIFrameName {
-        SingleFrame = 0,
-        FirstFrame,
-        ConsecutiveFrame,
-        FlowControl,
-        UnknownFrame
-    };
-    
-    static PCIFrameName getFrameName(uint8_t pci);
-    static uint8_t getPci(PCIFrameName frameName);
-    static size_t getRemainingSize(const PASSTHRU_MSG &msg, off_t offset);
-    static void prepareSentMessageHeaders(PASSTHRU_MSG &out_msg, const PASSTHRU_MSG &in_msg);
-    static void prepareReceivedMessageHeaders(PASSTHRU_MSG &out_msg, const PASSTHRU_MSG &in_msg);
-    static void paddingMessage(PASSTHRU_MSG &smsg);
-    
-    bool sendFlowControlMessage(unsigned long Timeout);
-
-    Configuration &mChannelConfiguration;
     Channel &mChannel;
+    Clock &mClock;
     
     uint32_t mMaskPid;
     uint32_t mPatternPid;
     uint32_t mFlowControlPid;
-    
-    unsigned long mBs;
-    unsigned long mStmin;
-    
-    unsigned int mSequence;
-    PASSTHRU_MSG mMessage;
-    TransferState mState;
-    off_t mOffset;
+
+    SenderISO15765 mSender;
+    ReceiverISO15765 mReceiver;
 };
 
 class MessageFilterISO15765: public MessageFilter {
@@ -169,11 +226,16 @@ public:
     virtual ChannelWeakPtr getChannel() const override;
     
     virtual TransferISO15765Ptr& getTransfer();
+
+    // Type and messages the filter was started with, kept for the snapshots
+    void setDefinition(const ISO15765_SNAPSHOT_FILTER &definition);
+    const ISO15765_SNAPSHOT_FILTER &getDefinition() const;
     
 private:
     ChannelISO15765WeakPtr mChannel;
     TransferISO15765Ptr mTransfer;
     MessageFilterPtr mMessageFilter;
+    ISO15765_SNAPSHOT_FILTER mDefinition;
 };
 
 #endif //__ISO15765_H
\ No newline at end of file
@@ -0,0 +1,340 @@
+#include "iso15765_engine.h"
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ISO15765Proxy.h"
+
+#define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
+
+#define J2534_DATA_OFFSET 4
+#define CAN_DATA_SIZE 8
+#define J2534_PCI_SIZE 1
+#define J2534_LENGTH_SIZE 1
+#define J2534_BS_SIZE 1
+#define J2534_STMIN_SIZE 1
+
+#define ISO15765_MAX_SF_SIZE (CAN_DATA_SIZE - J2534_PCI_SIZE)
+#define ISO15765_FF_DATA_SIZE (CAN_DATA_SIZE - J2534_PCI_SIZE - J2534_LENGTH_SIZE)
+#define ISO15765_CF_DATA_SIZE (CAN_DATA_SIZE - J2534_PCI_SIZE)
+
+#define PCI_SINGLE_FRAME 0x0
+#define PCI_FIRST_FRAME 0x1
+#define PCI_CONSECUTIVE_FRAME 0x2
+#define PCI_FLOW_CONTROL 0x3
+
+#define GET_PCI(d) (((d) & 0xF0) >> 4)
+#define GET_MS(d) ((d) & 0x0F)
+
+#define FC_CONTINUE_TO_SEND 0
+#define FC_WAIT 1
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = (0x1F & (pid >> 24));
+    data[1] = (0xFF & (pid >> 16));
+    data[2] = (0xFF & (pid >> 8));
+    data[3] = (0xFF & (pid >> 0));
+}
+
+static void paddingFrame(CanFrame &frame) {
+    for(int i = frame.size; i < CAN_DATA_SIZE; ++i) {
+        frame.data[i] = '\0';
+    }
+    frame.size = CAN_DATA_SIZE;
+}
+
+static Clock::duration getSeparationTime(unsigned long stmin) {
+    if(stmin <= 0x7F) {
+        return std::chrono::milliseconds(stmin);
+    } else if(stmin >= 0xF1 && stmin <= 0xF9) {
+        return std::chrono::microseconds(100 * (stmin - 0xF0));
+    } else {
+        // Reserved values are treated as the longest separation time
+        return std::chrono::milliseconds(0x7F);
+    }
+}
+
+static void prepareReceivedMessageHeaders(PASSTHRU_MSG &msg, uint32_t pid, size_t size) {
+    msg.ProtocolID = ISO15765;
+    msg.RxStatus = 0;
+    msg.TxFlags = 0;
+    msg.Timestamp = 0;
+    msg.DataSize = J2534_DATA_OFFSET + size;
+    msg.ExtraDataIndex = 0;
+    pid2Data(pid, msg.Data);
+}
+
+bool isFlowControl(const CanFrame &frame) {
+    return frame.size >= J2534_PCI_SIZE && GET_PCI(frame.data[0]) == PCI_FLOW_CONTROL;
+}
+
+/*
+ *
+ * SenderISO15765
+ *
+ */
+
+SenderISO15765::SenderISO15765() {
+    clear();
+}
+
+void SenderISO15765::clear() {
+    mStatus = IDLE;
+    mPid = 0;
+    mTxFlags = 0;
+    mPayload = NULL;
+    mSize = 0;
+    mOffset = 0;
+    mSequence = 0;
+    mBs = 0;
+    mStmin = 0;
+    mLastFrameSent = false;
+}
+
+bool SenderISO15765::start(uint32_t pid, unsigned long txFlags, const uint8_t *payload, size_t size) {
+    if(mStatus != IDLE && mStatus != DONE && mStatus != FAILED) {
+        LOG_DEBUG("Wrong state");
+        return false;
+    }
+    clear();
+    mPid = pid;
+    mTxFlags = txFlags;
+    mPayload = payload;
+    mSize = size;
+    mStatus = SEND;
+    return true;
+}
+
+SenderISO15765::Status SenderISO15765::getStatus(const Clock::time_point &now) {
+    if(mStatus == WAIT_SEPARATION && now >= mWakeUp) {
+        mStatus = mLastFrameSent ? DONE : SEND;
+    }
+    return mStatus;
+}
+
+void SenderISO15765::next(CanFrame &frame, const Clock::time_point &now) {
+    frame.protocolId = CAN;
+    frame.rxStatus = 0;
+    frame.txFlags = mTxFlags & ~(ISO15765_FRAME_PAD | ISO15765_ADDR_TYPE);
+    frame.timestamp = 0;
+    frame.id = mPid;
+
+    size_t size;
+    if(mOffset == 0 && mSize <= ISO15765_MAX_SF_SIZE) {
+        size = mSize;
+        frame.data[0] = (PCI_SINGLE_FRAME << 4) | (size & 0x0F);
+        frame.size = J2534_PCI_SIZE + size;
+        memcpy(&frame.data[J2534_PCI_SIZE], mPayload, size);
+        mStatus = DONE;
+    } else if(mOffset == 0) {
+        size = ISO15765_FF_DATA_SIZE;
+        frame.data[0] = (PCI_FIRST_FRAME << 4) | ((mSize >> 8) & 0x0F);
+        frame.data[J2534_PCI_SIZE] = (mSize & 0xFF);
+        frame.size = J2534_PCI_SIZE + J2534_LENGTH_SIZE + size;
+        memcpy(&frame.data[J2534_PCI_SIZE + J2534_LENGTH_SIZE], mPayload, size);
+        mSequence++;
+        mStatus = WAIT_FLOW_CONTROL;
+    } else {
+        size = std::min<size_t>(mSize - mOffset, ISO15765_CF_DATA_SIZE);
+        frame.data[0] = (PCI_CONSECUTIVE_FRAME << 4) | ((mSequence++) & 0x0F);
+        frame.size = J2534_PCI_SIZE + size;
+        memcpy(&frame.data[J2534_PCI_SIZE], &mPayload[mOffset], size);
+        mLastFrameSent = (mOffset + size >= mSize);
+
+        // End of the block: a flow control, unless the message is complete
+        if(--mBs == 0) {
+            mStatus = mLastFrameSent ? DONE : WAIT_FLOW_CONTROL;
+        } else {
+            mWakeUp = now + getSeparationTime(mStmin);
+            mStatus = WAIT_SEPARATION;
+        }
+    }
+    mOffset += size;
+
+    if(mTxFlags & ISO15765_FRAME_PAD) {
+        paddingFrame(frame);
+    }
+}
+
+bool SenderISO15765::onFlowControl(const CanFrame &frame, const Clock::time_point &now) {
+    if(mStatus != WAIT_FLOW_CONTROL) {
+        LOG_DEBUG("Wrong state");
+        goto fail;
+    }
+    if(frame.size < J2534_PCI_SIZE + J2534_BS_SIZE + J2534_STMIN_SIZE) {
+        LOG_DEBUG("Invalid flow control message size");
+        goto fail;
+    }
+    if(!isFlowControl(frame)) {
+        LOG_DEBUG("Invalid frame type %d (Need %d)", GET_PCI(frame.data[0]), PCI_FLOW_CONTROL);
+        goto fail;
+    }
+    {
+        // Flow status: wait for the next flow control, abort on overflow or reserved values
+        uint8_t flowStatus = GET_MS(frame.data[0]);
+        if(flowStatus == FC_WAIT) {
+            return true;
+        }
+        if(flowStatus != FC_CONTINUE_TO_SEND) {
+            LOG_DEBUG("Flow control status %d", flowStatus);
+            goto fail;
+        }
+    }
+
+    mBs = frame.data[J2534_PCI_SIZE];
+    mStmin = frame.data[J2534_PCI_SIZE + J2534_BS_SIZE];
+    mWakeUp = now + getSeparationTime(mStmin);
+    mStatus = WAIT_SEPARATION;
+    return true;
+
+fail:
+    mStatus = FAILED;
+    return false;
+}
+
+const Clock::time_point &SenderISO15765::getWakeUp() const {
+    return mWakeUp;
+}
+
+/*
+ *
+ * ReceiverISO15765
+ *
+ */
+
+ReceiverISO15765::ReceiverISO15765(Configuration &configuration, const BufferPoolPtr &pool, uint32_t flowControlPid):
+        mConfiguration(configuration), mPool(pool), mFlowControlPid(flowControlPid), mReceiving(false), mRxSize(0) {
+    clear();
+}
+
+ReceiverISO15765::~ReceiverISO15765() {
+    clear();
+}
+
+void ReceiverISO15765::clear() {
+    mReceiving = false;
+    mSequence = 0;
+    mBs = 0;
+    if(mBuffer) {
+        mPool->release(std::move(mBuffer), mRxSize);
+    }
+    mRxSize = 0;
+    mRxPid = 0;
+    mOffset = 0;
+}
+
+bool ReceiverISO15765::isReceiving() const {
+    return mReceiving;
+}
+
+void ReceiverISO15765::prepareFlowControl(CanFrame &flowControl) {
+    mBs = 0;
+    mConfiguration.getValue(ISO15765_BS, &mBs);
+    unsigned long stmin = 0;
+    mConfiguration.getValue(ISO15765_STMIN, &stmin);
+
+    flowControl.protocolId = CAN;
+    flowControl.rxStatus = 0;
+    flowControl.txFlags = 0;
+    flowControl.timestamp = 0;
+    flowControl.id = mFlowControlPid;
+    flowControl.size = J2534_PCI_SIZE + J2534_BS_SIZE + J2534_STMIN_SIZE;
+    flowControl.data[0] = (PCI_FLOW_CONTROL << 4);
+    flowControl.data[J2534_PCI_SIZE] = mBs;
+    flowControl.data[J2534_PCI_SIZE + J2534_BS_SIZE] = stmin;
+    paddingFrame(flowControl);
+}
+
+unsigned int ReceiverISO15765::onFrame(const CanFrame &frame, CanFrame &flowControl, PASSTHRU_MSG &msg) {
+    if(frame.size < J2534_PCI_SIZE) {
+        LOG_DEBUG("Invalid message size");
+        goto fail;
+    }
+    {
+        uint8_t pci = GET_PCI(frame.data[0]);
+        size_t available = frame.size - J2534_PCI_SIZE;
+        if(mReceiving && (pci == PCI_SINGLE_FRAME || pci == PCI_FIRST_FRAME)) {
+            // A new transfer replaces the one in progress
+            LOG_DEBUG("Reception interrupted by frame type %d", pci);
+            clear();
+        }
+        if(!mReceiving) {
+            if(pci == PCI_SINGLE_FRAME) {
+                // Straight to the output, no buffer needed
+                size_t size = frame.data[0] & 0x0F;
+                if(size == 0 || size > ISO15765_MAX_SF_SIZE || size > available) {
+                    LOG_DEBUG("Invalid single frame length %lu", (unsigned long)size);
+                    goto fail;
+                }
+                prepareReceivedMessageHeaders(msg, frame.id, size);
+                memcpy(&msg.Data[J2534_DATA_OFFSET], &frame.data[J2534_PCI_SIZE], size);
+                clear();
+                return COMPLETE;
+            } else if(pci == PCI_FIRST_FRAME) {
+                size_t size = ISO15765_FF_DATA_SIZE;
+                if(available < J2534_LENGTH_SIZE + size) {
+                    LOG_DEBUG("Truncated first frame");
+                    goto fail;
+                }
+                size_t fullsize = ((frame.data[0] & 0x0F) << 8) | (frame.data[J2534_PCI_SIZE] & 0xFF);
+                if(fullsize <= ISO15765_MAX_SF_SIZE) {
+                    LOG_DEBUG("Invalid first frame length %lu", (unsigned long)fullsize);
+                    goto fail;
+                }
+                mBuffer = mPool->acquire(fullsize);
+                mRxSize = fullsize;
+                mRxPid = frame.id;
+                memcpy(mBuffer.get(), &frame.data[J2534_PCI_SIZE + J2534_LENGTH_SIZE], size);
+
+                mSequence++;
+                mOffset = size;
+                mReceiving = true;
+                prepareFlowControl(flowControl);
+                return FLOW_CONTROL;
+            } else {
+                LOG_DEBUG("Invalid frame type %d", pci);
+                goto fail;
+            }
+        }
+
+        if(pci != PCI_CONSECUTIVE_FRAME) {
+            LOG_DEBUG("Ignore frame type %d during reception", pci);
+            return NONE;
+        }
+        unsigned int seq = frame.data[0] & 0xF;
+        if(seq != (mSequence % 0x10)) {
+            LOG_DEBUG("Wrong sequence number %d (Need %d)", seq, mSequence);
+            goto fail;
+        }
+
+        size_t size = std::min<size_t>(mRxSize - mOffset, ISO15765_CF_DATA_SIZE);
+        if(size > available) {
+            LOG_DEBUG("Truncated consecutive frame");
+            goto fail;
+        }
+        memcpy(&mBuffer[mOffset], &frame.data[J2534_PCI_SIZE], size);
+
+        mSequence++;
+        mOffset += size;
+
+        unsigned int events = NONE;
+        if(--mBs == 0) {
+            prepareFlowControl(flowControl);
+            events |= FLOW_CONTROL;
+        }
+
+        if(mOffset >= mRxSize) {
+            prepareReceivedMessageHeaders(msg, mRxPid, mRxSize);
+            memcpy(&msg.Data[J2534_DATA_OFFSET], mBuffer.get(), mRxSize);
+            clear();
+            events |= COMPLETE;
+        }
+        return events;
+    }
+
+fail:
+    clear();
+    return NONE;
+}
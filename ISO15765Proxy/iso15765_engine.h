@@ -0,0 +1,106 @@
+#pragma once
+
+#ifndef _ISO15765_ENGINE_H
+#define _ISO15765_ENGINE_H
+
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "internal.h"
+#include "can_frame.h"
+#include "buffer_pool.h"
+#include "clock.h"
+
+/*
+ * ISO15765 protocol without I/O. The sender and the receiver are fed with the frames of their peer and the time,
+ * and hand out the frames to write: nothing blocks or sleeps, so one thread can run any number of them. The
+ * channels run one of each per filter with the blocking calls of TransferISO15765.
+ */
+
+// Frames of the peer are flow controls for the sender, anything else for the receiver
+bool isFlowControl(const CanFrame &frame);
+
+class SenderISO15765 {
+public:
+    enum Status {
+        IDLE = 0,
+        // A frame is ready, take it with next()
+        SEND,
+        // Give the next frame of the peer to onFlowControl()
+        WAIT_FLOW_CONTROL,
+        // Nothing to do before getWakeUp()
+        WAIT_SEPARATION,
+        DONE,
+        FAILED
+    };
+
+    SenderISO15765();
+
+    // The payload stays owned by the caller until the sender is done or cleared
+    bool start(uint32_t pid, unsigned long txFlags, const uint8_t *payload, size_t size);
+
+    Status getStatus(const Clock::time_point &now);
+
+    void next(CanFrame &frame, const Clock::time_point &now);
+
+    // False if the frame ends the message in error
+    bool onFlowControl(const CanFrame &frame, const Clock::time_point &now);
+
+    const Clock::time_point &getWakeUp() const;
+
+    void clear();
+
+private:
+    Status mStatus;
+    uint32_t mPid;
+    unsigned long mTxFlags;
+    const uint8_t *mPayload;
+    size_t mSize;
+    size_t mOffset;
+    unsigned int mSequence;
+    unsigned long mBs;
+    unsigned long mStmin;
+    // The separation time also follows the last frame of a block, before the end of the message
+    bool mLastFrameSent;
+    Clock::time_point mWakeUp;
+};
+
+class ReceiverISO15765 {
+public:
+    enum Event {
+        NONE = 0,
+        // Write the flow control frame, before handling a complete message
+        FLOW_CONTROL = 1,
+        COMPLETE = 2
+    };
+
+    ReceiverISO15765(Configuration &configuration, const BufferPoolPtr &pool, uint32_t flowControlPid);
+    ~ReceiverISO15765();
+
+    // Events of the frame: flowControl is filled with FLOW_CONTROL, msg with COMPLETE
+    unsigned int onFrame(const CanFrame &frame, CanFrame &flowControl, PASSTHRU_MSG &msg);
+
+    bool isReceiving() const;
+
+    void clear();
+
+private:
+    void prepareFlowControl(CanFrame &flowControl);
+
+    Configuration &mConfiguration;
+    BufferPoolPtr mPool;
+    uint32_t mFlowControlPid;
+    bool mReceiving;
+    unsigned int mSequence;
+    unsigned long mBs;
+    // Payload of the message being received, from the first frame to the last one
+    std::unique_ptr<uint8_t[]> mBuffer;
+    size_t mRxSize;
+    uint32_t mRxPid;
+    size_t mOffset;
+};
+
+#endif //_ISO15765_ENGINE_H
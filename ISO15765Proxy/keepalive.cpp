@@ -0,0 +1,187 @@
+#include "keepalive.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <stdio.h>
+
+#include "iso15765_engine.h"
+#include "simple.h"
+#include "uds.h"
+
+#define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
+
+#define CAN_DATA_SIZE 8
+#define J2534_PCI_SIZE 1
+#define ISO15765_MAX_SF_SIZE (CAN_DATA_SIZE - J2534_PCI_SIZE)
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+KeepAlive::KeepAlive(Channel &channel, Clock &clock): mChannel(channel), mClock(clock), mSent(0), mPostponed(0) {
+}
+
+KeepAlive::~KeepAlive() {
+}
+
+std::vector<KeepAlive::Target>::iterator KeepAlive::find(uint32_t target) {
+    return std::find_if(mTargets.begin(), mTargets.end(), [&](const Target &entry) {
+        return entry.target == target;
+    });
+}
+
+// Single frame of the TesterPresent, padded as the requests of the target
+void KeepAlive::toMsg(const Target &entry, PASSTHRU_MSG &msg) {
+    static const uint8_t testerPresent[] = {UDS_TESTER_PRESENT, UDS_SUPPRESS_POSITIVE_RESPONSE};
+    SenderISO15765 sender;
+    CanFrame frame;
+    sender.start(entry.target, entry.txFlags, testerPresent, sizeof(testerPresent));
+    sender.next(frame, mClock.now());
+    frameToMsg(frame, msg);
+}
+
+void KeepAlive::run(Target &entry) {
+    PASSTHRU_MSG msg;
+    toMsg(entry, msg);
+    entry.periodic = mChannel.startPeriodicMsg(&msg, entry.interval);
+    entry.running = true;
+    entry.since = mClock.now();
+}
+
+void KeepAlive::halt(Target &entry) {
+    if(!entry.running) {
+        return;
+    }
+    mSent += getPeriods(entry);
+    entry.running = false;
+    mChannel.stopPeriodicMsg(entry.periodic);
+    entry.periodic = nullptr;
+}
+
+// Keepalives sent by the adapter since the periodic message was started
+unsigned long KeepAlive::getPeriods(const Target &entry) const {
+    if(!entry.running) {
+        return 0;
+    }
+    return (mClock.now() - entry.since) / std::chrono::milliseconds(entry.interval);
+}
+
+void KeepAlive::start(uint32_t responsePid, const ISO15765_KEEPALIVE &keepAlive) {
+    unsigned long s3 = (keepAlive.S3 != 0) ? keepAlive.S3 : KEEPALIVE_DEFAULT_S3;
+    unsigned long margin = (keepAlive.Margin != 0) ? keepAlive.Margin : KEEPALIVE_DEFAULT_MARGIN;
+    if(margin >= s3 || s3 - margin < KEEPALIVE_MIN_INTERVAL || s3 - margin > KEEPALIVE_MAX_INTERVAL) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    auto it = find(keepAlive.TargetID);
+    if(it == mTargets.end()) {
+        it = mTargets.insert(mTargets.end(), Target());
+        it->running = false;
+        it->testerPresent = false;
+    } else {
+        halt(*it);
+    }
+    it->target = keepAlive.TargetID;
+    it->responsePid = responsePid;
+    it->txFlags = keepAlive.TxFlags;
+    it->interval = s3 - margin;
+
+    // The requests sent before are unknown, the first keepalive is sent right away
+    PASSTHRU_MSG msg;
+    toMsg(*it, msg);
+    unsigned long count = 1;
+    mChannel.writeMsgs(&msg, &count, 0);
+    mSent += count;
+    run(*it);
+}
+
+void KeepAlive::stop(uint32_t target) {
+    auto it = find(target);
+    if(it == mTargets.end()) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    halt(*it);
+    mTargets.erase(it);
+}
+
+void KeepAlive::clear() {
+    for(Target &entry: mTargets) {
+        halt(entry);
+    }
+    mTargets.clear();
+}
+
+bool KeepAlive::contains(uint32_t target) const {
+    return std::any_of(mTargets.begin(), mTargets.end(), [&](const Target &entry) {
+        return entry.target == target;
+    });
+}
+
+bool KeepAlive::empty() const {
+    return mTargets.empty();
+}
+
+void KeepAlive::request(uint32_t target, const PASSTHRU_MSG &msg) {
+    auto it = find(target);
+    if(it == mTargets.end()) {
+        return;
+    }
+    size_t size = UdsClient::payloadSize(msg);
+    // A client waits for the response before its next request
+    it->testerPresent = (size >= 1 && UdsClient::payload(msg)[0] == UDS_TESTER_PRESENT);
+    if(!it->running) {
+        return;
+    }
+    std::chrono::milliseconds interval(it->interval);
+    Clock::time_point next = it->since + interval * (getPeriods(*it) + 1);
+    if(size > ISO15765_MAX_SF_SIZE || next - mClock.now() < interval / 2) {
+        halt(*it);
+        mPostponed++;
+    }
+}
+
+void KeepAlive::resume() {
+    for(Target &entry: mTargets) {
+        if(!entry.running) {
+            // The requests went out, a failure is retried after the next ones
+            try {
+                run(entry);
+            } catch(J2534Exception &exception) {
+                LOG_DEBUG("Can't start the keepalive of %X: %ld", (unsigned int)entry.target, exception.code());
+            }
+        }
+    }
+}
+
+bool KeepAlive::isResponse(const PASSTHRU_MSG &msg) {
+    const uint8_t *data = UdsClient::payload(msg);
+    size_t size = UdsClient::payloadSize(msg);
+    bool positive = (size >= 1 && data[0] == UDS_POSITIVE_RESPONSE(UDS_TESTER_PRESENT));
+    bool negative = (size >= 2 && data[0] == UDS_NEGATIVE_RESPONSE && data[1] == UDS_TESTER_PRESENT);
+    if(!positive && !negative) {
+        return false;
+    }
+    uint32_t pid = data2pid(msg.Data);
+    auto it = std::find_if(mTargets.begin(), mTargets.end(), [&](const Target &entry) {
+        return entry.responsePid == pid;
+    });
+    if(it == mTargets.end()) {
+        return false;
+    }
+    if(it->testerPresent) {
+        it->testerPresent = false;
+        return false;
+    }
+    // The keepalives suppress the positive response
+    return negative;
+}
+
+void KeepAlive::getStats(ISO15765_KEEPALIVE_STATS &stats) const {
+    stats.Sent = mSent;
+    for(const Target &entry: mTargets) {
+        stats.Sent += getPeriods(entry);
+    }
+    stats.Postponed = mPostponed;
+    stats.Targets = mTargets.size();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#ifndef _KEEPALIVE_H
+#define _KEEPALIVE_H
+
+#include <vector>
+
+#include "ISO15765Proxy.h"
+#include "internal.h"
+#include "clock.h"
+
+DEFINE_SHARED(KeepAlive)
+
+#define UDS_TESTER_PRESENT 0x3E
+#define UDS_SUPPRESS_POSITIVE_RESPONSE 0x80
+
+#define KEEPALIVE_DEFAULT_S3 5000
+#define KEEPALIVE_DEFAULT_MARGIN 1000
+
+// Time intervals accepted by PassThruStartPeriodicMsg
+#define KEEPALIVE_MIN_INTERVAL 5
+#define KEEPALIVE_MAX_INTERVAL 65535
+
+/*
+ * TesterPresent of the targets, sent every S3 minus the margin by a periodic message of the CAN channel: the adapter
+ * keeps the sessions open while the application makes no call. Restarting the periodic message costs two calls to the
+ * adapter, so a request only does it when the keepalive is due within half an interval: the keepalives go out at
+ * least half an interval after the last request. The periodic message is stopped while a segmented request is sent,
+ * a keepalive between its frames would cut it.
+ */
+class KeepAlive {
+public:
+    KeepAlive(Channel &channel, Clock &clock);
+    ~KeepAlive();
+
+    void start(uint32_t responsePid, const ISO15765_KEEPALIVE &keepAlive);
+
+    void stop(uint32_t target);
+
+    void clear();
+
+    bool contains(uint32_t target) const;
+
+    bool empty() const;
+
+    // A request of the application is about to be sent to the target, its keepalive may be held back until resume()
+    void request(uint32_t target, const PASSTHRU_MSG &msg);
+
+    // The keepalives held back start over, a whole interval after the requests
+    void resume();
+
+    // True for the responses to the keepalives, which are not returned to the application
+    bool isResponse(const PASSTHRU_MSG &msg);
+
+    void getStats(ISO15765_KEEPALIVE_STATS &stats) const;
+
+private:
+    struct Target {
+        uint32_t target;
+        uint32_t responsePid;
+        unsigned long txFlags;
+        unsigned long interval;
+        // False while held back
+        bool running;
+        PeriodicMessagePtr periodic;
+        Clock::time_point since;
+        // The application has its own TesterPresent outstanding
+        bool testerPresent;
+    };
+
+    std::vector<Target>::iterator find(uint32_t target);
+
+    void toMsg(const Target &entry, PASSTHRU_MSG &msg);
+
+    void run(Target &entry);
+
+    void halt(Target &entry);
+
+    unsigned long getPeriods(const Target &entry) const;
+
+    Channel &mChannel;
+    Clock &mClock;
+    std::vector<Target> mTargets;
+    unsigned long mSent;
+    unsigned long mPostponed;
+};
+
+#endif //_KEEPALIVE_H
@@ -0,0 +1,175 @@
+#include "lzss.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+// Ring buffer position of the first byte written
+#define LZSS_START (LZSS_WINDOW_SIZE - LZSS_MAX_MATCH)
+// Matches can't reach the bytes being replaced in the ring buffer
+#define LZSS_MAX_DISTANCE LZSS_START
+
+#define HASH_BITS 14
+#define HASH_SIZE (1 << HASH_BITS)
+#define MAX_CHAIN 64
+#define NO_POSITION ((size_t)-1)
+
+// Items of a flag byte
+#define GROUP_SIZE 8
+
+static size_t hash3(const uint8_t *data) {
+    return ((data[0] << 10) ^ (data[1] << 5) ^ data[2]) & (HASH_SIZE - 1);
+}
+
+LzssCompressor::LzssCompressor(const uint8_t *data, size_t size, size_t threads): mData(data), mSize(size),
+        mChunks((size + LZSS_CHUNK_SIZE - 1) / LZSS_CHUNK_SIZE), mNextChunk(0), mStopped(false), mChunk(0), mItem(0),
+        mByte(0), mPackedOffset(0), mConsumed(0) {
+    for(Chunk &chunk: mChunks) {
+        chunk.ready = false;
+    }
+    threads = std::max<size_t>(1, std::min(threads, mChunks.size()));
+    for(size_t i = 0; i < threads; ++i) {
+        mWorkers.emplace_back(&LzssCompressor::work, this);
+    }
+}
+
+LzssCompressor::~LzssCompressor() {
+    mStopped = true;
+    for(std::thread &worker: mWorkers) {
+        worker.join();
+    }
+}
+
+void LzssCompressor::work() {
+    // Chunks are taken in order, so that the first ones to be sent are the first ones ready
+    size_t index;
+    while(!mStopped && (index = mNextChunk++) < mChunks.size()) {
+        match(index);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mChunks[index].ready = true;
+        mReady.notify_all();
+    }
+}
+
+void LzssCompressor::match(size_t index) {
+    Chunk &chunk = mChunks[index];
+    size_t begin = index * LZSS_CHUNK_SIZE;
+    size_t end = std::min(begin + LZSS_CHUNK_SIZE, mSize);
+    size_t base = (begin > LZSS_MAX_DISTANCE) ? begin - LZSS_MAX_DISTANCE : 0;
+
+    // Positions are relative to base, the chains link the previous positions of the same hash
+    std::vector<size_t> head(HASH_SIZE, NO_POSITION);
+    std::vector<size_t> previous(end - base, NO_POSITION);
+    auto insert = [&](size_t position) {
+        if(position + LZSS_MIN_MATCH <= mSize) {
+            size_t h = hash3(&mData[position]);
+            previous[position - base] = head[h];
+            head[h] = position - base;
+        }
+    };
+    for(size_t position = base; position < begin; ++position) {
+        insert(position);
+    }
+
+    chunk.items.reserve((end - begin) / 2);
+    chunk.literals.reserve((end - begin) / 2);
+    size_t position = begin;
+    while(position < end) {
+        size_t maxLength = std::min<size_t>(LZSS_MAX_MATCH, end - position);
+        size_t bestLength = 0;
+        size_t bestPosition = 0;
+        if(maxLength >= LZSS_MIN_MATCH) {
+            size_t candidate = head[hash3(&mData[position])];
+            for(int chain = 0; candidate != NO_POSITION && chain < MAX_CHAIN; ++chain) {
+                size_t from = base + candidate;
+                if(position - from > LZSS_MAX_DISTANCE) {
+                    break;
+                }
+                size_t length = 0;
+                while(length < maxLength && mData[from + length] == mData[position + length]) {
+                    length++;
+                }
+                if(length > bestLength) {
+                    bestLength = length;
+                    bestPosition = from;
+                    if(length == maxLength) {
+                        break;
+                    }
+                }
+                candidate = previous[candidate];
+            }
+        }
+
+        if(bestLength >= LZSS_MIN_MATCH) {
+            size_t ring = (bestPosition + LZSS_START) & (LZSS_WINDOW_SIZE - 1);
+            chunk.items.push_back(ring & 0xFF);
+            chunk.items.push_back(((ring >> 4) & 0xF0) | (bestLength - LZSS_MIN_MATCH));
+            chunk.literals.push_back(false);
+        } else {
+            bestLength = 1;
+            chunk.items.push_back(mData[position]);
+            chunk.literals.push_back(true);
+        }
+        for(size_t i = 0; i < bestLength; ++i) {
+            insert(position++);
+        }
+    }
+}
+
+// Pack the next group of items in mPacked, return false at the end of the stream
+bool LzssCompressor::fill() {
+    mPacked.clear();
+    mPackedOffset = 0;
+    mPacked.push_back(0);
+    size_t count = 0;
+    while(count < GROUP_SIZE && mChunk < mChunks.size()) {
+        Chunk &chunk = mChunks[mChunk];
+        if(mItem == 0 && mByte == 0) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mReady.wait(lock, [&] { return chunk.ready; });
+        }
+        if(mItem == chunk.literals.size()) {
+            // The items of the chunk are no longer needed
+            std::vector<uint8_t>().swap(chunk.items);
+            std::vector<bool>().swap(chunk.literals);
+            mChunk++;
+            mItem = 0;
+            mByte = 0;
+            continue;
+        }
+        if(chunk.literals[mItem]) {
+            mPacked[0] |= 1 << count;
+            mPacked.push_back(chunk.items[mByte++]);
+            mConsumed += 1;
+        } else {
+            mPacked.push_back(chunk.items[mByte++]);
+            mPacked.push_back(chunk.items[mByte++]);
+            mConsumed += (mPacked.back() & 0x0F) + LZSS_MIN_MATCH;
+        }
+        mItem++;
+        count++;
+    }
+    if(count == 0) {
+        mPacked.clear();
+        return false;
+    }
+    return true;
+}
+
+size_t LzssCompressor::read(uint8_t *out, size_t size) {
+    size_t written = 0;
+    while(written < size) {
+        if(mPackedOffset == mPacked.size() && !fill()) {
+            break;
+        }
+        size_t length = std::min(size - written, mPacked.size() - mPackedOffset);
+        memcpy(out + written, &mPacked[mPackedOffset], length);
+        mPackedOffset += length;
+        written += length;
+    }
+    return written;
+}
+
+size_t LzssCompressor::consumed() const {
+    return mConsumed;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef _LZSS_H
+#define _LZSS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZSS_WINDOW_SIZE 4096
+#define LZSS_MAX_MATCH 18
+#define LZSS_MIN_MATCH 3
+#define LZSS_CHUNK_SIZE 0x10000
+
+/*
+ * LZSS compression as decoded by the classic Okumura decoder: 4096 bytes ring buffer filled with spaces, writing from
+ * 4078, flag bytes read from the LSB (1 for a literal), matches of 3 to 18 bytes as 12 bits position and 4 bits length.
+ *
+ * The image is cut into chunks matched on worker threads, each with the end of the previous chunk as dictionary, so
+ * that the chunks are one stream. read() packs the matched chunks in order, and only waits for a chunk which is not
+ * matched yet.
+ */
+class LzssCompressor {
+public:
+    LzssCompressor(const uint8_t *data, size_t size, size_t threads);
+    ~LzssCompressor();
+
+    // Return the number of bytes written, 0 at the end of the stream
+    size_t read(uint8_t *out, size_t size);
+
+    // Number of image bytes in the stream read so far
+    size_t consumed() const;
+
+private:
+    struct Chunk {
+        std::vector<uint8_t> items;      // Literal bytes, or the 2 bytes of the matches
+        std::vector<bool> literals;      // Per item
+        bool ready;
+    };
+
+    void work();
+    void match(size_t index);
+    bool fill();
+
+    const uint8_t *mData;
+    size_t mSize;
+    std::vector<Chunk> mChunks;
+    std::atomic<size_t> mNextChunk;
+    std::atomic<bool> mStopped;
+    std::mutex mMutex;
+    std::condition_variable mReady;
+    std::vector<std::thread> mWorkers;
+
+    // Packing
+    size_t mChunk;
+    size_t mItem;
+    size_t mByte;
+    std::vector<uint8_t> mPacked;
+    size_t mPackedOffset;
+    size_t mConsumed;
+};
+
+#endif //_LZSS_H
@@ -0,0 +1,133 @@
+#include "manifest.h"
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "simple.h"
+
+#define MAX_PART_NUMBER_LENGTH 255
+#define MAX_SEGMENTS 0x100000
+
+static int hexDigit(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Return false if the text isn't an even number of hex digits
+static bool parseHex(const char *text, uint8_t *data, size_t size) {
+    for(size_t i = 0; i < size; ++i) {
+        int high = hexDigit(text[2 * i]);
+        int low = (high < 0) ? -1 : hexDigit(text[2 * i + 1]);
+        if(low < 0) {
+            return false;
+        }
+        data[i] = (high << 4) | low;
+    }
+    return true;
+}
+
+FlashManifest::FlashManifest(const char *fileName): mFileName(fileName) {
+}
+
+FlashManifest::~FlashManifest() {
+}
+
+void FlashManifest::load() {
+    mEntries.clear();
+    FILE *file = fopen(mFileName.c_str(), "r");
+    if(file == NULL) {
+        return;
+    }
+
+    while(true) {
+        Entry entry;
+        unsigned long target, count;
+        char partNumber[MAX_PART_NUMBER_LENGTH + 1];
+        int fields = fscanf(file, "%lx %lx %lu %255s %lu", &target, &entry.address, &entry.segmentSize, partNumber, &count);
+        if(fields == EOF) {
+            break;
+        }
+        if(fields != 5 || count > MAX_SEGMENTS) {
+            goto fail;
+        }
+        entry.target = target;
+        entry.partNumber = partNumber;
+        entry.hashes.resize(count);
+        bool legacy = false;
+        for(unsigned long i = 0; i < count; ++i) {
+            char text[2 * SHA256_DIGEST_SIZE + 1];
+            if(fscanf(file, "%64s", text) != 1) {
+                goto fail;
+            }
+            size_t length = strlen(text);
+            if(length < 2 * SHA256_DIGEST_SIZE) {
+                // 64 bits hash of an older version
+                legacy = true;
+                if(!parseHex(text, entry.hashes[i].data(), length / 2)) {
+                    goto fail;
+                }
+            } else if(!parseHex(text, entry.hashes[i].data(), SHA256_DIGEST_SIZE)) {
+                goto fail;
+            }
+        }
+        if(!legacy) {
+            mEntries.push_back(entry);
+        }
+    }
+    fclose(file);
+    return;
+
+fail:
+    fclose(file);
+    mEntries.clear();
+    throw J2534Exception(ERR_FAILED);
+}
+
+void FlashManifest::save() const {
+    FILE *file = fopen(mFileName.c_str(), "w");
+    if(file == NULL) {
+        throw J2534Exception(ERR_FAILED);
+    }
+    for(const Entry &entry: mEntries) {
+        fprintf(file, "%lX %lX %lu %s %lu", (unsigned long)entry.target, entry.address, entry.segmentSize,
+                entry.partNumber.c_str(), (unsigned long)entry.hashes.size());
+        for(const Sha256Digest &hash: entry.hashes) {
+            fprintf(file, " ");
+            for(uint8_t byte: hash) {
+                fprintf(file, "%02X", byte);
+            }
+        }
+        fprintf(file, "\n");
+    }
+    if(fclose(file) != 0) {
+        throw J2534Exception(ERR_FAILED);
+    }
+}
+
+const FlashManifest::Entry *FlashManifest::find(uint32_t target, unsigned long address) const {
+    auto it = std::find_if(mEntries.begin(), mEntries.end(), [&](const Entry &entry) {
+        return entry.target == target && entry.address == address;
+    });
+    return (it != mEntries.end()) ? &*it : NULL;
+}
+
+void FlashManifest::set(const Entry &entry) {
+    remove(entry.target, entry.address);
+    mEntries.push_back(entry);
+}
+
+void FlashManifest::remove(uint32_t target, unsigned long address) {
+    mEntries.erase(std::remove_if(mEntries.begin(), mEntries.end(), [&](const Entry &entry) {
+        return entry.target == target && entry.address == address;
+    }), mEntries.end());
+}
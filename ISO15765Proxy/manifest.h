@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef _MANIFEST_H
+#define _MANIFEST_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "sha256.h"
+
+/*
+ * Hashes of the segments of the images last flashed, per ECU and memory region, kept in a text file:
+ * one line per region with the target, the address, the segment size, the part number and the SHA-256 of the
+ * segments. The lines with shorter hashes, from older versions, are dropped: their images are flashed entirely.
+ */
+class FlashManifest {
+public:
+    struct Entry {
+        uint32_t target;
+        unsigned long address;
+        unsigned long segmentSize;
+        std::string partNumber;
+        std::vector<Sha256Digest> hashes;
+    };
+
+    FlashManifest(const char *fileName);
+    ~FlashManifest();
+
+    // A missing file is an empty manifest
+    void load();
+
+    void save() const;
+
+    const Entry *find(uint32_t target, unsigned long address) const;
+
+    void set(const Entry &entry);
+
+    void remove(uint32_t target, unsigned long address);
+
+private:
+    std::string mFileName;
+    std::vector<Entry> mEntries;
+};
+
+#endif //_MANIFEST_H
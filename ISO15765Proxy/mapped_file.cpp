@@ -0,0 +1,193 @@
+#include "mapped_file.h"
+
+#include "simple.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //__linux__
+
+#ifdef _WIN32
+MappedFile::MappedFile(): mData(NULL), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(NULL) {
+}
+#endif //_WIN32
+
+#ifdef __linux__
+MappedFile::MappedFile(): mData(NULL), mSize(0), mFd(-1) {
+}
+#endif //__linux__
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+void MappedFile::create(const char *path, size_t size) {
+    close();
+    mFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(mFile == INVALID_HANDLE_VALUE) {
+        goto fail;
+    }
+    {
+        LARGE_INTEGER fileSize;
+        fileSize.QuadPart = size;
+        if(!SetFilePointerEx(mFile, fileSize, NULL, FILE_BEGIN) || !SetEndOfFile(mFile)) {
+            goto fail;
+        }
+    }
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if(mMapping == NULL) {
+        goto fail;
+    }
+    mData = reinterpret_cast<uint8_t *>(MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, size));
+    if(mData == NULL) {
+        goto fail;
+    }
+    mSize = size;
+    return;
+fail:
+    close();
+    throw J2534Exception(ERR_FAILED);
+}
+
+void MappedFile::open(const char *path) {
+    close();
+    mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(mFile == INVALID_HANDLE_VALUE) {
+        goto fail;
+    }
+    {
+        LARGE_INTEGER fileSize;
+        if(!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0 || (ULONGLONG)fileSize.QuadPart > (SIZE_T)-1) {
+            goto fail;
+        }
+        mSize = (size_t)fileSize.QuadPart;
+    }
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mMapping == NULL) {
+        goto fail;
+    }
+    mData = reinterpret_cast<uint8_t *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if(mData == NULL) {
+        goto fail;
+    }
+    return;
+fail:
+    close();
+    throw J2534Exception(ERR_FAILED);
+}
+
+void MappedFile::release(const uint8_t *begin, const uint8_t *end) const {
+    // Unlocking pages which are not locked removes them from the working set
+    if(mData != NULL && end > begin) {
+        VirtualUnlock(const_cast<uint8_t *>(begin), end - begin);
+    }
+}
+
+void MappedFile::close() {
+    if(mData != NULL) {
+        FlushViewOfFile(mData, mSize);
+        UnmapViewOfFile(mData);
+    }
+    if(mMapping != NULL) {
+        CloseHandle(mMapping);
+    }
+    if(mFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(mFile);
+    }
+    mData = NULL;
+    mSize = 0;
+    mMapping = NULL;
+    mFile = INVALID_HANDLE_VALUE;
+}
+
+void MappedFile::flush() {
+    if(mData != NULL && !FlushViewOfFile(mData, mSize)) {
+        throw J2534Exception(ERR_FAILED);
+    }
+}
+#endif //_WIN32
+
+#ifdef __linux__
+void MappedFile::create(const char *path, size_t size) {
+    close();
+    mFd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if(mFd < 0 || ftruncate(mFd, size) != 0) {
+        goto fail;
+    }
+    {
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+        if(data == MAP_FAILED) {
+            goto fail;
+        }
+        mData = reinterpret_cast<uint8_t *>(data);
+    }
+    mSize = size;
+    return;
+fail:
+    close();
+    throw J2534Exception(ERR_FAILED);
+}
+
+void MappedFile::open(const char *path) {
+    close();
+    struct stat st;
+    mFd = ::open(path, O_RDONLY);
+    if(mFd < 0 || fstat(mFd, &st) != 0 || st.st_size <= 0) {
+        goto fail;
+    }
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, mFd, 0);
+        if(data == MAP_FAILED) {
+            goto fail;
+        }
+        mData = reinterpret_cast<uint8_t *>(data);
+    }
+    mSize = st.st_size;
+    // Read ahead, and drop the pages read first when memory is short
+    madvise(mData, mSize, MADV_SEQUENTIAL);
+    return;
+fail:
+    close();
+    throw J2534Exception(ERR_FAILED);
+}
+
+void MappedFile::release(const uint8_t *begin, const uint8_t *end) const {
+    // Whole pages only, from the page of begin up to the page of end
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(begin) & ~(pageSize - 1);
+    uintptr_t last = reinterpret_cast<uintptr_t>(end) & ~(pageSize - 1);
+    if(mData != NULL && last > first) {
+        madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+    }
+}
+
+void MappedFile::close() {
+    if(mData != NULL) {
+        msync(mData, mSize, MS_SYNC);
+        munmap(mData, mSize);
+    }
+    if(mFd >= 0) {
+        ::close(mFd);
+    }
+    mData = NULL;
+    mSize = 0;
+    mFd = -1;
+}
+
+void MappedFile::flush() {
+    if(mData != NULL && msync(mData, mSize, MS_SYNC) != 0) {
+        throw J2534Exception(ERR_FAILED);
+    }
+}
+#endif //__linux__
+
+uint8_t *MappedFile::data() const {
+    return mData;
+}
+
+size_t MappedFile::size() const {
+    return mSize;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif //_WIN32
+
+/*
+ * File mapped in memory, written in place or read by the engines of the ISO15765 layer. Failures throw J2534Exception.
+ */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Open or create the file, read and write, resized to size bytes: the existing content is kept
+    void create(const char *path, size_t size);
+
+    // Open an existing file, read only, mapped as a whole
+    void open(const char *path);
+
+    void close();
+
+    // Write the modified pages back to the file
+    void flush();
+
+    // Drop the pages before end from the working set, they are read again from the file if needed
+    void release(const uint8_t *begin, const uint8_t *end) const;
+
+    uint8_t *data() const;
+
+    size_t size() const;
+
+private:
+    uint8_t *mData;
+    size_t mSize;
+
+#ifdef _WIN32
+    HANDLE mFile;
+    HANDLE mMapping;
+#endif //_WIN32
+
+#ifdef __linux__
+    int mFd;
+#endif //__linux__
+};
+
+#endif //_MAPPED_FILE_H
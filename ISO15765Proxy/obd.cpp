@@ -0,0 +1,245 @@
+#include "obd.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <string.h>
+
+#include "simple.h"
+#include "utils.h"
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+// SAE J1979 mode 01 data lengths, from PID 0x00
+static const uint8_t obdDataLengths[] = {
+    4, 4, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, // 0x00
+    2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, // 0x10
+    4, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1, // 0x20
+    1, 2, 2, 1, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2, // 0x30
+    4, 4, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 4, // 0x40
+    4, 1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1, // 0x50
+    4                                               // 0x60
+};
+
+size_t ObdPoller::getDataLength(uint8_t pid) {
+    return (pid < sizeof(obdDataLengths)) ? obdDataLengths[pid] : 0;
+}
+
+bool ObdPoller::later(const Entry &a, const Entry &b) {
+    return a.due > b.due || (a.due == b.due && a.order > b.order);
+}
+
+// Whole milliseconds to wait, rounded up so that a read never returns before the wake up time
+static unsigned long waitTime(const Clock::time_point &now, const Clock::time_point &wake) {
+    if(wake <= now) {
+        return 1;
+    }
+    return (std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count() + 999) / 1000;
+}
+
+ObdPoller::ObdPoller(Channel &channel, Clock &clock): mChannel(channel), mClock(clock), mNextId(1), mNextOrder(0),
+        mRequests(0), mTimeouts(0) {
+}
+
+ObdPoller::~ObdPoller() {
+}
+
+unsigned long ObdPoller::start(const UdsClientPtr &client, const ISO15765_OBD_POLL &poll) {
+    size_t length = (poll.DataLength != 0) ? poll.DataLength : getDataLength(poll.Pid & 0xFF);
+    if(poll.Pid > 0xFF || length == 0 || length > OBD_MAX_DATA_LENGTH) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+
+    auto it = std::find_if(mTargets.begin(), mTargets.end(), [&](const Target &target) {
+        return target.client->getRequestPid() == client->getRequestPid();
+    });
+    if(it == mTargets.end()) {
+        Target target;
+        target.client = client;
+        target.outstanding = false;
+        it = mTargets.insert(mTargets.end(), target);
+    }
+    for(const Entry &entry: it->heap) {
+        if(entry.pid == poll.Pid) {
+            // A PID can only appear once in a request
+            throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+        }
+    }
+
+    Entry entry;
+    entry.id = mNextId++;
+    entry.pid = poll.Pid;
+    entry.length = length;
+    entry.period = std::chrono::milliseconds(poll.Period);
+    entry.due = mClock.now();
+    entry.order = mNextOrder++;
+    it->heap.push_back(entry);
+    std::push_heap(it->heap.begin(), it->heap.end(), later);
+    return entry.id;
+}
+
+void ObdPoller::stop(unsigned long id) {
+    for(auto target = mTargets.begin(); target != mTargets.end(); ++target) {
+        auto it = std::find_if(target->heap.begin(), target->heap.end(), [&](const Entry &entry) {
+            return entry.id == id;
+        });
+        if(it == target->heap.end()) {
+            continue;
+        }
+        target->heap.erase(it);
+        std::make_heap(target->heap.begin(), target->heap.end(), later);
+        if(target->heap.empty() && !target->outstanding) {
+            mTargets.erase(target);
+        }
+        return;
+    }
+    throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+}
+
+void ObdPoller::stopAll() {
+    mTargets.clear();
+    mSamples.clear();
+}
+
+void ObdPoller::read(ISO15765_OBD_SAMPLE_LIST &list, unsigned long timeout) {
+    mRequests = 0;
+    mTimeouts = 0;
+    Clock::time_point deadline = mClock.now() + std::chrono::milliseconds(timeout);
+    // Leave room for a full response, so that nothing is dropped while the list is filled
+    size_t limit = std::min<size_t>(list.NumOfSamples, OBD_MAX_BUFFERED_SAMPLES - OBD_MAX_PIDS_PER_REQUEST);
+    while(mSamples.size() < limit) {
+        Clock::time_point now = mClock.now();
+        Clock::time_point wake = deadline;
+        for(auto target = mTargets.begin(); target != mTargets.end();) {
+            if(target->outstanding && now >= target->expiry) {
+                mTimeouts++;
+                // Looked at again, or the next one when it's gone
+                target = finish(target);
+                continue;
+            }
+            if(!target->outstanding) {
+                send(*target, now);
+            }
+            if(target->outstanding) {
+                wake = std::min(wake, target->expiry);
+            } else if(!target->heap.empty()) {
+                wake = std::min(wake, target->heap.front().due);
+            }
+            ++target;
+        }
+        if(now >= deadline) {
+            break;
+        }
+        if(UdsClient::read(mChannel, mMessage, waitTime(now, wake))) {
+            dispatch(mMessage);
+        }
+    }
+
+    unsigned long count = std::min<size_t>(list.NumOfSamples, mSamples.size());
+    std::copy(mSamples.begin(), mSamples.begin() + count, list.SamplePtr);
+    mSamples.erase(mSamples.begin(), mSamples.begin() + count);
+    list.NumOfSamples = count;
+    list.Requests = mRequests;
+    list.Timeouts = mTimeouts;
+}
+
+void ObdPoller::send(Target &target, const Clock::time_point &now) {
+    uint8_t request[1 + OBD_MAX_PIDS_PER_REQUEST];
+    size_t size = 0;
+    request[size++] = OBD_SHOW_CURRENT_DATA;
+
+    Entry packed[OBD_MAX_PIDS_PER_REQUEST];
+    size_t count = 0;
+    std::vector<Entry> &heap = target.heap;
+    while(!heap.empty() && heap.front().due <= now && count < OBD_MAX_PIDS_PER_REQUEST) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        packed[count++] = heap.back();
+        heap.pop_back();
+        request[size++] = packed[count - 1].pid;
+    }
+    if(count == 0) {
+        return;
+    }
+
+    // Missed periods are skipped rather than sent in a burst
+    for(size_t i = 0; i < count; ++i) {
+        Entry &entry = packed[i];
+        entry.due += entry.period;
+        if(entry.due < now) {
+            entry.due = now + entry.period;
+        }
+        entry.order = mNextOrder++;
+        heap.push_back(entry);
+        std::push_heap(heap.begin(), heap.end(), later);
+    }
+
+    target.client->send(target.client->prepare(mMessage, request, size));
+    target.outstanding = true;
+    target.expiry = now + std::chrono::milliseconds(target.client->getP2());
+    mRequests++;
+}
+
+// The request of the target is answered or timed out, the target goes once all its PIDs are stopped
+std::vector<ObdPoller::Target>::iterator ObdPoller::finish(std::vector<Target>::iterator target) {
+    target->outstanding = false;
+    if(target->heap.empty()) {
+        return mTargets.erase(target);
+    }
+    return target;
+}
+
+void ObdPoller::dispatch(const PASSTHRU_MSG &msg) {
+    uint32_t pid = data2pid(msg.Data);
+    auto target = std::find_if(mTargets.begin(), mTargets.end(), [&](const Target &target) {
+        return target.client->getResponsePid() == pid;
+    });
+    if(target == mTargets.end()) {
+        return;
+    }
+
+    const uint8_t *data = UdsClient::payload(msg);
+    size_t size = UdsClient::payloadSize(msg);
+    if(data[0] == UDS_POSITIVE_RESPONSE(OBD_SHOW_CURRENT_DATA)) {
+        parse(*target, data, size);
+        finish(target);
+    } else if(size >= 3 && data[0] == UDS_NEGATIVE_RESPONSE && data[1] == OBD_SHOW_CURRENT_DATA) {
+        if(data[2] == UDS_NRC_RESPONSE_PENDING) {
+            target->expiry = mClock.now() + std::chrono::milliseconds(target->client->getP2Star());
+        } else {
+            mTimeouts++;
+            finish(target);
+        }
+    }
+}
+
+void ObdPoller::parse(Target &target, const uint8_t *data, size_t size) {
+    unsigned long timestamp = std::chrono::duration_cast<std::chrono::microseconds>(mClock.now().time_since_epoch()).count();
+
+    // [0x41] then [PID][data] for each supported PID, the ECU omits the others
+    size_t offset = 1;
+    while(offset < size) {
+        uint8_t pid = data[offset];
+        auto entry = std::find_if(target.heap.begin(), target.heap.end(), [&](const Entry &entry) {
+            return entry.pid == pid;
+        });
+        if(entry == target.heap.end() || offset + 1 + entry->length > size) {
+            break;
+        }
+
+        ISO15765_OBD_SAMPLE sample;
+        memset(&sample, 0, sizeof(sample));
+        sample.TargetID = target.client->getRequestPid();
+        sample.Pid = pid;
+        sample.Timestamp = timestamp;
+        sample.DataSize = entry->length;
+        memcpy(sample.Data, &data[offset + 1], entry->length);
+        if(mSamples.size() >= OBD_MAX_BUFFERED_SAMPLES) {
+            mSamples.pop_front();
+        }
+        mSamples.push_back(sample);
+
+        offset += 1 + entry->length;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef _OBD_H
+#define _OBD_H
+
+#include <deque>
+#include <vector>
+
+#include "ISO15765Proxy.h"
+#include "uds.h"
+
+DEFINE_SHARED(ObdPoller)
+
+#define OBD_SHOW_CURRENT_DATA 0x01
+#define OBD_MAX_PIDS_PER_REQUEST 6
+#define OBD_MAX_DATA_LENGTH 8
+#define OBD_MAX_BUFFERED_SAMPLES 1024
+
+/*
+ * Scheduler of mode 01 PID reads. Each target keeps its PIDs in a min-heap ordered by due time; when the target has
+ * no request in flight, the due PIDs (up to 6) are packed in one request. Requests to different targets are in
+ * flight at the same time, and the responses are split into samples, buffered until they are read.
+ */
+class ObdPoller {
+public:
+    ObdPoller(Channel &channel, Clock &clock);
+    ~ObdPoller();
+
+    unsigned long start(const UdsClientPtr &client, const ISO15765_OBD_POLL &poll);
+
+    void stop(unsigned long id);
+
+    void stopAll();
+
+    // Poll until the list is full or the timeout is elapsed
+    void read(ISO15765_OBD_SAMPLE_LIST &list, unsigned long timeout);
+
+    // Number of data bytes of a PID as defined by SAE J1979, 0 if unknown
+    static size_t getDataLength(uint8_t pid);
+
+private:
+    struct Entry {
+        unsigned long id;
+        uint8_t pid;
+        size_t length;
+        Clock::duration period;
+        Clock::time_point due;
+        unsigned long order; // Entries due at the same time are sent in turn
+    };
+
+    struct Target {
+        UdsClientPtr client;
+        std::vector<Entry> heap;
+        bool outstanding;
+        Clock::time_point expiry;
+    };
+
+    static bool later(const Entry &a, const Entry &b);
+
+    void send(Target &target, const Clock::time_point &now);
+    std::vector<Target>::iterator finish(std::vector<Target>::iterator target);
+    void dispatch(const PASSTHRU_MSG &msg);
+    void parse(Target &target, const uint8_t *data, size_t size);
+
+    Channel &mChannel;
+    Clock &mClock;
+    unsigned long mNextId;
+    unsigned long mNextOrder;
+    std::vector<Target> mTargets;
+    std::deque<ISO15765_OBD_SAMPLE> mSamples;
+    unsigned long mRequests;
+    unsigned long mTimeouts;
+    PASSTHRU_MSG mMessage;
+};
+
+#endif //_OBD_H
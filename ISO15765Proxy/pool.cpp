@@ -0,0 +1,76 @@
+#include "pool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+#include <stdint.h>
+
+// Block sizes are multiples of the alignment; a ChannelISO15765 and its control block fit in the largest
+#define POOL_ALIGNMENT alignof(std::max_align_t)
+#define POOL_MAX_BLOCK_SIZE 8192
+#define POOL_ARENAS (POOL_MAX_BLOCK_SIZE / POOL_ALIGNMENT)
+#define POOL_SLAB_SIZE 16384
+
+static std::atomic<PoolArena *> arenas[POOL_ARENAS];
+
+PoolArena::PoolArena(size_t blockSize): mBlockSize(blockSize), mFree(NULL) {
+}
+
+PoolArena *PoolArena::forSize(size_t size) {
+    if(size == 0 || size > POOL_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+    size_t index = (size - 1) / POOL_ALIGNMENT;
+    PoolArena *arena = arenas[index].load(std::memory_order_acquire);
+    if(arena == NULL) {
+        // Two threads may race on a new arena: the loser drops its own
+        PoolArena *created = new PoolArena((index + 1) * POOL_ALIGNMENT);
+        if(arenas[index].compare_exchange_strong(arena, created, std::memory_order_acq_rel)) {
+            arena = created;
+        } else {
+            delete created;
+        }
+    }
+    return arena;
+}
+
+void *PoolArena::allocate() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mFree == NULL) {
+        size_t count = (mBlockSize < POOL_SLAB_SIZE) ? (POOL_SLAB_SIZE / mBlockSize) : 1;
+        uint8_t *slab = static_cast<uint8_t *>(::operator new(count * mBlockSize));
+        for(size_t i = count; i > 0; --i) {
+            FreeBlock *block = reinterpret_cast<FreeBlock *>(slab + (i - 1) * mBlockSize);
+            block->next = mFree;
+            mFree = block;
+        }
+    }
+    FreeBlock *block = mFree;
+    mFree = block->next;
+    return block;
+}
+
+void PoolArena::deallocate(void *block) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    FreeBlock *freeBlock = static_cast<FreeBlock *>(block);
+    freeBlock->next = mFree;
+    mFree = freeBlock;
+}
+
+void *poolAllocate(size_t size) {
+    PoolArena *arena = PoolArena::forSize(size);
+    if(arena == NULL) {
+        return ::operator new(size);
+    }
+    return arena->allocate();
+}
+
+void poolDeallocate(void *ptr, size_t size) {
+    PoolArena *arena = PoolArena::forSize(size);
+    if(arena == NULL) {
+        ::operator delete(ptr);
+        return;
+    }
+    arena->deallocate(ptr);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <stddef.h>
+
+/*
+ * Free lists of fixed size blocks, carved from slabs. Filters, transfers and channels are created and destroyed at a
+ * high rate by the scanners: their blocks, shared_ptr control blocks included, are reused instead of going back to
+ * the heap. Arenas and their slabs live until the end of the process.
+ */
+class PoolArena {
+public:
+    // Arena of the blocks of at least size bytes, NULL if size is above the largest block
+    static PoolArena *forSize(size_t size);
+
+    void *allocate();
+
+    void deallocate(void *block);
+
+private:
+    PoolArena(size_t blockSize);
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    std::mutex mMutex;
+    size_t mBlockSize;
+    FreeBlock *mFree;
+};
+
+// Blocks above the largest arena come from the heap
+void *poolAllocate(size_t size);
+
+void poolDeallocate(void *ptr, size_t size);
+
+/*
+ * Standard allocator on the arenas, for std::allocate_shared
+ */
+template<typename T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+
+    PoolAllocator() noexcept {
+    }
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U> &) noexcept {
+    }
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(poolAllocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept {
+        poolDeallocate(ptr, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept {
+    return false;
+}
+
+template<typename T, typename... Args>
+std::shared_ptr<T> makePooled(Args &&... args) {
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+#endif //_POOL_H
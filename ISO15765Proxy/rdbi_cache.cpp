@@ -0,0 +1,182 @@
+#include "rdbi_cache.h"
+
+#include <chrono>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "uds.h"
+#include "utils.h"
+
+#define J2534_DATA_OFFSET 4
+
+// Service and DID
+#define RDBI_REQUEST_SIZE 3
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = (0x1F & (pid >> 24));
+    data[1] = (0xFF & (pid >> 16));
+    data[2] = (0xFF & (pid >> 8));
+    data[3] = (0xFF & (pid >> 0));
+}
+
+bool RdbiCache::Key::operator<(const Key &other) const {
+    if(target != other.target) {
+        return target < other.target;
+    }
+    if(service != other.service) {
+        return service < other.service;
+    }
+    return did < other.did;
+}
+
+RdbiCache::RdbiCache(Clock &clock): mClock(clock), mEnabled(false), mDefaultTtl(0) {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+RdbiCache::~RdbiCache() {
+}
+
+void RdbiCache::configure(bool enable, unsigned long defaultTtl) {
+    mEnabled = enable;
+    mDefaultTtl = defaultTtl;
+    if(!mEnabled) {
+        clear();
+    }
+}
+
+void RdbiCache::setTtl(uint16_t did, unsigned long ttl) {
+    mTtls[did] = ttl;
+    // Apply the new TTL from the next response
+    for(auto it = mEntries.begin(); it != mEntries.end();) {
+        it = (it->first.did == did) ? mEntries.erase(it) : std::next(it);
+    }
+}
+
+void RdbiCache::clear() {
+    mEntries.clear();
+    mPending.clear();
+    mResponses.clear();
+}
+
+bool RdbiCache::getDid(const PASSTHRU_MSG &msg, uint8_t service, size_t size, uint16_t *did) {
+    const uint8_t *data = UdsClient::payload(msg);
+    size_t payloadSize = UdsClient::payloadSize(msg);
+    if(payloadSize < RDBI_REQUEST_SIZE || data[0] != service || (size != 0 && payloadSize != size)) {
+        return false;
+    }
+    *did = (data[1] << 8) | data[2];
+    return true;
+}
+
+unsigned long RdbiCache::getTtl(uint16_t did) const {
+    auto it = mTtls.find(did);
+    return (it != mTtls.end()) ? it->second : mDefaultTtl;
+}
+
+bool RdbiCache::lookup(uint32_t target, const PASSTHRU_MSG &msg) {
+    uint16_t did;
+    if(!mEnabled) {
+        return false;
+    }
+    // Only single DID requests, the responses to several DIDs can't be split without their data lengths
+    if(!getDid(msg, UDS_READ_DATA_BY_IDENTIFIER, RDBI_REQUEST_SIZE, &did) || getTtl(did) == 0) {
+        return false;
+    }
+    Key key = {target, UDS_READ_DATA_BY_IDENTIFIER, did};
+    auto it = mEntries.find(key);
+    if(it == mEntries.end() || (!it->second.infinite && mClock.now() >= it->second.expiry)) {
+        if(it != mEntries.end()) {
+            mEntries.erase(it);
+        }
+        mStats.Misses++;
+        return false;
+    }
+    mStats.Hits++;
+
+    const Entry &entry = it->second;
+    if(mResponses.size() >= RDBI_MAX_RESPONSES) {
+        mResponses.pop_front();
+    }
+    mResponses.emplace_back();
+    PASSTHRU_MSG &response = mResponses.back();
+    memset(&response, 0, offsetof(PASSTHRU_MSG, Data));
+    response.ProtocolID = msg.ProtocolID;
+    response.Timestamp = std::chrono::duration_cast<std::chrono::microseconds>(mClock.now().time_since_epoch()).count();
+    response.DataSize = J2534_DATA_OFFSET + entry.response.size();
+    pid2Data(entry.responsePid, response.Data);
+    memcpy(&response.Data[J2534_DATA_OFFSET], entry.response.data(), entry.response.size());
+    return true;
+}
+
+void RdbiCache::sent(uint32_t target, uint32_t responsePid, const PASSTHRU_MSG &msg) {
+    uint16_t did;
+    if(!mEnabled) {
+        return;
+    }
+    if(getDid(msg, UDS_READ_DATA_BY_IDENTIFIER, RDBI_REQUEST_SIZE, &did) && getTtl(did) != 0) {
+        Pending pending = {{target, UDS_READ_DATA_BY_IDENTIFIER, did}, responsePid};
+        if(mPending.size() >= RDBI_MAX_PENDING) {
+            mPending.pop_front();
+        }
+        mPending.push_back(pending);
+    } else if(getDid(msg, UDS_WRITE_DATA_BY_IDENTIFIER, 0, &did)) {
+        Key key = {target, UDS_READ_DATA_BY_IDENTIFIER, did};
+        mStats.Invalidations += mEntries.erase(key);
+    } else if(UdsClient::payloadSize(msg) > 0) {
+        uint8_t service = UdsClient::payload(msg)[0];
+        if(service == UDS_ECU_RESET || service == UDS_DIAGNOSTIC_SESSION_CONTROL) {
+            invalidate(target);
+        }
+    }
+}
+
+void RdbiCache::received(const PASSTHRU_MSG &msg) {
+    uint16_t did;
+    if(mPending.empty() || !getDid(msg, UDS_POSITIVE_RESPONSE(UDS_READ_DATA_BY_IDENTIFIER), 0, &did)) {
+        return;
+    }
+    uint32_t responsePid = data2pid(msg.Data);
+    for(auto it = mPending.begin(); it != mPending.end(); ++it) {
+        if(it->responsePid != responsePid || it->key.did != did) {
+            continue;
+        }
+        unsigned long ttl = getTtl(did);
+        Entry &entry = mEntries[it->key];
+        entry.responsePid = responsePid;
+        entry.infinite = (ttl == ISO15765_RDBI_TTL_INFINITE);
+        entry.expiry = mClock.now() + std::chrono::milliseconds(entry.infinite ? 0 : ttl);
+        entry.response.assign(UdsClient::payload(msg), UdsClient::payload(msg) + UdsClient::payloadSize(msg));
+        mPending.erase(it);
+        return;
+    }
+}
+
+bool RdbiCache::pop(PASSTHRU_MSG &msg) {
+    if(mResponses.empty()) {
+        return false;
+    }
+    msg = mResponses.front();
+    mResponses.pop_front();
+    return true;
+}
+
+void RdbiCache::invalidate(uint32_t target) {
+    for(auto it = mEntries.begin(); it != mEntries.end();) {
+        if(it->first.target == target) {
+            it = mEntries.erase(it);
+            mStats.Invalidations++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void RdbiCache::getStats(ISO15765_RDBI_CACHE_STATS &stats) const {
+    stats = mStats;
+    stats.Entries = mEntries.size();
+}
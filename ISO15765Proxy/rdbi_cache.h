@@ -0,0 +1,87 @@
+#pragma once
+
+#ifndef _RDBI_CACHE_H
+#define _RDBI_CACHE_H
+
+#include <map>
+#include <list>
+#include <deque>
+#include <vector>
+
+#include "ISO15765Proxy.h"
+#include "internal.h"
+#include "clock.h"
+
+DEFINE_SHARED(RdbiCache)
+
+#define UDS_DIAGNOSTIC_SESSION_CONTROL 0x10
+#define UDS_ECU_RESET 0x11
+#define UDS_READ_DATA_BY_IDENTIFIER 0x22
+#define UDS_WRITE_DATA_BY_IDENTIFIER 0x2E
+
+#define RDBI_MAX_PENDING 16
+#define RDBI_MAX_RESPONSES 64
+
+/*
+ * ReadDataByIdentifier responses cached per (target, service, DID). The channel asks lookup() before sending a
+ * request and tells sent() once it is out; received() stores the positive responses to the requests sent.
+ * All of them are no-ops while the cache is disabled.
+ */
+class RdbiCache {
+public:
+    RdbiCache(Clock &clock);
+    ~RdbiCache();
+
+    void configure(bool enable, unsigned long defaultTtl);
+
+    void setTtl(uint16_t did, unsigned long ttl);
+
+    void clear();
+
+    // Return true if the request is answered from the cache, the response is then queued for pop()
+    bool lookup(uint32_t target, const PASSTHRU_MSG &msg);
+
+    void sent(uint32_t target, uint32_t responsePid, const PASSTHRU_MSG &msg);
+
+    void received(const PASSTHRU_MSG &msg);
+
+    bool pop(PASSTHRU_MSG &msg);
+
+    void getStats(ISO15765_RDBI_CACHE_STATS &stats) const;
+
+private:
+    struct Key {
+        uint32_t target;
+        uint8_t service;
+        uint16_t did;
+
+        bool operator<(const Key &other) const;
+    };
+
+    struct Entry {
+        uint32_t responsePid;
+        Clock::time_point expiry;
+        bool infinite;
+        std::vector<uint8_t> response;
+    };
+
+    struct Pending {
+        Key key;
+        uint32_t responsePid;
+    };
+
+    static bool getDid(const PASSTHRU_MSG &msg, uint8_t service, size_t size, uint16_t *did);
+    unsigned long getTtl(uint16_t did) const;
+    void invalidate(uint32_t target);
+
+    Clock &mClock;
+    bool mEnabled;
+    unsigned long mDefaultTtl;
+    std::map<uint16_t, unsigned long> mTtls;
+    std::map<Key, Entry> mEntries;
+    std::list<Pending> mPending;
+    std::deque<PASSTHRU_MSG> mResponses;
+    ISO15765_RDBI_CACHE_STATS mStats;
+};
+
+#endif //_RDBI_CACHE_H
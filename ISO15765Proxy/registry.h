@@ -0,0 +1,146 @@
+#pragma once
+
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+
+template<typename T>
+class Registry;
+
+/*
+ * Slot of an object in the registry of its parent
+ */
+class RegistryEntry {
+    template<typename T>
+    friend class Registry;
+public:
+    RegistryEntry(): mRegistrySlot(0) {
+    }
+
+private:
+    size_t mRegistrySlot;
+};
+
+/*
+ * Objects of a parent (devices of a library, channels of a device, filters and periodic messages of a channel) kept
+ * in contiguous slots, in the order they were added: the first matching filter and the snapshots depend on it. An
+ * object knows its slot: it is removed in constant time, without a scan, and leaves a hole skipped by the iteration.
+ * The holes are squeezed out once they outnumber the objects, which keeps the removals constant in amortized time.
+ */
+template<typename T>
+class Registry {
+public:
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::shared_ptr<T> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const std::shared_ptr<T> *pointer;
+        typedef const std::shared_ptr<T> &reference;
+
+        const_iterator(const std::shared_ptr<T> *it, const std::shared_ptr<T> *end): mIt(it), mEnd(end) {
+            skip();
+        }
+
+        const std::shared_ptr<T> &operator*() const {
+            return *mIt;
+        }
+
+        const_iterator &operator++() {
+            ++mIt;
+            skip();
+            return *this;
+        }
+
+        bool operator==(const const_iterator &other) const {
+            return mIt == other.mIt;
+        }
+
+        bool operator!=(const const_iterator &other) const {
+            return mIt != other.mIt;
+        }
+
+    private:
+        void skip() {
+            while(mIt != mEnd && *mIt == nullptr) {
+                ++mIt;
+            }
+        }
+
+        const std::shared_ptr<T> *mIt;
+        const std::shared_ptr<T> *mEnd;
+    };
+
+    Registry(): mCount(0) {
+    }
+
+    void add(const std::shared_ptr<T> &item) {
+        item->mRegistrySlot = mSlots.size();
+        mSlots.push_back(item);
+        mCount++;
+    }
+
+    // Objects of another registry are ignored
+    void remove(const std::shared_ptr<T> &item) {
+        if(item == nullptr) {
+            return;
+        }
+        size_t slot = item->mRegistrySlot;
+        if(slot >= mSlots.size() || mSlots[slot] != item) {
+            return;
+        }
+        mSlots[slot] = nullptr;
+        mCount--;
+        if(mSlots.size() - mCount > mCount) {
+            compact();
+        }
+    }
+
+    // Capacity is kept for the next objects
+    void clear() {
+        mSlots.clear();
+        mCount = 0;
+    }
+
+    size_t size() const {
+        return mCount;
+    }
+
+    bool empty() const {
+        return mCount == 0;
+    }
+
+    const_iterator begin() const {
+        return const_iterator(mSlots.data(), mSlots.data() + mSlots.size());
+    }
+
+    const_iterator end() const {
+        return const_iterator(mSlots.data() + mSlots.size(), mSlots.data() + mSlots.size());
+    }
+
+private:
+    void compact() {
+        size_t next = 0;
+        for(size_t slot = 0; slot < mSlots.size(); ++slot) {
+            if(mSlots[slot] == nullptr) {
+                continue;
+            }
+            if(slot != next) {
+                mSlots[next] = std::move(mSlots[slot]);
+            }
+            mSlots[next]->mRegistrySlot = next;
+            next++;
+        }
+        mSlots.resize(next);
+    }
+
+    std::vector<std::shared_ptr<T>> mSlots;
+    size_t mCount;
+};
+
+#endif //_REGISTRY_H
@@ -0,0 +1,200 @@
+#include "scan.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pool.h"
+#include "simple.h"
+#include "uds.h"
+
+#define J2534_DATA_OFFSET 4
+#define CAN_DATA_SIZE 8
+
+#define CAN_11BIT_MASK 0x7FF
+#define CAN_29BIT_MASK 0x1FFFFFFF
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = (0x1F & (pid >> 24));
+    data[1] = (0xFF & (pid >> 16));
+    data[2] = (0xFF & (pid >> 8));
+    data[3] = (0xFF & (pid >> 0));
+}
+
+static void prepareIdMessage(PASSTHRU_MSG &msg, uint32_t pid, unsigned long txFlags) {
+    memset(&msg, 0, offsetof(PASSTHRU_MSG, Data));
+    msg.ProtocolID = CAN;
+    msg.TxFlags = txFlags;
+    msg.DataSize = J2534_DATA_OFFSET;
+    pid2Data(pid, msg.Data);
+}
+
+// Whole milliseconds to wait, a read never returns before the wake up time
+static unsigned long readTime(const Clock::time_point &now, const Clock::time_point &wake) {
+    if(wake <= now) {
+        return 0;
+    }
+    return (std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count() + 999) / 1000;
+}
+
+Scanner::Scanner(Configuration &configuration, Channel &channel, Clock &clock, const BufferPoolPtr &bufferPool):
+        mConfiguration(configuration), mChannel(channel), mClock(clock), mBufferPool(bufferPool), mProbes(0) {
+    memset(&mScan, 0, sizeof(mScan));
+}
+
+Scanner::~Scanner() {
+}
+
+uint32_t Scanner::getRequestId(unsigned long index) const {
+    return mScan.FirstID + index * mScan.Step;
+}
+
+uint32_t Scanner::getResponseId(uint32_t requestId) const {
+    if(mScan.Addressing == ISO15765_SCAN_NORMAL_FIXED) {
+        return (requestId & 0xFFFF0000) | ((requestId & 0xFF) << 8) | ((requestId >> 8) & 0xFF);
+    }
+    uint32_t mask = (mScan.TxFlags & CAN_29BIT_ID) ? CAN_29BIT_MASK : CAN_11BIT_MASK;
+    return (requestId + mScan.ResponseOffset) & mask;
+}
+
+bool Scanner::getRequestIdFromResponse(uint32_t responseId, uint32_t *requestId) const {
+    uint32_t id;
+    if(mScan.Addressing == ISO15765_SCAN_NORMAL_FIXED) {
+        id = getResponseId(responseId);
+    } else {
+        uint32_t mask = (mScan.TxFlags & CAN_29BIT_ID) ? CAN_29BIT_MASK : CAN_11BIT_MASK;
+        id = (responseId - mScan.ResponseOffset) & mask;
+    }
+    // Only the IDs already probed
+    if(id < mScan.FirstID || (id - mScan.FirstID) % mScan.Step != 0 || (id - mScan.FirstID) / mScan.Step >= mProbes) {
+        return false;
+    }
+    *requestId = id;
+    return true;
+}
+
+void Scanner::run(const ISO15765_SCAN &scan, ISO15765_SCAN_LIST &list) {
+    mScan = scan;
+    mScan.Step = (scan.Step != 0) ? scan.Step : 1;
+    mScan.ResponseOffset = (scan.ResponseOffset != 0) ? scan.ResponseOffset : SCAN_DEFAULT_RESPONSE_OFFSET;
+    mScan.QuietWindow = (scan.QuietWindow != 0) ? scan.QuietWindow : SCAN_DEFAULT_QUIET_WINDOW;
+    if(scan.ProbeSize == 0) {
+        mScan.ProbeSize = 2;
+        mScan.Probe[0] = UDS_TESTER_PRESENT;
+        mScan.Probe[1] = 0x00;
+    }
+    bool extended = (scan.TxFlags & CAN_29BIT_ID) != 0;
+    if(scan.FirstID > scan.LastID || scan.LastID > (extended ? CAN_29BIT_MASK : CAN_11BIT_MASK) ||
+            mScan.ProbeSize > sizeof(mScan.Probe) || (scan.LastID - scan.FirstID) / mScan.Step >= SCAN_MAX_PROBES ||
+            (scan.Addressing != ISO15765_SCAN_OFFSET && scan.Addressing != ISO15765_SCAN_NORMAL_FIXED) ||
+            (scan.Addressing == ISO15765_SCAN_NORMAL_FIXED && !extended)) {
+        throw J2534Exception(ERR_INVALID_IOCTL_VALUE);
+    }
+    unsigned long count = (scan.LastID - scan.FirstID) / mScan.Step + 1;
+
+    // One filter for all the response IDs: the bits common to all of them
+    uint32_t first = getResponseId(scan.FirstID);
+    uint32_t diff = 0;
+    for(unsigned long i = 1; i < count; ++i) {
+        diff |= first ^ getResponseId(getRequestId(i));
+    }
+    while(diff & (diff + 1)) {
+        diff |= diff >> 1;
+    }
+    uint32_t mask = (extended ? CAN_29BIT_MASK : CAN_11BIT_MASK) & ~diff;
+    prepareIdMessage(mMessage, mask, scan.TxFlags & CAN_29BIT_ID);
+    prepareIdMessage(mResponse, first & mask, scan.TxFlags & CAN_29BIT_ID);
+    MessageFilterPtr filter = mChannel.startMsgFilter(PASS_FILTER, &mMessage, &mResponse, NULL);
+
+    mProbes = 0;
+    mResponders.clear();
+    try {
+        Clock::duration interval = std::chrono::milliseconds(scan.Interval);
+        Clock::duration quiet = std::chrono::milliseconds(mScan.QuietWindow);
+        Clock::time_point now = mClock.now();
+        Clock::time_point nextProbe = now;
+        Clock::time_point quietEnd = now + quiet;
+        while(true) {
+            now = mClock.now();
+            if(mProbes < count && now >= nextProbe) {
+                sendProbe(getRequestId(mProbes++));
+                now = mClock.now();
+                nextProbe = now + interval;
+                quietEnd = now + quiet;
+            }
+            if(mProbes >= count && now >= quietEnd) {
+                break;
+            }
+            CanFrame frame;
+            if(UdsClient::read(mChannel, mMessage, readTime(now, (mProbes < count) ? nextProbe : quietEnd)) &&
+                    msgToFrame(mMessage, frame)) {
+                dispatch(frame);
+                quietEnd = std::max(quietEnd, mClock.now() + quiet);
+            }
+        }
+    } catch(std::exception &ex) {
+        mChannel.stopMsgFilter(filter);
+        throw;
+    }
+    mChannel.stopMsgFilter(filter);
+
+    unsigned long responders = 0;
+    for(auto it = mResponders.begin(); it != mResponders.end() && responders < list.NumOfResponders; ++it) {
+        list.ResponderPtr[responders++] = it->second.result;
+    }
+    list.NumOfResponders = responders;
+    list.Probes = mProbes;
+}
+
+void Scanner::sendProbe(uint32_t requestId) {
+    PASSTHRU_MSG &msg = mMessage;
+    prepareIdMessage(msg, requestId, mScan.TxFlags & CAN_29BIT_ID);
+    msg.Data[J2534_DATA_OFFSET] = mScan.ProbeSize;
+    memcpy(&msg.Data[J2534_DATA_OFFSET + 1], mScan.Probe, mScan.ProbeSize);
+    msg.DataSize = J2534_DATA_OFFSET + 1 + mScan.ProbeSize;
+    if(mScan.TxFlags & ISO15765_FRAME_PAD) {
+        memset(&msg.Data[msg.DataSize], 0, J2534_DATA_OFFSET + CAN_DATA_SIZE - msg.DataSize);
+        msg.DataSize = J2534_DATA_OFFSET + CAN_DATA_SIZE;
+    }
+    unsigned long c = 1;
+    mChannel.writeMsgs(&msg, &c, 0);
+}
+
+void Scanner::dispatch(const CanFrame &frame) {
+    uint32_t responseId = frame.id;
+    uint32_t requestId;
+    if(frame.size == 0 || !getRequestIdFromResponse(responseId, &requestId)) {
+        return;
+    }
+
+    auto it = mResponders.find(requestId);
+    if(it == mResponders.end()) {
+        // A responder starts with a single or a first frame
+        uint8_t frameType = frame.data[0] >> 4;
+        if(frameType > 1) {
+            return;
+        }
+        PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+        prepareIdMessage(maskMsg, 0xFFFFFFFF, mScan.TxFlags & CAN_29BIT_ID);
+        prepareIdMessage(patternMsg, responseId, mScan.TxFlags & CAN_29BIT_ID);
+        prepareIdMessage(flowControlMsg, requestId, mScan.TxFlags & CAN_29BIT_ID);
+
+        Responder responder;
+        responder.transfer = makePooled<TransferISO15765>(mConfiguration, mChannel, mClock, mBufferPool, maskMsg, patternMsg, flowControlMsg);
+        memset(&responder.result, 0, sizeof(responder.result));
+        responder.result.RequestID = requestId;
+        responder.result.ResponseID = responseId;
+        responder.result.Timestamp = std::chrono::duration_cast<std::chrono::microseconds>(mClock.now().time_since_epoch()).count();
+        it = mResponders.insert(std::make_pair(requestId, responder)).first;
+    }
+
+    // Only the first response is kept
+    ISO15765_SCAN_RESPONDER &result = it->second.result;
+    if(result.DataSize == 0 && it->second.transfer->readMsg(frame, mResponse, mScan.QuietWindow)) {
+        size_t size = UdsClient::payloadSize(mResponse);
+        result.DataSize = size;
+        memcpy(result.Data, UdsClient::payload(mResponse), std::min(size, sizeof(result.Data)));
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <map>
+
+#include "ISO15765Proxy.h"
+#include "configurable_channel.h"
+#include "iso15765.h"
+
+#define SCAN_DEFAULT_RESPONSE_OFFSET 8
+#define SCAN_DEFAULT_QUIET_WINDOW 100
+#define SCAN_MAX_PROBES 0x10000
+
+/*
+ * Probes of a range of request IDs on the CAN channel under the ISO15765 layer. Each responder gets its own
+ * transfer when its first frame is received, which reassembles the response.
+ */
+class Scanner {
+public:
+    Scanner(Configuration &configuration, Channel &channel, Clock &clock, const BufferPoolPtr &bufferPool);
+    ~Scanner();
+
+    void run(const ISO15765_SCAN &scan, ISO15765_SCAN_LIST &list);
+
+private:
+    struct Responder {
+        TransferISO15765Ptr transfer;
+        ISO15765_SCAN_RESPONDER result;
+    };
+
+    uint32_t getRequestId(unsigned long index) const;
+    uint32_t getResponseId(uint32_t requestId) const;
+    bool getRequestIdFromResponse(uint32_t responseId, uint32_t *requestId) const;
+    void sendProbe(uint32_t requestId);
+    void dispatch(const CanFrame &frame);
+
+    Configuration &mConfiguration;
+    Channel &mChannel;
+    Clock &mClock;
+    BufferPoolPtr mBufferPool;
+    ISO15765_SCAN mScan;
+    unsigned long mProbes;
+    std::map<uint32_t, Responder> mResponders;
+    PASSTHRU_MSG mMessage;
+    PASSTHRU_MSG mResponse;
+};
+
+#endif //_SCAN_H
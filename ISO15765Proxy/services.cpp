@@ -0,0 +1,2536 @@
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "internal.h"
+#include "iso15765.h"
+#include "simple.h"
+#include "transfer_loop.h"
+#include "virtual_channel.h"
+#include "utils.h"
+
+/*
+ * Tests of the UDS engines run by the ISO15765 layer, against virtual ECUs on a virtual CAN channel
+ */
+
+#define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
+
+#define CHECK(x) if(!(x)) { LOG_DEBUG("    %s:%d: check failed: %s", __FILE__, __LINE__, #x); return false; }
+
+#define J2534_DATA_OFFSET 4
+
+#define TESTER_PID 0x7E0
+#define ECU_PID 0x7E8
+
+typedef std::vector<uint8_t> Bytes;
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static PASSTHRU_MSG canFrame(uint32_t pid, const uint8_t *data, size_t size) {
+    PASSTHRU_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.ProtocolID = CAN;
+    msg.DataSize = J2534_DATA_OFFSET + size;
+    pid2Data(pid, msg.Data);
+    memcpy(&msg.Data[J2534_DATA_OFFSET], data, size);
+    return msg;
+}
+
+static long elapsedMs(const Clock::time_point &from, const Clock::time_point &to) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+}
+
+/*
+ * ECU side of ISO15765 on the virtual channel: requests are reassembled, handed to the handler, which answers with
+ * reply(). Flow controls are immediate, with no block size nor separation time.
+ */
+class VirtualEcu {
+public:
+    typedef std::function<void(VirtualEcu &ecu, const Bytes &request)> Handler;
+
+    VirtualEcu(ChannelVirtual &channel, uint32_t requestPid, uint32_t responsePid):
+            mChannel(channel), mRequestPid(requestPid), mResponsePid(responsePid), mExpected(0) {
+    }
+
+    void setHandler(const Handler &handler) {
+        mHandler = handler;
+    }
+
+    void reply(const Bytes &data, const Clock::duration &delay) {
+        uint8_t frame[8];
+        if(data.size() <= 7) {
+            frame[0] = data.size();
+            memcpy(&frame[1], data.data(), data.size());
+            mChannel.schedule(canFrame(mResponsePid, frame, 1 + data.size()), delay);
+            return;
+        }
+        frame[0] = 0x10 | ((data.size() >> 8) & 0x0F);
+        frame[1] = data.size() & 0xFF;
+        memcpy(&frame[2], data.data(), 6);
+        mChannel.schedule(canFrame(mResponsePid, frame, 8), delay);
+        mPendingTx.assign(data.begin() + 6, data.end());
+    }
+
+    void onFrame(const PASSTHRU_MSG &msg) {
+        if(data2pid(msg.Data) != mRequestPid || msg.DataSize <= J2534_DATA_OFFSET) {
+            return;
+        }
+        const uint8_t *data = &msg.Data[J2534_DATA_OFFSET];
+        size_t size = msg.DataSize - J2534_DATA_OFFSET;
+        uint8_t type = data[0] >> 4;
+        if(type == 0) {
+            mRx.assign(data + 1, data + 1 + (data[0] & 0x0F));
+            handle();
+        } else if(type == 1) {
+            mExpected = ((data[0] & 0x0F) << 8) | data[1];
+            mRx.assign(data + 2, data + size);
+            uint8_t fc[] = {0x30, 0, 0};
+            mChannel.schedule(canFrame(mResponsePid, fc, sizeof(fc)), std::chrono::milliseconds(0));
+        } else if(type == 2) {
+            mRx.insert(mRx.end(), data + 1, data + size);
+            if(mRx.size() >= mExpected) {
+                mRx.resize(mExpected);
+                handle();
+            }
+        } else if(type == 3) {
+            uint8_t sequence = 1;
+            for(size_t offset = 0; offset < mPendingTx.size(); offset += 7, ++sequence) {
+                uint8_t frame[8];
+                size_t chunk = std::min<size_t>(7, mPendingTx.size() - offset);
+                frame[0] = 0x20 | (sequence & 0x0F);
+                memcpy(&frame[1], &mPendingTx[offset], chunk);
+                mChannel.schedule(canFrame(mResponsePid, frame, 1 + chunk), std::chrono::milliseconds(0));
+            }
+            mPendingTx.clear();
+        }
+    }
+
+    std::vector<Bytes> requests;
+
+private:
+    void handle() {
+        requests.push_back(mRx);
+        if(mHandler) {
+            mHandler(*this, mRx);
+        }
+    }
+
+    ChannelVirtual &mChannel;
+    uint32_t mRequestPid;
+    uint32_t mResponsePid;
+    size_t mExpected;
+    Bytes mRx;
+    Bytes mPendingTx;
+    Handler mHandler;
+};
+
+/*
+ * Tester side ISO15765 channel with one ECU, more can be added
+ */
+class Fixture {
+public:
+    Fixture() {
+        clock = std::make_shared<VirtualClock>();
+        raw = std::make_shared<ChannelVirtual>(clock);
+        iso = std::make_shared<ChannelISO15765>(ISO15765, nullptr, raw, clock);
+        ecu = addEcu(TESTER_PID, ECU_PID);
+
+        std::vector<std::shared_ptr<VirtualEcu>> *targets = &ecus;
+        raw->setResponder([targets](ChannelVirtual &channel, const PASSTHRU_MSG &msg) {
+            UNUSED(channel);
+            for(const std::shared_ptr<VirtualEcu> &target: *targets) {
+                target->onFrame(msg);
+            }
+        });
+
+        start = clock->now();
+    }
+
+    std::shared_ptr<VirtualEcu> addEcu(uint32_t requestPid, uint32_t responsePid) {
+        PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+        memset(&maskMsg, 0, sizeof(maskMsg));
+        memset(&patternMsg, 0, sizeof(patternMsg));
+        memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+        maskMsg.DataSize = patternMsg.DataSize = flowControlMsg.DataSize = J2534_DATA_OFFSET;
+        pid2Data(0xFFFFFFFF, maskMsg.Data);
+        pid2Data(responsePid, patternMsg.Data);
+        pid2Data(requestPid, flowControlMsg.Data);
+        iso->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+
+        ecus.push_back(std::make_shared<VirtualEcu>(*raw, requestPid, responsePid));
+        return ecus.back();
+    }
+
+    long ioctl(unsigned long IoctlID, void *pInput, void *pOutput) {
+        try {
+            iso->ioctl(IoctlID, pInput, pOutput);
+        } catch(J2534Exception &exception) {
+            return exception.code();
+        }
+        return STATUS_NOERROR;
+    }
+
+    unsigned long send(const Bytes &payload, uint32_t target = TESTER_PID) {
+        PASSTHRU_MSG msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.ProtocolID = ISO15765;
+        msg.DataSize = J2534_DATA_OFFSET + payload.size();
+        pid2Data(target, msg.Data);
+        memcpy(&msg.Data[J2534_DATA_OFFSET], payload.data(), payload.size());
+        unsigned long count = 1;
+        iso->writeMsgs(&msg, &count, 1000);
+        return count;
+    }
+
+    bool receive(Bytes &payload, unsigned long timeout) {
+        PASSTHRU_MSG msg;
+        unsigned long count = 1;
+        iso->readMsgs(&msg, &count, timeout);
+        if(count != 1) {
+            return false;
+        }
+        payload.assign(&msg.Data[J2534_DATA_OFFSET], &msg.Data[msg.DataSize]);
+        return true;
+    }
+
+    long elapsed() {
+        return elapsedMs(start, clock->now());
+    }
+
+    VirtualClockPtr clock;
+    ChannelVirtualPtr raw;
+    ChannelPtr iso;
+    std::vector<std::shared_ptr<VirtualEcu>> ecus;
+    std::shared_ptr<VirtualEcu> ecu;
+    Clock::time_point start;
+};
+
+/*
+ * Flash download
+ */
+
+static Bytes image(size_t size) {
+    Bytes ret(size);
+    for(size_t i = 0; i < size; ++i) {
+        ret[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+    return ret;
+}
+
+static ISO15765_FLASH_DOWNLOAD flashRequest(const Bytes &data) {
+    ISO15765_FLASH_DOWNLOAD download;
+    memset(&download, 0, sizeof(download));
+    download.TargetID = TESTER_PID;
+    download.AddressAndLengthFormat = 0x44;
+    download.MemoryAddress = 0x00080000;
+    download.MemorySize = data.size();
+    download.Data = data.data();
+    return download;
+}
+
+struct FlashEcu {
+    FlashEcu(size_t maxBlockLength): maxBlockLength(maxBlockLength), delay(std::chrono::milliseconds(10)),
+            blocks(0), failAt(0), failCode(0), pendingAt(0), pendingCount(0), answerExit(true) {
+    }
+
+    VirtualEcu::Handler handler() {
+        return [this](VirtualEcu &ecu, const Bytes &request) {
+            if(request[0] == 0x34) {
+                ecu.reply({0x74, 0x20, (uint8_t)(maxBlockLength >> 8), (uint8_t)maxBlockLength}, delay);
+            } else if(request[0] == 0x36) {
+                unsigned int block = ++blocks;
+                received.insert(received.end(), request.begin() + 2, request.end());
+                sequences.push_back(request[1]);
+                Clock::duration at = delay;
+                if(block == pendingAt) {
+                    for(unsigned int i = 0; i < pendingCount; ++i, at += std::chrono::milliseconds(40)) {
+                        ecu.reply({0x7F, 0x36, 0x78}, at);
+                    }
+                }
+                if(block == failAt) {
+                    ecu.reply({0x7F, 0x36, failCode}, at);
+                } else {
+                    ecu.reply({0x76, request[1]}, at);
+                }
+            } else if(request[0] == 0x37 && answerExit) {
+                ecu.reply({0x77}, delay);
+            }
+        };
+    }
+
+    size_t maxBlockLength;
+    Clock::duration delay;
+    unsigned int blocks;
+    unsigned int failAt;
+    uint8_t failCode;
+    unsigned int pendingAt;
+    unsigned int pendingCount;
+    bool answerExit;
+    Bytes received;
+    Bytes sequences;
+};
+
+static bool test_flash_download() {
+    Fixture f;
+    FlashEcu ecu(0x102);
+    f.ecu->setHandler(ecu.handler());
+
+    Bytes data = image(1000);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == STATUS_NOERROR);
+
+    // 0x102 bytes per TransferData, 256 of data
+    CHECK(result.BlockLength == 0x102);
+    CHECK(result.BlockCount == 4);
+    CHECK(result.BytesTransferred == 1000);
+    CHECK(result.FailedService == 0);
+    CHECK(ecu.received == data);
+    CHECK(ecu.sequences == Bytes({1, 2, 3, 4}));
+
+    const std::vector<Bytes> &requests = f.ecu->requests;
+    CHECK(requests.size() == 6);
+    CHECK(requests[0] == Bytes({0x34, 0x00, 0x44, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x03, 0xE8}));
+    CHECK(requests[1].size() == 0x102);
+    CHECK(requests[4].size() == 2 + 1000 - 3 * 256);
+    CHECK(requests[5] == Bytes({0x37}));
+
+    // No time is spent between blocks beyond the ECU answers
+    CHECK(f.elapsed() == 6 * 10);
+    return true;
+}
+
+static bool test_flash_block_length_limits() {
+    Fixture f;
+    FlashEcu ecu(0x2000);
+    f.ecu->setHandler(ecu.handler());
+
+    // maxNumberOfBlockLength is capped to the ISO15765 maximum message size
+    Bytes data = image(10000);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == STATUS_NOERROR);
+    CHECK(result.BlockLength == 0xFFF);
+    CHECK(result.BlockCount == 3);
+    CHECK(ecu.received == data);
+
+    // And to the caller's limit
+    Fixture g;
+    FlashEcu ecu2(0x2000);
+    g.ecu->setHandler(ecu2.handler());
+    download.MaxBlockLength = 130;
+    CHECK(g.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == STATUS_NOERROR);
+    CHECK(result.BlockLength == 130);
+    CHECK(result.BlockCount == (10000 + 127) / 128);
+    CHECK(ecu2.received == data);
+    return true;
+}
+
+static bool test_flash_sequence_wrap() {
+    Fixture f;
+    FlashEcu ecu(0x3);
+    f.ecu->setHandler(ecu.handler());
+
+    Bytes data = image(300);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == STATUS_NOERROR);
+    CHECK(result.BlockCount == 300);
+    CHECK(ecu.sequences[254] == 0xFF);
+    CHECK(ecu.sequences[255] == 0x00);
+    CHECK(ecu.sequences[256] == 0x01);
+    CHECK(ecu.received == data);
+    return true;
+}
+
+static bool test_flash_response_pending() {
+    Fixture f;
+    FlashEcu ecu(0x102);
+    ecu.pendingAt = 2;
+    ecu.pendingCount = 3;
+    f.ecu->setHandler(ecu.handler());
+
+    Bytes data = image(1000);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == STATUS_NOERROR);
+    CHECK(result.ResponsePending == 3);
+    CHECK(result.BlockCount == 4);
+    CHECK(ecu.received == data);
+    // The final answer of block 2 came 120 ms after the first pending, beyond P2 but within P2*
+    CHECK(f.elapsed() == 6 * 10 + 3 * 40);
+    return true;
+}
+
+static bool test_flash_negative_response() {
+    Fixture f;
+    FlashEcu ecu(0x102);
+    ecu.failAt = 2;
+    ecu.failCode = 0x72;
+    f.ecu->setHandler(ecu.handler());
+
+    Bytes data = image(1000);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_FAILED);
+    CHECK(result.FailedService == 0x36);
+    CHECK(result.ResponseCode == 0x72);
+    CHECK(result.BlockCount == 1);
+    CHECK(result.BytesTransferred == 256);
+    CHECK(f.ecu->requests.size() == 3);
+    return true;
+}
+
+static bool test_flash_timeout() {
+    Fixture f;
+    FlashEcu ecu(0x102);
+    ecu.answerExit = false;
+    f.ecu->setHandler(ecu.handler());
+
+    Bytes data = image(100);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    download.P2Timeout = 200;
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_TIMEOUT);
+    CHECK(result.FailedService == 0x37);
+    CHECK(result.ResponseCode == 0);
+    CHECK(result.BytesTransferred == 100);
+    CHECK(f.elapsed() == 2 * 10 + 200);
+    return true;
+}
+
+static bool test_flash_invalid() {
+    Fixture f;
+    FlashEcu ecu(0x102);
+    f.ecu->setHandler(ecu.handler());
+
+    Bytes data = image(100);
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    ISO15765_FLASH_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, NULL, &result) == ERR_NULL_PARAMETER);
+
+    download.TargetID = 0x7E1;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_NO_FLOW_CONTROL);
+
+    download = flashRequest(data);
+    download.AddressAndLengthFormat = 0x12;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_INVALID_IOCTL_VALUE);
+
+    download = flashRequest(data);
+    download.AddressAndLengthFormat = 0x05;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_INVALID_IOCTL_VALUE);
+
+    download = flashRequest(data);
+    download.ChecksumType = ISO15765_CHECKSUM_ADD32 + 1;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_INVALID_IOCTL_VALUE);
+    CHECK(f.ecu->requests.empty());
+    return true;
+}
+
+// Bit by bit, as reference
+static uint32_t crc32Reference(const Bytes &data) {
+    uint32_t crc = 0xFFFFFFFF;
+    for(uint8_t byte: data) {
+        crc ^= byte;
+        for(int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static unsigned long flashChecksum(const Bytes &data, unsigned long type, unsigned long maxBlockLength) {
+    Fixture f;
+    FlashEcu ecu(0x2000);
+    f.ecu->setHandler(ecu.handler());
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    download.MaxBlockLength = maxBlockLength;
+    download.ChecksumType = type;
+    ISO15765_FLASH_RESULT result;
+    if(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) != STATUS_NOERROR || ecu.received != data) {
+        return 0;
+    }
+    return result.Checksum;
+}
+
+static bool test_flash_checksum() {
+    // Check values of the algorithms, over blocks of 3 bytes
+    Bytes check = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    CHECK(flashChecksum(check, ISO15765_CHECKSUM_CRC32, 5) == 0xCBF43926);
+    CHECK(flashChecksum(check, ISO15765_CHECKSUM_CRC16, 5) == 0x29B1);
+    CHECK(flashChecksum(check, ISO15765_CHECKSUM_ADD32, 5) == 0x1DD);
+    CHECK(flashChecksum(check, ISO15765_CHECKSUM_NONE, 5) == 0);
+
+    // Blocks which are not multiple of 8 bytes
+    Bytes data = image(10000);
+    CHECK(flashChecksum(data, ISO15765_CHECKSUM_CRC32, 0) == crc32Reference(data));
+    CHECK(flashChecksum(data, ISO15765_CHECKSUM_CRC32, 133) == crc32Reference(data));
+    unsigned long sum = 0;
+    for(uint8_t byte: data) {
+        sum += byte;
+    }
+    CHECK(flashChecksum(data, ISO15765_CHECKSUM_ADD32, 133) == sum);
+    return true;
+}
+
+/*
+ * Delta flash
+ */
+
+#define MANIFEST_FILE "services_manifest.txt"
+
+// Flash memory from 0x00080000, written by RequestDownload/TransferData and erased by RoutineControl 0xFF00
+struct DeltaEcu {
+    DeltaEcu(size_t size): memory(size, 0xFF), address(0), failAt(0), blocks(0) {
+    }
+
+    static unsigned long get(const Bytes &request, size_t offset) {
+        return (request[offset] << 24) | (request[offset + 1] << 16) | (request[offset + 2] << 8) | request[offset + 3];
+    }
+
+    VirtualEcu::Handler handler() {
+        return [this](VirtualEcu &ecu, const Bytes &request) {
+            Clock::duration delay = std::chrono::milliseconds(10);
+            if(request[0] == 0x31 && request.size() == 13) {
+                erases.push_back({get(request, 5), get(request, 9)});
+                std::fill_n(memory.begin() + (get(request, 5) - 0x00080000), get(request, 9), 0xFF);
+                ecu.reply({0x71, 0x01, 0xFF, 0x00}, delay);
+            } else if(request[0] == 0x34) {
+                address = get(request, 3) - 0x00080000;
+                downloads.push_back({get(request, 3), get(request, 7)});
+                ecu.reply({0x74, 0x20, 0x04, 0x02}, delay);
+            } else if(request[0] == 0x36) {
+                if(++blocks == failAt) {
+                    ecu.reply({0x7F, 0x36, 0x72}, delay);
+                    return;
+                }
+                std::copy(request.begin() + 2, request.end(), memory.begin() + address);
+                address += request.size() - 2;
+                ecu.reply({0x76, request[1]}, delay);
+            } else if(request[0] == 0x37) {
+                ecu.reply({0x77}, delay);
+            }
+        };
+    }
+
+    Bytes memory;
+    unsigned long address;
+    unsigned int failAt;
+    unsigned int blocks;
+    std::vector<std::pair<unsigned long, unsigned long>> erases;
+    std::vector<std::pair<unsigned long, unsigned long>> downloads;
+};
+
+static ISO15765_FLASH_DELTA deltaRequest(const Bytes &data, const char *partNumber) {
+    ISO15765_FLASH_DELTA delta;
+    memset(&delta, 0, sizeof(delta));
+    delta.Download = flashRequest(data);
+    delta.ManifestFile = MANIFEST_FILE;
+    delta.PartNumber = partNumber;
+    delta.Erase = 1;
+    return delta;
+}
+
+static bool test_flash_delta() {
+    remove(MANIFEST_FILE);
+    Fixture f;
+    DeltaEcu ecu(0x10000);
+    f.ecu->setHandler(ecu.handler());
+
+    // Everything the first time
+    Bytes data = image(0x10000 - 100);
+    ISO15765_FLASH_DELTA delta = deltaRequest(data, "SW-0001");
+    ISO15765_FLASH_DELTA_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.Segments == 16);
+    CHECK(result.SegmentsChanged == 16);
+    CHECK(result.Downloads == 1);
+    CHECK(result.BytesSkipped == 0);
+    CHECK(result.Flash.BytesTransferred == data.size());
+    CHECK(std::equal(data.begin(), data.end(), ecu.memory.begin()));
+
+    // Segments 3, 9 and 10, and the last one which is shorter
+    data[3 * 4096 + 17]++;
+    data[9 * 4096 + 4095]++;
+    data[10 * 4096]++;
+    data[data.size() - 1]++;
+    ecu.erases.clear();
+    ecu.downloads.clear();
+    delta = deltaRequest(data, "SW-0001");
+    delta.Download.ChecksumType = ISO15765_CHECKSUM_CRC32;
+    delta.Threads = 3;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 4);
+    CHECK(result.Downloads == 3);
+    CHECK(result.Flash.BytesTransferred == 4 * 4096 - 100);
+    CHECK(result.BytesSkipped == 12 * 4096);
+    CHECK(result.Flash.Checksum == crc32Reference(data));
+    typedef std::pair<unsigned long, unsigned long> Range;
+    std::vector<Range> expected = {Range(0x00083000, 4096), Range(0x00089000, 8192), Range(0x0008F000, 4096 - 100)};
+    CHECK(ecu.downloads == expected);
+    CHECK(ecu.erases == expected);
+    CHECK(std::equal(data.begin(), data.end(), ecu.memory.begin()));
+
+    // Nothing when nothing changed
+    ecu.downloads.clear();
+    size_t sent = f.ecu->requests.size();
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 0);
+    CHECK(result.Downloads == 0);
+    CHECK(result.BytesSkipped == data.size());
+    CHECK(f.ecu->requests.size() == sent);
+
+    // The same bit of two words cancelled out in the former 64 bits hash
+    data[5 * 4096 + 7] ^= 0x80;
+    data[5 * 4096 + 15] ^= 0x80;
+    ecu.downloads.clear();
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 1);
+    expected = {Range(0x00085000, 4096)};
+    CHECK(ecu.downloads == expected);
+    CHECK(std::equal(data.begin(), data.end(), ecu.memory.begin()));
+    remove(MANIFEST_FILE);
+    return true;
+}
+
+static bool test_flash_delta_invalidation() {
+    remove(MANIFEST_FILE);
+    Fixture f;
+    DeltaEcu ecu(0x8000);
+    f.ecu->setHandler(ecu.handler());
+    Bytes data = image(0x8000);
+    ISO15765_FLASH_DELTA delta = deltaRequest(data, "SW-0001");
+    delta.Erase = 0;
+    ISO15765_FLASH_DELTA_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+
+    // Another part number, or another segment size, is flashed entirely
+    delta.PartNumber = "SW-0002";
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 8);
+    delta.SegmentSize = 0x2000;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.Segments == 4);
+    CHECK(result.SegmentsChanged == 4);
+    CHECK(ecu.erases.empty());
+
+    // A failed download leaves the ECU with an unknown image
+    data[0]++;
+    ecu.blocks = 0;
+    ecu.failAt = 2;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == ERR_FAILED);
+    CHECK(result.SegmentsChanged == 1);
+    CHECK(result.Flash.FailedService == 0x36);
+    CHECK(result.Flash.ResponseCode == 0x72);
+    data[0]--;
+    ecu.failAt = 0;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 4);
+
+    // Separate entries per target and address
+    delta.Download.MemoryAddress = 0x00084000;
+    delta.Download.MemorySize = 0x4000;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 2);
+    delta.Download.MemoryAddress = 0x00080000;
+    delta.Download.MemorySize = 0x8000;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 0);
+
+    // A manifest with the 64 bits hashes of an older version is flashed entirely
+    FILE *file = fopen(MANIFEST_FILE, "w");
+    CHECK(file != NULL);
+    fprintf(file, "7E0 80000 4096 SW-0001 2 0123456789ABCDEF 0123456789ABCDEF\n");
+    fclose(file);
+    delta.Download.MemoryAddress = 0x00080000;
+    delta.Download.MemorySize = 0x2000;
+    delta.SegmentSize = 0x1000;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == STATUS_NOERROR);
+    CHECK(result.SegmentsChanged == 2);
+
+    delta.PartNumber = "SW 0001";
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == ERR_INVALID_IOCTL_VALUE);
+    delta.PartNumber = NULL;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DELTA, &delta, &result) == ERR_NULL_PARAMETER);
+    remove(MANIFEST_FILE);
+    return true;
+}
+
+// The classic Okumura LZSS decoder, as found in bootloaders
+static Bytes lzssDecode(const Bytes &in) {
+    uint8_t ring[4096];
+    memset(ring, ' ', sizeof(ring));
+    size_t r = 4096 - 18;
+    unsigned int flags = 0;
+    Bytes out;
+    size_t i = 0;
+    while(i < in.size()) {
+        if(((flags >>= 1) & 0x100) == 0) {
+            flags = in[i++] | 0xFF00;
+            if(i == in.size()) {
+                break;
+            }
+        }
+        if(flags & 1) {
+            out.push_back(in[i]);
+            ring[r++] = in[i++];
+            r &= 4095;
+        } else {
+            if(i + 1 >= in.size()) {
+                break;
+            }
+            size_t position = in[i] | ((in[i + 1] & 0xF0) << 4);
+            size_t length = (in[i + 1] & 0x0F) + 3;
+            i += 2;
+            for(size_t k = 0; k < length; ++k) {
+                uint8_t c = ring[(position + k) & 4095];
+                out.push_back(c);
+                ring[r++] = c;
+                r &= 4095;
+            }
+        }
+    }
+    return out;
+}
+
+// Maps of 16 bits values with small steps, axes and erased areas
+static Bytes calibration(size_t size) {
+    Bytes ret(size, 0xFF);
+    uint32_t seed = 1;
+    for(size_t offset = 0; offset + 1024 <= size; offset += 1536) {
+        for(size_t i = 0; i < 512; ++i) {
+            seed = seed * 1103515245 + 12345;
+            uint16_t value = 1000 + (i % 16) * 50 + ((seed >> 16) % 4);
+            ret[offset + 2 * i] = value >> 8;
+            ret[offset + 2 * i + 1] = value & 0xFF;
+        }
+    }
+    return ret;
+}
+
+static bool flashCompressed(const Bytes &data, ISO15765_FLASH_RESULT &result) {
+    Fixture f;
+    FlashEcu ecu(0x2000);
+    f.ecu->setHandler(ecu.handler());
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    download.DataFormat = 0x10;
+    download.Compression = ISO15765_COMPRESSION_LZSS;
+    download.ChecksumType = ISO15765_CHECKSUM_CRC32;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == STATUS_NOERROR);
+    CHECK(lzssDecode(ecu.received) == data);
+    CHECK(ecu.received.size() == result.BytesTransferred);
+    CHECK(result.BlockCount == (result.BytesTransferred + 0xFFC) / 0xFFD);
+    CHECK(result.Checksum == crc32Reference(data));
+
+    // The size of the image, with the compression method
+    CHECK(f.ecu->requests[0][1] == 0x10);
+    CHECK(DeltaEcu::get(f.ecu->requests[0], 7) == data.size());
+    return true;
+}
+
+static bool test_flash_compressed() {
+    // Several chunks compressed in parallel
+    Bytes data = calibration(300000);
+    ISO15765_FLASH_RESULT result;
+    CHECK(flashCompressed(data, result));
+    CHECK(result.BytesTransferred < data.size() / 2);
+
+    // Incompressible, and shorter than the flag bytes groups
+    Bytes noise(70000);
+    uint32_t seed = 7;
+    for(uint8_t &byte: noise) {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 16;
+    }
+    CHECK(flashCompressed(noise, result));
+    CHECK(flashCompressed(Bytes({1, 2, 3}), result));
+    CHECK(flashCompressed(Bytes(100, 0x55), result));
+    CHECK(result.BytesTransferred < 20);
+
+    Fixture f;
+    ISO15765_FLASH_DOWNLOAD download = flashRequest(data);
+    download.Compression = ISO15765_COMPRESSION_LZSS;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_INVALID_IOCTL_VALUE);
+    download.DataFormat = 0x10;
+    download.Compression = ISO15765_COMPRESSION_LZSS + 1;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_DOWNLOAD, &download, &result) == ERR_INVALID_IOCTL_VALUE);
+    return true;
+}
+
+#define IMAGE_FILE "services_image.bin"
+
+static bool writeFile(const char *name, const Bytes &data) {
+    FILE *file = fopen(name, "wb");
+    if(file == NULL) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+static bool test_flash_file() {
+    Fixture f;
+    DeltaEcu ecu(0x20000);
+    f.ecu->setHandler(ecu.handler());
+    Bytes data = image(0x20000);
+    CHECK(writeFile(IMAGE_FILE, data));
+
+    // The first 16 KiB at 0x80000, the second half at 0x90000
+    ISO15765_FLASH_REGION regions[] = {{0x00080000, 0, 0x4000, 0}, {0x00090000, 0x10000, 0, 0}};
+    ISO15765_FLASH_FILE flashFile;
+    memset(&flashFile, 0, sizeof(flashFile));
+    flashFile.Download.TargetID = TESTER_PID;
+    flashFile.Download.AddressAndLengthFormat = 0x44;
+    flashFile.Download.ChecksumType = ISO15765_CHECKSUM_CRC32;
+    flashFile.FileName = IMAGE_FILE;
+    flashFile.NumOfRegions = 2;
+    flashFile.RegionPtr = regions;
+    ISO15765_FLASH_FILE_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_FILE, &flashFile, &result) == STATUS_NOERROR);
+    CHECK(result.Regions == 2);
+    CHECK(result.Flash.BytesTransferred == 0x14000);
+    CHECK(result.Flash.BlockCount == (0x4000 + 0x3FF) / 0x400 + (0x10000 + 0x3FF) / 0x400);
+    CHECK(regions[0].Checksum == crc32Reference(Bytes(data.begin(), data.begin() + 0x4000)));
+    CHECK(regions[1].Checksum == crc32Reference(Bytes(data.begin() + 0x10000, data.end())));
+    CHECK(std::equal(data.begin(), data.begin() + 0x4000, ecu.memory.begin()));
+    CHECK(std::equal(data.begin() + 0x10000, data.end(), ecu.memory.begin() + 0x10000));
+    CHECK(ecu.memory[0x4000] == 0xFF);
+
+    // Failure in the second region
+    ecu.blocks = 0;
+    ecu.failAt = 20;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_FILE, &flashFile, &result) == ERR_FAILED);
+    CHECK(result.Regions == 1);
+    CHECK(result.Flash.FailedService == 0x36);
+    CHECK(result.Flash.BytesTransferred == 0x4000 + 3 * 0x400);
+
+    // Regions out of the file are refused before anything is sent
+    size_t sent = f.ecu->requests.size();
+    regions[1].Size = 0x10001;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_FILE, &flashFile, &result) == ERR_INVALID_IOCTL_VALUE);
+    regions[1].Size = 0;
+    regions[1].FileOffset = 0x20000;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_FILE, &flashFile, &result) == ERR_INVALID_IOCTL_VALUE);
+    CHECK(f.ecu->requests.size() == sent);
+    remove(IMAGE_FILE);
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_FILE, &flashFile, &result) == ERR_FAILED);
+    flashFile.FileName = NULL;
+    CHECK(f.ioctl(ISO15765_IOCTL_FLASH_FILE, &flashFile, &result) == ERR_NULL_PARAMETER);
+    return true;
+}
+
+/*
+ * OBD-II polling
+ */
+
+// Mode 01 with the PIDs 0x04-0x0F, answered after 10 ms
+static VirtualEcu::Handler obdHandler(const Bytes &unsupported = Bytes()) {
+    return [=](VirtualEcu &ecu, const Bytes &request) {
+        if(request[0] != 0x01) {
+            return;
+        }
+        Bytes response = {0x41};
+        for(size_t i = 1; i < request.size(); ++i) {
+            uint8_t pid = request[i];
+            if(std::find(unsupported.begin(), unsupported.end(), pid) != unsupported.end()) {
+                continue;
+            }
+            response.push_back(pid);
+            for(size_t j = 0; j < ObdPoller::getDataLength(pid); ++j) {
+                response.push_back(pid + j);
+            }
+        }
+        ecu.reply(response, std::chrono::milliseconds(10));
+    };
+}
+
+static unsigned long obdStart(Fixture &f, uint32_t target, uint8_t pid, unsigned long period) {
+    ISO15765_OBD_POLL poll;
+    memset(&poll, 0, sizeof(poll));
+    poll.TargetID = target;
+    poll.Pid = pid;
+    poll.Period = period;
+    unsigned long id = 0;
+    f.ioctl(ISO15765_IOCTL_OBD_POLL_START, &poll, &id);
+    return id;
+}
+
+static long obdRead(Fixture &f, std::vector<ISO15765_OBD_SAMPLE> &samples, ISO15765_OBD_SAMPLE_LIST &list, unsigned long timeout) {
+    list.NumOfSamples = samples.size();
+    list.SamplePtr = samples.data();
+    long ret = f.ioctl(ISO15765_IOCTL_OBD_POLL_READ, &timeout, &list);
+    samples.resize(list.NumOfSamples);
+    return ret;
+}
+
+// Read in batches for the given time
+static std::vector<ISO15765_OBD_SAMPLE> obdCollect(Fixture &f, long duration, unsigned long *requests) {
+    std::vector<ISO15765_OBD_SAMPLE> ret;
+    *requests = 0;
+    while(f.elapsed() < duration) {
+        std::vector<ISO15765_OBD_SAMPLE> samples(256);
+        ISO15765_OBD_SAMPLE_LIST list;
+        if(obdRead(f, samples, list, duration - f.elapsed()) != STATUS_NOERROR) {
+            break;
+        }
+        ret.insert(ret.end(), samples.begin(), samples.end());
+        *requests += list.Requests;
+    }
+    return ret;
+}
+
+static size_t countPid(const std::vector<ISO15765_OBD_SAMPLE> &samples, uint8_t pid) {
+    return std::count_if(samples.begin(), samples.end(), [&](const ISO15765_OBD_SAMPLE &sample) {
+        return sample.Pid == pid;
+    });
+}
+
+static bool test_obd_packing() {
+    Fixture f;
+    f.ecu->setHandler(obdHandler());
+    for(uint8_t pid = 0x04; pid < 0x10; ++pid) {
+        CHECK(obdStart(f, TESTER_PID, pid, 0) != 0);
+    }
+
+    unsigned long requests;
+    std::vector<ISO15765_OBD_SAMPLE> samples = obdCollect(f, 1005, &requests);
+
+    // One request per 10 ms round trip, each with 6 of the 12 PIDs
+    CHECK(requests == 101);
+    CHECK(samples.size() == 100 * 6);
+    for(const Bytes &request: f.ecu->requests) {
+        CHECK(request.size() == 7);
+    }
+    for(uint8_t pid = 0x04; pid < 0x10; ++pid) {
+        CHECK(countPid(samples, pid) == 50);
+    }
+
+    // Decoded per PID
+    const ISO15765_OBD_SAMPLE &rpm = *std::find_if(samples.begin(), samples.end(), [](const ISO15765_OBD_SAMPLE &sample) {
+        return sample.Pid == 0x0C;
+    });
+    CHECK(rpm.TargetID == TESTER_PID);
+    CHECK(rpm.DataSize == 2);
+    CHECK(rpm.Data[0] == 0x0C && rpm.Data[1] == 0x0D);
+    return true;
+}
+
+static bool test_obd_periods() {
+    Fixture f;
+    f.ecu->setHandler(obdHandler());
+    obdStart(f, TESTER_PID, 0x0C, 100);
+    obdStart(f, TESTER_PID, 0x0D, 300);
+
+    std::vector<ISO15765_OBD_SAMPLE> samples(10000);
+    ISO15765_OBD_SAMPLE_LIST list;
+    CHECK(obdRead(f, samples, list, 1000) == STATUS_NOERROR);
+    CHECK(countPid(samples, 0x0C) == 10);
+    CHECK(countPid(samples, 0x0D) == 4);
+
+    // 0x0D rides along with 0x0C
+    CHECK(f.ecu->requests[0] == Bytes({0x01, 0x0C, 0x0D}) || f.ecu->requests[0] == Bytes({0x01, 0x0D, 0x0C}));
+    CHECK(f.ecu->requests[1] == Bytes({0x01, 0x0C}));
+    CHECK(list.Requests == 11);
+    return true;
+}
+
+static bool test_obd_multi_ecu() {
+    Fixture f;
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    f.ecu->setHandler(obdHandler());
+    second->setHandler(obdHandler());
+    for(uint8_t pid = 0x04; pid < 0x0A; ++pid) {
+        obdStart(f, TESTER_PID, pid, 0);
+        obdStart(f, 0x7E1, pid, 0);
+    }
+
+    // Both ECUs are polled concurrently, at the rate of a single one
+    unsigned long requests;
+    std::vector<ISO15765_OBD_SAMPLE> samples = obdCollect(f, 1005, &requests);
+    CHECK(samples.size() == 2 * 100 * 6);
+    CHECK(requests == 2 * 101);
+    CHECK(f.ecu->requests.size() == 101);
+    CHECK(second->requests.size() == 101);
+    size_t fromSecond = std::count_if(samples.begin(), samples.end(), [](const ISO15765_OBD_SAMPLE &sample) {
+        return sample.TargetID == 0x7E1;
+    });
+    CHECK(fromSecond == 100 * 6);
+    return true;
+}
+
+static bool test_obd_batches() {
+    Fixture f;
+    f.ecu->setHandler(obdHandler({0x05}));
+    unsigned long id = obdStart(f, TESTER_PID, 0x04, 50);
+    obdStart(f, TESTER_PID, 0x05, 50);
+    obdStart(f, TESTER_PID, 0x06, 50);
+
+    // A response is buffered until it fits, the unsupported PID is skipped
+    std::vector<ISO15765_OBD_SAMPLE> samples(1);
+    ISO15765_OBD_SAMPLE_LIST list;
+    CHECK(obdRead(f, samples, list, 1000) == STATUS_NOERROR);
+    CHECK(samples.size() == 1);
+    CHECK(f.elapsed() == 10);
+    samples.resize(10);
+    CHECK(obdRead(f, samples, list, 0) == STATUS_NOERROR);
+    CHECK(samples.size() == 1);
+    CHECK(samples[0].Pid == 0x06);
+    CHECK(countPid(samples, 0x05) == 0);
+
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_STOP, &id, NULL) == STATUS_NOERROR);
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_STOP, &id, NULL) == ERR_INVALID_IOCTL_VALUE);
+    samples.resize(10);
+    CHECK(obdRead(f, samples, list, 60) == STATUS_NOERROR);
+    CHECK(countPid(samples, 0x04) == 0);
+    CHECK(countPid(samples, 0x06) == 1);
+    return true;
+}
+
+static bool test_obd_stop_outstanding() {
+    Fixture f;
+    f.ecu->setHandler(obdHandler());
+    unsigned long id = obdStart(f, TESTER_PID, 0x0C, 100);
+
+    // Stopped while its request is in flight
+    std::vector<ISO15765_OBD_SAMPLE> samples(1);
+    ISO15765_OBD_SAMPLE_LIST list;
+    CHECK(obdRead(f, samples, list, 5) == STATUS_NOERROR);
+    CHECK(samples.empty());
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_STOP, &id, NULL) == STATUS_NOERROR);
+    samples.resize(1);
+    CHECK(obdRead(f, samples, list, 20) == STATUS_NOERROR);
+    CHECK(samples.empty());
+
+    // The target went with the response, a new poll takes the new flags
+    ISO15765_OBD_POLL poll;
+    memset(&poll, 0, sizeof(poll));
+    poll.TargetID = TESTER_PID;
+    poll.TxFlags = ISO15765_FRAME_PAD;
+    poll.Pid = 0x0D;
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_START, &poll, &id) == STATUS_NOERROR);
+    samples.resize(1);
+    CHECK(obdRead(f, samples, list, 20) == STATUS_NOERROR);
+    CHECK(samples.size() == 1);
+    CHECK(f.raw->getSentFrames().back().msg.DataSize == 4 + 8);
+    return true;
+}
+
+static bool test_obd_timeouts() {
+    Fixture f;
+    int calls = 0;
+    f.ecu->setHandler([&](VirtualEcu &ecu, const Bytes &request) {
+        // Silent, then busy, then answering
+        if(++calls == 1) {
+            return;
+        }
+        if(calls == 2) {
+            ecu.reply({0x7F, request[0], 0x21}, std::chrono::milliseconds(5));
+            return;
+        }
+        ecu.reply({0x41, 0x0C, 0x10, 0x20}, std::chrono::milliseconds(5));
+    });
+    obdStart(f, TESTER_PID, 0x0C, 0);
+
+    std::vector<ISO15765_OBD_SAMPLE> samples(1);
+    ISO15765_OBD_SAMPLE_LIST list;
+    CHECK(obdRead(f, samples, list, 1000) == STATUS_NOERROR);
+    CHECK(list.Requests == 3);
+    CHECK(list.Timeouts == 2);
+    CHECK(samples.size() == 1);
+    CHECK(f.elapsed() == 50 + 5 + 5);
+
+    ISO15765_OBD_POLL poll;
+    memset(&poll, 0, sizeof(poll));
+    poll.TargetID = TESTER_PID;
+    poll.Pid = 0x0C;
+    unsigned long id;
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_START, &poll, &id) == ERR_INVALID_IOCTL_VALUE);
+    poll.Pid = 0xA6;
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_START, &poll, &id) == ERR_INVALID_IOCTL_VALUE);
+    poll.DataLength = 4;
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_START, &poll, &id) == STATUS_NOERROR);
+    poll.TargetID = 0x7E3;
+    CHECK(f.ioctl(ISO15765_IOCTL_OBD_POLL_START, &poll, &id) == ERR_NO_FLOW_CONTROL);
+    return true;
+}
+
+/*
+ * ReadDataByIdentifier cache
+ */
+
+static const Bytes vin = {'W', 'V', 'W', 'Z', 'Z', 'Z', '1', 'K', 'Z', 'A', 'W', '0', '0', '0', '0', '0', '1'};
+
+// Identification DIDs, answered after 20 ms
+static VirtualEcu::Handler identificationHandler() {
+    return [](VirtualEcu &ecu, const Bytes &request) {
+        Bytes response = {(uint8_t)(request[0] + 0x40)};
+        if(request[0] == 0x22) {
+            response.insert(response.end(), request.begin() + 1, request.end());
+            if(request[1] == 0xF1 && request[2] == 0x90) {
+                response.insert(response.end(), vin.begin(), vin.end());
+            } else {
+                response.push_back(request[2]);
+            }
+        } else if(request[0] == 0x2E) {
+            response.insert(response.end(), request.begin() + 1, request.begin() + 3);
+        } else if(request[0] == 0x3E && (request[1] & 0x80) != 0) {
+            return;
+        } else {
+            response.push_back(request[1]);
+        }
+        ecu.reply(response, std::chrono::milliseconds(20));
+    };
+}
+
+static Bytes rdbiResponse(uint8_t high, uint8_t low, const Bytes &data) {
+    Bytes ret = {0x62, high, low};
+    ret.insert(ret.end(), data.begin(), data.end());
+    return ret;
+}
+
+static void cacheConfigure(Fixture &f, unsigned long enable, unsigned long defaultTtl) {
+    ISO15765_RDBI_CACHE_CONFIG config;
+    config.Enable = enable;
+    config.DefaultTTL = defaultTtl;
+    f.ioctl(ISO15765_IOCTL_RDBI_CACHE_CONFIG, &config, NULL);
+}
+
+static void cacheTtl(Fixture &f, unsigned long did, unsigned long ttl) {
+    ISO15765_RDBI_CACHE_TTL config;
+    config.Did = did;
+    config.TTL = ttl;
+    f.ioctl(ISO15765_IOCTL_RDBI_CACHE_TTL, &config, NULL);
+}
+
+static ISO15765_RDBI_CACHE_STATS cacheStats(Fixture &f) {
+    ISO15765_RDBI_CACHE_STATS stats;
+    memset(&stats, 0, sizeof(stats));
+    f.ioctl(ISO15765_IOCTL_RDBI_CACHE_STATS, NULL, &stats);
+    return stats;
+}
+
+// Request and response, return the time it took
+static long rdbi(Fixture &f, uint8_t high, uint8_t low, Bytes &response) {
+    long start = f.elapsed();
+    response.clear();
+    if(f.send({0x22, high, low}) != 1 || !f.receive(response, 500)) {
+        return -1;
+    }
+    return f.elapsed() - start;
+}
+
+static bool test_rdbi_cache_hit() {
+    Fixture f;
+    f.ecu->setHandler(identificationHandler());
+    cacheConfigure(f, 1, 0);
+    cacheTtl(f, 0xF190, ISO15765_RDBI_TTL_INFINITE);
+
+    Bytes response;
+    CHECK(rdbi(f, 0xF1, 0x90, response) == 20);
+    CHECK(response == rdbiResponse(0xF1, 0x90, vin));
+    size_t frames = f.raw->getSentFrames().size();
+
+    // Answered locally, nothing on the bus
+    for(int i = 0; i < 10; ++i) {
+        CHECK(rdbi(f, 0xF1, 0x90, response) == 0);
+        CHECK(response == rdbiResponse(0xF1, 0x90, vin));
+    }
+    CHECK(f.raw->getSentFrames().size() == frames);
+    CHECK(f.ecu->requests.size() == 1);
+
+    // Not cached without TTL
+    CHECK(rdbi(f, 0xF1, 0x87, response) == 20);
+    CHECK(rdbi(f, 0xF1, 0x87, response) == 20);
+
+    ISO15765_RDBI_CACHE_STATS stats = cacheStats(f);
+    CHECK(stats.Hits == 10);
+    CHECK(stats.Misses == 1);
+    CHECK(stats.Entries == 1);
+    return true;
+}
+
+static bool test_rdbi_cache_ttl() {
+    Fixture f;
+    f.ecu->setHandler(identificationHandler());
+    cacheConfigure(f, 1, 100);
+    cacheTtl(f, 0xF187, 0);
+
+    Bytes response;
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 20);
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 0);
+    f.clock->sleepFor(std::chrono::milliseconds(80));
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 0);
+    f.clock->sleepFor(std::chrono::milliseconds(20));
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 20);
+    CHECK(response == rdbiResponse(0xF1, 0x95, {0x95}));
+
+    // A null TTL overrides the default
+    CHECK(rdbi(f, 0xF1, 0x87, response) == 20);
+    CHECK(rdbi(f, 0xF1, 0x87, response) == 20);
+
+    // Disabling drops the entries
+    cacheConfigure(f, 0, 100);
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 20);
+    CHECK(cacheStats(f).Entries == 0);
+    return true;
+}
+
+static bool test_rdbi_cache_invalidation() {
+    Fixture f;
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    f.ecu->setHandler(identificationHandler());
+    second->setHandler(identificationHandler());
+    cacheConfigure(f, 1, ISO15765_RDBI_TTL_INFINITE);
+
+    Bytes response;
+    CHECK(rdbi(f, 0xF1, 0x90, response) == 20);
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 20);
+    CHECK(f.send({0x22, 0xF1, 0x90}, 0x7E1) == 1 && f.receive(response, 500));
+    CHECK(cacheStats(f).Entries == 3);
+
+    // A write drops its DID
+    CHECK(f.send({0x2E, 0xF1, 0x95, 0x01}) == 1 && f.receive(response, 500));
+    CHECK(rdbi(f, 0xF1, 0x90, response) == 0);
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 20);
+
+    // A session change or a reset drops the target
+    CHECK(f.send({0x10, 0x03}) == 1 && f.receive(response, 500));
+    CHECK(rdbi(f, 0xF1, 0x90, response) == 20);
+    CHECK(rdbi(f, 0xF1, 0x95, response) == 20);
+    CHECK(f.send({0x11, 0x01}) == 1 && f.receive(response, 500));
+    CHECK(rdbi(f, 0xF1, 0x90, response) == 20);
+
+    // The other target kept its entry
+    long start = f.elapsed();
+    CHECK(f.send({0x22, 0xF1, 0x90}, 0x7E1) == 1 && f.receive(response, 500));
+    CHECK(f.elapsed() == start);
+    CHECK(second->requests.size() == 1);
+
+    ISO15765_RDBI_CACHE_STATS stats = cacheStats(f);
+    CHECK(stats.Invalidations == 1 + 2 + 2);
+    CHECK(f.ioctl(ISO15765_IOCTL_RDBI_CACHE_CLEAR, NULL, NULL) == STATUS_NOERROR);
+    CHECK(cacheStats(f).Entries == 0);
+    return true;
+}
+
+/*
+ * TesterPresent keepalive
+ */
+
+static const Bytes testerPresent = {0x3E, 0x80};
+
+static void keepAliveStart(Fixture &f, unsigned long target, unsigned long s3, unsigned long margin) {
+    ISO15765_KEEPALIVE keepAlive;
+    keepAlive.TargetID = target;
+    keepAlive.TxFlags = 0;
+    keepAlive.S3 = s3;
+    keepAlive.Margin = margin;
+    f.ioctl(ISO15765_IOCTL_KEEPALIVE_START, &keepAlive, NULL);
+}
+
+static ISO15765_KEEPALIVE_STATS keepAliveStats(Fixture &f) {
+    ISO15765_KEEPALIVE_STATS stats;
+    memset(&stats, 0, sizeof(stats));
+    f.ioctl(ISO15765_IOCTL_KEEPALIVE_STATS, NULL, &stats);
+    return stats;
+}
+
+// Times of the keepalives sent to a target, in ms from the start
+static std::vector<long> keepAliveTimes(Fixture &f, uint32_t target) {
+    std::vector<long> ret;
+    for(const ChannelVirtual::Frame &frame: f.raw->getSentFrames()) {
+        const uint8_t *data = &frame.msg.Data[J2534_DATA_OFFSET];
+        if(data2pid(frame.msg.Data) == target && data[0] == 0x02 && data[1] == 0x3E && data[2] == 0x80) {
+            ret.push_back(elapsedMs(f.start, frame.time));
+        }
+    }
+    return ret;
+}
+
+static bool test_keepalive_idle() {
+    Fixture f;
+    keepAliveStart(f, TESTER_PID, 0, 0);
+    CHECK(f.raw->getPeriodicMsgs().size() == 1);
+    CHECK(f.raw->getPeriodicMsgs()[0].timeInterval == 4000);
+
+    // Sent by the adapter while the application makes no call
+    PASSTHRU_MSG msg;
+    unsigned long count = 1;
+    f.raw->readMsgs(&msg, &count, 10000);
+    CHECK(count == 0);
+    CHECK(f.elapsed() == 10000);
+    CHECK(keepAliveTimes(f, TESTER_PID) == std::vector<long>({0, 4000, 8000}));
+    CHECK(f.ecu->requests == std::vector<Bytes>(3, testerPresent));
+
+    // The periodic messages of the application don't stop them
+    CHECK(f.ioctl(CLEAR_PERIODIC_MSGS, NULL, NULL) == STATUS_NOERROR);
+    CHECK(f.raw->getPeriodicMsgs()[0].active);
+
+    Bytes response;
+    // Shorter S3
+    keepAliveStart(f, TESTER_PID, 2000, 500);
+    CHECK(!f.receive(response, 3100));
+    CHECK(keepAliveTimes(f, TESTER_PID) == std::vector<long>({0, 4000, 8000, 10000, 11500, 13000}));
+
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_STOP, NULL, NULL) == STATUS_NOERROR);
+    CHECK(!f.receive(response, 10000));
+    CHECK(keepAliveTimes(f, TESTER_PID).size() == 6);
+    return true;
+}
+
+static bool test_keepalive_traffic() {
+    Fixture f;
+    f.ecu->setHandler(identificationHandler());
+    keepAliveStart(f, TESTER_PID, 0, 0);
+
+    // A request every second, with the keepalive due every 4 seconds
+    Bytes response;
+    for(int i = 0; i < 10; ++i) {
+        CHECK(rdbi(f, 0xF1, 0x90, response) == 20);
+        CHECK(!f.receive(response, 980));
+    }
+    CHECK(f.elapsed() == 10000);
+    CHECK(keepAliveTimes(f, TESTER_PID) == std::vector<long>({0}));
+
+    // The interval started over when the keepalive was due within 2 seconds, at 3, 6 and 9 seconds
+    CHECK(f.raw->getPeriodicMsgs().size() == 4);
+    CHECK(std::count_if(f.raw->getPeriodicMsgs().begin(), f.raw->getPeriodicMsgs().end(),
+            [](const ChannelVirtual::Periodic &periodic) { return periodic.active; }) == 1);
+
+    // Back to idle: 4 seconds after the last request
+    CHECK(!f.receive(response, 5000));
+    CHECK(keepAliveTimes(f, TESTER_PID) == std::vector<long>({0, 13000}));
+
+    ISO15765_KEEPALIVE_STATS stats = keepAliveStats(f);
+    CHECK(stats.Sent == 2);
+    CHECK(stats.Postponed == 3);
+    CHECK(stats.Targets == 1);
+    return true;
+}
+
+static bool test_keepalive_targets() {
+    Fixture f;
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    f.ecu->setHandler(identificationHandler());
+    second->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        // Not supported in the active session
+        ecu.reply({0x7F, request[0], 0x7F}, std::chrono::milliseconds(5));
+    });
+    keepAliveStart(f, TESTER_PID, 0, 0);
+    keepAliveStart(f, 0x7E1, 0, 0);
+
+    Bytes response;
+    for(int i = 0; i < 10; ++i) {
+        CHECK(rdbi(f, 0xF1, 0x90, response) == 20);
+        CHECK(response == rdbiResponse(0xF1, 0x90, vin));
+        CHECK(!f.receive(response, 980));
+    }
+    CHECK(keepAliveTimes(f, TESTER_PID) == std::vector<long>({0}));
+    CHECK(keepAliveTimes(f, 0x7E1) == std::vector<long>({0, 4000, 8000}));
+
+    // The negative responses to the keepalives are not returned
+    CHECK(second->requests.size() == 3);
+    CHECK(!f.receive(response, 100));
+
+    // Stopped with the filters
+    f.iso->ioctl(CLEAR_MSG_FILTERS, NULL, NULL);
+    CHECK(keepAliveStats(f).Targets == 0);
+    CHECK(std::none_of(f.raw->getPeriodicMsgs().begin(), f.raw->getPeriodicMsgs().end(),
+            [](const ChannelVirtual::Periodic &periodic) { return periodic.active; }));
+    return true;
+}
+
+static bool test_keepalive_responses() {
+    Fixture f;
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    f.ecu->setHandler(identificationHandler());
+    second->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x7F, request[0], 0x7F}, std::chrono::milliseconds(5));
+    });
+    keepAliveStart(f, TESTER_PID, 0, 0);
+    keepAliveStart(f, 0x7E1, 0, 0);
+
+    // The responses to the TesterPresent of the application are returned
+    Bytes response;
+    CHECK(f.send({0x3E, 0x00}) == 1);
+    CHECK(f.receive(response, 500));
+    CHECK(response == Bytes({0x7E, 0x00}));
+    CHECK(f.send({0x3E, 0x00}, 0x7E1) == 1);
+    CHECK(f.receive(response, 500));
+    CHECK(response == Bytes({0x7F, 0x3E, 0x7F}));
+
+    // Not the ones to the keepalives
+    CHECK(!f.receive(response, 5000));
+    CHECK(second->requests == std::vector<Bytes>({testerPresent, {0x3E, 0x00}, testerPresent}));
+
+    // A segmented request holds the keepalive back, then starts it over
+    size_t periodics = f.raw->getPeriodicMsgs().size();
+    CHECK(f.send({0x2E, 0xF1, 0x90, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07}) == 1);
+    CHECK(f.receive(response, 500));
+    CHECK(response == Bytes({0x6E, 0xF1, 0x90}));
+    CHECK(f.raw->getPeriodicMsgs().size() == periodics + 1);
+    CHECK(keepAliveStats(f).Postponed == 1);
+    return true;
+}
+
+static bool test_keepalive_invalid() {
+    Fixture f;
+    ISO15765_KEEPALIVE keepAlive;
+    memset(&keepAlive, 0, sizeof(keepAlive));
+    keepAlive.TargetID = TESTER_PID;
+    keepAlive.S3 = 1000;
+    keepAlive.Margin = 1000;
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_START, &keepAlive, NULL) == ERR_INVALID_IOCTL_VALUE);
+    keepAlive.TargetID = 0x7E5;
+    keepAlive.Margin = 0;
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_START, &keepAlive, NULL) == ERR_NO_FLOW_CONTROL);
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_START, NULL, NULL) == ERR_NULL_PARAMETER);
+
+    unsigned long target = TESTER_PID;
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_STOP, &target, NULL) == ERR_INVALID_IOCTL_VALUE);
+    keepAliveStart(f, TESTER_PID, 0, 0);
+    target = 0x7E5;
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_STOP, &target, NULL) == ERR_INVALID_IOCTL_VALUE);
+    target = TESTER_PID;
+    CHECK(f.ioctl(ISO15765_IOCTL_KEEPALIVE_STOP, &target, NULL) == STATUS_NOERROR);
+    CHECK(keepAliveStats(f).Targets == 0);
+    return true;
+}
+
+/*
+ * Parallel DTC read
+ */
+
+// reportDTCByStatusMask response with count DTCs, after a delay
+static VirtualEcu::Handler dtcHandler(unsigned int count, long delay) {
+    return [count, delay](VirtualEcu &ecu, const Bytes &request) {
+        if(request[0] != 0x19) {
+            return;
+        }
+        Bytes response = {0x59, 0x02, 0xFF};
+        for(unsigned int i = 0; i < count; ++i) {
+            Bytes dtc = {0x01, (uint8_t)(delay & 0xFF), (uint8_t)i, 0x2F};
+            response.insert(response.end(), dtc.begin(), dtc.end());
+        }
+        ecu.reply(response, std::chrono::milliseconds(delay));
+    };
+}
+
+static ISO15765_DTC_READ dtcRead(std::vector<ISO15765_DTC_TARGET> &targets) {
+    ISO15765_DTC_READ read;
+    memset(&read, 0, sizeof(read));
+    read.NumOfTargets = targets.size();
+    read.TargetPtr = targets.data();
+    read.StatusMask = 0xFF;
+    read.P2Timeout = 100;
+    return read;
+}
+
+static std::vector<ISO15765_DTC_TARGET> dtcTargets(unsigned long count) {
+    std::vector<ISO15765_DTC_TARGET> ret(count);
+    memset(ret.data(), 0, count * sizeof(ISO15765_DTC_TARGET));
+    for(unsigned long i = 0; i < count; ++i) {
+        ret[i].RequestID = 0x710 + i;
+    }
+    return ret;
+}
+
+static bool test_dtc_parallel() {
+    Fixture f;
+    std::vector<ISO15765_DTC_TARGET> targets = dtcTargets(8);
+    for(unsigned long i = 0; i < targets.size(); ++i) {
+        // Two ECUs per delay, so that their multi-frame responses interleave
+        f.addEcu(0x710 + i, 0x790 + i)->setHandler(dtcHandler(i, 20 + 10 * (i / 2)));
+    }
+    ISO15765_DTC_READ read = dtcRead(targets);
+    std::vector<ISO15765_DTC> dtcs(64);
+    ISO15765_DTC_LIST list = {(unsigned long)dtcs.size(), dtcs.data()};
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, &read, &list) == STATUS_NOERROR);
+
+    // The slowest ECU, rather than the sum
+    CHECK(f.elapsed() == 50);
+    CHECK(list.NumOfDtcs == 0 + 1 + 2 + 3 + 4 + 5 + 6 + 7);
+    for(unsigned long i = 0; i < targets.size(); ++i) {
+        CHECK(targets[i].Result == STATUS_NOERROR);
+        CHECK(targets[i].ResponseID == 0x790 + i);
+        CHECK(targets[i].AvailabilityMask == 0xFF);
+        CHECK(targets[i].NumOfDtcs == i);
+        unsigned long found = 0;
+        for(unsigned long j = 0; j < list.NumOfDtcs; ++j) {
+            if(dtcs[j].TargetID == 0x710 + i) {
+                CHECK(dtcs[j].Dtc == ((0x01 << 16) | ((20 + 10 * (i / 2)) << 8) | found));
+                CHECK(dtcs[j].Status == 0x2F);
+                found++;
+            }
+        }
+        CHECK(found == i);
+    }
+    return true;
+}
+
+static bool test_dtc_budget() {
+    Fixture f;
+    std::vector<ISO15765_DTC_TARGET> targets = dtcTargets(6);
+    for(unsigned long i = 0; i < targets.size(); ++i) {
+        f.addEcu(0x710 + i, 0x790 + i)->setHandler(dtcHandler(1, 50));
+    }
+    std::vector<ISO15765_DTC> dtcs(64);
+    ISO15765_DTC_LIST list = {(unsigned long)dtcs.size(), dtcs.data()};
+
+    // Two requests in flight: three rounds
+    ISO15765_DTC_READ read = dtcRead(targets);
+    read.MaxPending = 2;
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, &read, &list) == STATUS_NOERROR);
+    CHECK(f.elapsed() == 150);
+    CHECK(list.NumOfDtcs == 6);
+
+    // Spread requests: the last one is sent after 5 intervals
+    long start = f.elapsed();
+    f.raw->clearSentFrames();
+    read.MaxPending = 0;
+    read.RequestInterval = 10;
+    list.NumOfDtcs = dtcs.size();
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, &read, &list) == STATUS_NOERROR);
+    CHECK(f.elapsed() - start == 50 + 50);
+    CHECK(list.NumOfDtcs == 6);
+    std::vector<long> times;
+    for(const ChannelVirtual::Frame &frame: f.raw->getSentFrames()) {
+        if(frame.msg.Data[J2534_DATA_OFFSET + 1] == 0x19) {
+            times.push_back(elapsedMs(f.start, frame.time) - start);
+        }
+    }
+    CHECK(times == std::vector<long>({0, 10, 20, 30, 40, 50}));
+    return true;
+}
+
+static bool test_dtc_failures() {
+    Fixture f;
+    std::vector<ISO15765_DTC_TARGET> targets = dtcTargets(4);
+    f.addEcu(0x710, 0x790)->setHandler(dtcHandler(3, 10));
+    f.addEcu(0x711, 0x791);
+    f.addEcu(0x712, 0x792)->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x7F, request[0], 0x78}, std::chrono::milliseconds(10));
+        ecu.reply({0x7F, request[0], 0x78}, std::chrono::milliseconds(90));
+        ecu.reply({0x59, 0x02, 0x09, 0x12, 0x34, 0x56, 0x08}, std::chrono::milliseconds(300));
+    });
+    f.addEcu(0x713, 0x793)->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x7F, request[0], 0x31}, std::chrono::milliseconds(10));
+    });
+
+    // Room for two DTCs only
+    std::vector<ISO15765_DTC> dtcs(2);
+    ISO15765_DTC_LIST list = {(unsigned long)dtcs.size(), dtcs.data()};
+    ISO15765_DTC_READ read = dtcRead(targets);
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, &read, &list) == STATUS_NOERROR);
+    CHECK(f.elapsed() == 300);
+
+    CHECK(targets[0].Result == STATUS_NOERROR);
+    CHECK(targets[0].NumOfDtcs == 3);
+    CHECK(targets[1].Result == ERR_TIMEOUT);
+    CHECK(targets[2].Result == STATUS_NOERROR);
+    CHECK(targets[2].ResponsePending == 2);
+    CHECK(targets[2].AvailabilityMask == 0x09);
+    CHECK(targets[2].NumOfDtcs == 1);
+    CHECK(targets[3].Result == ERR_FAILED);
+    CHECK(targets[3].ResponseCode == 0x31);
+    CHECK(list.NumOfDtcs == 2);
+    CHECK(dtcs[0].TargetID == 0x710 && dtcs[1].TargetID == 0x710);
+
+    // Nothing is sent when a target has no filter
+    f.raw->clearSentFrames();
+    targets[3].RequestID = 0x720;
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, &read, &list) == ERR_NO_FLOW_CONTROL);
+    targets[3].RequestID = 0x713;
+    targets[3].ResponseID = 0x794;
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, &read, &list) == ERR_NO_FLOW_CONTROL);
+    CHECK(f.raw->getSentFrames().empty());
+    CHECK(f.ioctl(ISO15765_IOCTL_DTC_READ, NULL, &list) == ERR_NULL_PARAMETER);
+    return true;
+}
+
+/*
+ * ECU discovery
+ */
+
+static VirtualEcu::Handler testerPresentHandler(long delay) {
+    return [delay](VirtualEcu &ecu, const Bytes &request) {
+        if(request[0] == 0x3E) {
+            ecu.reply({0x7E, request[1]}, std::chrono::milliseconds(delay));
+        }
+    };
+}
+
+static ISO15765_SCAN scanRange(unsigned long first, unsigned long last) {
+    ISO15765_SCAN scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.FirstID = first;
+    scan.LastID = last;
+    return scan;
+}
+
+static bool test_scan_11bit() {
+    Fixture f;
+    f.ecu->setHandler(testerPresentHandler(5));
+    f.addEcu(0x7E1, 0x7E9)->setHandler(testerPresentHandler(5));
+    f.addEcu(0x7A5, 0x7AD)->setHandler(testerPresentHandler(30));
+    f.addEcu(0x712, 0x71A)->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x7F, request[0], 0x7F}, std::chrono::milliseconds(10));
+    });
+    // Out of the range
+    f.addEcu(0x6F0, 0x6F8)->setHandler(testerPresentHandler(5));
+
+    std::vector<ISO15765_SCAN_RESPONDER> responders(16);
+    ISO15765_SCAN_LIST list = {(unsigned long)responders.size(), responders.data(), 0};
+    ISO15765_SCAN scan = scanRange(0x700, 0x7FF);
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == STATUS_NOERROR);
+
+    // Back to back: the slowest responder, then the quiet window
+    CHECK(f.elapsed() == 30 + 100);
+    CHECK(list.Probes == 0x100);
+    CHECK(f.raw->getSentFrames().size() == 0x100);
+    CHECK(list.NumOfResponders == 4);
+    const unsigned long ids[] = {0x712, 0x7A5, 0x7E0, 0x7E1};
+    for(unsigned long i = 0; i < 4; ++i) {
+        CHECK(responders[i].RequestID == ids[i]);
+        CHECK(responders[i].ResponseID == ids[i] + 8);
+        CHECK(responders[i].DataSize == (ids[i] == 0x712 ? 3UL : 2UL));
+    }
+    CHECK(responders[2].Data[0] == 0x7E && responders[2].Data[1] == 0x00);
+
+    // Paced probes
+    long start = f.elapsed();
+    scan.Interval = 2;
+    scan.QuietWindow = 50;
+    list.NumOfResponders = responders.size();
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == STATUS_NOERROR);
+    CHECK(f.elapsed() - start == 255 * 2 + 50);
+    CHECK(f.elapsed() - start < 1000);
+    CHECK(list.NumOfResponders == 4);
+    CHECK(responders[1].Timestamp == (unsigned long)(elapsedMs(Clock::time_point(), f.start) + start + (0xA5 * 2) + 30) * 1000);
+    return true;
+}
+
+static bool test_scan_reassembly() {
+    Fixture f;
+    f.ecu->setHandler(identificationHandler());
+    f.addEcu(0x7E1, 0x7E9)->setHandler(identificationHandler());
+    f.addEcu(0x7E2, 0x7EA)->setHandler(identificationHandler());
+
+    // The three multi-frame responses are received at the same time
+    std::vector<ISO15765_SCAN_RESPONDER> responders(16);
+    ISO15765_SCAN_LIST list = {(unsigned long)responders.size(), responders.data(), 0};
+    ISO15765_SCAN scan = scanRange(0x7E0, 0x7E7);
+    scan.ProbeSize = 3;
+    scan.Probe[0] = 0x22;
+    scan.Probe[1] = 0xF1;
+    scan.Probe[2] = 0x90;
+    scan.TxFlags = ISO15765_FRAME_PAD;
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == STATUS_NOERROR);
+    CHECK(list.NumOfResponders == 3);
+    Bytes expected = rdbiResponse(0xF1, 0x90, vin);
+    for(unsigned long i = 0; i < 3; ++i) {
+        CHECK(responders[i].RequestID == 0x7E0 + i);
+        CHECK(responders[i].DataSize == expected.size());
+        CHECK(Bytes(responders[i].Data, responders[i].Data + expected.size()) == expected);
+    }
+    // Padded probes, and a flow control to each responder
+    const std::vector<ChannelVirtual::Frame> &frames = f.raw->getSentFrames();
+    CHECK(frames.size() == 8 + 3);
+    CHECK(frames[0].msg.DataSize == J2534_DATA_OFFSET + 8);
+    return true;
+}
+
+static bool test_scan_29bit() {
+    Fixture f;
+    f.addEcu(0x18DA10F1, 0x18DAF110)->setHandler(testerPresentHandler(5));
+    f.addEcu(0x18DA33F1, 0x18DAF133)->setHandler(testerPresentHandler(5));
+
+    std::vector<ISO15765_SCAN_RESPONDER> responders(16);
+    ISO15765_SCAN_LIST list = {(unsigned long)responders.size(), responders.data(), 0};
+    ISO15765_SCAN scan = scanRange(0x18DA00F1, 0x18DAFFF1);
+    scan.Step = 0x100;
+    scan.TxFlags = CAN_29BIT_ID;
+    scan.Addressing = ISO15765_SCAN_NORMAL_FIXED;
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == STATUS_NOERROR);
+    CHECK(list.Probes == 0x100);
+    CHECK(list.NumOfResponders == 2);
+    CHECK(responders[0].RequestID == 0x18DA10F1 && responders[0].ResponseID == 0x18DAF110);
+    CHECK(responders[1].RequestID == 0x18DA33F1 && responders[1].ResponseID == 0x18DAF133);
+
+    // Invalid ranges
+    scan.TxFlags = 0;
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == ERR_INVALID_IOCTL_VALUE);
+    scan = scanRange(0x700, 0x800);
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == ERR_INVALID_IOCTL_VALUE);
+    scan = scanRange(0x7FF, 0x700);
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, &list) == ERR_INVALID_IOCTL_VALUE);
+    CHECK(f.ioctl(ISO15765_IOCTL_SCAN, &scan, NULL) == ERR_NULL_PARAMETER);
+    return true;
+}
+
+/*
+ * Response pending absorbed by the reads
+ */
+
+static void setConfig(Fixture &f, unsigned long parameter, unsigned long value) {
+    SCONFIG config = {parameter, value};
+    SCONFIG_LIST input = {1, &config};
+    f.iso->ioctl(SET_CONFIG, &input, NULL);
+}
+
+static unsigned long responsePendingCount(Fixture &f) {
+    unsigned long count = 0;
+    f.ioctl(ISO15765_IOCTL_RESPONSE_PENDING_STATS, NULL, &count);
+    return count;
+}
+
+// Erase routine: response pending every 2 seconds, final response after 6 seconds
+static VirtualEcu::Handler eraseHandler() {
+    return [](VirtualEcu &ecu, const Bytes &request) {
+        if(request[0] != 0x31) {
+            return;
+        }
+        ecu.reply({0x7F, 0x31, 0x78}, std::chrono::milliseconds(40));
+        ecu.reply({0x7F, 0x31, 0x78}, std::chrono::milliseconds(2000));
+        ecu.reply({0x7F, 0x31, 0x78}, std::chrono::milliseconds(4000));
+        ecu.reply({0x71, 0x01, 0xFF, 0x00}, std::chrono::milliseconds(6000));
+    };
+}
+
+static bool test_pending_absorbed() {
+    Fixture f;
+    f.ecu->setHandler(eraseHandler());
+    const Bytes erase = {0x31, 0x01, 0xFF, 0x00};
+    const Bytes pending = {0x7F, 0x31, 0x78};
+
+    // Default: returned to the application
+    Bytes response;
+    CHECK(f.send(erase) == 1);
+    CHECK(f.receive(response, 100) && response == pending);
+    CHECK(f.elapsed() == 40);
+    CHECK(!f.receive(response, 100));
+    f.clock->sleepFor(std::chrono::milliseconds(6000));
+    f.raw->ioctl(CLEAR_RX_BUFFER, NULL, NULL);
+    CHECK(responsePendingCount(f) == 0);
+
+    // Absorbed: one read, with a timeout of P2 only, returns the final response
+    setConfig(f, ISO15765_CONFIG_RESPONSE_PENDING, 1);
+    long start = f.elapsed();
+    CHECK(f.send(erase) == 1);
+    CHECK(f.receive(response, 100));
+    CHECK(response == Bytes({0x71, 0x01, 0xFF, 0x00}));
+    CHECK(f.elapsed() - start == 6000);
+    CHECK(responsePendingCount(f) == 3);
+
+    // Only the responses to the requests sent: nothing was sent to the second ECU
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    second->reply(pending, std::chrono::milliseconds(10));
+    CHECK(f.receive(response, 100) && response == pending);
+    CHECK(responsePendingCount(f) == 3);
+    return true;
+}
+
+static bool test_pending_p2_star() {
+    Fixture f;
+    f.ecu->setHandler(eraseHandler());
+    const Bytes erase = {0x31, 0x01, 0xFF, 0x00};
+    setConfig(f, ISO15765_CONFIG_RESPONSE_PENDING, 1);
+    setConfig(f, ISO15765_CONFIG_P2_STAR, 1500);
+
+    // The ECU is late: the read stops P2* after the last response pending
+    Bytes response;
+    CHECK(f.send(erase) == 1);
+    CHECK(!f.receive(response, 100));
+    CHECK(f.elapsed() == 40 + 1500);
+    CHECK(responsePendingCount(f) == 1);
+
+    // Later reads go on absorbing them until the final response
+    CHECK(f.receive(response, 5000));
+    CHECK(response == Bytes({0x71, 0x01, 0xFF, 0x00}));
+    CHECK(f.elapsed() == 6000);
+    CHECK(responsePendingCount(f) == 3);
+
+    // A non-blocking read absorbs without waiting
+    CHECK(f.send(erase) == 1);
+    f.clock->sleepFor(std::chrono::milliseconds(50));
+    CHECK(!f.receive(response, 0));
+    CHECK(f.elapsed() == 6050);
+    CHECK(responsePendingCount(f) == 4);
+
+    SCONFIG config = {ISO15765_CONFIG_P2_STAR, 0};
+    SCONFIG_LIST input = {1, &config};
+    f.iso->ioctl(GET_CONFIG, &input, NULL);
+    CHECK(config.Value == 1500);
+    return true;
+}
+
+/*
+ * Request/response transactions
+ */
+
+// Return the J2534 code, the response payload in response
+static long transact(Fixture &f, const Bytes &request, Bytes &response, unsigned long timeout,
+                     unsigned long p2Star = 0, uint32_t target = TESTER_PID) {
+    PASSTHRU_MSG msg, out;
+    memset(&msg, 0, sizeof(msg));
+    msg.ProtocolID = ISO15765;
+    msg.DataSize = J2534_DATA_OFFSET + request.size();
+    pid2Data(target, msg.Data);
+    memcpy(&msg.Data[J2534_DATA_OFFSET], request.data(), request.size());
+    ISO15765_TRANSACTION transaction = {&msg, timeout, p2Star};
+    response.clear();
+    long ret = f.ioctl(ISO15765_IOCTL_TRANSACTION, &transaction, &out);
+    if(ret == STATUS_NOERROR) {
+        response.assign(&out.Data[J2534_DATA_OFFSET], &out.Data[out.DataSize]);
+    }
+    return ret;
+}
+
+static bool test_transaction() {
+    Fixture f;
+    f.ecu->setHandler(identificationHandler());
+
+    Bytes response;
+    CHECK(transact(f, {0x22, 0xF1, 0x90}, response, 100) == STATUS_NOERROR);
+    CHECK(response == rdbiResponse(0xF1, 0x90, vin));
+    CHECK(f.elapsed() == 20);
+    CHECK(transact(f, {0x22, 0xF1, 0x90}, response, 10) == ERR_TIMEOUT);
+    CHECK(f.elapsed() == 30);
+
+    // The late response is still returned by a read
+    CHECK(f.receive(response, 100) && response == rdbiResponse(0xF1, 0x90, vin));
+
+    // Answered from the cache
+    cacheConfigure(f, 1, ISO15765_RDBI_TTL_INFINITE);
+    CHECK(transact(f, {0x22, 0xF1, 0x95}, response, 100) == STATUS_NOERROR);
+    long start = f.elapsed();
+    CHECK(transact(f, {0x22, 0xF1, 0x95}, response, 100) == STATUS_NOERROR);
+    CHECK(response == rdbiResponse(0xF1, 0x95, {0x95}));
+    CHECK(f.elapsed() == start);
+
+    CHECK(transact(f, {0x22, 0xF1, 0x90}, response, 100, 0, 0x7E5) == ERR_NO_FLOW_CONTROL);
+    CHECK(f.ioctl(ISO15765_IOCTL_TRANSACTION, NULL, NULL) == ERR_NULL_PARAMETER);
+    return true;
+}
+
+static bool test_transaction_pending() {
+    Fixture f;
+    f.ecu->setHandler(eraseHandler());
+    const Bytes erase = {0x31, 0x01, 0xFF, 0x00};
+
+    Bytes response;
+    CHECK(transact(f, erase, response, 100) == STATUS_NOERROR);
+    CHECK(response == Bytes({0x71, 0x01, 0xFF, 0x00}));
+    CHECK(f.elapsed() == 6000);
+    CHECK(responsePendingCount(f) == 3);
+
+    // P2* of the transaction
+    CHECK(transact(f, erase, response, 100, 1500) == ERR_TIMEOUT);
+    CHECK(f.elapsed() == 6000 + 40 + 1500);
+    return true;
+}
+
+static bool test_transaction_deferred() {
+    Fixture f;
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    f.ecu->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x7F, request[0], 0x31}, std::chrono::milliseconds(20));
+    });
+    // Received during the transaction
+    second->reply(rdbiResponse(0xF1, 0x90, vin), std::chrono::milliseconds(5));
+    f.ecu->reply({0x50, 0x03, 0x00, 0x32, 0x01, 0xF4}, std::chrono::milliseconds(10));
+
+    // A negative response is a response
+    Bytes response;
+    CHECK(transact(f, {0x22, 0xF1, 0x90}, response, 100) == STATUS_NOERROR);
+    CHECK(response == Bytes({0x7F, 0x22, 0x31}));
+
+    // The other messages, in order
+    PASSTHRU_MSG msgs[3];
+    unsigned long count = 3;
+    f.iso->readMsgs(msgs, &count, 0);
+    CHECK(count == 2);
+    CHECK(data2pid(msgs[0].Data) == 0x7E9);
+    CHECK(msgs[0].DataSize == J2534_DATA_OFFSET + 3 + vin.size());
+    CHECK(data2pid(msgs[1].Data) == ECU_PID);
+    CHECK(msgs[1].Data[J2534_DATA_OFFSET] == 0x50);
+    return true;
+}
+
+static bool test_transaction_overflow() {
+    Fixture f;
+    std::shared_ptr<VirtualEcu> second = f.addEcu(0x7E1, 0x7E9);
+    f.ecu->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x7F, request[0], 0x31}, std::chrono::milliseconds(100));
+    });
+    for(int i = 0; i < 70; ++i) {
+        second->reply({0x62, 0xF1, (uint8_t)i}, std::chrono::milliseconds(1 + i));
+    }
+
+    // The queue of the messages received meanwhile is full before the response
+    Bytes response;
+    CHECK(transact(f, {0x22, 0xF1, 0x90}, response, 200) == ERR_BUFFER_OVERFLOW);
+
+    // Nothing is lost
+    for(int i = 0; i < 70; ++i) {
+        CHECK(f.receive(response, 200));
+        CHECK(response == Bytes({0x62, 0xF1, (uint8_t)i}));
+    }
+    CHECK(f.receive(response, 200));
+    CHECK(response == Bytes({0x7F, 0x22, 0x31}));
+    return true;
+}
+
+/*
+ * Memory dump
+ */
+
+#define DUMP_FILE "services_dump.bin"
+
+/*
+ * ReadMemoryByAddress with 4 bytes address and size. Blocks longer than maxBlockLength are out of range; an ECU
+ * without pipelining drops the requests received while it is answering.
+ */
+struct MemoryEcu {
+    MemoryEcu(const VirtualClockPtr &clock, size_t size, size_t maxBlockLength): clock(clock), memory(image(size)),
+            maxBlockLength(maxBlockLength), delay(std::chrono::milliseconds(10)), pipelining(true),
+            silentFrom(~0UL), busyAt(~0UL), pendingAt(~0UL) {
+    }
+
+    VirtualEcu::Handler handler() {
+        return [this](VirtualEcu &ecu, const Bytes &request) {
+            if(request.size() != 10 || request[0] != 0x23 || request[1] != 0x44) {
+                return;
+            }
+            Clock::time_point now = clock->now();
+            if(!pipelining && now < busyUntil) {
+                return;
+            }
+            unsigned long address = (request[2] << 24) | (request[3] << 16) | (request[4] << 8) | request[5];
+            unsigned long length = (request[6] << 24) | (request[7] << 16) | (request[8] << 8) | request[9];
+            if(address >= silentFrom) {
+                return;
+            }
+            busyUntil = now + delay;
+            if(address == busyAt) {
+                busyAt = ~0UL;
+                ecu.reply({0x7F, 0x23, 0x22}, delay);
+                return;
+            }
+            Clock::duration at = delay;
+            if(address == pendingAt) {
+                pendingAt = ~0UL;
+                ecu.reply({0x7F, 0x23, 0x78}, delay);
+                at += std::chrono::milliseconds(100);
+            }
+            if(length > maxBlockLength || address + length > memory.size()) {
+                ecu.reply({0x7F, 0x23, 0x31}, at);
+                return;
+            }
+            Bytes response(1, 0x63);
+            response.insert(response.end(), memory.begin() + address, memory.begin() + address + length);
+            ecu.reply(response, at);
+        };
+    }
+
+    VirtualClockPtr clock;
+    Bytes memory;
+    size_t maxBlockLength;
+    Clock::duration delay;
+    bool pipelining;
+    unsigned long silentFrom;
+    unsigned long busyAt;
+    unsigned long pendingAt;
+    Clock::time_point busyUntil;
+};
+
+static ISO15765_MEMORY_DUMP dumpRequest(unsigned long size) {
+    ISO15765_MEMORY_DUMP dump;
+    memset(&dump, 0, sizeof(dump));
+    dump.TargetID = TESTER_PID;
+    dump.AddressAndLengthFormat = 0x44;
+    dump.MemorySize = size;
+    dump.FileName = DUMP_FILE;
+    return dump;
+}
+
+static Bytes readDump() {
+    Bytes ret;
+    FILE *file = fopen(DUMP_FILE, "rb");
+    if(file == NULL) {
+        return ret;
+    }
+    uint8_t buffer[4096];
+    size_t size;
+    while((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        ret.insert(ret.end(), buffer, buffer + size);
+    }
+    fclose(file);
+    return ret;
+}
+
+static bool test_dump_probe() {
+    Fixture f;
+    MemoryEcu ecu(f.clock, 20000, 1000);
+    f.ecu->setHandler(ecu.handler());
+
+    ISO15765_MEMORY_DUMP dump = dumpRequest(20000);
+    ISO15765_MEMORY_DUMP_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    remove(DUMP_FILE);
+
+    // 4094, 2047, 1024 are refused
+    CHECK(result.BlockLength == 512);
+    CHECK(result.BytesRead == 20000);
+    CHECK(result.Requests == 3 + (20000 + 511) / 512);
+    CHECK(result.Retries == 0);
+    const std::vector<Bytes> &requests = f.ecu->requests;
+    CHECK(requests[0] == Bytes({0x23, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0xFE}));
+    CHECK(requests[3] == Bytes({0x23, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00}));
+    CHECK(requests.back() == Bytes({0x23, 0x44, 0x00, 0x00, 0x4E, 0x00, 0x00, 0x00, 0x00, 0x20}));
+
+    // The largest block a response can carry
+    Fixture g;
+    MemoryEcu ecu2(g.clock, 10000, 0x10000);
+    g.ecu->setHandler(ecu2.handler());
+    dump = dumpRequest(10000);
+    CHECK(g.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    Bytes data = readDump();
+    remove(DUMP_FILE);
+    CHECK(result.BlockLength == 4094);
+    CHECK(result.Requests == 3);
+    CHECK(data == ecu2.memory);
+    return true;
+}
+
+static bool test_dump_resume() {
+    Fixture f;
+    MemoryEcu ecu(f.clock, 5000, 256);
+    ecu.silentFrom = 3000;
+    f.ecu->setHandler(ecu.handler());
+
+    ISO15765_MEMORY_DUMP dump = dumpRequest(5000);
+    dump.MemoryAddress = 0;
+    dump.MaxBlockLength = 256;
+    dump.Retries = 2;
+    ISO15765_MEMORY_DUMP_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == ERR_TIMEOUT);
+    CHECK(result.BytesRead == 3072);
+    CHECK(result.FailedAddress == 3072);
+    CHECK(result.ResponseCode == 0);
+    CHECK(result.Retries == 2);
+
+    // From the last good address, the data already read is kept
+    ecu.silentFrom = ~0UL;
+    size_t sent = f.ecu->requests.size();
+    dump.Offset = result.BytesRead;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    Bytes data = readDump();
+    remove(DUMP_FILE);
+    CHECK(result.BytesRead == 5000);
+    CHECK(result.Requests == (5000 - 3072 + 255) / 256);
+    CHECK(f.ecu->requests[sent] == Bytes({0x23, 0x44, 0x00, 0x00, 0x0C, 0x00, 0x00, 0x00, 0x01, 0x00}));
+    CHECK(data == ecu.memory);
+    return true;
+}
+
+static bool test_dump_retry() {
+    Fixture f;
+    MemoryEcu ecu(f.clock, 2048, 512);
+    ecu.busyAt = 1024;
+    ecu.pendingAt = 1536;
+    f.ecu->setHandler(ecu.handler());
+
+    ISO15765_MEMORY_DUMP dump = dumpRequest(2048);
+    dump.MaxBlockLength = 512;
+    ISO15765_MEMORY_DUMP_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    Bytes data = readDump();
+    CHECK(result.Retries == 1);
+    CHECK(result.ResponsePending == 1);
+    CHECK(result.Requests == 5);
+    CHECK(data == ecu.memory);
+
+    // A range error once the block size is known is final
+    ecu.memory.resize(1500);
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == ERR_FAILED);
+    remove(DUMP_FILE);
+    CHECK(result.BytesRead == 1024);
+    CHECK(result.FailedAddress == 1024);
+    CHECK(result.ResponseCode == 0x31);
+
+    dump.AddressAndLengthFormat = 0x45;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == ERR_INVALID_IOCTL_VALUE);
+    dump = dumpRequest(0);
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == ERR_INVALID_IOCTL_VALUE);
+    dump = dumpRequest(100);
+    dump.FileName = NULL;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == ERR_NULL_PARAMETER);
+    return true;
+}
+
+static bool test_dump_pipeline() {
+    // Single frame requests with 2 bytes address and size, responses of 6 bytes
+    Fixture f;
+    MemoryEcu ecu(f.clock, 600, 6);
+    f.ecu->setHandler([&ecu](VirtualEcu &target, const Bytes &request) {
+        Bytes wide = {0x23, 0x44, 0, 0, request[2], request[3], 0, 0, request[4], request[5]};
+        ecu.handler()(target, wide);
+    });
+    ISO15765_MEMORY_DUMP dump = dumpRequest(600);
+    dump.AddressAndLengthFormat = 0x22;
+    dump.MaxBlockLength = 6;
+    dump.Pipeline = 4;
+    ISO15765_MEMORY_DUMP_RESULT result;
+    CHECK(f.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    CHECK(readDump() == ecu.memory);
+    CHECK(result.Pipeline == 4);
+    CHECK(result.Requests == 100);
+    // 4 requests answered in one ECU delay
+    CHECK(f.elapsed() == 25 * 10);
+
+    // The ECU drops the requests sent ahead, one at a time after the first timeout
+    Fixture g;
+    MemoryEcu ecu2(g.clock, 600, 6);
+    ecu2.pipelining = false;
+    g.ecu->setHandler([&ecu2](VirtualEcu &target, const Bytes &request) {
+        Bytes wide = {0x23, 0x44, 0, 0, request[2], request[3], 0, 0, request[4], request[5]};
+        ecu2.handler()(target, wide);
+    });
+    CHECK(g.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    CHECK(readDump() == ecu2.memory);
+    remove(DUMP_FILE);
+    CHECK(result.Pipeline == 1);
+    CHECK(result.Retries == 0);
+    CHECK(result.Requests == 4 + 99);
+
+    // Multi-frame requests are never sent ahead
+    dump.AddressAndLengthFormat = 0x44;
+    Fixture h;
+    MemoryEcu ecu3(h.clock, 600, 6);
+    h.ecu->setHandler(ecu3.handler());
+    CHECK(h.ioctl(ISO15765_IOCTL_MEMORY_DUMP, &dump, &result) == STATUS_NOERROR);
+    remove(DUMP_FILE);
+    CHECK(result.Pipeline == 1);
+    return true;
+}
+
+/*
+ * Snapshot and restore
+ */
+
+static unsigned long configValue(const ISO15765_SNAPSHOT &snapshot, unsigned long parameter) {
+    for(unsigned long i = 0; i < snapshot.NumOfConfigs; ++i) {
+        if(snapshot.Configs[i].Parameter == parameter) {
+            return snapshot.Configs[i].Value;
+        }
+    }
+    return 0xFFFFFFFF;
+}
+
+static bool test_snapshot_restore() {
+    Fixture f;
+    f.addEcu(0x7E1, 0x7E9);
+    setConfig(f, DATA_RATE, 250000);
+    setConfig(f, ISO15765_STMIN, 5);
+    setConfig(f, ISO15765_CONFIG_P2_STAR, 3000);
+    PASSTHRU_MSG testerPresent;
+    memset(&testerPresent, 0, sizeof(testerPresent));
+    testerPresent.ProtocolID = ISO15765;
+    testerPresent.DataSize = J2534_DATA_OFFSET + 2;
+    pid2Data(0x7DF, testerPresent.Data);
+    testerPresent.Data[J2534_DATA_OFFSET] = 0x3E;
+    testerPresent.Data[J2534_DATA_OFFSET + 1] = 0x80;
+    f.iso->startPeriodicMsg(&testerPresent, 2000);
+
+    ISO15765_SNAPSHOT snapshot;
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &snapshot) == STATUS_NOERROR);
+    CHECK(configValue(snapshot, DATA_RATE) == 250000);
+    CHECK(configValue(snapshot, ISO15765_STMIN) == 5);
+    CHECK(configValue(snapshot, ISO15765_CONFIG_P2_STAR) == 3000);
+    CHECK(snapshot.NumOfFilters == 2);
+    CHECK(snapshot.Filters[0].FilterType == FLOW_CONTROL_FILTER);
+    CHECK(data2pid(snapshot.Filters[0].FlowControl.Data) == TESTER_PID);
+    CHECK(data2pid(snapshot.Filters[1].Pattern.Data) == 0x7E9);
+    CHECK(snapshot.NumOfPeriodics == 1);
+    CHECK(snapshot.Periodics[0].TimeInterval == 2000);
+
+    // Replayed on the channel of a new connection, in place of its own filter
+    Fixture g;
+    g.ecu->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        if(request[0] == 0x22) {
+            ecu.reply({0x62, request[1], request[2], 0x42}, std::chrono::milliseconds(10));
+        }
+    });
+    ISO15765_SNAPSHOT restored;
+    CHECK(g.ioctl(ISO15765_IOCTL_RESTORE, &snapshot, &restored) == STATUS_NOERROR);
+    CHECK(std::count(g.raw->getIoctls().begin(), g.raw->getIoctls().end(), (unsigned long)SET_CONFIG) == 1);
+    CHECK(g.raw->getPeriodicMsgs().size() == 1);
+    CHECK(g.raw->getPeriodicMsgs()[0].timeInterval == 2000);
+    CHECK(g.raw->getPeriodicMsgs()[0].msg.Data[J2534_DATA_OFFSET] == 0x3E);
+    CHECK(configValue(restored, DATA_RATE) == 250000);
+    CHECK(configValue(restored, ISO15765_STMIN) == 5);
+    CHECK(restored.NumOfFilters == 2);
+    CHECK(restored.Filters[0].FilterID != snapshot.Filters[0].FilterID);
+    CHECK(restored.NumOfPeriodics == 1);
+
+    Bytes response;
+    CHECK(g.send({0x22, 0xF1, 0x90}) == 1);
+    CHECK(g.receive(response, 1000));
+    CHECK((response == Bytes{0x62, 0xF1, 0x90, 0x42}));
+    CHECK(g.send({0x22, 0xF1, 0x90}, 0x7E1) == 1);
+
+    // Restoring again replaces the state, in place
+    CHECK(g.ioctl(ISO15765_IOCTL_RESTORE, &restored, &restored) == STATUS_NOERROR);
+    CHECK(restored.NumOfFilters == 2 && restored.NumOfPeriodics == 1);
+    CHECK(g.raw->getPeriodicMsgs().size() == 2);
+    return true;
+}
+
+static bool test_snapshot_services() {
+    Fixture f;
+    keepAliveStart(f, TESTER_PID, 0, 0);
+    ISO15765_SNAPSHOT snapshot;
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &snapshot) == STATUS_NOERROR);
+    CHECK(snapshot.NumOfPeriodics == 0);
+
+    // Only the filters and periodic messages are replaced
+    CHECK(f.ioctl(ISO15765_IOCTL_RESTORE, &snapshot, NULL) == STATUS_NOERROR);
+    CHECK(keepAliveStats(f).Targets == 1);
+    CHECK(f.raw->getPeriodicMsgs().size() == 1 && f.raw->getPeriodicMsgs()[0].active);
+
+    // And the keepalive goes through the new filter
+    Bytes response;
+    CHECK(!f.receive(response, 5000));
+    CHECK(keepAliveTimes(f, TESTER_PID) == std::vector<long>({0, 4000}));
+    return true;
+}
+
+static bool test_snapshot_invalid() {
+    Fixture f;
+    ISO15765_SNAPSHOT snapshot;
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, NULL) == ERR_NULL_PARAMETER);
+    CHECK(f.ioctl(ISO15765_IOCTL_RESTORE, NULL, &snapshot) == ERR_NULL_PARAMETER);
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &snapshot) == STATUS_NOERROR);
+
+    ISO15765_SNAPSHOT invalid = snapshot;
+    invalid.NumOfFilters = ISO15765_SNAPSHOT_MAX_FILTERS + 1;
+    CHECK(f.ioctl(ISO15765_IOCTL_RESTORE, &invalid, NULL) == ERR_INVALID_IOCTL_VALUE);
+    invalid = snapshot;
+    invalid.Filters[0].Pattern.DataSize = sizeof(invalid.Filters[0].Pattern.Data) + 1;
+    CHECK(f.ioctl(ISO15765_IOCTL_RESTORE, &invalid, NULL) == ERR_INVALID_MSG);
+
+    // A rejected snapshot leaves the channel as it was
+    ISO15765_SNAPSHOT current;
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &current) == STATUS_NOERROR);
+    CHECK(current.NumOfFilters == 1);
+    CHECK(current.Filters[0].FilterID == snapshot.Filters[0].FilterID);
+
+    // A periodic message refused by the device leaves the channel empty
+    keepAliveStart(f, TESTER_PID, 0, 0);
+    invalid = snapshot;
+    invalid.NumOfPeriodics = 1;
+    invalid.Periodics[0].TimeInterval = 1;
+    invalid.Periodics[0].Msg = snapshot.Filters[0].FlowControl;
+    CHECK(f.ioctl(ISO15765_IOCTL_RESTORE, &invalid, NULL) == ERR_INVALID_TIME_INTERVAL);
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &current) == STATUS_NOERROR);
+    CHECK(current.NumOfFilters == 0);
+    CHECK(current.NumOfPeriodics == 0);
+    CHECK(keepAliveStats(f).Targets == 0);
+    CHECK(std::none_of(f.raw->getPeriodicMsgs().begin(), f.raw->getPeriodicMsgs().end(),
+            [](const ChannelVirtual::Periodic &periodic) { return periodic.active; }));
+
+    // And takes the snapshot again
+    CHECK(f.ioctl(ISO15765_IOCTL_RESTORE, &snapshot, &current) == STATUS_NOERROR);
+    CHECK(current.NumOfFilters == 1);
+    return true;
+}
+
+/*
+ * Reassembly buffers
+ */
+
+// First frame then consecutive frames of a response, scheduled at the given time
+static void scheduleResponse(Fixture &f, uint32_t pid, const Bytes &data, const Clock::duration &delay) {
+    uint8_t frame[8] = {(uint8_t)(0x10 | (data.size() >> 8)), (uint8_t)data.size()};
+    memcpy(&frame[2], data.data(), 6);
+    f.raw->schedule(canFrame(pid, frame, 8), delay);
+    uint8_t sequence = 1;
+    for(size_t offset = 6; offset < data.size(); offset += 7, ++sequence) {
+        size_t chunk = std::min<size_t>(7, data.size() - offset);
+        frame[0] = 0x20 | (sequence & 0x0F);
+        memcpy(&frame[1], &data[offset], chunk);
+        f.raw->schedule(canFrame(pid, frame, 1 + chunk), delay + std::chrono::milliseconds(1));
+    }
+}
+
+static bool test_buffer_pool() {
+    Fixture f;
+    f.addEcu(0x7E1, 0x7E9);
+    ISO15765_BUFFER_POOL_STATS stats;
+    CHECK(f.ioctl(ISO15765_IOCTL_BUFFER_POOL_STATS, NULL, NULL) == ERR_NULL_PARAMETER);
+
+    // Single frames take no buffer
+    f.ecu->setHandler([](VirtualEcu &ecu, const Bytes &request) {
+        ecu.reply({0x62, request[1], request[2], 0x01}, std::chrono::milliseconds(10));
+    });
+    Bytes response;
+    CHECK(f.send({0x22, 0xF1, 0x90}) == 1);
+    CHECK(f.receive(response, 1000));
+    CHECK(f.ioctl(ISO15765_IOCTL_BUFFER_POOL_STATS, NULL, &stats) == STATUS_NOERROR);
+    for(const ISO15765_BUFFER_CLASS_STATS &sizeClass: stats.Classes) {
+        CHECK(sizeClass.Allocated == 0 && sizeClass.HighWater == 0);
+    }
+    CHECK(stats.Classes[0].Size == 64 && stats.Classes[3].Size == 4096);
+
+    // Two receptions at once, the buffers are given back when complete
+    Bytes first = image(20), second = image(50), large = image(300);
+    scheduleResponse(f, ECU_PID, first, std::chrono::milliseconds(0));
+    scheduleResponse(f, 0x7E9, second, std::chrono::milliseconds(0));
+    CHECK(f.receive(response, 1000));
+    CHECK(response == first);
+    CHECK(f.ioctl(ISO15765_IOCTL_BUFFER_POOL_STATS, NULL, &stats) == STATUS_NOERROR);
+    CHECK(stats.Classes[0].InUse == 1);
+    CHECK(f.receive(response, 1000));
+    CHECK(response == second);
+    CHECK(f.ioctl(ISO15765_IOCTL_BUFFER_POOL_STATS, NULL, &stats) == STATUS_NOERROR);
+    CHECK(stats.Classes[0].InUse == 0 && stats.Classes[0].HighWater == 2 && stats.Classes[0].Allocated == 2);
+
+    // Free buffers are reused, larger messages take a larger class
+    scheduleResponse(f, ECU_PID, first, std::chrono::milliseconds(0));
+    CHECK(f.receive(response, 1000));
+    scheduleResponse(f, ECU_PID, large, std::chrono::milliseconds(0));
+    CHECK(f.receive(response, 1000));
+    CHECK(response == large);
+    CHECK(f.ioctl(ISO15765_IOCTL_BUFFER_POOL_STATS, NULL, &stats) == STATUS_NOERROR);
+    CHECK(stats.Classes[0].Allocated == 2 && stats.Classes[0].HighWater == 2);
+    CHECK(stats.Classes[1].Allocated == 0);
+    CHECK(stats.Classes[2].Allocated == 1 && stats.Classes[2].InUse == 0);
+
+    // An interrupted reception gives its buffer back too
+    scheduleResponse(f, ECU_PID, large, std::chrono::milliseconds(0));
+    uint8_t singleFrame[] = {0x03, 0x62, 0xF1, 0x90};
+    f.raw->schedule(canFrame(ECU_PID, singleFrame, sizeof(singleFrame)), std::chrono::microseconds(500));
+    CHECK(f.receive(response, 1000));
+    CHECK((response == Bytes{0x62, 0xF1, 0x90}));
+    CHECK(f.ioctl(ISO15765_IOCTL_BUFFER_POOL_STATS, NULL, &stats) == STATUS_NOERROR);
+    CHECK(stats.Classes[2].InUse == 0);
+    return true;
+}
+
+static MessageFilterPtr startFilter(Fixture &f, uint32_t requestPid, uint32_t responsePid) {
+    PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+    memset(&maskMsg, 0, sizeof(maskMsg));
+    memset(&patternMsg, 0, sizeof(patternMsg));
+    memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+    maskMsg.DataSize = patternMsg.DataSize = flowControlMsg.DataSize = J2534_DATA_OFFSET;
+    pid2Data(0xFFFFFFFF, maskMsg.Data);
+    pid2Data(responsePid, patternMsg.Data);
+    pid2Data(requestPid, flowControlMsg.Data);
+    return f.iso->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+}
+
+static bool test_filter_registry() {
+    Fixture f;
+    f.addEcu(0x7E1, 0x7E9);
+    MessageFilterPtr filter = startFilter(f, 0x7E2, 0x7EA);
+    f.addEcu(0x7E3, 0x7EB);
+
+    // Removing a filter leaves the others in place
+    f.iso->stopMsgFilter(filter);
+    CHECK(f.send({0x3E, 0x00}, 0x7E2) == 0);
+    CHECK(f.send({0x3E, 0x00}, 0x7E1) == 1);
+    CHECK(f.send({0x3E, 0x00}, 0x7E3) == 1);
+
+    // Stopping it again changes nothing
+    f.iso->stopMsgFilter(filter);
+    ISO15765_SNAPSHOT snapshot;
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &snapshot) == STATUS_NOERROR);
+    CHECK(snapshot.NumOfFilters == 3);
+
+    // The filters stay in the order they were started
+    filter = startFilter(f, 0x7E4, 0x7EC);
+    CHECK(f.send({0x3E, 0x00}, 0x7E4) == 1);
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &snapshot) == STATUS_NOERROR);
+    CHECK(snapshot.NumOfFilters == 4);
+    CHECK(data2pid(snapshot.Filters[0].Pattern.Data) == ECU_PID);
+    CHECK(data2pid(snapshot.Filters[1].Pattern.Data) == 0x7E9);
+    CHECK(data2pid(snapshot.Filters[2].Pattern.Data) == 0x7EB);
+    CHECK(data2pid(snapshot.Filters[3].Pattern.Data) == 0x7EC);
+
+    // Also once the holes are squeezed out
+    std::vector<MessageFilterPtr> filters;
+    for(uint32_t i = 0; i < 8; ++i) {
+        filters.push_back(startFilter(f, 0x700 + i, 0x780 + i));
+    }
+    for(uint32_t i = 0; i < 7; ++i) {
+        f.iso->stopMsgFilter(filters[i]);
+    }
+    f.iso->stopMsgFilter(filter);
+    CHECK(f.ioctl(ISO15765_IOCTL_SNAPSHOT, NULL, &snapshot) == STATUS_NOERROR);
+    CHECK(snapshot.NumOfFilters == 4);
+    CHECK(data2pid(snapshot.Filters[2].Pattern.Data) == 0x7EB);
+    CHECK(data2pid(snapshot.Filters[3].Pattern.Data) == 0x787);
+    f.iso->stopMsgFilter(filters[7]);
+    CHECK(f.send({0x3E, 0x00}, 0x707) == 0);
+    CHECK(f.send({0x3E, 0x00}, 0x7E3) == 1);
+    return true;
+}
+
+static bool test_transfer_loop() {
+    Fixture f;
+    const uint32_t count = 64;
+    Bytes request = image(40);
+    for(uint32_t i = 0; i < count; ++i) {
+        f.addEcu(0x600 + i, 0x680 + i)->setHandler([i](VirtualEcu &ecu, const Bytes &received) {
+            Bytes response = image(100 + i);
+            response[0] = received[0];
+            ecu.reply(response, std::chrono::milliseconds(10));
+        });
+    }
+
+    // All the transfers run at once on the test thread
+    Configuration &configuration = std::static_pointer_cast<ChannelISO15765>(f.iso)->getConfiguration();
+    TransferLoop loop(configuration, *f.raw, *f.clock, std::make_shared<BufferPool>());
+    std::vector<Bytes> responses(count);
+    unsigned long sent = 0, failed = 0, received = 0;
+    loop.setSendHandler([&](uint32_t responsePid, bool success) {
+        UNUSED(responsePid);
+        (success ? sent : failed)++;
+    });
+    loop.setReceiveHandler([&](uint32_t responsePid, const PASSTHRU_MSG &msg) {
+        responses[responsePid - 0x680].assign(&msg.Data[J2534_DATA_OFFSET], &msg.Data[msg.DataSize]);
+        received++;
+    });
+    PASSTHRU_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.ProtocolID = ISO15765;
+    msg.DataSize = J2534_DATA_OFFSET + request.size();
+    memcpy(&msg.Data[J2534_DATA_OFFSET], request.data(), request.size());
+    for(uint32_t i = 0; i < count; ++i) {
+        loop.add(0x600 + i, 0x680 + i);
+        pid2Data(0x600 + i, msg.Data);
+        CHECK(loop.send(0x680 + i, msg, 1000));
+    }
+    CHECK(!loop.send(0x680, msg, 1000));
+    CHECK(!loop.send(0x7FF, msg, 1000));
+    try {
+        loop.add(0x600, 0x680);
+        CHECK(false);
+    } catch(J2534Exception &exception) {
+        CHECK(exception.code() == ERR_NOT_UNIQUE);
+    }
+
+    for(int i = 0; i < 10 && received < count; ++i) {
+        loop.poll(10);
+    }
+    CHECK(sent == count && failed == 0 && received == count);
+    CHECK(loop.isIdle());
+    for(uint32_t i = 0; i < count; ++i) {
+        CHECK(f.ecus[i + 1]->requests.size() == 1 && f.ecus[i + 1]->requests[0] == request);
+        CHECK(responses[i].size() == 100 + i && responses[i][0] == request[0]);
+    }
+    // One response delay, not one per ECU
+    CHECK(f.elapsed() <= 20);
+
+    // A sender without flow control times out, the others go on
+    loop.remove(0x681);
+    loop.add(0x7F0, 0x7F8);
+    pid2Data(0x7F0, msg.Data);
+    CHECK(loop.send(0x7F8, msg, 50));
+    pid2Data(0x600, msg.Data);
+    CHECK(loop.send(0x680, msg, 1000));
+    received = 0;
+    loop.poll(100);
+    CHECK(failed == 1 && sent == count + 1 && received == 1);
+    return true;
+}
+
+struct ServiceTest {
+    const char *name;
+    bool (*fct)();
+};
+
+static ServiceTest tests[] = {
+        {"flash_download", test_flash_download},
+        {"flash_block_length_limits", test_flash_block_length_limits},
+        {"flash_sequence_wrap", test_flash_sequence_wrap},
+        {"flash_response_pending", test_flash_response_pending},
+        {"flash_negative_response", test_flash_negative_response},
+        {"flash_timeout", test_flash_timeout},
+        {"flash_invalid", test_flash_invalid},
+        {"flash_checksum", test_flash_checksum},
+        {"flash_delta", test_flash_delta},
+        {"flash_delta_invalidation", test_flash_delta_invalidation},
+        {"flash_compressed", test_flash_compressed},
+        {"flash_file", test_flash_file},
+        {"obd_packing", test_obd_packing},
+        {"obd_periods", test_obd_periods},
+        {"obd_multi_ecu", test_obd_multi_ecu},
+        {"obd_batches", test_obd_batches},
+        {"obd_stop_outstanding", test_obd_stop_outstanding},
+        {"obd_timeouts", test_obd_timeouts},
+        {"rdbi_cache_hit", test_rdbi_cache_hit},
+        {"rdbi_cache_ttl", test_rdbi_cache_ttl},
+        {"rdbi_cache_invalidation", test_rdbi_cache_invalidation},
+        {"keepalive_idle", test_keepalive_idle},
+        {"keepalive_traffic", test_keepalive_traffic},
+        {"keepalive_targets", test_keepalive_targets},
+        {"keepalive_responses", test_keepalive_responses},
+        {"keepalive_invalid", test_keepalive_invalid},
+        {"dtc_parallel", test_dtc_parallel},
+        {"dtc_budget", test_dtc_budget},
+        {"dtc_failures", test_dtc_failures},
+        {"scan_11bit", test_scan_11bit},
+        {"scan_reassembly", test_scan_reassembly},
+        {"scan_29bit", test_scan_29bit},
+        {"pending_absorbed", test_pending_absorbed},
+        {"pending_p2_star", test_pending_p2_star},
+        {"transaction", test_transaction},
+        {"transaction_pending", test_transaction_pending},
+        {"transaction_deferred", test_transaction_deferred},
+        {"transaction_overflow", test_transaction_overflow},
+        {"dump_probe", test_dump_probe},
+        {"dump_resume", test_dump_resume},
+        {"dump_retry", test_dump_retry},
+        {"dump_pipeline", test_dump_pipeline},
+        {"snapshot_restore", test_snapshot_restore},
+        {"snapshot_services", test_snapshot_services},
+        {"snapshot_invalid", test_snapshot_invalid},
+        {"buffer_pool", test_buffer_pool},
+        {"filter_registry", test_filter_registry},
+        {"transfer_loop", test_transfer_loop},
+        {NULL, NULL}
+};
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int failed = 0;
+    for(ServiceTest *test = tests; test->name != NULL; ++test) {
+        bool ok = test->fct();
+        printf("%s %s\n", ok ? "OK  " : "FAIL", test->name);
+        if(!ok) {
+            failed++;
+        }
+    }
+
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("%d failed, ran in %ld ms\n", failed, ms);
+    return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <array>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef std::array<uint8_t, SHA256_DIGEST_SIZE> Sha256Digest;
+
+// SHA-256 (FIPS 180-4) of a buffer
+Sha256Digest sha256(const uint8_t *data, size_t size);
+
+#endif //_SHA256_H
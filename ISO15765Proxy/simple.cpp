@@ -1,8 +1,11 @@
 #include "stdafx.h"
 #include "simple.h"
 #include "ISO15765Proxy.h"
+#include "pool.h"
 #include "utils.h"
 
+#include <stdio.h>
+
 J2534Exception::J2534Exception(long code) : mCode(code) {
 }
 
@@ -33,7 +36,7 @@ DevicePtr LibrarySimple::open(void *pName) {
         throw J2534Exception(ret);
     }
     DevicePtr device = createDevice(pName, deviceID);
-    mDevices.push_back(device);
+    mDevices.add(device);
     return device;
 }
 
@@ -81,7 +84,7 @@ ChannelPtr DeviceSimple::connect(unsigned long ProtocolID, unsigned long Flags,
     }
 
     ChannelPtr channel = createChannel(ProtocolID, Flags, BaudRate, channelID);
-    mChannels.push_back(channel);
+    mChannels.add(channel);
     return channel;
 }
 
@@ -142,7 +145,7 @@ ChannelPtr DeviceSimple::createChannel(unsigned long ProtocolID, unsigned long F
     UNUSED(ProtocolID);
     UNUSED(Flags);
     UNUSED(BaudRate);
-    return std::make_shared<ChannelSimple>(std::static_pointer_cast<DeviceSimple>(shared_from_this()), channelId);
+    return makePooled<ChannelSimple>(std::static_pointer_cast<DeviceSimple>(shared_from_this()), channelId);
 }
 
 ChannelSimple::ChannelSimple(const DeviceSimplePtr &device, unsigned long channelId): mDevice(device), mChannelId(channelId) {
@@ -193,7 +196,7 @@ PeriodicMessagePtr ChannelSimple::startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned
     }
 
     PeriodicMessagePtr periodicMessage = createPeriodicMessage(pMsg, TimeInterval, msgID);
-    mPeriodicMessages.push_back(periodicMessage);
+    mPeriodicMessages.add(periodicMessage);
     return periodicMessage;
 }
 
@@ -228,7 +231,7 @@ MessageFilterPtr ChannelSimple::startMsgFilter(unsigned long FilterType, PASSTHR
     }
     
     MessageFilterPtr messageFilter = createMessageFilter(FilterType, pMaskMsg, pPatternMsg, pFlowControlMsg, messageFilterId);
-    mMessageFilters.push_back(messageFilter);
+    mMessageFilters.add(messageFilter);
     return messageFilter;
 }
 
@@ -269,13 +272,13 @@ MessageFilterPtr ChannelSimple::createMessageFilter(unsigned long FilterType, PA
     UNUSED(pMaskMsg);
     UNUSED(pPatternMsg);
     UNUSED(pFlowControlMsg);
-    return std::make_shared<MessageFilterSimple>(std::static_pointer_cast<ChannelSimple>(shared_from_this()), messageFilterId);
+    return makePooled<MessageFilterSimple>(std::static_pointer_cast<ChannelSimple>(shared_from_this()), messageFilterId);
 }
 
 PeriodicMessagePtr ChannelSimple::createPeriodicMessage(PASSTHRU_MSG *pMsg, unsigned long TimeInterval, unsigned long periodicMessageId) {
     UNUSED(pMsg);
     UNUSED(TimeInterval);
-    return std::make_shared<PeriodicMessageSimple>(std::static_pointer_cast<ChannelSimple>(shared_from_this()), periodicMessageId);
+    return makePooled<PeriodicMessageSimple>(std::static_pointer_cast<ChannelSimple>(shared_from_this()), periodicMessageId);
 }
 
 /*
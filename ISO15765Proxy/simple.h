@@ -5,7 +5,6 @@
 
 #include "ISO15765Proxy.h"
 #include <exception>
-#include <list>
 #include "internal.h"
 #include <memory>
 
@@ -46,7 +45,7 @@ public:
 protected:
     virtual DevicePtr createDevice(void *pName, unsigned long deviceId);
 
-    std::list<DevicePtr> mDevices;
+    Registry<Device> mDevices;
     j2534_fcts *mProxy;
 };
 
@@ -73,7 +72,7 @@ protected:
     virtual ChannelPtr createChannel(unsigned long ProtocolID, unsigned long Flags, unsigned long BaudRate, unsigned long channelId);
 
     LibrarySimpleWeakPtr mLibrary;
-    std::list<ChannelPtr> mChannels;
+    Registry<Channel> mChannels;
     unsigned long mDeviceId;
 };
 
@@ -106,8 +105,8 @@ protected:
     virtual PeriodicMessagePtr createPeriodicMessage(PASSTHRU_MSG *pMsg, unsigned long TimeInterval, unsigned long periodicMessageId);
 
     DeviceSimpleWeakPtr mDevice;
-    std::list<MessageFilterPtr> mMessageFilters;
-    std::list<PeriodicMessagePtr> mPeriodicMessages;
+    Registry<MessageFilter> mMessageFilters;
+    Registry<PeriodicMessage> mPeriodicMessages;
     unsigned long mChannelId;
 };
 
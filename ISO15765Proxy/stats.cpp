@@ -0,0 +1,17 @@
+#include "stats.h"
+
+#include <stddef.h>
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if(sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)(p * sorted.size() + 0.999999);
+    if(rank < 1) {
+        rank = 1;
+    }
+    if(rank > sorted.size()) {
+        rank = sorted.size();
+    }
+    return sorted[rank - 1];
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <vector>
+
+/*
+ * Statistics shared by the test and benchmark executables
+ */
+
+// Nearest-rank percentile of sorted samples, p in [0, 1]; 0 without samples
+double percentile(const std::vector<double> &sorted, double p);
+
+#endif //_STATS_H
@@ -0,0 +1,473 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "iso15765.h"
+#include "bus.h"
+#include "stats.h"
+#include "utils.h"
+
+#define J2534_DATA_OFFSET 4
+#define ISO15765_MAX_PAYLOAD 4095
+
+#define REQUEST_PID_BASE 0x600
+#define RESPONSE_PID_BASE 0x680
+#define FUNCTIONAL_PID 0x7DF
+#define FUNCTIONAL_RESPONSE_PID 0x7D7
+#define MAX_ECUS 0x80
+
+#define ECU_POLL_TIMEOUT 50
+#define EXCHANGE_TIMEOUT 5000
+
+#define SID_ECHO 0x31
+#define SID_FUNCTIONAL 0x3E
+#define POSITIVE_RESPONSE 0x40
+
+typedef std::chrono::steady_clock stress_clock;
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static void startFilter(const ChannelPtr &channel, uint32_t patternPid, uint32_t flowControlPid) {
+    PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+    memset(&maskMsg, 0, sizeof(maskMsg));
+    memset(&patternMsg, 0, sizeof(patternMsg));
+    memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+    maskMsg.DataSize = patternMsg.DataSize = flowControlMsg.DataSize = J2534_DATA_OFFSET;
+    pid2Data(0xFFFFFFFF, maskMsg.Data);
+    pid2Data(patternPid, patternMsg.Data);
+    pid2Data(flowControlPid, flowControlMsg.Data);
+    channel->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+}
+
+static void setBlockParameters(const ChannelPtr &channel, unsigned long bs, unsigned long stmin) {
+    SCONFIG CfgItem[2];
+    SCONFIG_LIST Input;
+    CfgItem[0].Parameter = ISO15765_BS;
+    CfgItem[0].Value = bs;
+    CfgItem[1].Parameter = ISO15765_STMIN;
+    CfgItem[1].Value = stmin;
+    Input.NumOfParams = 2;
+    Input.ConfigPtr = CfgItem;
+    channel->ioctl(SET_CONFIG, &Input, NULL);
+}
+
+struct StressOptions {
+    unsigned long buses;
+    unsigned long ecus;
+    unsigned long threads;
+    unsigned long duration;
+    unsigned long maxSize;
+    unsigned long functionalPercent;
+    unsigned long bs;
+    unsigned long stmin;
+    unsigned long seed;
+    const char *output;
+};
+
+struct StressStats {
+    StressStats(): exchanges(0), functional(0), bytes(0), writeFailures(0), readTimeouts(0), corrupted(0), unexpected(0), lockWait(0) {
+    }
+
+    void merge(const StressStats &other) {
+        exchanges += other.exchanges;
+        functional += other.functional;
+        bytes += other.bytes;
+        writeFailures += other.writeFailures;
+        readTimeouts += other.readTimeouts;
+        corrupted += other.corrupted;
+        unexpected += other.unexpected;
+        lockWait += other.lockWait;
+        latencies.insert(latencies.end(), other.latencies.begin(), other.latencies.end());
+    }
+
+    unsigned long errors() const {
+        return writeFailures + readTimeouts + corrupted + unexpected;
+    }
+
+    unsigned long exchanges;
+    unsigned long functional;
+    unsigned long long bytes;
+    unsigned long writeFailures;
+    unsigned long readTimeouts;
+    unsigned long corrupted;
+    unsigned long unexpected;
+    double lockWait;
+    std::vector<double> latencies;
+};
+
+/*
+ * Emulated ECU: answers physical requests with an echo and functional requests with its own index
+ */
+class StressEcu {
+public:
+    StressEcu(const BusPtr &bus, unsigned int index, const StressOptions &options);
+    ~StressEcu();
+
+    void start();
+    void stop();
+
+private:
+    void run();
+
+    BusPtr mBus;
+    unsigned int mIndex;
+    ChannelTestPtr mRaw;
+    ChannelPtr mChannel;
+    std::atomic<bool> mContinue;
+    std::thread mThread;
+    PASSTHRU_MSG mRequest;
+    PASSTHRU_MSG mResponse;
+};
+
+StressEcu::StressEcu(const BusPtr &bus, unsigned int index, const StressOptions &options): mBus(bus), mIndex(index), mContinue(true) {
+    mRaw = std::make_shared<ChannelTest>();
+    mBus->addChannel(mRaw);
+    mChannel = std::make_shared<ChannelISO15765>(ISO15765, nullptr, mRaw);
+    setBlockParameters(mChannel, options.bs, options.stmin);
+    startFilter(mChannel, REQUEST_PID_BASE + index, RESPONSE_PID_BASE + index);
+    startFilter(mChannel, FUNCTIONAL_PID, RESPONSE_PID_BASE + index);
+}
+
+StressEcu::~StressEcu() {
+    stop();
+    mBus->removeChannel(mRaw);
+}
+
+void StressEcu::start() {
+    mThread = std::thread(&StressEcu::run, this);
+}
+
+void StressEcu::stop() {
+    mContinue = false;
+    if(mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void StressEcu::run() {
+    while(mContinue) {
+        unsigned long count = 1;
+        mChannel->readMsgs(&mRequest, &count, ECU_POLL_TIMEOUT);
+        if(count != 1 || mRequest.DataSize <= J2534_DATA_OFFSET) {
+            continue;
+        }
+
+        memset(&mResponse, 0, sizeof(PASSTHRU_MSG));
+        mResponse.ProtocolID = ISO15765;
+        pid2Data(RESPONSE_PID_BASE + mIndex, mResponse.Data);
+        if(data2pid(mRequest.Data) == FUNCTIONAL_PID) {
+            mResponse.Data[J2534_DATA_OFFSET] = mRequest.Data[J2534_DATA_OFFSET] + POSITIVE_RESPONSE;
+            mResponse.Data[J2534_DATA_OFFSET + 1] = (uint8_t)mIndex;
+            mResponse.DataSize = J2534_DATA_OFFSET + 2;
+        } else {
+            memcpy(&mResponse.Data[J2534_DATA_OFFSET], &mRequest.Data[J2534_DATA_OFFSET], mRequest.DataSize - J2534_DATA_OFFSET);
+            mResponse.Data[J2534_DATA_OFFSET] += POSITIVE_RESPONSE;
+            mResponse.DataSize = mRequest.DataSize;
+        }
+        count = 1;
+        mChannel->writeMsgs(&mResponse, &count, EXCHANGE_TIMEOUT);
+    }
+}
+
+/*
+ * One tester on its own bus, shared by several client threads
+ */
+class StressStation {
+public:
+    StressStation(unsigned int index, const StressOptions &options);
+    ~StressStation();
+
+    void exchange(std::mt19937 &random, StressStats &stats);
+
+private:
+    void physical(std::mt19937 &random, StressStats &stats);
+    void functional(std::mt19937 &random, StressStats &stats);
+
+    const StressOptions &mOptions;
+    BusPtr mBus;
+    ChannelTestPtr mRaw;
+    ChannelPtr mChannel;
+    std::vector<std::unique_ptr<StressEcu>> mEcus;
+
+    std::mutex mMutex;
+    PASSTHRU_MSG mRequest;
+    PASSTHRU_MSG mResponse;
+};
+
+StressStation::StressStation(unsigned int index, const StressOptions &options): mOptions(options) {
+    UNUSED(index);
+    mBus = std::make_shared<Bus>();
+    mRaw = std::make_shared<ChannelTest>();
+    mBus->addChannel(mRaw);
+    mChannel = std::make_shared<ChannelISO15765>(ISO15765, nullptr, mRaw);
+    setBlockParameters(mChannel, options.bs, options.stmin);
+
+    for(unsigned int i = 0; i < options.ecus; ++i) {
+        startFilter(mChannel, RESPONSE_PID_BASE + i, REQUEST_PID_BASE + i);
+        mEcus.push_back(std::unique_ptr<StressEcu>(new StressEcu(mBus, i, options)));
+    }
+    // Transmit-only route for functional requests
+    startFilter(mChannel, FUNCTIONAL_RESPONSE_PID, FUNCTIONAL_PID);
+
+    for(std::unique_ptr<StressEcu> &ecu: mEcus) {
+        ecu->start();
+    }
+}
+
+StressStation::~StressStation() {
+    mEcus.clear();
+    mBus->removeChannel(mRaw);
+}
+
+void StressStation::exchange(std::mt19937 &random, StressStats &stats) {
+    stress_clock::time_point wait = stress_clock::now();
+    std::unique_lock<std::mutex> lck(mMutex);
+    stats.lockWait += std::chrono::duration<double>(stress_clock::now() - wait).count();
+
+    if(std::uniform_int_distribution<unsigned long>(0, 99)(random) < mOptions.functionalPercent) {
+        functional(random, stats);
+    } else {
+        physical(random, stats);
+    }
+}
+
+void StressStation::physical(std::mt19937 &random, StressStats &stats) {
+    unsigned int ecu = std::uniform_int_distribution<unsigned int>(0, mOptions.ecus - 1)(random);
+    size_t size = std::uniform_int_distribution<size_t>(1, mOptions.maxSize)(random);
+
+    memset(&mRequest, 0, sizeof(PASSTHRU_MSG));
+    mRequest.ProtocolID = ISO15765;
+    mRequest.DataSize = J2534_DATA_OFFSET + size;
+    pid2Data(REQUEST_PID_BASE + ecu, mRequest.Data);
+    mRequest.Data[J2534_DATA_OFFSET] = SID_ECHO;
+    for(size_t i = 1; i < size; ++i) {
+        mRequest.Data[J2534_DATA_OFFSET + i] = (uint8_t)random();
+    }
+
+    stress_clock::time_point start = stress_clock::now();
+    stress_clock::time_point deadline = start + std::chrono::milliseconds(EXCHANGE_TIMEOUT);
+    unsigned long count = 1;
+    mChannel->writeMsgs(&mRequest, &count, EXCHANGE_TIMEOUT);
+    if(count != 1) {
+        stats.writeFailures++;
+        return;
+    }
+
+    while(true) {
+        long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - stress_clock::now()).count();
+        if(remaining <= 0) {
+            stats.readTimeouts++;
+            return;
+        }
+        count = 1;
+        mChannel->readMsgs(&mResponse, &count, remaining);
+        if(count != 1) {
+            stats.readTimeouts++;
+            return;
+        }
+        if(data2pid(mResponse.Data) != RESPONSE_PID_BASE + ecu || mResponse.Data[J2534_DATA_OFFSET] != SID_ECHO + POSITIVE_RESPONSE) {
+            // Late answer to an earlier exchange
+            stats.unexpected++;
+            continue;
+        }
+        break;
+    }
+
+    if(mResponse.DataSize != mRequest.DataSize ||
+            memcmp(&mResponse.Data[J2534_DATA_OFFSET + 1], &mRequest.Data[J2534_DATA_OFFSET + 1], size - 1) != 0) {
+        stats.corrupted++;
+        return;
+    }
+    stats.exchanges++;
+    stats.bytes += 2 * size;
+    stats.latencies.push_back(std::chrono::duration<double, std::micro>(stress_clock::now() - start).count());
+}
+
+void StressStation::functional(std::mt19937 &random, StressStats &stats) {
+    UNUSED(random);
+    memset(&mRequest, 0, sizeof(PASSTHRU_MSG));
+    mRequest.ProtocolID = ISO15765;
+    mRequest.DataSize = J2534_DATA_OFFSET + 2;
+    pid2Data(FUNCTIONAL_PID, mRequest.Data);
+    mRequest.Data[J2534_DATA_OFFSET] = SID_FUNCTIONAL;
+
+    stress_clock::time_point start = stress_clock::now();
+    stress_clock::time_point deadline = start + std::chrono::milliseconds(EXCHANGE_TIMEOUT);
+    unsigned long count = 1;
+    mChannel->writeMsgs(&mRequest, &count, EXCHANGE_TIMEOUT);
+    if(count != 1) {
+        stats.writeFailures++;
+        return;
+    }
+
+    std::vector<bool> answered(mOptions.ecus, false);
+    unsigned long missing = mOptions.ecus;
+    while(missing > 0) {
+        long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - stress_clock::now()).count();
+        if(remaining <= 0) {
+            stats.readTimeouts++;
+            return;
+        }
+        count = 1;
+        mChannel->readMsgs(&mResponse, &count, remaining);
+        if(count != 1) {
+            stats.readTimeouts++;
+            return;
+        }
+        uint32_t pid = data2pid(mResponse.Data);
+        unsigned int ecu = mResponse.Data[J2534_DATA_OFFSET + 1];
+        if(mResponse.DataSize != J2534_DATA_OFFSET + 2 || mResponse.Data[J2534_DATA_OFFSET] != SID_FUNCTIONAL + POSITIVE_RESPONSE ||
+                ecu >= mOptions.ecus || pid != RESPONSE_PID_BASE + ecu || answered[ecu]) {
+            stats.unexpected++;
+            continue;
+        }
+        answered[ecu] = true;
+        missing--;
+    }
+    stats.functional++;
+    stats.exchanges++;
+    stats.latencies.push_back(std::chrono::duration<double, std::micro>(stress_clock::now() - start).count());
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  --buses M            Number of buses, each with its own tester channel\n");
+    fprintf(stderr, "  --ecus N             Emulated ECUs per bus (1-%d)\n", MAX_ECUS);
+    fprintf(stderr, "  --threads K          Client threads, spread over the buses\n");
+    fprintf(stderr, "  --duration S         Run time in seconds\n");
+    fprintf(stderr, "  --max-size BYTES     Largest physical request (1-%d)\n", ISO15765_MAX_PAYLOAD);
+    fprintf(stderr, "  --functional PCT     Percentage of functional broadcasts\n");
+    fprintf(stderr, "  --bs N --stmin N     Flow control parameters of every node\n");
+    fprintf(stderr, "  --seed N             Random seed\n");
+    fprintf(stderr, "  --output FILE        Write the JSON report to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[]) {
+    StressOptions options;
+    options.buses = 2;
+    options.ecus = 4;
+    options.threads = 4;
+    options.duration = 5;
+    options.maxSize = 512;
+    options.functionalPercent = 10;
+    options.bs = 0;
+    options.stmin = 0;
+    options.seed = 1;
+    options.output = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return -1;
+        }
+        const char *arg = argv[i];
+        const char *value = argv[++i];
+        unsigned long number = strtoul(value, NULL, 0);
+        if(strcmp(arg, "--buses") == 0) {
+            options.buses = number;
+        } else if(strcmp(arg, "--ecus") == 0) {
+            options.ecus = number;
+        } else if(strcmp(arg, "--threads") == 0) {
+            options.threads = number;
+        } else if(strcmp(arg, "--duration") == 0) {
+            options.duration = number;
+        } else if(strcmp(arg, "--max-size") == 0) {
+            options.maxSize = number;
+        } else if(strcmp(arg, "--functional") == 0) {
+            options.functionalPercent = number;
+        } else if(strcmp(arg, "--bs") == 0) {
+            options.bs = number;
+        } else if(strcmp(arg, "--stmin") == 0) {
+            options.stmin = number;
+        } else if(strcmp(arg, "--seed") == 0) {
+            options.seed = number;
+        } else if(strcmp(arg, "--output") == 0) {
+            options.output = value;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if(options.buses < 1 || options.threads < 1 || options.ecus < 1 || options.ecus > MAX_ECUS ||
+            options.maxSize < 1 || options.maxSize > ISO15765_MAX_PAYLOAD) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    std::vector<std::unique_ptr<StressStation>> stations;
+    for(unsigned int i = 0; i < options.buses; ++i) {
+        stations.push_back(std::unique_ptr<StressStation>(new StressStation(i, options)));
+    }
+
+    std::vector<StressStats> stats(options.threads);
+    std::vector<std::thread> threads;
+    stress_clock::time_point start = stress_clock::now();
+    stress_clock::time_point end = start + std::chrono::seconds(options.duration);
+    for(unsigned int i = 0; i < options.threads; ++i) {
+        StressStation *station = stations[i % stations.size()].get();
+        StressStats *s = &stats[i];
+        unsigned long seed = options.seed + i;
+        threads.push_back(std::thread([station, s, seed, end]() {
+            std::mt19937 random(seed);
+            while(stress_clock::now() < end) {
+                station->exchange(random, *s);
+            }
+        }));
+    }
+    for(std::thread &thread: threads) {
+        thread.join();
+    }
+    double wall = std::chrono::duration<double>(stress_clock::now() - start).count();
+    stations.clear();
+
+    StressStats total;
+    for(StressStats &s: stats) {
+        total.merge(s);
+    }
+    std::sort(total.latencies.begin(), total.latencies.end());
+
+    FILE *file = stdout;
+    if(options.output != NULL) {
+        file = fopen(options.output, "w");
+        if(file == NULL) {
+            fprintf(stderr, "Can't open %s\n", options.output);
+            return -1;
+        }
+    }
+    fprintf(file, "{\n  \"benchmark\": \"iso15765_stress\",\n");
+    fprintf(file, "  \"config\": {\"buses\": %lu, \"ecus\": %lu, \"threads\": %lu, \"duration_s\": %lu, \"max_size\": %lu, "
+            "\"functional_pct\": %lu, \"bs\": %lu, \"stmin\": %lu, \"seed\": %lu},\n",
+            options.buses, options.ecus, options.threads, options.duration, options.maxSize,
+            options.functionalPercent, options.bs, options.stmin, options.seed);
+    fprintf(file, "  \"exchanges\": %lu, \"functional\": %lu, \"exchanges_per_s\": %.2f, \"payload_MBps\": %.4f,\n",
+            total.exchanges, total.functional, total.exchanges / wall, total.bytes / wall / 1e6);
+    fprintf(file, "  \"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f},\n",
+            percentile(total.latencies, 0.50), percentile(total.latencies, 0.90), percentile(total.latencies, 0.99),
+            percentile(total.latencies, 0.999), total.latencies.empty() ? 0 : total.latencies.back());
+    fprintf(file, "  \"lock_wait_s\": %.4f,\n", total.lockWait);
+    fprintf(file, "  \"errors\": {\"write_failures\": %lu, \"read_timeouts\": %lu, \"corrupted\": %lu, \"unexpected\": %lu}\n}\n",
+            total.writeFailures, total.readTimeouts, total.corrupted, total.unexpected);
+    if(file != stdout) {
+        fclose(file);
+    }
+
+    return total.errors() == 0 ? 0 : -2;
+}
@@ -1,13 +1,11 @@
-#include <vector>
-#include <list>
-#include <mutex>
-#include <condition_variable>
 #include <thread>
 
+#include <stdio.h>
 #include <string.h>
 
 #include "internal.h"
 #include "iso15765.h"
+#include "bus.h"
 #include "utils.h"
 
 #define DEBUG
@@ -18,259 +16,6 @@
 #define LOG_DEBUG(...)
 #endif //DEBUG
 
-DEFINE_SHARED(ChannelTest)
-DEFINE_SHARED(MessageFilterTest)
-DEFINE_SHARED(Bus)
-
-class Bus: public std::enable_shared_from_this<Bus> {
-    friend class ChannelTest;
-public:
-    Bus();
-    ~Bus();
-    void addChannel(const ChannelTestPtr &channel);
-    void removeChannel(const ChannelTestPtr &channel);
-
-    static void _run(Bus *bus);
-protected:
-    void run();
-private:
-    std::list<ChannelTestPtr> mChannels;
-
-    bool mContinue;
-    std::thread mThread;
-    std::mutex mMutex;
-    std::list<ChannelTestPtr> mIncommingMessageChannels;
-    std::condition_variable mInterrupted;
-};
-
-class ChannelTest: public Channel {
-    friend class Bus;
-public:
-    ChannelTest();
-    
-    virtual ~ChannelTest();
-
-    virtual void readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override;
-
-    virtual void writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override;
-
-    virtual PeriodicMessagePtr startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) override;
-
-    virtual void stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) override;
-
-    virtual MessageFilterPtr startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
-                                         PASSTHRU_MSG *pFlowControlMsg) override;
-
-    virtual void stopMsgFilter(const MessageFilterPtr &messageFilter) override;
-
-    virtual void ioctl(unsigned long IoctlID, void *pInput, void *pOutput) override;
-
-    virtual DeviceWeakPtr getDevice() const override;
-
-private:
-    BusWeakPtr mBus;
-
-    std::list<PASSTHRU_MSG> mInBuffers;
-    std::list<PASSTHRU_MSG> mOutBuffers;
-
-    std::mutex mMutex;
-    std::condition_variable mInterrupted;
-};
-
-class MessageFilterTest : public MessageFilter {
-public:
-    MessageFilterTest(const ChannelTestPtr& channel);
-
-    virtual ChannelWeakPtr getChannel() const override;
-protected:
-    ChannelTestWeakPtr mChannel;
-};
-
-MessageFilterTest::MessageFilterTest(const ChannelTestPtr& channel): mChannel(channel) {
-
-}
-
-ChannelWeakPtr MessageFilterTest::getChannel() const {
-    return mChannel;
-}
-
-Bus::Bus(): mContinue(true), mThread(_run, this) {
-}
-
-Bus::~Bus() {
-    mContinue = false;
-    {
-        std::unique_lock<std::mutex> lck(mMutex);
-        mInterrupted.notify_all();
-    }
-    mThread.join();
-}
-
-void Bus::_run(Bus *bus) {
-    bus->run();
-}
-
-void Bus::addChannel(const ChannelTestPtr &channel) {
-    std::unique_lock<std::mutex> lck (mMutex);
-    channel->mBus = shared_from_this();
-    mChannels.push_back(channel);
-}
-void Bus::removeChannel(const ChannelTestPtr &channel) {
-    std::unique_lock<std::mutex> lck (mMutex);
-    channel->mBus.reset();
-    mChannels.remove(channel);
-}
-
-static void printMsg(PASSTHRU_MSG &msg) {
-#ifdef DEBUG
-    for(unsigned int i = 0; i < msg.DataSize; ++i) {
-        printf("%02x ", msg.Data[i]);
-    }
-    printf("\n");
-#else //DEBUG
-    UNUSED(msg);
-#endif //DEBUG
-}
-
-void Bus::run() {
-    std::unique_lock<std::mutex> lck (mMutex);
-    while(mContinue) {
-        mInterrupted.wait(lck);
-
-        while(!mIncommingMessageChannels.empty()) {
-            ChannelTestPtr channel = mIncommingMessageChannels.front();
-
-            std::unique_lock<std::mutex> lckC (channel->mMutex);
-
-            while(!channel->mOutBuffers.empty()) {
-                // Dispatch the incoming message to the other channel on the bus
-                PASSTHRU_MSG &msg = channel->mOutBuffers.front();
-                printMsg(msg);
-                for(ChannelTestPtr &c: mChannels) {
-                    if(c != channel) {
-                        std::unique_lock<std::mutex> lckC2 (c->mMutex);
-                        c->mInBuffers.push_back(msg);
-                        c->mInterrupted.notify_all();
-                        LOG_DEBUG("%p -> %p", (void*)channel.get(), (void*)c.get());
-                    }
-                }
-                channel->mOutBuffers.pop_front();
-            }
-
-            channel->mInterrupted.notify_all();
-            mIncommingMessageChannels.pop_front();
-        }
-    }
-}
-
-
-ChannelTest::ChannelTest() {
-}
-
-ChannelTest::~ChannelTest() {
-    
-}
-
-void ChannelTest::readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
-    BusPtr bus = mBus.lock();
-    if(!bus) {
-        LOG_DEBUG("No connected to bus");
-        *pNumMsgs = 0;
-        return;
-    }
-
-    // Set Deadline
-    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
-    unsigned long count = 0;
-    std::unique_lock<std::mutex> lck (mMutex);
-    
-    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
-        while(mInBuffers.empty()) {
-            if(mInterrupted.wait_until(lck, deadline) == std::cv_status::timeout) {
-                goto end;
-            }
-        }
-        *(pMsg++) = mInBuffers.front();
-        mInBuffers.pop_front();
-        
-        count++;
-    }
-end:
-    *pNumMsgs = count;
-    LOG_DEBUG("Read %ld message(s)", *pNumMsgs);
-}
-
-void ChannelTest::writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
-    BusPtr bus = mBus.lock();
-    if(!bus) {
-        LOG_DEBUG("No connected to bus");
-        *pNumMsgs = 0;
-        return;
-    }
-
-    // Set Deadline
-    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
-
-    unsigned long count = 0;
-    std::unique_lock<std::mutex> lck (mMutex);
-
-    LOG_DEBUG("Send %ld message(s)", *pNumMsgs);
-    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
-        mOutBuffers.push_back(*(pMsg++));
-        bus->mIncommingMessageChannels.push_back(std::static_pointer_cast<ChannelTest>(shared_from_this()));
-        bus->mInterrupted.notify_all();
-
-        while(!mOutBuffers.empty()) {
-            if(mInterrupted.wait_until(lck, deadline) == std::cv_status::timeout) {
-                goto end;
-            }
-        }
-        
-        count++;
-    }
-
-end:
-    *pNumMsgs = count;
-    return;
-}
-
-PeriodicMessagePtr ChannelTest::startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) {
-    UNUSED(pMsg);
-    UNUSED(TimeInterval);
-    return nullptr;
-}
-
-void ChannelTest::stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) {
-    UNUSED(periodicMessage);
-}
-
-MessageFilterPtr ChannelTest::startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
-                                                             PASSTHRU_MSG *pFlowControlMsg) {
-    UNUSED(FilterType);
-    UNUSED(pMaskMsg);
-    UNUSED(pPatternMsg);
-    UNUSED(pFlowControlMsg);
-    return std::make_shared<MessageFilterTest>(std::static_pointer_cast<ChannelTest>(shared_from_this()));
-}
-
-void ChannelTest::stopMsgFilter(const MessageFilterPtr &messageFilter) {
-    UNUSED(messageFilter);
-}
-
-void ChannelTest::ioctl(unsigned long IoctlID, void *pInput, void *pOutput) {
-    UNUSED(pInput);
-    UNUSED(pOutput);
-    if(IoctlID == CLEAR_RX_BUFFER) {
-        mInBuffers.clear();
-    } else if(IoctlID == CLEAR_TX_BUFFER) {
-        mOutBuffers.clear();
-    }
-}
-
-DeviceWeakPtr ChannelTest::getDevice() const {
-    return DeviceWeakPtr();
-}
-
 static void pid2Data(uint32_t pid, uint8_t *data) {
     data[0] = 0x1F & (pid >> 24);
     data[1] = 0xFF & (pid >> 16);
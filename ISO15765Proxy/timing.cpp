@@ -0,0 +1,324 @@
+#include <chrono>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "internal.h"
+#include "iso15765.h"
+#include "virtual_channel.h"
+#include "utils.h"
+
+#define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
+
+#define CHECK(x) if(!(x)) { LOG_DEBUG("    %s:%d: check failed: %s", __FILE__, __LINE__, #x); return false; }
+
+#define J2534_DATA_OFFSET 4
+
+#define TESTER_PID 0x7E0
+#define ECU_PID 0x7E8
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static PASSTHRU_MSG canFrame(uint32_t pid, const uint8_t *data, size_t size) {
+    PASSTHRU_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.ProtocolID = CAN;
+    msg.DataSize = J2534_DATA_OFFSET + size;
+    pid2Data(pid, msg.Data);
+    memcpy(&msg.Data[J2534_DATA_OFFSET], data, size);
+    return msg;
+}
+
+static PASSTHRU_MSG flowControl(uint8_t bs, uint8_t stmin) {
+    uint8_t data[] = {0x30, bs, stmin, 0, 0, 0, 0, 0};
+    return canFrame(ECU_PID, data, sizeof(data));
+}
+
+static PASSTHRU_MSG isoMessage(uint32_t pid, size_t size) {
+    PASSTHRU_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.ProtocolID = ISO15765;
+    msg.DataSize = J2534_DATA_OFFSET + size;
+    pid2Data(pid, msg.Data);
+    for(size_t i = 0; i < size; ++i) {
+        msg.Data[J2534_DATA_OFFSET + i] = (uint8_t)i;
+    }
+    return msg;
+}
+
+static uint8_t frameType(const PASSTHRU_MSG &msg) {
+    return msg.Data[J2534_DATA_OFFSET] >> 4;
+}
+
+static long elapsedUs(const Clock::time_point &from, const Clock::time_point &to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+/*
+ * Tester side ISO15765 channel on top of a virtual CAN channel
+ */
+class Fixture {
+public:
+    Fixture(unsigned long bs = 0, unsigned long stmin = 0) {
+        clock = std::make_shared<VirtualClock>();
+        raw = std::make_shared<ChannelVirtual>(clock);
+        iso = std::make_shared<ChannelISO15765>(ISO15765, nullptr, raw, clock);
+
+        SCONFIG CfgItem[2];
+        SCONFIG_LIST Input;
+        CfgItem[0].Parameter = ISO15765_BS;
+        CfgItem[0].Value = bs;
+        CfgItem[1].Parameter = ISO15765_STMIN;
+        CfgItem[1].Value = stmin;
+        Input.NumOfParams = 2;
+        Input.ConfigPtr = CfgItem;
+        iso->ioctl(SET_CONFIG, &Input, NULL);
+
+        PASSTHRU_MSG maskMsg, patternMsg, flowControlMsg;
+        memset(&maskMsg, 0, sizeof(maskMsg));
+        memset(&patternMsg, 0, sizeof(patternMsg));
+        memset(&flowControlMsg, 0, sizeof(flowControlMsg));
+        pid2Data(0xFFFFFFFF, maskMsg.Data);
+        pid2Data(ECU_PID, patternMsg.Data);
+        pid2Data(TESTER_PID, flowControlMsg.Data);
+        iso->startMsgFilter(FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg);
+
+        start = clock->now();
+    }
+
+    unsigned long write(size_t size, unsigned long timeout) {
+        PASSTHRU_MSG msg = isoMessage(TESTER_PID, size);
+        unsigned long count = 1;
+        iso->writeMsgs(&msg, &count, timeout);
+        return count;
+    }
+
+    unsigned long read(PASSTHRU_MSG &msg, unsigned long timeout) {
+        unsigned long count = 1;
+        iso->readMsgs(&msg, &count, timeout);
+        return count;
+    }
+
+    std::vector<ChannelVirtual::Frame> sentFrames(uint8_t type) const {
+        std::vector<ChannelVirtual::Frame> frames;
+        for(const ChannelVirtual::Frame &frame: raw->getSentFrames()) {
+            if(frameType(frame.msg) == type) {
+                frames.push_back(frame);
+            }
+        }
+        return frames;
+    }
+
+    long elapsed() {
+        return elapsedUs(start, clock->now());
+    }
+
+    VirtualClockPtr clock;
+    ChannelVirtualPtr raw;
+    ChannelPtr iso;
+    Clock::time_point start;
+};
+
+/*
+ * Answer every FirstFrame, and then every `bs` ConsecutiveFrames, with a FlowControl after `delay`
+ */
+static ChannelVirtual::Responder flowControlResponder(uint8_t bs, uint8_t stmin, Clock::duration delay, int *fcCount = NULL) {
+    std::shared_ptr<unsigned int> cfs = std::make_shared<unsigned int>(0);
+    return [=](ChannelVirtual &channel, const PASSTHRU_MSG &msg) {
+        uint8_t type = frameType(msg);
+        bool send = false;
+        if(type == 1) {
+            *cfs = 0;
+            send = true;
+        } else if(type == 2 && bs != 0 && (++(*cfs) % bs) == 0) {
+            send = true;
+        }
+        if(send) {
+            if(fcCount != NULL) {
+                (*fcCount)++;
+            }
+            channel.schedule(flowControl(bs, stmin), delay);
+        }
+    };
+}
+
+static bool test_single_frame() {
+    Fixture f;
+    CHECK(f.write(7, 1000) == 1);
+    CHECK(f.raw->getSentFrames().size() == 1);
+    CHECK(frameType(f.raw->getSentFrames()[0].msg) == 0);
+    CHECK(f.elapsed() == 0);
+    return true;
+}
+
+static bool test_tx_stmin_ms() {
+    Fixture f;
+    f.raw->setResponder(flowControlResponder(0, 20, std::chrono::milliseconds(5)));
+    CHECK(f.write(50, 5000) == 1);
+
+    std::vector<ChannelVirtual::Frame> cfs = f.sentFrames(2);
+    CHECK(cfs.size() == 7);
+    for(size_t i = 1; i < cfs.size(); ++i) {
+        CHECK(elapsedUs(cfs[i - 1].time, cfs[i].time) == 20000);
+    }
+    return true;
+}
+
+static bool test_tx_stmin_us() {
+    Fixture f;
+    f.raw->setResponder(flowControlResponder(0, 0xF5, std::chrono::milliseconds(1)));
+    CHECK(f.write(50, 5000) == 1);
+
+    std::vector<ChannelVirtual::Frame> cfs = f.sentFrames(2);
+    CHECK(cfs.size() == 7);
+    for(size_t i = 1; i < cfs.size(); ++i) {
+        CHECK(elapsedUs(cfs[i - 1].time, cfs[i].time) == 500);
+    }
+    return true;
+}
+
+static bool test_tx_stmin_reserved() {
+    Fixture f;
+    f.raw->setResponder(flowControlResponder(0, 0xA0, std::chrono::milliseconds(1)));
+    CHECK(f.write(20, 5000) == 1);
+
+    std::vector<ChannelVirtual::Frame> cfs = f.sentFrames(2);
+    CHECK(cfs.size() == 2);
+    CHECK(elapsedUs(cfs[0].time, cfs[1].time) == 127000);
+    return true;
+}
+
+static bool test_tx_block_size() {
+    Fixture f;
+    int fcCount = 0;
+    f.raw->setResponder(flowControlResponder(2, 0, std::chrono::milliseconds(3), &fcCount));
+    CHECK(f.write(62, 5000) == 1);
+
+    // 62 bytes = FF (6) + 8 CF (7 each), one FC after the FF and one after every 2 CF except the last pair
+    CHECK(f.sentFrames(2).size() == 8);
+    CHECK(fcCount == 5);
+    CHECK(f.elapsed() == 4 * 3000);
+    return true;
+}
+
+static bool test_tx_no_flow_control() {
+    Fixture f;
+    CHECK(f.write(50, 1000) == 0);
+    CHECK(f.sentFrames(1).size() == 1);
+    CHECK(f.sentFrames(2).size() == 0);
+    CHECK(f.elapsed() == 1000000);
+    return true;
+}
+
+static bool test_tx_deadline_during_block() {
+    Fixture f;
+    f.raw->setResponder(flowControlResponder(0, 100, std::chrono::milliseconds(0)));
+    CHECK(f.write(50, 250) == 0);
+    CHECK(f.sentFrames(2).size() < 7);
+    CHECK(f.elapsed() <= 300000);
+    return true;
+}
+
+static bool test_rx_flow_control_parameters() {
+    Fixture f(8, 0xF3);
+    uint8_t ff[] = {0x10, 20, 0, 1, 2, 3, 4, 5};
+    f.raw->schedule(canFrame(ECU_PID, ff, sizeof(ff)), std::chrono::milliseconds(10));
+
+    PASSTHRU_MSG msg;
+    CHECK(f.read(msg, 100) == 0);
+
+    std::vector<ChannelVirtual::Frame> fcs = f.sentFrames(3);
+    CHECK(fcs.size() == 1);
+    CHECK(data2pid(fcs[0].msg.Data) == TESTER_PID);
+    CHECK(fcs[0].msg.Data[J2534_DATA_OFFSET + 1] == 8);
+    CHECK(fcs[0].msg.Data[J2534_DATA_OFFSET + 2] == 0xF3);
+    CHECK(elapsedUs(f.start, fcs[0].time) == 10000);
+    return true;
+}
+
+static bool test_rx_consecutive_timeout() {
+    Fixture f;
+    uint8_t ff[] = {0x10, 20, 0, 1, 2, 3, 4, 5};
+    f.raw->schedule(canFrame(ECU_PID, ff, sizeof(ff)), std::chrono::milliseconds(0));
+
+    PASSTHRU_MSG msg;
+    CHECK(f.read(msg, 500) == 0);
+    CHECK(f.elapsed() == 500000);
+    return true;
+}
+
+static bool test_rx_multi_frame() {
+    Fixture f;
+    uint8_t ff[] = {0x10, 20, 0, 1, 2, 3, 4, 5};
+    uint8_t cf1[] = {0x21, 6, 7, 8, 9, 10, 11, 12};
+    uint8_t cf2[] = {0x22, 13, 14, 15, 16, 17, 18, 19};
+    f.raw->schedule(canFrame(ECU_PID, ff, sizeof(ff)), std::chrono::milliseconds(0));
+    f.raw->schedule(canFrame(ECU_PID, cf1, sizeof(cf1)), std::chrono::milliseconds(15));
+    f.raw->schedule(canFrame(ECU_PID, cf2, sizeof(cf2)), std::chrono::milliseconds(30));
+
+    PASSTHRU_MSG msg;
+    CHECK(f.read(msg, 1000) == 1);
+    CHECK(msg.DataSize == J2534_DATA_OFFSET + 20);
+    for(size_t i = 0; i < 20; ++i) {
+        CHECK(msg.Data[J2534_DATA_OFFSET + i] == i);
+    }
+    CHECK(f.elapsed() == 30000);
+    return true;
+}
+
+static bool test_rx_nothing() {
+    Fixture f;
+    PASSTHRU_MSG msg;
+    CHECK(f.read(msg, 2000) == 0);
+    CHECK(f.elapsed() == 2000000);
+    return true;
+}
+
+struct TimingTest {
+    const char *name;
+    bool (*fct)();
+};
+
+static TimingTest tests[] = {
+        {"single_frame", test_single_frame},
+        {"tx_stmin_ms", test_tx_stmin_ms},
+        {"tx_stmin_us", test_tx_stmin_us},
+        {"tx_stmin_reserved", test_tx_stmin_reserved},
+        {"tx_block_size", test_tx_block_size},
+        {"tx_no_flow_control", test_tx_no_flow_control},
+        {"tx_deadline_during_block", test_tx_deadline_during_block},
+        {"rx_flow_control_parameters", test_rx_flow_control_parameters},
+        {"rx_consecutive_timeout", test_rx_consecutive_timeout},
+        {"rx_multi_frame", test_rx_multi_frame},
+        {"rx_nothing", test_rx_nothing},
+        {NULL, NULL}
+};
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int failed = 0;
+    for(TimingTest *test = tests; test->name != NULL; ++test) {
+        bool ok = test->fct();
+        printf("%s %s\n", ok ? "OK  " : "FAIL", test->name);
+        if(!ok) {
+            failed++;
+        }
+    }
+
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("%d failed, ran in %ld ms\n", failed, ms);
+    return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,215 @@
+#include "transfer_loop.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "simple.h"
+
+#define LOG_DEBUG(...) printf(__VA_ARGS__); printf("\n"); fflush(stdout)
+
+#define J2534_DATA_OFFSET 4
+#define ISO15765_MAX_SIZE 0xFFF
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((uint32_t)(data[0] & 0x1F) << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+TransferLoop::Transfer::Transfer(Configuration &configuration, const BufferPoolPtr &pool, uint32_t requestPid):
+        requestPid(requestPid), receiver(configuration, pool, requestPid), sending(false), first(false) {
+}
+
+TransferLoop::TransferLoop(Configuration &configuration, Channel &channel, Clock &clock, const BufferPoolPtr &pool):
+        mConfiguration(configuration), mChannel(channel), mClock(clock), mPool(pool), mSending(0) {
+}
+
+TransferLoop::~TransferLoop() {
+}
+
+void TransferLoop::setReceiveHandler(const ReceiveHandler &handler) {
+    mReceiveHandler = handler;
+}
+
+void TransferLoop::setSendHandler(const SendHandler &handler) {
+    mSendHandler = handler;
+}
+
+void TransferLoop::add(uint32_t requestPid, uint32_t responsePid) {
+    if(mTransfers.find(responsePid) != mTransfers.end()) {
+        throw J2534Exception(ERR_NOT_UNIQUE);
+    }
+    mTransfers[responsePid] = std::make_unique<Transfer>(mConfiguration, mPool, requestPid);
+}
+
+void TransferLoop::remove(uint32_t responsePid) {
+    auto it = mTransfers.find(responsePid);
+    if(it == mTransfers.end()) {
+        return;
+    }
+    if(it->second->sending) {
+        mSending--;
+    }
+    mTransfers.erase(it);
+}
+
+bool TransferLoop::send(uint32_t responsePid, const PASSTHRU_MSG &msg, unsigned long Timeout) {
+    auto it = mTransfers.find(responsePid);
+    if(it == mTransfers.end()) {
+        return false;
+    }
+    Transfer &transfer = *it->second;
+    if(transfer.sending || transfer.receiver.isReceiving()) {
+        LOG_DEBUG("Wrong state");
+        return false;
+    }
+    if(msg.DataSize <= J2534_DATA_OFFSET || msg.DataSize > J2534_DATA_OFFSET + ISO15765_MAX_SIZE) {
+        LOG_DEBUG("Invalid size");
+        return false;
+    }
+    transfer.payload.assign(&msg.Data[J2534_DATA_OFFSET], &msg.Data[msg.DataSize]);
+    if(!transfer.sender.start(data2pid(msg.Data), msg.TxFlags, transfer.payload.data(), transfer.payload.size())) {
+        return false;
+    }
+    transfer.sending = true;
+    transfer.first = true;
+    transfer.deadline = mClock.now() + std::chrono::milliseconds(Timeout);
+    mSending++;
+    return true;
+}
+
+bool TransferLoop::isIdle() const {
+    if(mSending > 0) {
+        return false;
+    }
+    for(const auto &it: mTransfers) {
+        if(it.second->receiver.isReceiving()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TransferLoop::writeFrame(const CanFrame &frame) {
+    PASSTHRU_MSG msg;
+    frameToMsg(frame, msg);
+    unsigned long count = 1;
+    mChannel.writeMsgs(&msg, &count, 0);
+    return count == 1;
+}
+
+void TransferLoop::finish(uint32_t responsePid, Transfer &transfer, bool success) {
+    transfer.sender.clear();
+    transfer.sending = false;
+    mSending--;
+    if(mSendHandler) {
+        mSendHandler(responsePid, success);
+    }
+}
+
+// Writes the frames that are due, wakeUp is brought back to the next separation time or sender timeout
+void TransferLoop::runSenders(Clock::time_point &wakeUp) {
+    if(mSending == 0) {
+        return;
+    }
+    CanFrame frame;
+    for(auto &it: mTransfers) {
+        Transfer &transfer = *it.second;
+        while(transfer.sending) {
+            Clock::time_point now = mClock.now();
+            SenderISO15765::Status status = transfer.sender.getStatus(now);
+            if(status == SenderISO15765::DONE) {
+                finish(it.first, transfer, true);
+            } else if(status == SenderISO15765::WAIT_SEPARATION) {
+                wakeUp = std::min(wakeUp, transfer.sender.getWakeUp());
+                break;
+            } else if(!transfer.first && now >= transfer.deadline) {
+                LOG_DEBUG("Timeout");
+                finish(it.first, transfer, false);
+            } else if(status == SenderISO15765::SEND) {
+                transfer.first = false;
+                transfer.sender.next(frame, now);
+                if(!writeFrame(frame)) {
+                    LOG_DEBUG("Can't write message");
+                    finish(it.first, transfer, false);
+                }
+            } else if(status == SenderISO15765::WAIT_FLOW_CONTROL) {
+                wakeUp = std::min(wakeUp, transfer.deadline);
+                break;
+            } else {
+                finish(it.first, transfer, false);
+            }
+        }
+    }
+}
+
+void TransferLoop::dispatch(const CanFrame &frame) {
+    auto it = mTransfers.find(frame.id);
+    if(it == mTransfers.end()) {
+        return;
+    }
+    Transfer &transfer = *it->second;
+    Clock::time_point now = mClock.now();
+    if(transfer.sending && transfer.sender.getStatus(now) == SenderISO15765::WAIT_FLOW_CONTROL && isFlowControl(frame)) {
+        if(!transfer.sender.onFlowControl(frame, now)) {
+            finish(it->first, transfer, false);
+        }
+        return;
+    }
+
+    CanFrame flowControl;
+    unsigned int events = transfer.receiver.onFrame(frame, flowControl, mMessage);
+    if(events & ReceiverISO15765::FLOW_CONTROL) {
+        if(!writeFrame(flowControl)) {
+            LOG_DEBUG("Can't send flow control message");
+            transfer.receiver.clear();
+            return;
+        }
+    }
+    if((events & ReceiverISO15765::COMPLETE) && mReceiveHandler) {
+        mReceiveHandler(it->first, mMessage);
+    }
+}
+
+unsigned long TransferLoop::readFrames(PASSTHRU_MSG *pMsg, unsigned long count, unsigned long Timeout) {
+    try {
+        mChannel.readMsgs(pMsg, &count, Timeout);
+    } catch(J2534Exception &exception) {
+        // The frames read before the timeout are counted
+        if(exception.code() != ERR_TIMEOUT && exception.code() != ERR_BUFFER_EMPTY) {
+            throw;
+        }
+    }
+    return count;
+}
+
+void TransferLoop::poll(unsigned long Timeout) {
+    Clock::time_point deadline = mClock.now() + std::chrono::milliseconds(Timeout);
+    while(true) {
+        Clock::time_point wakeUp = deadline;
+        runSenders(wakeUp);
+
+        Clock::time_point now = mClock.now();
+        if(now >= deadline) {
+            break;
+        }
+
+        // A read only returns once all the asked frames are there: wait for the first one, then take the others
+        // already received. Separation times below the millisecond are slept.
+        long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(wakeUp - now).count();
+        unsigned long count = readFrames(mFrames, 1, remaining > 0 ? remaining : 0);
+        if(count == 1) {
+            count += readFrames(mFrames + 1, TRANSFER_LOOP_READ_BATCH - 1, 0);
+        }
+        for(unsigned long i = 0; i < count; ++i) {
+            CanFrame frame;
+            if(msgToFrame(mFrames[i], frame)) {
+                dispatch(frame);
+            }
+        }
+        if(count == 0 && remaining <= 0 && wakeUp > mClock.now()) {
+            mClock.sleepFor(wakeUp - mClock.now());
+        }
+    }
+}
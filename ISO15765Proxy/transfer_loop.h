@@ -0,0 +1,89 @@
+#pragma once
+
+#ifndef _TRANSFER_LOOP_H
+#define _TRANSFER_LOOP_H
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal.h"
+#include "iso15765_engine.h"
+
+#define TRANSFER_LOOP_READ_BATCH 16
+
+/*
+ * Any number of ISO15765 transfers on one CAN channel, run by a single thread. poll() writes the frames that are
+ * due, then reads and dispatches the incoming frames until the next separation time or timeout of a sender; no
+ * transfer blocks another. Transfers are addressed by the exact CAN ID of their responses.
+ * The handlers may send() but must not add() or remove() transfers.
+ * Only built with the tests, which drive many ECUs through it: the channels don't use it.
+ */
+class TransferLoop {
+public:
+    // Complete messages, from poll()
+    typedef std::function<void(uint32_t responsePid, const PASSTHRU_MSG &msg)> ReceiveHandler;
+
+    // End of the messages given to send(), from poll()
+    typedef std::function<void(uint32_t responsePid, bool success)> SendHandler;
+
+    TransferLoop(Configuration &configuration, Channel &channel, Clock &clock, const BufferPoolPtr &pool);
+    ~TransferLoop();
+
+    void setReceiveHandler(const ReceiveHandler &handler);
+
+    void setSendHandler(const SendHandler &handler);
+
+    void add(uint32_t requestPid, uint32_t responsePid);
+
+    void remove(uint32_t responsePid);
+
+    // The payload is copied; false if the transfer is unknown or already sending
+    bool send(uint32_t responsePid, const PASSTHRU_MSG &msg, unsigned long Timeout);
+
+    // Runs the transfers for Timeout ms
+    void poll(unsigned long Timeout);
+
+    // No message being sent or received
+    bool isIdle() const;
+
+private:
+    struct Transfer {
+        Transfer(Configuration &configuration, const BufferPoolPtr &pool, uint32_t requestPid);
+
+        uint32_t requestPid;
+        SenderISO15765 sender;
+        ReceiverISO15765 receiver;
+        std::vector<uint8_t> payload;
+        bool sending;
+        bool first;
+        Clock::time_point deadline;
+    };
+
+    void runSenders(Clock::time_point &wakeUp);
+
+    void finish(uint32_t responsePid, Transfer &transfer, bool success);
+
+    void dispatch(const CanFrame &frame);
+
+    bool writeFrame(const CanFrame &frame);
+
+    unsigned long readFrames(PASSTHRU_MSG *pMsg, unsigned long count, unsigned long Timeout);
+
+    Configuration &mConfiguration;
+    Channel &mChannel;
+    Clock &mClock;
+    BufferPoolPtr mPool;
+    ReceiveHandler mReceiveHandler;
+    SendHandler mSendHandler;
+    std::unordered_map<uint32_t, std::unique_ptr<Transfer>> mTransfers;
+    size_t mSending;
+    PASSTHRU_MSG mFrames[TRANSFER_LOOP_READ_BATCH];
+    PASSTHRU_MSG mMessage;
+};
+
+#endif //_TRANSFER_LOOP_H
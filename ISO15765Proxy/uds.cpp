@@ -0,0 +1,139 @@
+#include "uds.h"
+
+#include <chrono>
+
+#include <string.h>
+
+#include "simple.h"
+#include "utils.h"
+
+#define J2534_DATA_OFFSET 4
+
+static uint32_t data2pid(const uint8_t *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static void pid2Data(uint32_t pid, uint8_t *data) {
+    data[0] = (0x1F & (pid >> 24));
+    data[1] = (0xFF & (pid >> 16));
+    data[2] = (0xFF & (pid >> 8));
+    data[3] = (0xFF & (pid >> 0));
+}
+
+static long remainingTime(Clock &clock, const Clock::time_point &deadline) {
+    return (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock.now())).count();
+}
+
+UdsClient::UdsClient(Channel &channel, Clock &clock, uint32_t requestPid, uint32_t responsePid): mChannel(channel),
+        mClock(clock), mRequestPid(requestPid), mResponsePid(responsePid), mTxFlags(0), mP2(UDS_DEFAULT_P2),
+        mP2Star(UDS_DEFAULT_P2_STAR), mResponsePending(0) {
+}
+
+UdsClient::~UdsClient() {
+}
+
+void UdsClient::setTimeouts(unsigned long p2, unsigned long p2Star) {
+    mP2 = (p2 != 0) ? p2 : UDS_DEFAULT_P2;
+    mP2Star = (p2Star != 0) ? p2Star : UDS_DEFAULT_P2_STAR;
+}
+
+void UdsClient::setTxFlags(unsigned long txFlags) {
+    mTxFlags = txFlags;
+}
+
+PASSTHRU_MSG &UdsClient::prepare(PASSTHRU_MSG &msg, const uint8_t *data, size_t size) const {
+    msg.ProtocolID = ISO15765;
+    msg.RxStatus = 0;
+    msg.TxFlags = mTxFlags;
+    msg.Timestamp = 0;
+    msg.ExtraDataIndex = 0;
+    msg.DataSize = J2534_DATA_OFFSET + size;
+    pid2Data(mRequestPid, msg.Data);
+    if(data != NULL) {
+        memcpy(&msg.Data[J2534_DATA_OFFSET], data, size);
+    }
+    return msg;
+}
+
+void UdsClient::send(PASSTHRU_MSG &msg) {
+    // The whole message has to be sent within P2*, the ISO15765 layer only returns once the last frame is out
+    unsigned long count = 1;
+    mChannel.writeMsgs(&msg, &count, mP2Star);
+    if(count != 1) {
+        throw J2534Exception(ERR_FAILED);
+    }
+}
+
+uint8_t UdsClient::receive(uint8_t sid, PASSTHRU_MSG &response) {
+    Clock::time_point deadline = mClock.now() + std::chrono::milliseconds(mP2);
+    while(true) {
+        long remaining = remainingTime(mClock, deadline);
+        if(remaining <= 0) {
+            throw J2534Exception(ERR_TIMEOUT);
+        }
+
+        if(!read(mChannel, response, remaining) || data2pid(response.Data) != mResponsePid) {
+            continue;
+        }
+
+        const uint8_t *data = payload(response);
+        size_t size = payloadSize(response);
+        if(data[0] == UDS_POSITIVE_RESPONSE(sid)) {
+            return 0;
+        }
+        if(size >= 3 && data[0] == UDS_NEGATIVE_RESPONSE && data[1] == sid) {
+            if(data[2] != UDS_NRC_RESPONSE_PENDING) {
+                return data[2];
+            }
+            mResponsePending++;
+            deadline = mClock.now() + std::chrono::milliseconds(mP2Star);
+        }
+        // Anything else is a late answer to a previous request
+    }
+}
+
+uint8_t UdsClient::request(const uint8_t *data, size_t size, PASSTHRU_MSG &response) {
+    send(prepare(response, data, size));
+    return receive(data[0], response);
+}
+
+unsigned long UdsClient::getResponsePending() const {
+    return mResponsePending;
+}
+
+uint32_t UdsClient::getRequestPid() const {
+    return mRequestPid;
+}
+
+uint32_t UdsClient::getResponsePid() const {
+    return mResponsePid;
+}
+
+unsigned long UdsClient::getP2() const {
+    return mP2;
+}
+
+unsigned long UdsClient::getP2Star() const {
+    return mP2Star;
+}
+
+bool UdsClient::read(Channel &channel, PASSTHRU_MSG &msg, unsigned long timeout) {
+    unsigned long count = 1;
+    try {
+        channel.readMsgs(&msg, &count, timeout);
+    } catch(J2534Exception &exception) {
+        if(exception.code() != ERR_TIMEOUT && exception.code() != ERR_BUFFER_EMPTY) {
+            throw;
+        }
+        count = 0;
+    }
+    return count == 1 && msg.DataSize > J2534_DATA_OFFSET;
+}
+
+const uint8_t *UdsClient::payload(const PASSTHRU_MSG &msg) {
+    return &msg.Data[J2534_DATA_OFFSET];
+}
+
+size_t UdsClient::payloadSize(const PASSTHRU_MSG &msg) {
+    return (msg.DataSize > J2534_DATA_OFFSET) ? msg.DataSize - J2534_DATA_OFFSET : 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#ifndef _UDS_H
+#define _UDS_H
+
+#include "internal.h"
+#include "clock.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+DEFINE_SHARED(UdsClient)
+
+#define UDS_NEGATIVE_RESPONSE 0x7F
+#define UDS_POSITIVE_RESPONSE(sid) ((sid) + 0x40)
+#define UDS_NRC_RESPONSE_PENDING 0x78
+
+#define UDS_DEFAULT_P2 50
+#define UDS_DEFAULT_P2_STAR 5000
+
+/*
+ * UDS (ISO 14229) requests over an ISO15765 channel: a request is sent, then the response of the same service from
+ * the response ID is awaited. Response pending (0x78) negative responses extend the wait to P2* and are counted.
+ * Transport failures are reported with J2534Exception, negative responses with their code.
+ */
+class UdsClient {
+public:
+    UdsClient(Channel &channel, Clock &clock, uint32_t requestPid, uint32_t responsePid);
+    ~UdsClient();
+
+    void setTimeouts(unsigned long p2, unsigned long p2Star);
+
+    void setTxFlags(unsigned long txFlags);
+
+    // Build a request in place, to be sent with send()
+    PASSTHRU_MSG &prepare(PASSTHRU_MSG &msg, const uint8_t *data, size_t size) const;
+
+    void send(PASSTHRU_MSG &msg);
+
+    // Return 0 on a positive response, the negative response code otherwise
+    uint8_t receive(uint8_t sid, PASSTHRU_MSG &response);
+
+    uint8_t request(const uint8_t *data, size_t size, PASSTHRU_MSG &response);
+
+    unsigned long getResponsePending() const;
+
+    uint32_t getRequestPid() const;
+
+    uint32_t getResponsePid() const;
+
+    unsigned long getP2() const;
+
+    unsigned long getP2Star() const;
+
+    // Read one message, timeouts and empty buffers are not errors
+    static bool read(Channel &channel, PASSTHRU_MSG &msg, unsigned long timeout);
+
+    static const uint8_t *payload(const PASSTHRU_MSG &msg);
+
+    static size_t payloadSize(const PASSTHRU_MSG &msg);
+
+private:
+    Channel &mChannel;
+    Clock &mClock;
+    uint32_t mRequestPid;
+    uint32_t mResponsePid;
+    unsigned long mTxFlags;
+    unsigned long mP2;
+    unsigned long mP2Star;
+    unsigned long mResponsePending;
+};
+
+#endif //_UDS_H
@@ -0,0 +1,161 @@
+#include "virtual_channel.h"
+
+#include <algorithm>
+
+#include "simple.h"
+#include "utils.h"
+
+// J2534 range of the periodic messages
+#define VIRTUAL_MIN_INTERVAL 5
+#define VIRTUAL_MAX_INTERVAL 65535
+
+class PeriodicMessageVirtual: public PeriodicMessage {
+public:
+    virtual ChannelWeakPtr getChannel() const override {
+        return ChannelWeakPtr();
+    }
+};
+
+ChannelVirtual::ChannelVirtual(const VirtualClockPtr &clock): mClock(clock) {
+}
+
+ChannelVirtual::~ChannelVirtual() {
+}
+
+void ChannelVirtual::readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
+    Clock::time_point deadline = mClock->now() + std::chrono::milliseconds(Timeout);
+    unsigned long count = 0;
+    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
+        // Their answers may come before the next frame
+        sendPeriodicMsgs(mInFrames.empty() ? deadline : std::min(deadline, mInFrames.front().time));
+        if(mInFrames.empty() || mInFrames.front().time > deadline) {
+            mClock->advanceTo(deadline);
+            break;
+        }
+        mClock->advanceTo(mInFrames.front().time);
+        *(pMsg++) = mInFrames.front().msg;
+        mInFrames.pop_front();
+        count++;
+    }
+    *pNumMsgs = count;
+}
+
+void ChannelVirtual::writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) {
+    UNUSED(Timeout);
+    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
+        write(pMsg[i], mClock->now());
+    }
+}
+
+void ChannelVirtual::write(const PASSTHRU_MSG &msg, const Clock::time_point &time) {
+    Frame frame;
+    frame.time = time;
+    frame.msg = msg;
+    mSentFrames.push_back(frame);
+    if(mResponder) {
+        mResponder(*this, msg);
+    }
+}
+
+void ChannelVirtual::sendPeriodicMsgs(const Clock::time_point &until) {
+    while(true) {
+        Periodic *next = NULL;
+        for(Periodic &periodic: mPeriodicMsgs) {
+            if(periodic.active && (next == NULL || periodic.due < next->due)) {
+                next = &periodic;
+            }
+        }
+        if(next == NULL || next->due > until) {
+            return;
+        }
+        // The ones due while the clock was slept are written late, with their time
+        mClock->advanceTo(next->due);
+        Clock::time_point time = next->due;
+        next->due += std::chrono::milliseconds(next->timeInterval);
+        write(next->msg, time);
+    }
+}
+
+PeriodicMessagePtr ChannelVirtual::startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) {
+    if(TimeInterval < VIRTUAL_MIN_INTERVAL || TimeInterval > VIRTUAL_MAX_INTERVAL) {
+        throw J2534Exception(ERR_INVALID_TIME_INTERVAL);
+    }
+    Periodic periodic;
+    periodic.timeInterval = TimeInterval;
+    periodic.msg = *pMsg;
+    periodic.message = std::make_shared<PeriodicMessageVirtual>();
+    periodic.active = true;
+    periodic.due = mClock->now() + std::chrono::milliseconds(TimeInterval);
+    mPeriodicMsgs.push_back(periodic);
+    return periodic.message;
+}
+
+void ChannelVirtual::stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) {
+    for(Periodic &periodic: mPeriodicMsgs) {
+        if(periodic.message == periodicMessage) {
+            periodic.active = false;
+        }
+    }
+}
+
+MessageFilterPtr ChannelVirtual::startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
+                                                PASSTHRU_MSG *pFlowControlMsg) {
+    UNUSED(FilterType);
+    UNUSED(pMaskMsg);
+    UNUSED(pPatternMsg);
+    UNUSED(pFlowControlMsg);
+    return nullptr;
+}
+
+void ChannelVirtual::stopMsgFilter(const MessageFilterPtr &messageFilter) {
+    UNUSED(messageFilter);
+}
+
+void ChannelVirtual::ioctl(unsigned long IoctlID, void *pInput, void *pOutput) {
+    UNUSED(pInput);
+    UNUSED(pOutput);
+    mIoctls.push_back(IoctlID);
+    if(IoctlID == CLEAR_RX_BUFFER) {
+        mInFrames.clear();
+    }
+    if(IoctlID == CLEAR_PERIODIC_MSGS) {
+        for(Periodic &periodic: mPeriodicMsgs) {
+            periodic.active = false;
+        }
+    }
+}
+
+DeviceWeakPtr ChannelVirtual::getDevice() const {
+    return DeviceWeakPtr();
+}
+
+void ChannelVirtual::schedule(const PASSTHRU_MSG &msg, const Clock::duration &delay) {
+    Frame frame;
+    frame.time = mClock->now() + delay;
+    frame.msg = msg;
+    // Keep the queue ordered by time, frames scheduled at the same time stay in order
+    auto it = std::upper_bound(mInFrames.begin(), mInFrames.end(), frame, [](const Frame &a, const Frame &b) {
+        return a.time < b.time;
+    });
+    mInFrames.insert(it, frame);
+}
+
+void ChannelVirtual::setResponder(const Responder &responder) {
+    mResponder = responder;
+}
+
+const std::vector<ChannelVirtual::Frame> &ChannelVirtual::getSentFrames() const {
+    return mSentFrames;
+}
+
+void ChannelVirtual::clearSentFrames() {
+    mSentFrames.clear();
+}
+
+const std::vector<ChannelVirtual::Periodic> &ChannelVirtual::getPeriodicMsgs() const {
+    return mPeriodicMsgs;
+}
+
+const std::vector<unsigned long> &ChannelVirtual::getIoctls() const {
+    return mIoctls;
+}
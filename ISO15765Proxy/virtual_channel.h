@@ -0,0 +1,89 @@
+#pragma once
+
+#ifndef _VIRTUAL_CHANNEL_H
+#define _VIRTUAL_CHANNEL_H
+
+#include <list>
+#include <vector>
+#include <functional>
+
+#include "internal.h"
+#include "clock.h"
+
+DEFINE_SHARED(ChannelVirtual)
+
+/*
+ * Single-threaded CAN channel driven by a VirtualClock.
+ * Incoming frames are scheduled at a virtual time; a read jumps the clock to the next frame or to its deadline.
+ * Written frames are recorded with their virtual timestamp and handed to an optional responder, which plays the
+ * peer by scheduling its answers. Periodic messages are written the same way, every interval from their start, as the
+ * reads move the clock on.
+ */
+class ChannelVirtual: public Channel {
+public:
+    typedef std::function<void(ChannelVirtual &channel, const PASSTHRU_MSG &msg)> Responder;
+
+    struct Frame {
+        Clock::time_point time;
+        PASSTHRU_MSG msg;
+    };
+
+    struct Periodic {
+        unsigned long timeInterval;
+        PASSTHRU_MSG msg;
+        PeriodicMessagePtr message;
+        bool active;
+        Clock::time_point due;
+    };
+
+    ChannelVirtual(const VirtualClockPtr &clock);
+
+    virtual ~ChannelVirtual();
+
+    virtual void readMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override;
+
+    virtual void writeMsgs(PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout) override;
+
+    virtual PeriodicMessagePtr startPeriodicMsg(PASSTHRU_MSG *pMsg, unsigned long TimeInterval) override;
+
+    virtual void stopPeriodicMsg(const PeriodicMessagePtr &periodicMessage) override;
+
+    virtual MessageFilterPtr startMsgFilter(unsigned long FilterType, PASSTHRU_MSG *pMaskMsg, PASSTHRU_MSG *pPatternMsg,
+                                         PASSTHRU_MSG *pFlowControlMsg) override;
+
+    virtual void stopMsgFilter(const MessageFilterPtr &messageFilter) override;
+
+    virtual void ioctl(unsigned long IoctlID, void *pInput, void *pOutput) override;
+
+    virtual DeviceWeakPtr getDevice() const override;
+
+    // New
+
+    void schedule(const PASSTHRU_MSG &msg, const Clock::duration &delay);
+
+    void setResponder(const Responder &responder);
+
+    const std::vector<Frame> &getSentFrames() const;
+
+    void clearSentFrames();
+
+    // Every periodic message started, the stopped ones included
+    const std::vector<Periodic> &getPeriodicMsgs() const;
+
+    const std::vector<unsigned long> &getIoctls() const;
+
+private:
+    void write(const PASSTHRU_MSG &msg, const Clock::time_point &time);
+
+    // Writes the periodic messages due before the time, in order
+    void sendPeriodicMsgs(const Clock::time_point &until);
+
+    VirtualClockPtr mClock;
+    std::list<Frame> mInFrames;
+    std::vector<Frame> mSentFrames;
+    Responder mResponder;
+    std::vector<Periodic> mPeriodicMsgs;
+    std::vector<unsigned long> mIoctls;
+};
+
+#endif //_VIRTUAL_CHANNEL_H
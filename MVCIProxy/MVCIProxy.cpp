@@ -1,5 +1,5 @@
 #include "stdafx.h"
-#include "../gateway/gateway.h"
+#include "../Gateway/gateway.h"
 #include "MVCIProxy.h"
 #include "log.h"
 #include <stdlib.h>
@@ -57,6 +57,18 @@ static PASSTHRU_MSG* filterPS(const PASSTHRU_MSG *msg) {
     return msg2;
 }
 
+static bool hasPS(const PASSTHRU_MSG *msg, unsigned long count) {
+    if(msg==NULL) {
+        return false;
+    }
+    for(unsigned long i = 0; i < count; ++i) {
+        if(filterProtocol(msg[i].ProtocolID) != msg[i].ProtocolID) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static PASSTHRU_MSG* filterPSs(const PASSTHRU_MSG *msg, unsigned long count) {
     if(msg==NULL) {
         return NULL;
@@ -183,15 +195,19 @@ long MVCI_PROXY_API PassThruWriteMsgs(unsigned long ChannelID, PASSTHRU_MSG *pMs
     j2534_fcts *proxy = device->proxy;
     ChannelID = channel->channelId;
 
-    // Filter
-    pMsg = filterPSs(pMsg, *pNumMsgs);
+    // Filter (only copy the messages when a protocol id has to be rewritten)
+    PASSTHRU_MSG *filtered = NULL;
+    if(hasPS(pMsg, *pNumMsgs)) {
+        filtered = filterPSs(pMsg, *pNumMsgs);
+        pMsg = filtered;
+    }
 
     long ret;
     ret = proxy->passThruWriteMsgs(ChannelID, pMsg, pNumMsgs, Timeout);
     LAST_RET(proxy, ret);
 
     // Free filter
-    free(pMsg);
+    free(filtered);
 
     return ret;
 }
@@ -4,7 +4,7 @@
 #define __MVCIPROXY_H
 
 #include "j2534_v0404.h"
-#include "../gateway/gateway.h"
+#include "../Gateway/gateway.h"
 #ifdef _WIN32
 #include <windows.h>
 #endif //_WIN32
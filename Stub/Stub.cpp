@@ -1,177 +1,397 @@
-#include "stub.h"
-#include "log.h"
-#include "utils.h"
-
-///////////////////////////////////// PassThruFunctions /////////////////////////////////////////////////
-
-long STUB_API PassThruOpen(void *pName, unsigned long *pDeviceID) {
-    UNUSED(pName);
-    UNUSED(pDeviceID);
-    LOG(INIT, "PassThruOpen");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-long STUB_API PassThruClose(unsigned long DeviceID) {
-    UNUSED(DeviceID);
-    LOG(INIT, "PassThruClose");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-long STUB_API PassThruConnect(unsigned long DeviceID, unsigned long ProtocolID, unsigned long Flags,
-                               unsigned long Baudrate, unsigned long *pChannelID) {
-    UNUSED(DeviceID);
-    UNUSED(ProtocolID);
-    UNUSED(Flags);
-    UNUSED(Baudrate);
-    UNUSED(pChannelID);
-    LOG(INIT, "PassThruConnect");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-long STUB_API PassThruDisconnect(unsigned long ChannelID) {
-    UNUSED(ChannelID);
-    LOG(INIT, "PassThruDisconnect");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruReadMsgs(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs,
-                                unsigned long Timeout) {
-    UNUSED(ChannelID);
-    UNUSED(pMsg);
-    UNUSED(pNumMsgs);
-    UNUSED(Timeout);
-    LOG(INIT, "PassThruReadMsgs");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruWriteMsgs(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs,
-                                 unsigned long Timeout) {
-    UNUSED(ChannelID);
-    UNUSED(pMsg);
-    UNUSED(pNumMsgs);
-    UNUSED(Timeout);
-    LOG(INIT, "PassThruWriteMsgs");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruStartPeriodicMsg(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsigned long *pMsgID,
-                                        unsigned long TimeInterval) {
-    UNUSED(ChannelID);
-    UNUSED(pMsg);
-    UNUSED(pMsgID);
-    UNUSED(TimeInterval);
-    LOG(INIT, "PassThruStartPeriodicMsg");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruStopPeriodicMsg(unsigned long ChannelID, unsigned long MsgID) {
-    UNUSED(ChannelID);
-    UNUSED(MsgID);
-    LOG(INIT, "PassThruStopPeriodicMsg");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruStartMsgFilter(unsigned long ChannelID, unsigned long FilterType, PASSTHRU_MSG *pMaskMsg,
-                                      PASSTHRU_MSG *pPatternMsg, PASSTHRU_MSG *pFlowControlMsg,
-                                      unsigned long *pFilterID) {
-    UNUSED(ChannelID);
-    UNUSED(FilterType);
-    UNUSED(pMaskMsg);
-    UNUSED(pPatternMsg);
-    UNUSED(pFlowControlMsg);
-    UNUSED(pFilterID);
-    LOG(INIT, "PassThruStartMsgFilter");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruStopMsgFilter(unsigned long ChannelID, unsigned long FilterID) {
-    UNUSED(ChannelID);
-    UNUSED(FilterID);
-    LOG(INIT, "PassThruStopMsgFilter");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruSetProgrammingVoltage(unsigned long DeviceID, unsigned long PinNumber, unsigned long Voltage) {
-    UNUSED(DeviceID);
-    UNUSED(PinNumber);
-    UNUSED(Voltage);
-    LOG(INIT, "PassThruSetProgrammingVoltage");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruReadVersion(unsigned long DeviceID, char *pFirmwareVersion, char *pDllVersion,
-                                   char *pApiVersion) {
-    UNUSED(DeviceID);
-    UNUSED(pFirmwareVersion);
-    UNUSED(pDllVersion);
-    UNUSED(pApiVersion);
-    LOG(INIT, "PassThruReadVersion");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruGetLastError(char *pErrorDescription) {
-    UNUSED(pErrorDescription);
-    LOG(INIT, "PassThruGetLastError");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
-
-
-long STUB_API PassThruIoctl(unsigned long ChannelID, unsigned long IoctlID, void *pInput, void *pOutput) {
-    UNUSED(ChannelID);
-    UNUSED(IoctlID);
-    UNUSED(pInput);
-    UNUSED(pOutput);
-    LOG(INIT, "PassThruIoctl");
-
-    long ret = STATUS_NOERROR;
-
-    return ret;
-}
\ No newline at end of file
+#include "Stub.h"
+#include "log.h"
+#include "utils.h"
+
+#include <list>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include <string.h>
+
+/*
+ * The stub behaves as a virtual CAN bus: every frame written on a channel is delivered to the receive queue of the
+ * other connected channels whose filters accept it. All the devices opened on the library share the same bus.
+ */
+
+#define J2534_DATA_OFFSET 4
+#define STUB_RX_QUEUE_SIZE 1024
+#define STUB_VBATT 12000
+
+struct StubFilter {
+    unsigned long id;
+    unsigned long type;
+    uint32_t mask;
+    uint32_t pattern;
+};
+
+struct StubChannel {
+    unsigned long protocolId;
+    unsigned long nextFilterId;
+    std::list<StubFilter> filters;
+    std::deque<PASSTHRU_MSG> rxQueue;
+};
+
+struct StubDevice {
+    unsigned long deviceId;
+};
+
+static std::mutex stub_mutex;
+static std::condition_variable stub_received;
+static std::list<StubChannel *> stub_channels;
+static unsigned long stub_next_device_id = 1;
+
+static uint32_t data2pid(const unsigned char *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static unsigned long timestamp() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool accept(const StubChannel *channel, const PASSTHRU_MSG *msg) {
+    if(msg->DataSize < J2534_DATA_OFFSET) {
+        return false;
+    }
+    uint32_t pid = data2pid(msg->Data);
+    bool pass = false;
+    for(const StubFilter &filter: channel->filters) {
+        if((pid & filter.mask) == (filter.pattern & filter.mask)) {
+            if(filter.type == BLOCK_FILTER) {
+                return false;
+            }
+            pass = true;
+        }
+    }
+    return pass;
+}
+
+static bool isChannel(const StubChannel *channel) {
+    for(StubChannel *c: stub_channels) {
+        if(c == channel) {
+            return true;
+        }
+    }
+    return false;
+}
+
+///////////////////////////////////// PassThruFunctions /////////////////////////////////////////////////
+
+long STUB_API PassThruOpen(void *pName, unsigned long *pDeviceID) {
+    UNUSED(pName);
+    LOG(INIT, "PassThruOpen");
+
+    if(pDeviceID == NULL) {
+        return ERR_NULL_PARAMETER;
+    }
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    StubDevice *device = new StubDevice();
+    device->deviceId = stub_next_device_id++;
+    *pDeviceID = reinterpret_cast<unsigned long>(device);
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+long STUB_API PassThruClose(unsigned long DeviceID) {
+    LOG(INIT, "PassThruClose");
+
+    StubDevice *device = reinterpret_cast<StubDevice *>(DeviceID);
+    delete device;
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+long STUB_API PassThruConnect(unsigned long DeviceID, unsigned long ProtocolID, unsigned long Flags,
+                               unsigned long Baudrate, unsigned long *pChannelID) {
+    UNUSED(DeviceID);
+    UNUSED(Flags);
+    UNUSED(Baudrate);
+    LOG(INIT, "PassThruConnect");
+
+    if(pChannelID == NULL) {
+        return ERR_NULL_PARAMETER;
+    }
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    StubChannel *channel = new StubChannel();
+    channel->protocolId = ProtocolID;
+    channel->nextFilterId = 1;
+    stub_channels.push_back(channel);
+    *pChannelID = reinterpret_cast<unsigned long>(channel);
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+long STUB_API PassThruDisconnect(unsigned long ChannelID) {
+    LOG(INIT, "PassThruDisconnect");
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    StubChannel *channel = reinterpret_cast<StubChannel *>(ChannelID);
+    if(!isChannel(channel)) {
+        return ERR_INVALID_CHANNEL_ID;
+    }
+    stub_channels.remove(channel);
+    delete channel;
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruReadMsgs(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs,
+                                unsigned long Timeout) {
+    LOG(INIT, "PassThruReadMsgs");
+
+    if(pMsg == NULL || pNumMsgs == NULL) {
+        return ERR_NULL_PARAMETER;
+    }
+    StubChannel *channel = reinterpret_cast<StubChannel *>(ChannelID);
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+    unsigned long count = 0;
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(channel)) {
+        *pNumMsgs = 0;
+        return ERR_INVALID_CHANNEL_ID;
+    }
+    while(count < *pNumMsgs) {
+        if(channel->rxQueue.empty()) {
+            bool timeout = (Timeout == 0 || stub_received.wait_until(lck, deadline) == std::cv_status::timeout);
+            // The channel may have been disconnected during the wait
+            if(!isChannel(channel)) {
+                *pNumMsgs = count;
+                return ERR_INVALID_CHANNEL_ID;
+            }
+            if(timeout && channel->rxQueue.empty()) {
+                break;
+            }
+            continue;
+        }
+        pMsg[count++] = channel->rxQueue.front();
+        channel->rxQueue.pop_front();
+    }
+
+    // The messages read before the timeout are a success
+    long ret = STATUS_NOERROR;
+    if(count == 0) {
+        ret = (Timeout == 0) ? ERR_BUFFER_EMPTY : ERR_TIMEOUT;
+    }
+    *pNumMsgs = count;
+
+    return ret;
+}
+
+
+long STUB_API PassThruWriteMsgs(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs,
+                                 unsigned long Timeout) {
+    UNUSED(Timeout);
+    LOG(INIT, "PassThruWriteMsgs");
+
+    if(pMsg == NULL || pNumMsgs == NULL) {
+        return ERR_NULL_PARAMETER;
+    }
+    StubChannel *sender = reinterpret_cast<StubChannel *>(ChannelID);
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(sender)) {
+        *pNumMsgs = 0;
+        return ERR_INVALID_CHANNEL_ID;
+    }
+    for(unsigned long i = 0; i < *pNumMsgs; ++i) {
+        const PASSTHRU_MSG &msg = pMsg[i];
+        if(msg.DataSize < J2534_DATA_OFFSET || msg.DataSize > sizeof(msg.Data)) {
+            *pNumMsgs = i;
+            return ERR_INVALID_MSG;
+        }
+        unsigned long now = timestamp();
+        for(StubChannel *channel: stub_channels) {
+            if(channel == sender || !accept(channel, &msg)) {
+                continue;
+            }
+            if(channel->rxQueue.size() >= STUB_RX_QUEUE_SIZE) {
+                channel->rxQueue.pop_front();
+            }
+            channel->rxQueue.push_back(msg);
+            PASSTHRU_MSG &received = channel->rxQueue.back();
+            received.ProtocolID = channel->protocolId;
+            received.RxStatus = 0;
+            received.TxFlags = 0;
+            received.Timestamp = now;
+        }
+    }
+    stub_received.notify_all();
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruStartPeriodicMsg(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsigned long *pMsgID,
+                                        unsigned long TimeInterval) {
+    UNUSED(pMsg);
+    UNUSED(pMsgID);
+    UNUSED(TimeInterval);
+    LOG(INIT, "PassThruStartPeriodicMsg");
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(reinterpret_cast<StubChannel *>(ChannelID))) {
+        return ERR_INVALID_CHANNEL_ID;
+    }
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruStopPeriodicMsg(unsigned long ChannelID, unsigned long MsgID) {
+    UNUSED(MsgID);
+    LOG(INIT, "PassThruStopPeriodicMsg");
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(reinterpret_cast<StubChannel *>(ChannelID))) {
+        return ERR_INVALID_CHANNEL_ID;
+    }
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruStartMsgFilter(unsigned long ChannelID, unsigned long FilterType, PASSTHRU_MSG *pMaskMsg,
+                                      PASSTHRU_MSG *pPatternMsg, PASSTHRU_MSG *pFlowControlMsg,
+                                      unsigned long *pFilterID) {
+    UNUSED(pFlowControlMsg);
+    LOG(INIT, "PassThruStartMsgFilter");
+
+    if(pMaskMsg == NULL || pPatternMsg == NULL || pFilterID == NULL) {
+        return ERR_NULL_PARAMETER;
+    }
+    if(pMaskMsg->DataSize < J2534_DATA_OFFSET || pPatternMsg->DataSize < J2534_DATA_OFFSET) {
+        return ERR_INVALID_MSG;
+    }
+    StubChannel *channel = reinterpret_cast<StubChannel *>(ChannelID);
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(channel)) {
+        return ERR_INVALID_CHANNEL_ID;
+    }
+    StubFilter filter;
+    filter.id = channel->nextFilterId++;
+    filter.type = FilterType;
+    filter.mask = data2pid(pMaskMsg->Data);
+    filter.pattern = data2pid(pPatternMsg->Data);
+    channel->filters.push_back(filter);
+    *pFilterID = filter.id;
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruStopMsgFilter(unsigned long ChannelID, unsigned long FilterID) {
+    LOG(INIT, "PassThruStopMsgFilter");
+
+    StubChannel *channel = reinterpret_cast<StubChannel *>(ChannelID);
+
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(channel)) {
+        return ERR_INVALID_CHANNEL_ID;
+    }
+    for(auto it = channel->filters.begin(); it != channel->filters.end(); ++it) {
+        if(it->id == FilterID) {
+            channel->filters.erase(it);
+            return STATUS_NOERROR;
+        }
+    }
+
+    long ret = ERR_INVALID_FILTER_ID;
+
+    return ret;
+}
+
+
+long STUB_API PassThruSetProgrammingVoltage(unsigned long DeviceID, unsigned long PinNumber, unsigned long Voltage) {
+    UNUSED(DeviceID);
+    UNUSED(PinNumber);
+    UNUSED(Voltage);
+    LOG(INIT, "PassThruSetProgrammingVoltage");
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruReadVersion(unsigned long DeviceID, char *pFirmwareVersion, char *pDllVersion,
+                                   char *pApiVersion) {
+    UNUSED(DeviceID);
+    LOG(INIT, "PassThruReadVersion");
+
+    if(pFirmwareVersion != NULL) {
+        strcpy(pFirmwareVersion, "Stub");
+    }
+    if(pDllVersion != NULL) {
+        strcpy(pDllVersion, "Stub");
+    }
+    if(pApiVersion != NULL) {
+        strcpy(pApiVersion, "04.04");
+    }
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruGetLastError(char *pErrorDescription) {
+    LOG(INIT, "PassThruGetLastError");
+
+    if(pErrorDescription != NULL) {
+        pErrorDescription[0] = '\0';
+    }
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
+
+
+long STUB_API PassThruIoctl(unsigned long ChannelID, unsigned long IoctlID, void *pInput, void *pOutput) {
+    UNUSED(pInput);
+    LOG(INIT, "PassThruIoctl");
+
+    if(IoctlID == READ_VBATT || IoctlID == READ_PROG_VOLTAGE) {
+        if(pOutput == NULL) {
+            return ERR_NULL_PARAMETER;
+        }
+        *reinterpret_cast<unsigned long *>(pOutput) = (IoctlID == READ_VBATT) ? STUB_VBATT : 0;
+        return STATUS_NOERROR;
+    }
+
+    StubChannel *channel = reinterpret_cast<StubChannel *>(ChannelID);
+    std::unique_lock<std::mutex> lck(stub_mutex);
+    if(!isChannel(channel)) {
+        return ERR_INVALID_CHANNEL_ID;
+    }
+    if(IoctlID == CLEAR_RX_BUFFER) {
+        channel->rxQueue.clear();
+    } else if(IoctlID == CLEAR_MSG_FILTERS) {
+        channel->filters.clear();
+    }
+
+    long ret = STATUS_NOERROR;
+
+    return ret;
+}
@@ -0,0 +1,443 @@
+#include "Stub.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <libgen.h>
+#include <unistd.h>
+
+/*
+ * End-to-end benchmark of the shared libraries as loaded in production:
+ * libISO15765Proxy.so -> libMVCIProxy.so -> libMVCI32.so (the Stub virtual bus), all through their C ABI.
+ */
+
+#define J2534_DATA_OFFSET 4
+#define CAN_DATA_SIZE 8
+
+#define TESTER_PID 0x7E0
+#define ECU_PID 0x7E8
+
+#define READ_FULL_CHUNK 256
+#define WRITE_BATCH 16
+#define ECU_POLL_TIMEOUT 100
+#define EXCHANGE_TIMEOUT 1000
+
+typedef std::chrono::steady_clock e2e_clock;
+
+struct Layer {
+    const char *name;
+    const char *library;
+    void *handle;
+    j2534_fcts fcts;
+};
+
+#define LOAD_FCT(layer, name, type, dest) { \
+    dest = (type)dlsym(layer.handle, #name); \
+    if(dest == NULL) { \
+        fprintf(stderr, "Can't load " #name " from %s\n", layer.library); \
+        return false; \
+    } \
+}
+
+static bool loadLayer(const char *dir, Layer &layer) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, layer.library);
+    layer.handle = dlopen(path, RTLD_NOW);
+    if(layer.handle == NULL) {
+        fprintf(stderr, "Can't load library %s: %s\n", path, dlerror());
+        return false;
+    }
+    LOAD_FCT(layer, PassThruOpen, PTOPEN, layer.fcts.passThruOpen);
+    LOAD_FCT(layer, PassThruClose, PTCLOSE, layer.fcts.passThruClose);
+    LOAD_FCT(layer, PassThruConnect, PTCONNECT, layer.fcts.passThruConnect);
+    LOAD_FCT(layer, PassThruDisconnect, PTDISCONNECT, layer.fcts.passThruDisconnect);
+    LOAD_FCT(layer, PassThruReadMsgs, PTREADMSGS, layer.fcts.passThruReadMsgs);
+    LOAD_FCT(layer, PassThruWriteMsgs, PTWRITEMSGS, layer.fcts.passThruWriteMsgs);
+    LOAD_FCT(layer, PassThruStartPeriodicMsg, PTSTARTPERIODICMSG, layer.fcts.passThruStartPeriodicMsg);
+    LOAD_FCT(layer, PassThruStopPeriodicMsg, PTSTOPPERIODICMSG, layer.fcts.passThruStopPeriodicMsg);
+    LOAD_FCT(layer, PassThruStartMsgFilter, PTSTARTMSGFILTER, layer.fcts.passThruStartMsgFilter);
+    LOAD_FCT(layer, PassThruStopMsgFilter, PTSTOPMSGFILTER, layer.fcts.passThruStopMsgFilter);
+    LOAD_FCT(layer, PassThruSetProgrammingVoltage, PTSETPROGRAMMINGVOLTAGE, layer.fcts.passThruSetProgrammingVoltage);
+    LOAD_FCT(layer, PassThruReadVersion, PTREADVERSION, layer.fcts.passThruReadVersion);
+    LOAD_FCT(layer, PassThruGetLastError, PTGETLASTERROR, layer.fcts.passThruGetLastError);
+    LOAD_FCT(layer, PassThruIoctl, PTIOCTL, layer.fcts.passThruIoctl);
+    return true;
+}
+
+static void pid2Data(uint32_t pid, unsigned char *data) {
+    data[0] = 0x1F & (pid >> 24);
+    data[1] = 0xFF & (pid >> 16);
+    data[2] = 0xFF & (pid >> 8);
+    data[3] = 0xFF & (pid >> 0);
+}
+
+static uint32_t data2pid(const unsigned char *data) {
+    return ((0x1F & data[0]) << 24) | ((0xFF & data[1]) << 16) | ((0xFF & data[2]) << 8) | (0xFF & data[3]);
+}
+
+static PASSTHRU_MSG message(unsigned long protocolId, uint32_t pid, size_t size) {
+    PASSTHRU_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.ProtocolID = protocolId;
+    msg.DataSize = J2534_DATA_OFFSET + size;
+    pid2Data(pid, msg.Data);
+    return msg;
+}
+
+// Raw CAN frame holding an ISO15765 single frame of 7 bytes, or the same 7 bytes as an ISO15765 message
+static PASSTHRU_MSG singleFrame(unsigned long protocolId, uint32_t pid) {
+    if(protocolId == ISO15765) {
+        PASSTHRU_MSG msg = message(protocolId, pid, CAN_DATA_SIZE - 1);
+        for(int i = 0; i < CAN_DATA_SIZE - 1; ++i) {
+            msg.Data[J2534_DATA_OFFSET + i] = (unsigned char)(i + 1);
+        }
+        return msg;
+    }
+    PASSTHRU_MSG msg = message(protocolId, pid, CAN_DATA_SIZE);
+    msg.Data[J2534_DATA_OFFSET] = 0x07;
+    for(int i = 1; i < CAN_DATA_SIZE; ++i) {
+        msg.Data[J2534_DATA_OFFSET + i] = (unsigned char)i;
+    }
+    return msg;
+}
+
+static long startFilter(const Layer &layer, unsigned long channel, unsigned long protocolId, uint32_t pattern, uint32_t flowControl) {
+    PASSTHRU_MSG maskMsg = message(protocolId, 0xFFFFFFFF, 0);
+    PASSTHRU_MSG patternMsg = message(protocolId, pattern, 0);
+    PASSTHRU_MSG flowControlMsg = message(protocolId, flowControl, 0);
+    unsigned long filterId;
+    if(protocolId == ISO15765) {
+        return layer.fcts.passThruStartMsgFilter(channel, FLOW_CONTROL_FILTER, &maskMsg, &patternMsg, &flowControlMsg, &filterId);
+    }
+    return layer.fcts.passThruStartMsgFilter(channel, PASS_FILTER, &maskMsg, &patternMsg, NULL, &filterId);
+}
+
+static double elapsedNs(const e2e_clock::time_point &start, unsigned long count) {
+    return std::chrono::duration<double, std::nano>(e2e_clock::now() - start).count() / count;
+}
+
+struct CallCosts {
+    const char *layer;
+    const char *protocol;
+    double readEmpty;
+    double readFull;
+    double write;
+    double writeBatch;
+    unsigned long errors;
+};
+
+/*
+ * Per-call cost of one layer. A channel opened directly on the stub feeds the receive queue for the full reads.
+ */
+static bool measureCalls(const Layer &layer, const Layer &stub, unsigned long feeder, unsigned long protocolId,
+                         unsigned long iterations, CallCosts &costs) {
+    costs.layer = layer.name;
+    costs.protocol = (protocolId == ISO15765) ? "ISO15765" : "CAN";
+    costs.errors = 0;
+
+    unsigned long device, channel;
+    if(layer.fcts.passThruOpen(NULL, &device) != STATUS_NOERROR ||
+            layer.fcts.passThruConnect(device, protocolId, 0, 500000, &channel) != STATUS_NOERROR ||
+            startFilter(layer, channel, protocolId, ECU_PID, TESTER_PID) != STATUS_NOERROR) {
+        fprintf(stderr, "%s: can't open the channel\n", layer.name);
+        return false;
+    }
+
+    PASSTHRU_MSG msg;
+    e2e_clock::time_point start = e2e_clock::now();
+    for(unsigned long i = 0; i < iterations; ++i) {
+        unsigned long count = 1;
+        layer.fcts.passThruReadMsgs(channel, &msg, &count, 0);
+        if(count != 0) {
+            costs.errors++;
+        }
+    }
+    costs.readEmpty = elapsedNs(start, iterations);
+
+    PASSTHRU_MSG frames[READ_FULL_CHUNK];
+    for(unsigned long i = 0; i < READ_FULL_CHUNK; ++i) {
+        frames[i] = singleFrame(CAN, ECU_PID);
+    }
+    double total = 0;
+    unsigned long reads = 0;
+    while(reads < iterations) {
+        unsigned long count = READ_FULL_CHUNK;
+        stub.fcts.passThruWriteMsgs(feeder, frames, &count, 0);
+        start = e2e_clock::now();
+        for(unsigned long i = 0; i < READ_FULL_CHUNK; ++i) {
+            count = 1;
+            layer.fcts.passThruReadMsgs(channel, &msg, &count, 0);
+            if(count != 1) {
+                costs.errors++;
+            }
+        }
+        total += std::chrono::duration<double, std::nano>(e2e_clock::now() - start).count();
+        reads += READ_FULL_CHUNK;
+    }
+    costs.readFull = total / reads;
+
+    PASSTHRU_MSG requests[WRITE_BATCH];
+    for(unsigned long i = 0; i < WRITE_BATCH; ++i) {
+        requests[i] = singleFrame(protocolId, TESTER_PID);
+    }
+    start = e2e_clock::now();
+    for(unsigned long i = 0; i < iterations; ++i) {
+        unsigned long count = 1;
+        layer.fcts.passThruWriteMsgs(channel, requests, &count, 0);
+        if(count != 1) {
+            costs.errors++;
+        }
+    }
+    costs.write = elapsedNs(start, iterations);
+
+    unsigned long batches = (iterations + WRITE_BATCH - 1) / WRITE_BATCH;
+    start = e2e_clock::now();
+    for(unsigned long i = 0; i < batches; ++i) {
+        unsigned long count = WRITE_BATCH;
+        layer.fcts.passThruWriteMsgs(channel, requests, &count, 0);
+        if(count != WRITE_BATCH) {
+            costs.errors++;
+        }
+    }
+    costs.writeBatch = elapsedNs(start, batches * WRITE_BATCH);
+
+    layer.fcts.passThruDisconnect(channel);
+    layer.fcts.passThruClose(device);
+    return true;
+}
+
+struct RoundTrip {
+    size_t size;
+    unsigned long iterations;
+    unsigned long errors;
+    std::vector<double> latencies;
+};
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    if(sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)(p * sorted.size() + 0.999999);
+    rank = std::max<size_t>(1, std::min(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+/*
+ * UDS-like request/response through the whole stack: tester and emulated ECU are both ISO15765Proxy channels
+ */
+static bool measureRoundTrips(const Layer &iso, const std::vector<size_t> &sizes, unsigned long iterations,
+                              std::vector<RoundTrip> &results) {
+    unsigned long device, tester, ecu;
+    if(iso.fcts.passThruOpen(NULL, &device) != STATUS_NOERROR ||
+            iso.fcts.passThruConnect(device, ISO15765, 0, 500000, &tester) != STATUS_NOERROR ||
+            iso.fcts.passThruConnect(device, ISO15765, 0, 500000, &ecu) != STATUS_NOERROR ||
+            startFilter(iso, tester, ISO15765, ECU_PID, TESTER_PID) != STATUS_NOERROR ||
+            startFilter(iso, ecu, ISO15765, TESTER_PID, ECU_PID) != STATUS_NOERROR) {
+        fprintf(stderr, "%s: can't open the round trip channels\n", iso.name);
+        return false;
+    }
+
+    std::atomic<bool> running(true);
+    std::thread ecuThread([&]() {
+        PASSTHRU_MSG request, response;
+        while(running) {
+            unsigned long count = 1;
+            iso.fcts.passThruReadMsgs(ecu, &request, &count, ECU_POLL_TIMEOUT);
+            if(count != 1 || request.DataSize <= J2534_DATA_OFFSET) {
+                continue;
+            }
+            response = request;
+            response.ProtocolID = ISO15765;
+            response.TxFlags = 0;
+            pid2Data(ECU_PID, response.Data);
+            response.Data[J2534_DATA_OFFSET] += 0x40;
+            count = 1;
+            iso.fcts.passThruWriteMsgs(ecu, &response, &count, EXCHANGE_TIMEOUT);
+        }
+    });
+
+    PASSTHRU_MSG request, response;
+    for(size_t size: sizes) {
+        RoundTrip result;
+        result.size = size;
+        result.iterations = iterations;
+        result.errors = 0;
+
+        request = message(ISO15765, TESTER_PID, size);
+        request.Data[J2534_DATA_OFFSET] = 0x22;
+        for(size_t i = 1; i < size; ++i) {
+            request.Data[J2534_DATA_OFFSET + i] = (unsigned char)(i * 7);
+        }
+        for(unsigned long i = 0; i < iterations; ++i) {
+            e2e_clock::time_point start = e2e_clock::now();
+            unsigned long count = 1;
+            iso.fcts.passThruWriteMsgs(tester, &request, &count, EXCHANGE_TIMEOUT);
+            if(count != 1) {
+                result.errors++;
+                continue;
+            }
+            count = 1;
+            iso.fcts.passThruReadMsgs(tester, &response, &count, EXCHANGE_TIMEOUT);
+            if(count != 1 || response.DataSize != request.DataSize || data2pid(response.Data) != ECU_PID ||
+                    response.Data[J2534_DATA_OFFSET] != 0x62 ||
+                    memcmp(&response.Data[J2534_DATA_OFFSET + 1], &request.Data[J2534_DATA_OFFSET + 1], size - 1) != 0) {
+                result.errors++;
+                continue;
+            }
+            result.latencies.push_back(std::chrono::duration<double, std::micro>(e2e_clock::now() - start).count());
+        }
+        std::sort(result.latencies.begin(), result.latencies.end());
+        results.push_back(result);
+    }
+
+    running = false;
+    ecuThread.join();
+    iso.fcts.passThruDisconnect(ecu);
+    iso.fcts.passThruDisconnect(tester);
+    iso.fcts.passThruClose(device);
+    return true;
+}
+
+static std::vector<size_t> parseSizes(const char *str) {
+    std::vector<size_t> sizes;
+    char *end;
+    while(*str != '\0') {
+        unsigned long value = strtoul(str, &end, 0);
+        if(end == str) {
+            break;
+        }
+        if(value >= 1 && value <= 4095) {
+            sizes.push_back(value);
+        }
+        str = (*end == ',') ? end + 1 : end;
+    }
+    return sizes;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--lib-dir DIR] [--iterations N] [--round-trips N] [--sizes 3,7,62,...] [--output FILE]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    char dir[PATH_MAX];
+    unsigned long iterations = 20000;
+    unsigned long roundTrips = 200;
+    std::vector<size_t> sizes = {3, 7, 62, 255, 1024, 4095};
+    const char *output = NULL;
+
+    // The libraries are staged next to the executable by default
+    ssize_t len = readlink("/proc/self/exe", dir, sizeof(dir) - 1);
+    if(len <= 0) {
+        strcpy(dir, ".");
+    } else {
+        dir[len] = '\0';
+        char *parent = dirname(dir);
+        memmove(dir, parent, strlen(parent) + 1);
+    }
+
+    for(int i = 1; i < argc; ++i) {
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return -1;
+        }
+        if(strcmp(argv[i], "--lib-dir") == 0) {
+            if(realpath(argv[++i], dir) == NULL) {
+                fprintf(stderr, "Invalid directory %s\n", argv[i]);
+                return -1;
+            }
+        } else if(strcmp(argv[i], "--iterations") == 0) {
+            iterations = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--round-trips") == 0) {
+            roundTrips = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--sizes") == 0) {
+            sizes = parseSizes(argv[++i]);
+        } else if(strcmp(argv[i], "--output") == 0) {
+            output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if(iterations < 1 || roundTrips < 1 || sizes.empty()) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    // Loading the top library pulls the whole chain; the lower ones are then shared with it
+    Layer iso = {"iso15765proxy", "libISO15765Proxy.so", NULL, j2534_fcts()};
+    Layer mvci = {"mvciproxy", "libMVCIProxy.so", NULL, j2534_fcts()};
+    Layer stub = {"stub", "libMVCI32.so", NULL, j2534_fcts()};
+    if(!loadLayer(dir, iso) || !loadLayer(dir, mvci) || !loadLayer(dir, stub)) {
+        return -1;
+    }
+
+    unsigned long feederDevice, feeder;
+    if(stub.fcts.passThruOpen(NULL, &feederDevice) != STATUS_NOERROR ||
+            stub.fcts.passThruConnect(feederDevice, CAN, 0, 500000, &feeder) != STATUS_NOERROR) {
+        fprintf(stderr, "Can't open the feeder channel\n");
+        return -1;
+    }
+
+    std::vector<CallCosts> costs(4);
+    if(!measureCalls(stub, stub, feeder, CAN, iterations, costs[0]) ||
+            !measureCalls(mvci, stub, feeder, CAN, iterations, costs[1]) ||
+            !measureCalls(iso, stub, feeder, CAN, iterations, costs[2]) ||
+            !measureCalls(iso, stub, feeder, ISO15765, iterations, costs[3])) {
+        return -1;
+    }
+
+    std::vector<RoundTrip> trips;
+    if(!measureRoundTrips(iso, sizes, roundTrips, trips)) {
+        return -1;
+    }
+
+    stub.fcts.passThruDisconnect(feeder);
+    stub.fcts.passThruClose(feederDevice);
+
+    FILE *file = stdout;
+    if(output != NULL) {
+        file = fopen(output, "w");
+        if(file == NULL) {
+            fprintf(stderr, "Can't open %s\n", output);
+            return -1;
+        }
+    }
+    unsigned long errors = 0;
+    fprintf(file, "{\n  \"benchmark\": \"e2e\",\n  \"calls_ns\": [\n");
+    for(size_t i = 0; i < costs.size(); ++i) {
+        const CallCosts &c = costs[i];
+        errors += c.errors;
+        fprintf(file, "    {\"layer\": \"%s\", \"protocol\": \"%s\", \"read_empty\": %.1f, \"read_full\": %.1f, "
+                "\"write\": %.1f, \"write_batch_per_msg\": %.1f, \"errors\": %lu",
+                c.layer, c.protocol, c.readEmpty, c.readFull, c.write, c.writeBatch, c.errors);
+        // Overhead added on top of the layer below, for the same protocol
+        if(i > 0 && i < 3) {
+            const CallCosts &below = costs[i - 1];
+            fprintf(file, ", \"overhead\": {\"read_empty\": %.1f, \"read_full\": %.1f, \"write\": %.1f}",
+                    c.readEmpty - below.readEmpty, c.readFull - below.readFull, c.write - below.write);
+        }
+        fprintf(file, "}%s\n", (i + 1 < costs.size()) ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"round_trip_us\": [\n");
+    for(size_t i = 0; i < trips.size(); ++i) {
+        const RoundTrip &t = trips[i];
+        errors += t.errors;
+        fprintf(file, "    {\"size\": %lu, \"iterations\": %lu, \"errors\": %lu, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}%s\n",
+                (unsigned long)t.size, t.iterations, t.errors, percentile(t.latencies, 0.50), percentile(t.latencies, 0.99),
+                t.latencies.empty() ? 0 : t.latencies.back(), (i + 1 < trips.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    if(file != stdout) {
+        fclose(file);
+    }
+
+    return errors == 0 ? 0 : -2;
+}